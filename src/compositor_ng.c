@@ -129,6 +129,10 @@ struct compositor {
     FlutterCompositor flutter_compositor;
 
     struct vec2f cursor_pos;
+
+    bool has_raster_begin;
+    uint64_t raster_begin_ns;
+    struct frame_stats frame_stats;
 };
 
 struct platform_view_with_id {
@@ -175,6 +179,9 @@ MUST_CHECK struct compositor *compositor_new(struct tracer *tracer, struct windo
 
     compositor->tracer = tracer_ref(tracer);
     compositor->cursor_pos = VEC2F(0, 0);
+    compositor->has_raster_begin = false;
+    compositor->raster_begin_ns = 0;
+    memset(&compositor->frame_stats, 0, sizeof(compositor->frame_stats));
     return compositor;
 
 fail_free_compositor:
@@ -203,10 +210,53 @@ void compositor_get_view_geometry(struct compositor *compositor, struct view_geo
     *view_geometry_out = window_get_view_geometry(compositor->main_window);
 }
 
+void compositor_get_frame_view_geometry(struct compositor *compositor, struct view_geometry *view_geometry_out) {
+    *view_geometry_out = window_get_frame_view_geometry(compositor->main_window);
+}
+
 ATTR_PURE double compositor_get_refresh_rate(struct compositor *compositor) {
     return window_get_refresh_rate(compositor->main_window);
 }
 
+void compositor_get_frame_stats(struct compositor *compositor, struct frame_stats *stats_out) {
+    ASSERT_NOT_NULL(compositor);
+    ASSERT_NOT_NULL(stats_out);
+
+    compositor_lock(compositor);
+    *stats_out = compositor->frame_stats;
+    compositor_unlock(compositor);
+}
+
+/**
+ * @brief Update the frame stats after flutter presented a frame.
+ */
+static void compositor_on_frame_presented(struct compositor *compositor) {
+    uint64_t now, raster_time, refresh_interval;
+
+    now = get_monotonic_time();
+    refresh_interval = (uint64_t) (1000000000.0 / compositor_get_refresh_rate(compositor));
+
+    compositor_lock(compositor);
+
+    // If flutter didn't ask for a backing store this frame, we can't tell how long it took.
+    raster_time = compositor->has_raster_begin ? now - compositor->raster_begin_ns : 0;
+    compositor->has_raster_begin = false;
+
+    compositor->frame_stats.total_frames++;
+    if (raster_time > FROZEN_RASTER_THRESHOLD_NS) {
+        compositor->frame_stats.frozen_raster_frames++;
+    } else if (raster_time > refresh_interval) {
+        compositor->frame_stats.slow_raster_frames++;
+    }
+
+    if (!compositor->frame_stats.has_first_frame) {
+        compositor->frame_stats.has_first_frame = true;
+        compositor->frame_stats.first_frame_ns = now;
+    }
+
+    compositor_unlock(compositor);
+}
+
 int compositor_get_next_vblank(struct compositor *compositor, uint64_t *next_vblank_ns_out) {
     ASSERT_NOT_NULL(compositor);
     ASSERT_NOT_NULL(next_vblank_ns_out);
@@ -223,6 +273,50 @@ static int compositor_push_composition(struct compositor *compositor, struct fl_
     return ok;
 }
 
+enum device_orientation compositor_get_orientation(struct compositor *compositor) {
+    ASSERT_NOT_NULL(compositor);
+    return window_get_orientation(compositor->main_window);
+}
+
+int compositor_set_orientation(struct compositor *compositor, enum device_orientation orientation) {
+    ASSERT_NOT_NULL(compositor);
+    return window_set_orientation(compositor->main_window, orientation);
+}
+
+int compositor_on_hotplug(struct compositor *compositor, bool *geometry_changed_out) {
+    ASSERT_NOT_NULL(compositor);
+    return window_on_hotplug(compositor->main_window, geometry_changed_out);
+}
+
+int compositor_set_display_color(struct compositor *compositor, const struct display_color_settings *settings) {
+    ASSERT_NOT_NULL(compositor);
+    return window_set_display_color(compositor->main_window, settings);
+}
+
+int compositor_capture_frame(
+    struct compositor *compositor,
+    void (*callback)(void *userdata, int error, const struct window_frame_capture *capture),
+    void *userdata
+) {
+    ASSERT_NOT_NULL(compositor);
+    return window_capture_frame(compositor->main_window, callback, userdata);
+}
+
+int compositor_set_display_power(struct compositor *compositor, enum display_power_state state, double dim_brightness) {
+    ASSERT_NOT_NULL(compositor);
+    return window_set_display_power(compositor->main_window, state, dim_brightness);
+}
+
+void compositor_suspend(struct compositor *compositor) {
+    ASSERT_NOT_NULL(compositor);
+    window_suspend(compositor->main_window);
+}
+
+int compositor_resume(struct compositor *compositor) {
+    ASSERT_NOT_NULL(compositor);
+    return window_resume(compositor->main_window);
+}
+
 static void fill_platform_view_layer_props(
     struct fl_layer_props *props_out,
     const FlutterPoint *offset,
@@ -359,7 +453,7 @@ static int compositor_push_fl_layers(struct compositor *compositor, size_t n_fl_
             layer->surface = surface_ref(surface_from_id(fl_layer->platform_view->identifier));
 #endif
 
-            struct view_geometry geometry = window_get_view_geometry(compositor->main_window);
+            struct view_geometry geometry = window_get_frame_view_geometry(compositor->main_window);
 
             // The coordinates flutter gives us are a bit buggy, so calculating the right geometry is really a problem on its own
             /// TODO: Don't unconditionally take the geometry from the main window.
@@ -391,6 +485,11 @@ static int compositor_push_fl_layers(struct compositor *compositor, size_t n_fl_
     return ok;
 }
 
+static int on_schedule_frame(void *userdata) {
+    flutterpi_schedule_frame(userdata);
+    return 0;
+}
+
 static bool on_flutter_present_layers(const FlutterLayer **layers, size_t layers_count, void *userdata) {
     struct compositor *compositor;
     int ok;
@@ -400,6 +499,25 @@ static bool on_flutter_present_layers(const FlutterLayer **layers, size_t layers
     ASSERT_NOT_NULL(userdata);
     compositor = userdata;
 
+    for (size_t i = 0; i < layers_count; i++) {
+        if (layers[i]->type != kFlutterLayerContentTypeBackingStore) {
+            continue;
+        }
+
+        if (window_latch_orientation(compositor->main_window, VEC2I((int) layers[i]->size.width, (int) layers[i]->size.height))) {
+            // This is the first frame laid out for a new orientation, but it was rasterized with the old
+            // root surface transform. Keep showing the last frame, and let flutter render this one again.
+            // We're on the raster thread here, FlutterEngineScheduleFrame must be called on the platform thread.
+            ok = flutterpi_post_platform_task(on_schedule_frame, flutterpi);
+            if (ok != 0) {
+                LOG_ERROR("Could not post frame request to the platform thread.\n");
+            }
+            return true;
+        }
+
+        break;
+    }
+
     TRACER_BEGIN(compositor->tracer, "compositor_push_fl_layers");
     ok = compositor_push_fl_layers(compositor, layers_count, layers);
     TRACER_END(compositor->tracer, "compositor_push_fl_layers");
@@ -408,6 +526,8 @@ static bool on_flutter_present_layers(const FlutterLayer **layers, size_t layers
         return false;
     }
 
+    compositor_on_frame_presented(compositor);
+
     return true;
 }
 
@@ -487,7 +607,14 @@ on_flutter_create_backing_store(const FlutterBackingStoreConfig *config, Flutter
     ASSERT_NOT_NULL(userdata);
     compositor = userdata;
 
-    // this will not increase the refcount on the surface.
+    compositor_lock(compositor);
+    if (!compositor->has_raster_begin) {
+        compositor->has_raster_begin = true;
+        compositor->raster_begin_ns = get_monotonic_time();
+    }
+    compositor_unlock(compositor);
+
+    // this will not increase the refcount on the surface, we do that below.
     s = window_get_render_surface(compositor->main_window, VEC2I((int) config->size.width, (int) config->size.height));
     if (s == NULL) {
         LOG_ERROR("Couldn't create render surface for flutter to render into.\n");
@@ -511,7 +638,10 @@ on_flutter_create_backing_store(const FlutterBackingStoreConfig *config, Flutter
     }
 
     // now we can set the user_data.
+    // The window can replace its render surface (on hotplug) while flutter is still rendering into
+    // this backing store, so the backing store keeps its own reference. Released in collect.
     backing_store_out->user_data = s;
+    surface_ref(CAST_SURFACE(s));
 
     return true;
 }
@@ -523,10 +653,12 @@ static bool on_flutter_collect_backing_store(const FlutterBackingStore *fl_store
     ASSERT_NOT_NULL(userdata);
     compositor = userdata;
 
-    /// TODO: What should we do here?
-    (void) fl_store;
     (void) compositor;
 
+    // Drop the reference we took in on_flutter_create_backing_store.
+    // If the surface is in the composition that's currently presented, that keeps it alive.
+    surface_unref(CAST_SURFACE(fl_store->user_data));
+
     return true;
 }
 
@@ -581,3 +713,10 @@ void compositor_set_cursor(
 
     compositor_unlock(compositor);
 }
+
+int compositor_set_cursor_icon(struct compositor *compositor, const struct pointer_icon *icon) {
+    ASSERT_NOT_NULL(compositor);
+    ASSERT_NOT_NULL(icon);
+
+    return window_set_cursor_icon(compositor->main_window, icon);
+}
@@ -27,6 +27,8 @@
 #endif
 
 struct compositor;
+struct display_color_settings;
+struct window_frame_capture;
 
 struct drm_connector_config {
     uint32_t connector_type;
@@ -154,6 +156,39 @@ struct tracer;
 
 typedef void (*compositor_frame_begin_cb_t)(void *userdata, uint64_t vblank_ns, uint64_t next_vblank_ns);
 
+/**
+ * @brief Frames flutter presented so far, and how many of them were slow or frozen to rasterize.
+ *
+ * The raster time of a frame is measured from the point where flutter asks for the first backing
+ * store of the frame until it presents the layers. The time flutter spent building the frame on
+ * the UI thread before that isn't included.
+ */
+struct frame_stats {
+    /**
+     * @brief Number of frames presented.
+     */
+    uint64_t total_frames;
+
+    /**
+     * @brief Number of frames that took longer than one refresh interval to rasterize.
+     */
+    uint64_t slow_raster_frames;
+
+    /**
+     * @brief Number of frames that took longer than @ref FROZEN_RASTER_THRESHOLD_NS to rasterize.
+     */
+    uint64_t frozen_raster_frames;
+
+    /**
+     * @brief True if the first frame was presented, in which case @ref first_frame_ns
+     * is the monotonic timestamp of that.
+     */
+    bool has_first_frame;
+    uint64_t first_frame_ns;
+};
+
+#define FROZEN_RASTER_THRESHOLD_NS 700000000ull
+
 struct compositor *compositor_new(struct tracer *tracer, struct window *main_window);
 
 void compositor_destroy(struct compositor *compositor);
@@ -162,6 +197,8 @@ DECLARE_REF_OPS(compositor)
 
 void compositor_get_view_geometry(struct compositor *compositor, struct view_geometry *view_geometry_out);
 
+void compositor_get_frame_view_geometry(struct compositor *compositor, struct view_geometry *view_geometry_out);
+
 ATTR_PURE double compositor_get_refresh_rate(struct compositor *compositor);
 
 int compositor_get_next_vblank(struct compositor *compositor, uint64_t *next_vblank_ns_out);
@@ -174,6 +211,8 @@ const FlutterCompositor *compositor_get_flutter_compositor(struct compositor *co
 
 int compositor_request_frame(struct compositor *compositor, compositor_frame_begin_cb_t cb, void *userdata);
 
+void compositor_get_frame_stats(struct compositor *compositor, struct frame_stats *stats_out);
+
 #ifdef HAVE_EGL_GLES2
 bool compositor_has_egl_surface(struct compositor *compositor);
 
@@ -194,6 +233,28 @@ void compositor_set_cursor(
     struct vec2f delta
 );
 
+int compositor_set_cursor_icon(struct compositor *compositor, const struct pointer_icon *icon);
+
+enum device_orientation compositor_get_orientation(struct compositor *compositor);
+
+int compositor_set_orientation(struct compositor *compositor, enum device_orientation orientation);
+
+int compositor_on_hotplug(struct compositor *compositor, bool *geometry_changed_out);
+
+int compositor_set_display_color(struct compositor *compositor, const struct display_color_settings *settings);
+
+int compositor_capture_frame(
+    struct compositor *compositor,
+    void (*callback)(void *userdata, int error, const struct window_frame_capture *capture),
+    void *userdata
+);
+
+int compositor_set_display_power(struct compositor *compositor, enum display_power_state state, double dim_brightness);
+
+void compositor_suspend(struct compositor *compositor);
+
+int compositor_resume(struct compositor *compositor);
+
 struct fl_layer_composition;
 
 struct fl_layer_composition *fl_layer_composition_new(size_t n_layers);
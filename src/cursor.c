@@ -1,11 +1,19 @@
+#define _GNU_SOURCE
 #include "cursor.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
 
 #include "util/asserts.h"
 #include "util/collection.h"
 #include "util/geometry.h"
+#include "util/list.h"
+#include "util/logging.h"
 
 #define PIXEL_RATIO_LDPI 1.25
 #define PIXEL_RATIO_MDPI 1.6666
@@ -22,6 +30,12 @@ struct pointer_icon {
     float pixel_ratio;
     unsigned int hot_x, hot_y;
     char *rle_pixel_data;
+
+    /**
+     * @brief Already decoded, premultiplied ARGB8888 pixels, for icons that were
+     * loaded at runtime. NULL for the built-in, RLE-compressed icons.
+     */
+    uint32_t *pixels;
 };
 
 // These were all generated by GIMP.
@@ -1450,10 +1464,363 @@ static void run_length_decode(void *image_buf, const void *rle_data, size_t size
     }
 }
 
+/*
+ * XCursor themes
+ *
+ * The built-in icons only cover a few pointer kinds, so we try to load the others
+ * from the XCursor theme installed on the system (the same one X11 / wayland use).
+ *
+ * See https://www.x.org/releases/current/doc/man/man3/Xcursor.3.xhtml for the file format.
+ */
+
+#define XCURSOR_MAGIC 0x72756358u  // "Xcur"
+#define XCURSOR_IMAGE_TYPE 0xfffd0002u
+#define XCURSOR_IMAGE_HEADER_SIZE 36
+#define XCURSOR_MAX_TOC_ENTRIES 0x10000
+#define XCURSOR_MAX_IMAGE_SIZE 0x7fff
+#define XCURSOR_MAX_INHERIT_DEPTH 8
+
+#define XCURSOR_DEFAULT_THEME "default"
+#define XCURSOR_DEFAULT_SIZE 24
+#define XCURSOR_DEFAULT_PATH "~/.local/share/icons:~/.icons:/usr/share/icons:/usr/share/pixmaps"
+
+// The cursor names to try for each pointer kind, in order.
+// The CSS names are used by most modern themes, the others are the traditional X11 names.
+static const char *const xcursor_names[][4] = {
+    [POINTER_KIND_NONE] = { NULL },
+    [POINTER_KIND_BASIC] = { "default", "left_ptr", "arrow", NULL },
+    [POINTER_KIND_CLICK] = { "pointer", "hand2", "pointing_hand", NULL },
+    [POINTER_KIND_FORBIDDEN] = { "not-allowed", "crossed_circle", "circle", NULL },
+    [POINTER_KIND_WAIT] = { "wait", "watch", NULL },
+    [POINTER_KIND_PROGRESS] = { "progress", "left_ptr_watch", "half-busy", NULL },
+    [POINTER_KIND_CONTEXT_MENU] = { "context-menu", NULL },
+    [POINTER_KIND_HELP] = { "help", "question_arrow", "whats_this", NULL },
+    [POINTER_KIND_TEXT] = { "text", "xterm", "ibeam", NULL },
+    [POINTER_KIND_VERTICAL_TEXT] = { "vertical-text", NULL },
+    [POINTER_KIND_CELL] = { "cell", "plus", NULL },
+    [POINTER_KIND_PRECISE] = { "crosshair", "cross", "tcross", NULL },
+    [POINTER_KIND_MOVE] = { "move", "fleur", NULL },
+    [POINTER_KIND_GRAB] = { "grab", "openhand", "hand1", NULL },
+    [POINTER_KIND_GRABBING] = { "grabbing", "closedhand", NULL },
+    [POINTER_KIND_NO_DROP] = { "no-drop", "dnd-no-drop", NULL },
+    [POINTER_KIND_ALIAS] = { "alias", "dnd-link", NULL },
+    [POINTER_KIND_COPY] = { "copy", "dnd-copy", NULL },
+    [POINTER_KIND_DISAPPEARING] = { NULL },
+    [POINTER_KIND_ALL_SCROLL] = { "all-scroll", "fleur", NULL },
+    [POINTER_KIND_RESIZE_LEFT_RIGHT] = { "ew-resize", "sb_h_double_arrow", "h_double_arrow", NULL },
+    [POINTER_KIND_RESIZE_UP_DOWN] = { "ns-resize", "sb_v_double_arrow", "v_double_arrow", NULL },
+    [POINTER_KIND_RESIZE_UP_LEFT_DOWN_RIGHT] = { "nwse-resize", "size_fdiag", "bd_double_arrow", NULL },
+    [POINTER_KIND_RESIZE_UP_RIGHT_DOWN_LEFT] = { "nesw-resize", "size_bdiag", "fd_double_arrow", NULL },
+    [POINTER_KIND_RESIZE_UP] = { "n-resize", "top_side", NULL },
+    [POINTER_KIND_RESIZE_DOWN] = { "s-resize", "bottom_side", NULL },
+    [POINTER_KIND_RESIZE_LEFT] = { "w-resize", "left_side", NULL },
+    [POINTER_KIND_RESIZE_RIGHT] = { "e-resize", "right_side", NULL },
+    [POINTER_KIND_RESIZE_UP_LEFT] = { "nw-resize", "top_left_corner", NULL },
+    [POINTER_KIND_RESIZE_UP_RIGHT] = { "ne-resize", "top_right_corner", NULL },
+    [POINTER_KIND_RESIZE_DOWN_LEFT] = { "sw-resize", "bottom_left_corner", NULL },
+    [POINTER_KIND_RESIZE_DOWN_RIGHT] = { "se-resize", "bottom_right_corner", NULL },
+    [POINTER_KIND_RESIZE_COLUMN] = { "col-resize", "sb_h_double_arrow", NULL },
+    [POINTER_KIND_RESIZE_ROW] = { "row-resize", "sb_v_double_arrow", NULL },
+    [POINTER_KIND_ZOOM_IN] = { "zoom-in", NULL },
+    [POINTER_KIND_ZOOM_OUT] = { "zoom-out", NULL },
+};
+
+struct theme_icon {
+    struct list_head entry;
+    enum pointer_kind kind;
+    int size;
+
+    /**
+     * @brief The loaded icon, or NULL if the theme doesn't have a cursor for this kind.
+     *
+     * Theme icons are never freed, since windows keep pointers to them.
+     */
+    struct pointer_icon *icon;
+};
+
+static pthread_mutex_t theme_icons_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head theme_icons = { &theme_icons, &theme_icons };
+
+static bool read_u32_le(FILE *file, uint32_t *value_out) {
+    uint8_t bytes[4];
+
+    if (fread(bytes, sizeof bytes, 1, file) != 1) {
+        return false;
+    }
+
+    *value_out = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+    return true;
+}
+
+/**
+ * @brief Load the image with the nominal size closest to @param desired_size from an XCursor file.
+ *
+ * For animated cursors, only the first frame is used.
+ */
+static struct pointer_icon *load_xcursor_file(FILE *file, enum pointer_kind kind, int desired_size, int base_size) {
+    struct pointer_icon *icon;
+    uint32_t magic, header_size, version, n_toc;
+    uint32_t best_size, best_position;
+    uint32_t chunk_header_size, type, size, width, height, hot_x, hot_y, delay;
+    uint32_t *pixels;
+    bool found;
+
+    if (!read_u32_le(file, &magic) || !read_u32_le(file, &header_size) || !read_u32_le(file, &version) || !read_u32_le(file, &n_toc)) {
+        return NULL;
+    }
+
+    if (magic != XCURSOR_MAGIC || n_toc > XCURSOR_MAX_TOC_ENTRIES || fseek(file, header_size, SEEK_SET) != 0) {
+        return NULL;
+    }
+
+    found = false;
+    best_size = 0;
+    best_position = 0;
+    for (uint32_t i = 0; i < n_toc; i++) {
+        uint32_t position;
+
+        if (!read_u32_le(file, &type) || !read_u32_le(file, &size) || !read_u32_le(file, &position)) {
+            return NULL;
+        }
+
+        if (type != XCURSOR_IMAGE_TYPE) {
+            continue;
+        }
+
+        // Only the first image of each size is used, the others are animation frames.
+        if (!found || abs((int) size - desired_size) < abs((int) best_size - desired_size)) {
+            found = true;
+            best_size = size;
+            best_position = position;
+        }
+    }
+
+    if (!found || fseek(file, best_position, SEEK_SET) != 0) {
+        return NULL;
+    }
+
+    if (!read_u32_le(file, &chunk_header_size) || !read_u32_le(file, &type) || !read_u32_le(file, &size) ||
+        !read_u32_le(file, &version) || !read_u32_le(file, &width) || !read_u32_le(file, &height) || !read_u32_le(file, &hot_x) ||
+        !read_u32_le(file, &hot_y) || !read_u32_le(file, &delay)) {
+        return NULL;
+    }
+
+    if (chunk_header_size != XCURSOR_IMAGE_HEADER_SIZE || type != XCURSOR_IMAGE_TYPE) {
+        return NULL;
+    }
+
+    if (width == 0 || height == 0 || width > XCURSOR_MAX_IMAGE_SIZE || height > XCURSOR_MAX_IMAGE_SIZE || hot_x >= width ||
+        hot_y >= height) {
+        return NULL;
+    }
+
+    pixels = malloc(width * height * sizeof *pixels);
+    if (pixels == NULL) {
+        return NULL;
+    }
+
+    // XCursor pixels are already premultiplied ARGB, same as what KMS expects.
+    for (uint32_t i = 0; i < width * height; i++) {
+        if (!read_u32_le(file, pixels + i)) {
+            free(pixels);
+            return NULL;
+        }
+    }
+
+    icon = calloc(1, sizeof *icon);
+    if (icon == NULL) {
+        free(pixels);
+        return NULL;
+    }
+
+    icon->kind = kind;
+    icon->width = width;
+    icon->height = height;
+    icon->bytes_per_pixel = 4;
+    icon->pixel_ratio = PIXEL_RATIO_MDPI * best_size / base_size;
+    icon->hot_x = hot_x;
+    icon->hot_y = hot_y;
+    icon->rle_pixel_data = NULL;
+    icon->pixels = pixels;
+    return icon;
+}
+
+static FILE *open_in_search_path(const char *search_path, const char *theme, const char *filename) {
+    const char *dir, *dir_end, *home;
+    char path[PATH_MAX];
+    FILE *file;
+    int ok;
+
+    home = getenv("HOME");
+
+    for (dir = search_path; *dir != '\0'; dir = *dir_end != '\0' ? dir_end + 1 : dir_end) {
+        dir_end = strchrnul(dir, ':');
+
+        if (dir_end == dir) {
+            continue;
+        }
+
+        if (dir[0] == '~') {
+            if (home == NULL) {
+                continue;
+            }
+
+            ok = snprintf(path, sizeof path, "%s%.*s/%s/%s", home, (int) (dir_end - dir - 1), dir + 1, theme, filename);
+        } else {
+            ok = snprintf(path, sizeof path, "%.*s/%s/%s", (int) (dir_end - dir), dir, theme, filename);
+        }
+
+        if (ok < 0 || ok >= (int) sizeof path) {
+            continue;
+        }
+
+        file = fopen(path, "rb");
+        if (file != NULL) {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+static struct pointer_icon *load_theme_icon(
+    const char *search_path,
+    const char *theme,
+    enum pointer_kind kind,
+    int desired_size,
+    int base_size,
+    int depth
+) {
+    struct pointer_icon *icon;
+    char filename[64];
+    char *line, *inherits, *saveptr;
+    size_t line_size;
+    FILE *file;
+
+    for (const char *const *name = xcursor_names[kind]; *name != NULL; name++) {
+        snprintf(filename, sizeof filename, "cursors/%s", *name);
+
+        file = open_in_search_path(search_path, theme, filename);
+        if (file == NULL) {
+            continue;
+        }
+
+        icon = load_xcursor_file(file, kind, desired_size, base_size);
+        fclose(file);
+
+        if (icon != NULL) {
+            return icon;
+        }
+
+        LOG_ERROR("Couldn't load cursor \"%s\" of cursor theme \"%s\".\n", *name, theme);
+    }
+
+    if (depth >= XCURSOR_MAX_INHERIT_DEPTH) {
+        return NULL;
+    }
+
+    // The theme doesn't have this cursor, maybe one of the themes it inherits from does.
+    file = open_in_search_path(search_path, theme, "index.theme");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    icon = NULL;
+    line = NULL;
+    line_size = 0;
+    while (icon == NULL && getline(&line, &line_size, file) != -1) {
+        if (strncmp(line, "Inherits", 8) != 0) {
+            continue;
+        }
+
+        inherits = strchr(line, '=');
+        if (inherits == NULL) {
+            continue;
+        }
+
+        for (char *parent = strtok_r(inherits + 1, ",; \t\r\n", &saveptr); parent != NULL && icon == NULL;
+             parent = strtok_r(NULL, ",; \t\r\n", &saveptr)) {
+            if (!streq(parent, theme)) {
+                icon = load_theme_icon(search_path, parent, kind, desired_size, base_size, depth + 1);
+            }
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    return icon;
+}
+
+/**
+ * @brief Get the icon for this pointer kind from the system XCursor theme, or NULL if there's none.
+ *
+ * The theme, search path and base size can be configured using the usual XCURSOR_THEME,
+ * XCURSOR_PATH and XCURSOR_SIZE environment variables.
+ *
+ * Every icon is only loaded and decoded once.
+ */
+static const struct pointer_icon *get_theme_icon(enum pointer_kind kind, double pixel_ratio) {
+    struct theme_icon *cached;
+    const char *theme, *search_path, *size_str;
+    int base_size, desired_size;
+
+    ASSERT(kind < ARRAY_SIZE(xcursor_names));
+
+    theme = getenv("XCURSOR_THEME");
+    if (theme == NULL || *theme == '\0') {
+        theme = XCURSOR_DEFAULT_THEME;
+    }
+
+    search_path = getenv("XCURSOR_PATH");
+    if (search_path == NULL || *search_path == '\0') {
+        search_path = XCURSOR_DEFAULT_PATH;
+    }
+
+    size_str = getenv("XCURSOR_SIZE");
+    base_size = size_str != NULL ? atoi(size_str) : 0;
+    if (base_size <= 0) {
+        base_size = XCURSOR_DEFAULT_SIZE;
+    }
+
+    // The built-in icons are about as big as a default size XCursor at PIXEL_RATIO_MDPI,
+    // so scale the theme cursors the same way.
+    desired_size = MAX2((int) round(base_size * pixel_ratio / PIXEL_RATIO_MDPI), 1);
+
+    pthread_mutex_lock(&theme_icons_mutex);
+
+    list_for_each_entry(struct theme_icon, entry, &theme_icons, entry) {
+        if (entry->kind == kind && entry->size == desired_size) {
+            pthread_mutex_unlock(&theme_icons_mutex);
+            return entry->icon;
+        }
+    }
+
+    cached = malloc(sizeof *cached);
+    if (cached == NULL) {
+        pthread_mutex_unlock(&theme_icons_mutex);
+        return NULL;
+    }
+
+    cached->kind = kind;
+    cached->size = desired_size;
+    cached->icon = load_theme_icon(search_path, theme, kind, desired_size, base_size, 0);
+    list_addtail(&cached->entry, &theme_icons);
+
+    pthread_mutex_unlock(&theme_icons_mutex);
+
+    return cached->icon;
+}
+
 const struct pointer_icon *pointer_icon_for_details(enum pointer_kind kind, double pixel_ratio) {
     const struct pointer_icon *best;
 
-    best = NULL;
+    // Prefer the system cursor theme, so all cursors look the same.
+    best = get_theme_icon(kind, pixel_ratio);
+    if (best != NULL) {
+        return best;
+    }
+
     for (int i = 0; i < ARRAY_SIZE(pointer_icons); i++) {
         const struct pointer_icon *icon = pointer_icons[i];
 
@@ -1502,7 +1869,51 @@ void *pointer_icon_dup_pixels(const struct pointer_icon *icon) {
         return NULL;
     }
 
-    run_length_decode(buffer, icon->rle_pixel_data, icon->width * icon->height);
+    if (icon->pixels != NULL) {
+        memcpy(buffer, icon->pixels, icon->bytes_per_pixel * icon->width * icon->height);
+    } else {
+        run_length_decode(buffer, icon->rle_pixel_data, icon->width * icon->height);
+    }
 
     return buffer;
 }
+
+struct pointer_icon *pointer_icon_new(struct vec2i size, struct vec2i hotspot, float pixel_ratio, const uint32_t *pixels) {
+    struct pointer_icon *icon;
+    uint32_t *pixels_dup;
+
+    ASSERT_NOT_NULL(pixels);
+    ASSERT(size.x > 0 && size.y > 0);
+
+    icon = calloc(1, sizeof *icon);
+    if (icon == NULL) {
+        return NULL;
+    }
+
+    pixels_dup = malloc(size.x * size.y * sizeof *pixels_dup);
+    if (pixels_dup == NULL) {
+        free(icon);
+        return NULL;
+    }
+
+    memcpy(pixels_dup, pixels, size.x * size.y * sizeof *pixels_dup);
+
+    icon->kind = POINTER_KIND_BASIC;
+    icon->width = size.x;
+    icon->height = size.y;
+    icon->bytes_per_pixel = 4;
+    icon->pixel_ratio = pixel_ratio;
+    icon->hot_x = CLAMP(hotspot.x, 0, size.x - 1);
+    icon->hot_y = CLAMP(hotspot.y, 0, size.y - 1);
+    icon->rle_pixel_data = NULL;
+    icon->pixels = pixels_dup;
+    return icon;
+}
+
+void pointer_icon_destroy(struct pointer_icon *icon) {
+    ASSERT_NOT_NULL(icon);
+    ASSERT_NOT_NULL_MSG(icon->pixels, "Only icons created with pointer_icon_new can be destroyed.");
+
+    free(icon->pixels);
+    free(icon);
+}
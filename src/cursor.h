@@ -5,6 +5,8 @@
  * Contains all the mouse cursor images in compressed form,
  * and some utilities for using them.
  *
+ * Cursors that aren't built-in are loaded from the system XCursor theme.
+ *
  * Copyright (c) 2023, Hannes Winkler <hanneswinkler2000@web.de>
  */
 
@@ -68,4 +70,24 @@ struct vec2i pointer_icon_get_hotspot(const struct pointer_icon *icon);
 
 void *pointer_icon_dup_pixels(const struct pointer_icon *icon);
 
+/**
+ * @brief Create a new pointer icon from already decoded pixels, for example for a custom cursor
+ * of the flutter app.
+ *
+ * @param size The size of the icon in pixels.
+ * @param hotspot The position of the hotspot (the pixel that's actually pointing at something) inside the icon.
+ * @param pixel_ratio The device pixel ratio the icon was made for.
+ * @param pixels The pixels of the icon as premultiplied ARGB8888 (the same layout KMS uses),
+ *               without any padding between rows. The pixels are copied.
+ * @return struct pointer_icon* The new pointer icon, or NULL on error.
+ */
+struct pointer_icon *pointer_icon_new(struct vec2i size, struct vec2i hotspot, float pixel_ratio, const uint32_t *pixels);
+
+/**
+ * @brief Destroy a pointer icon created with @ref pointer_icon_new.
+ *
+ * The icon must not be in use by any window anymore.
+ */
+void pointer_icon_destroy(struct pointer_icon *icon);
+
 #endif  // _FLUTTERPI_SRC_CURSOR_H
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include "display_color.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/asserts.h"
+#include "util/collection.h"
+#include "util/logging.h"
+
+void display_color_calibration_init(struct display_color_calibration *calibration) {
+    ASSERT_NOT_NULL(calibration);
+
+    for (int i = 0; i < 3; i++) {
+        calibration->gamma[i] = 1.0;
+        calibration->gain[i] = 1.0;
+        calibration->offset[i] = 0.0;
+    }
+
+    for (int i = 0; i < 9; i++) {
+        calibration->matrix[i] = i % 4 == 0 ? 1.0 : 0.0;
+    }
+}
+
+void display_color_settings_init(struct display_color_settings *settings) {
+    ASSERT_NOT_NULL(settings);
+
+    settings->brightness = 1.0;
+    settings->contrast = 1.0;
+    settings->temperature = DISPLAY_COLOR_NEUTRAL_TEMPERATURE;
+    display_color_calibration_init(&settings->calibration);
+}
+
+bool display_color_settings_is_identity(const struct display_color_settings *settings) {
+    struct display_color_settings identity;
+
+    ASSERT_NOT_NULL(settings);
+
+    display_color_settings_init(&identity);
+
+    return memcmp(settings, &identity, sizeof identity) == 0;
+}
+
+static char *strip(char *str) {
+    char *end;
+
+    while (isspace(*str)) {
+        str++;
+    }
+
+    end = str + strlen(str);
+    while (end > str && isspace(end[-1])) {
+        end--;
+    }
+    *end = '\0';
+
+    return str;
+}
+
+/**
+ * @brief Parse up to @param max whitespace separated numbers from @param str.
+ *
+ * @returns The number of values parsed, or -1 if @param str contains something that's not a number.
+ */
+static int parse_values(const char *str, double *values_out, int max) {
+    char *end;
+    int n;
+
+    for (n = 0; *str != '\0'; n++) {
+        if (n == max) {
+            return -1;
+        }
+
+        errno = 0;
+        values_out[n] = strtod(str, &end);
+        if (end == str || errno != 0) {
+            return -1;
+        }
+
+        str = end;
+        while (isspace(*str)) {
+            str++;
+        }
+    }
+
+    return n;
+}
+
+static int parse_channel_values(const char *str, double channels_out[3]) {
+    double values[3];
+    int n;
+
+    n = parse_values(str, values, 3);
+    if (n == 1) {
+        channels_out[0] = channels_out[1] = channels_out[2] = values[0];
+    } else if (n == 3) {
+        memcpy(channels_out, values, sizeof values);
+    } else {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int display_color_calibration_load(const char *path, struct display_color_calibration *calibration_out) {
+    struct display_color_calibration calibration;
+    size_t line_size;
+    char *line, *key, *value, *equals;
+    FILE *file;
+    int ok, line_no;
+
+    ASSERT_NOT_NULL(path);
+    ASSERT_NOT_NULL(calibration_out);
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        ok = errno;
+        LOG_ERROR("Couldn't open display calibration file \"%s\". fopen: %s\n", path, strerror(ok));
+        return ok;
+    }
+
+    display_color_calibration_init(&calibration);
+
+    line = NULL;
+    line_size = 0;
+    line_no = 0;
+    ok = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        line_no++;
+
+        value = strchr(line, '#');
+        if (value != NULL) {
+            *value = '\0';
+        }
+
+        key = strip(line);
+        if (*key == '\0') {
+            continue;
+        }
+
+        equals = strchr(key, '=');
+        if (equals == NULL) {
+            ok = EINVAL;
+            goto fail_syntax;
+        }
+
+        *equals = '\0';
+        key = strip(key);
+        value = strip(equals + 1);
+
+        if (streq(key, "gamma")) {
+            ok = parse_channel_values(value, calibration.gamma);
+        } else if (streq(key, "gain")) {
+            ok = parse_channel_values(value, calibration.gain);
+        } else if (streq(key, "offset")) {
+            ok = parse_channel_values(value, calibration.offset);
+        } else if (streq(key, "matrix")) {
+            ok = parse_values(value, calibration.matrix, 9) == 9 ? 0 : EINVAL;
+        } else {
+            LOG_ERROR("Unknown key \"%s\" in display calibration file \"%s\", line %d.\n", key, path, line_no);
+            ok = EINVAL;
+            goto fail_free_line;
+        }
+
+        if (ok != 0) {
+            goto fail_syntax;
+        }
+    }
+
+    if (ferror(file)) {
+        ok = EIO;
+        LOG_ERROR("Couldn't read display calibration file \"%s\".\n", path);
+        goto fail_free_line;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (!(calibration.gamma[i] > 0.0)) {
+            LOG_ERROR("Gamma values in display calibration file \"%s\" must be positive.\n", path);
+            ok = EINVAL;
+            goto fail_free_line;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    *calibration_out = calibration;
+    return 0;
+
+fail_syntax:
+    LOG_ERROR("Invalid line in display calibration file \"%s\", line %d.\n", path, line_no);
+
+fail_free_line:
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Get the relative R, G, B intensities of a black body with the given temperature,
+ * normalized so the neutral temperature gives (1, 1, 1).
+ *
+ * Uses the curve fit by Tanner Helland, which is more than accurate enough for this.
+ */
+static void get_white_point(double temperature, double rgb_out[3]) {
+    double t, r, g, b;
+
+    t = CLAMP(temperature, DISPLAY_COLOR_MIN_TEMPERATURE, DISPLAY_COLOR_MAX_TEMPERATURE) / 100.0;
+
+    if (t <= 66.0) {
+        r = 255.0;
+        g = 99.4708025861 * log(t) - 161.1195681661;
+    } else {
+        r = 329.698727446 * pow(t - 60.0, -0.1332047592);
+        g = 288.1221695283 * pow(t - 60.0, -0.0755148492);
+    }
+
+    if (t >= 66.0) {
+        b = 255.0;
+    } else if (t <= 19.0) {
+        b = 0.0;
+    } else {
+        b = 138.5177312231 * log(t - 10.0) - 305.0447927307;
+    }
+
+    rgb_out[0] = CLAMP(r, 0.0, 255.0) / 255.0;
+    rgb_out[1] = CLAMP(g, 0.0, 255.0) / 255.0;
+    rgb_out[2] = CLAMP(b, 0.0, 255.0) / 255.0;
+}
+
+static void get_temperature_factors(double temperature, double factors_out[3]) {
+    double neutral[3], white[3];
+
+    if (temperature == DISPLAY_COLOR_NEUTRAL_TEMPERATURE) {
+        factors_out[0] = factors_out[1] = factors_out[2] = 1.0;
+        return;
+    }
+
+    get_white_point(DISPLAY_COLOR_NEUTRAL_TEMPERATURE, neutral);
+    get_white_point(temperature, white);
+
+    for (int i = 0; i < 3; i++) {
+        factors_out[i] = MIN2(white[i] / neutral[i], 1.0);
+    }
+}
+
+static void get_ctm(const struct display_color_settings *settings, double matrix_out[9]) {
+    double factors[3];
+
+    get_temperature_factors(settings->temperature, factors);
+
+    // Scale the rows of the calibration matrix, i.e. apply the white point after the calibration.
+    for (int i = 0; i < 9; i++) {
+        matrix_out[i] = factors[i / 3] * settings->calibration.matrix[i];
+    }
+}
+
+void display_color_fill_gamma_lut(
+    const struct display_color_settings *settings,
+    bool include_ctm,
+    size_t size,
+    struct drm_color_lut *lut_out
+) {
+    const struct display_color_calibration *calibration;
+    double matrix[9], value;
+    uint16_t channels[3];
+
+    ASSERT_NOT_NULL(settings);
+    ASSERT_NOT_NULL(lut_out);
+    assert(size >= 2);
+
+    calibration = &settings->calibration;
+
+    if (include_ctm) {
+        get_ctm(settings, matrix);
+
+        // A 1D LUT can only scale each channel by itself, so only the diagonal of the matrix can be applied here.
+        for (int i = 0; i < 9; i++) {
+            if (i % 4 != 0 && matrix[i] != 0.0) {
+                LOG_ERROR("Display has no color transformation matrix. Ignoring the off-diagonal terms of the calibration matrix.\n");
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        for (int c = 0; c < 3; c++) {
+            value = (double) i / (double) (size - 1);
+
+            // The CTM is applied before the gamma LUT in the hardware pipeline.
+            if (include_ctm) {
+                value *= matrix[c * 4];
+            }
+
+            value = (value - 0.5) * settings->contrast + 0.5;
+            value *= settings->brightness;
+            value = pow(CLAMP(value, 0.0, 1.0), calibration->gamma[c]);
+            value = value * calibration->gain[c] + calibration->offset[c];
+
+            channels[c] = (uint16_t) lround(CLAMP(value, 0.0, 1.0) * 0xFFFF);
+        }
+
+        lut_out[i].red = channels[0];
+        lut_out[i].green = channels[1];
+        lut_out[i].blue = channels[2];
+        lut_out[i].reserved = 0;
+    }
+}
+
+/**
+ * @brief Convert a double to the S31.32 sign-magnitude fixed point format the kernel uses for the CTM.
+ */
+static uint64_t double_to_s31_32(double value) {
+    uint64_t sign;
+    double magnitude;
+
+    sign = value < 0.0 ? (UINT64_C(1) << 63) : 0;
+    magnitude = MIN2(fabs(value), (double) INT32_MAX);
+
+    return sign | (uint64_t) llround(magnitude * 4294967296.0);
+}
+
+void display_color_fill_ctm(const struct display_color_settings *settings, bool include_brightness, struct drm_color_ctm *ctm_out) {
+    double matrix[9];
+
+    ASSERT_NOT_NULL(settings);
+    ASSERT_NOT_NULL(ctm_out);
+
+    get_ctm(settings, matrix);
+
+    for (int i = 0; i < 9; i++) {
+        if (include_brightness) {
+            matrix[i] *= settings->brightness;
+        }
+
+        ctm_out->matrix[i] = double_to_s31_32(matrix[i]);
+    }
+}
+
+void display_hdr_metadata_init(struct display_hdr_metadata *metadata, enum drm_hdr_eotf eotf, double max_luminance) {
+    ASSERT_NOT_NULL(metadata);
+
+    metadata->eotf = eotf;
+
+    // BT.2020 primaries
+    metadata->primaries[0][0] = 0.708;
+    metadata->primaries[0][1] = 0.292;
+    metadata->primaries[1][0] = 0.170;
+    metadata->primaries[1][1] = 0.797;
+    metadata->primaries[2][0] = 0.131;
+    metadata->primaries[2][1] = 0.046;
+
+    // D65
+    metadata->white_point[0] = 0.3127;
+    metadata->white_point[1] = 0.3290;
+
+    metadata->max_mastering_luminance = max_luminance;
+    metadata->min_mastering_luminance = 0.005;
+
+    // We don't know anything about the content, so just assume it uses the full range.
+    metadata->max_cll = max_luminance;
+    metadata->max_fall = max_luminance * 0.4;
+}
+
+/**
+ * @brief Encode @param value in units of @param unit as an unsigned 16-bit integer.
+ */
+static uint16_t encode_u16(double value, double unit) {
+    return (uint16_t) lround(CLAMP(value / unit, 0.0, 65535.0));
+}
+
+void display_hdr_metadata_fill_blob(const struct display_hdr_metadata *metadata, struct drm_hdr_output_metadata *blob_out) {
+    ASSERT_NOT_NULL(metadata);
+    ASSERT_NOT_NULL(blob_out);
+
+    memset(blob_out, 0, sizeof *blob_out);
+
+    // Static metadata type 1 is the only one there is.
+    blob_out->metadata_type = 0;
+    blob_out->hdmi_metadata_type1.metadata_type = 0;
+    blob_out->hdmi_metadata_type1.eotf = (uint8_t) metadata->eotf;
+
+    for (int i = 0; i < 3; i++) {
+        blob_out->hdmi_metadata_type1.display_primaries[i].x = encode_u16(metadata->primaries[i][0], 0.00002);
+        blob_out->hdmi_metadata_type1.display_primaries[i].y = encode_u16(metadata->primaries[i][1], 0.00002);
+    }
+    blob_out->hdmi_metadata_type1.white_point.x = encode_u16(metadata->white_point[0], 0.00002);
+    blob_out->hdmi_metadata_type1.white_point.y = encode_u16(metadata->white_point[1], 0.00002);
+
+    blob_out->hdmi_metadata_type1.max_display_mastering_luminance = encode_u16(metadata->max_mastering_luminance, 1.0);
+    blob_out->hdmi_metadata_type1.min_display_mastering_luminance = encode_u16(metadata->min_mastering_luminance, 0.0001);
+    blob_out->hdmi_metadata_type1.max_cll = encode_u16(metadata->max_cll, 1.0);
+    blob_out->hdmi_metadata_type1.max_fall = encode_u16(metadata->max_fall, 1.0);
+}
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Display color
+ *
+ * Computes the gamma LUT and color transformation matrix (CTM) blobs for
+ * the CRTC color pipeline from brightness, contrast, color temperature
+ * and per-panel calibration settings.
+ *
+ * Copyright (c) 2023, Hannes Winkler <hanneswinkler2000@web.de>
+ */
+
+#ifndef _FLUTTERPI_SRC_DISPLAY_COLOR_H
+#define _FLUTTERPI_SRC_DISPLAY_COLOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <xf86drmMode.h>
+
+#include "modesetting.h"
+
+/**
+ * @brief The color temperature (in kelvin) that leaves the colors unchanged.
+ */
+#define DISPLAY_COLOR_NEUTRAL_TEMPERATURE 6500.0
+
+#define DISPLAY_COLOR_MIN_TEMPERATURE 1000.0
+#define DISPLAY_COLOR_MAX_TEMPERATURE 40000.0
+
+/**
+ * @brief The peak luminance (in cd/m²) signalled in the HDR metadata, if none is specified.
+ */
+#define DISPLAY_HDR_DEFAULT_MAX_LUMINANCE 1000.0
+
+/**
+ * @brief Per-panel calibration, usually loaded from a file using @ref display_color_calibration_load.
+ *
+ * All per-channel values are in R, G, B order.
+ */
+struct display_color_calibration {
+    /**
+     * @brief Exponent that's applied to each channel. 1.0 means no correction.
+     */
+    double gamma[3];
+
+    /**
+     * @brief Factor and offset that are applied to each channel after the gamma correction.
+     */
+    double gain[3];
+    double offset[3];
+
+    /**
+     * @brief Row-major 3x3 color transformation matrix, for example for correcting the panel primaries.
+     */
+    double matrix[9];
+};
+
+struct display_color_settings {
+    /**
+     * @brief Brightness factor, from 0 (black) to 1 (unchanged).
+     */
+    double brightness;
+
+    /**
+     * @brief Contrast factor around the middle grey, 1 is unchanged.
+     */
+    double contrast;
+
+    /**
+     * @brief White point color temperature in kelvin.
+     *
+     * Lower values give a warmer (more red) image, like a night mode.
+     */
+    double temperature;
+
+    struct display_color_calibration calibration;
+};
+
+/**
+ * @brief HDR static metadata, describing the display the content was mastered on and its light levels.
+ *
+ * The display uses it to tone map the content to its own capabilities.
+ */
+struct display_hdr_metadata {
+    /**
+     * @brief The transfer function the frames are encoded with. Flutter doesn't know about it,
+     * the app needs to render its content with this transfer function.
+     */
+    enum drm_hdr_eotf eotf;
+
+    /**
+     * @brief CIE 1931 xy chromaticity coordinates of the red, green and blue primaries
+     * and the white point of the mastering display.
+     */
+    double primaries[3][2];
+    double white_point[2];
+
+    /**
+     * @brief Luminance range of the mastering display, in cd/m².
+     */
+    double max_mastering_luminance;
+    double min_mastering_luminance;
+
+    /**
+     * @brief Maximum content light level and maximum frame-average light level, in cd/m².
+     */
+    double max_cll;
+    double max_fall;
+};
+
+/**
+ * @brief Initialize @param settings to values that don't change the colors.
+ */
+void display_color_settings_init(struct display_color_settings *settings);
+
+/**
+ * @brief Initialize @param calibration to values that don't change the colors.
+ */
+void display_color_calibration_init(struct display_color_calibration *calibration);
+
+/**
+ * @brief True if @param settings don't change the colors at all, i.e. the gamma LUT
+ * and CTM can be disabled.
+ */
+bool display_color_settings_is_identity(const struct display_color_settings *settings);
+
+/**
+ * @brief Load a calibration profile from the file at @param path.
+ *
+ * The file consists of `key = values` lines, with `#` starting a comment:
+ *
+ *     gamma = 1.0 1.0 1.0
+ *     gain = 1.0 0.97 0.95
+ *     offset = 0.0 0.0 0.0
+ *     matrix = 1 0 0  0 1 0  0 0 1
+ *
+ * `gamma`, `gain` and `offset` take either one value for all channels or one per channel.
+ * Keys that are not specified keep their neutral value.
+ *
+ * @returns Zero if successful, errno-code otherwise. (EINVAL if the file is malformed)
+ */
+int display_color_calibration_load(const char *path, struct display_color_calibration *calibration_out);
+
+/**
+ * @brief Fill the gamma LUT with @param size entries for @param settings.
+ *
+ * @param include_ctm If true, the diagonal of the matrix that would be returned by
+ *                    @ref display_color_fill_ctm (i.e. the color temperature and the
+ *                    per-channel part of the calibration matrix) is applied in the LUT as well.
+ *                    Useful if the CRTC has no CTM.
+ */
+void display_color_fill_gamma_lut(
+    const struct display_color_settings *settings,
+    bool include_ctm,
+    size_t size,
+    struct drm_color_lut *lut_out
+);
+
+/**
+ * @brief Fill the color transformation matrix for @param settings.
+ *
+ * That's the calibration matrix, followed by the white point adjustment for the color temperature.
+ *
+ * @param include_brightness Also scale the matrix by the brightness. Useful if the CRTC has no gamma LUT.
+ *                           The contrast can't be expressed as a matrix and is ignored.
+ */
+void display_color_fill_ctm(const struct display_color_settings *settings, bool include_brightness, struct drm_color_ctm *ctm_out);
+
+/**
+ * @brief Initialize @param metadata for content with the BT.2020 primaries, a D65 white point
+ * and a peak luminance of @param max_luminance cd/m², encoded using @param eotf.
+ */
+void display_hdr_metadata_init(struct display_hdr_metadata *metadata, enum drm_hdr_eotf eotf, double max_luminance);
+
+/**
+ * @brief Encode @param metadata into the HDR_OUTPUT_METADATA connector property blob.
+ */
+void display_hdr_metadata_fill_blob(const struct display_hdr_metadata *metadata, struct drm_hdr_output_metadata *blob_out);
+
+#endif  // _FLUTTERPI_SRC_DISPLAY_COLOR_H
@@ -248,6 +248,7 @@ ATTR_PURE int64_t dmabuf_surface_get_texture_id(struct dmabuf_surface *s) {
 
 static int dmabuf_surface_present_kms(struct surface *_s, const struct fl_layer_props *props, struct kms_req_builder *builder) {
     struct dmabuf_surface *s;
+    struct kms_fb_layer layer;
     uint32_t fb_id;
     int ok;
 
@@ -257,6 +258,11 @@ static int dmabuf_surface_present_kms(struct surface *_s, const struct fl_layer_
     (void) props;
     (void) builder;
 
+    if (props->opacity <= 0.0) {
+        // Fully transparent, nothing to scan out.
+        return 0;
+    }
+
     surface_lock(_s);
 
     ASSERT_NOT_NULL_MSG(s->next_buf, "dmabuf_surface_present_kms was called, but no dmabuf is queued to be presented.");
@@ -284,34 +290,47 @@ static int dmabuf_surface_present_kms(struct surface *_s, const struct fl_layer_
         s->next_buf->drmdev = drmdev_ref(kms_req_builder_get_drmdev(builder));
     }
 
-    ok = kms_req_builder_push_fb_layer(
-        builder,
-        &(struct kms_fb_layer){
-            .drm_fb_id = fb_id,
-            .format = s->next_buf->buf.format,
-
-            .has_modifier = s->next_buf->buf.has_modifiers,
-            .modifier = s->next_buf->buf.modifiers[0],
-
-            .src_x = 0,
-            .src_y = 0,
-            .src_w = DOUBLE_TO_FP1616_ROUNDED(s->next_buf->buf.width),
-            .src_h = DOUBLE_TO_FP1616_ROUNDED(s->next_buf->buf.height),
-
-            .dst_x = props->aa_rect.offset.x,
-            .dst_y = props->aa_rect.offset.y,
-            .dst_w = props->aa_rect.size.x,
-            .dst_h = props->aa_rect.size.y,
-
-            .has_rotation = false,
-            .rotation = PLANE_TRANSFORM_ROTATE_0,
-            .has_in_fence_fd = false,
-            .in_fence_fd = 0,
-        },
-        refcounted_dmabuf_unref_void,
-        NULL,
-        refcounted_dmabuf_ref(s->next_buf)
-    );
+    layer = (struct kms_fb_layer){
+        .drm_fb_id = fb_id,
+        .format = s->next_buf->buf.format,
+
+        .has_modifier = s->next_buf->buf.has_modifiers,
+        .modifier = s->next_buf->buf.modifiers[0],
+
+        .src_x = 0,
+        .src_y = 0,
+        .src_w = DOUBLE_TO_FP1616_ROUNDED(s->next_buf->buf.width),
+        .src_h = DOUBLE_TO_FP1616_ROUNDED(s->next_buf->buf.height),
+
+        .dst_x = props->aa_rect.offset.x,
+        .dst_y = props->aa_rect.offset.y,
+        .dst_w = props->aa_rect.size.x,
+        .dst_h = props->aa_rect.size.y,
+
+        .has_rotation = false,
+        .rotation = PLANE_TRANSFORM_ROTATE_0,
+        .has_in_fence_fd = false,
+        .in_fence_fd = 0,
+
+        // Let the display controller apply the opacity, so fading a video in or out
+        // doesn't cost us anything.
+        // Note that nothing can queue a dmabuf yet (dmabuf_surface_push_dmabuf is unimplemented),
+        // and there's no fbdev path for dmabuf surfaces, so this is only wired up for KMS.
+        .has_alpha = props->opacity < 1.0,
+        .alpha = drm_blend_alpha_from_opacity(props->opacity),
+    };
+
+    ok = kms_req_builder_push_fb_layer(builder, &layer, refcounted_dmabuf_unref_void, NULL, refcounted_dmabuf_ref(s->next_buf));
+    if (ok == EOPNOTSUPP && layer.has_alpha) {
+        refcounted_dmabuf_unref(s->next_buf);
+
+        // No free plane supports plane alpha. Better to show the layer opaque than not at all.
+        LOG_DEBUG("Couldn't find a plane with alpha support for the dmabuf layer, presenting it opaque.\n");
+        layer.has_alpha = false;
+        layer.alpha = DRM_BLEND_ALPHA_OPAQUE;
+
+        ok = kms_req_builder_push_fb_layer(builder, &layer, refcounted_dmabuf_unref_void, NULL, refcounted_dmabuf_ref(s->next_buf));
+    }
     if (ok != 0) {
         LOG_ERROR("Couldn't push KMS fb layer. kms_req_builder_push_fb_layer: %s\n", strerror(ok));
         refcounted_dmabuf_unref(s->next_buf);
@@ -58,6 +58,7 @@ ATTR_PURE struct dummy_render_surface *__checked_cast_dummy_render_surface(void
 void dummy_render_surface_deinit(struct surface *s);
 static int dummy_render_surface_present_kms(struct surface *s, const struct fl_layer_props *props, struct kms_req_builder *builder);
 static int dummy_render_surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder);
+static int dummy_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out);
 static int dummy_render_surface_fill(struct render_surface *surface, FlutterBackingStore *fl_store);
 static int dummy_render_surface_queue_present(struct render_surface *surface, const FlutterBackingStore *fl_store);
 
@@ -71,6 +72,7 @@ int dummy_render_surface_init(struct dummy_render_surface *surface, struct trace
 
     surface->surface.present_kms = dummy_render_surface_present_kms;
     surface->surface.present_fbdev = dummy_render_surface_present_fbdev;
+    surface->surface.snapshot = dummy_render_surface_snapshot;
     surface->surface.deinit = dummy_render_surface_deinit;
     surface->render_surface.fill = dummy_render_surface_fill;
     surface->render_surface.queue_present = dummy_render_surface_queue_present;
@@ -128,6 +130,17 @@ static int dummy_render_surface_present_fbdev(struct surface *s, const struct fl
     return 0;
 }
 
+static int dummy_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out) {
+    (void) s;
+
+    // We don't have any pixels, so there's nothing to present.
+    snapshot_out->bo = NULL;
+    snapshot_out->format = PIXFMT_ARGB8888;
+    snapshot_out->release = NULL;
+    snapshot_out->release_userdata = NULL;
+    return 0;
+}
+
 static int dummy_render_surface_fill(struct render_surface *s, FlutterBackingStore *fl_store) {
     (void) fl_store;
 
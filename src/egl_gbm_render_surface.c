@@ -14,6 +14,7 @@
 #include <stdlib.h>
 
 #include "egl.h"
+#include "fbdev.h"
 #include "gl_renderer.h"
 #include "gles.h"
 #include "modesetting.h"
@@ -58,6 +59,7 @@ struct egl_gbm_render_surface {
     // more than 4 here either.
     struct locked_fb locked_fbs[4];
     struct locked_fb *locked_front_fb;
+    bool warned_about_modifier;
 #ifdef DEBUG
     atomic_int n_locked_fbs;
     bool logged_format_and_modifier;
@@ -103,6 +105,7 @@ void egl_gbm_render_surface_deinit(struct surface *s);
 static int egl_gbm_render_surface_present_kms(struct surface *s, const struct fl_layer_props *props, struct kms_req_builder *builder);
 static int
 egl_gbm_render_surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder);
+static int egl_gbm_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out);
 static int egl_gbm_render_surface_fill(struct render_surface *s, FlutterBackingStore *fl_store);
 static int egl_gbm_render_surface_queue_present(struct render_surface *s, const FlutterBackingStore *fl_store);
 
@@ -163,13 +166,15 @@ static int egl_gbm_render_surface_init(
         }
     }
     if (gbm_surface == NULL) {
-        gbm_surface = gbm_surface_create(
-            gbm_device,
-            size.x,
-            size.y,
-            get_pixfmt_info(pixel_format)->gbm_format,
-            GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT
-        );
+        uint32_t flags = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+
+        // If the only allowed layout is linear (for example because the buffers are scanned out
+        // by another device), make sure we get that even without modifier support.
+        if (n_allowed_modifiers == 1 && allowed_modifiers[0] == DRM_FORMAT_MOD_LINEAR) {
+            flags |= GBM_BO_USE_LINEAR;
+        }
+
+        gbm_surface = gbm_surface_create(gbm_device, size.x, size.y, get_pixfmt_info(pixel_format)->gbm_format, flags);
         if (gbm_surface == NULL) {
             ok = errno;
             LOG_ERROR("Couldn't create GBM surface for rendering. gbm_surface_create: %s\n", strerror(ok));
@@ -227,6 +232,7 @@ static int egl_gbm_render_surface_init(
 
     s->surface.present_kms = egl_gbm_render_surface_present_kms;
     s->surface.present_fbdev = egl_gbm_render_surface_present_fbdev;
+    s->surface.snapshot = egl_gbm_render_surface_snapshot;
     s->surface.deinit = egl_gbm_render_surface_deinit;
     s->render_surface.fill = egl_gbm_render_surface_fill;
     s->render_surface.queue_present = egl_gbm_render_surface_queue_present;
@@ -244,6 +250,7 @@ static int egl_gbm_render_surface_init(
         s->locked_fbs[i].is_locked = (atomic_flag) ATOMIC_FLAG_INIT;
     }
     s->locked_front_fb = NULL;
+    s->warned_about_modifier = false;
 #ifdef DEBUG
     s->n_locked_fbs = 0;
     s->logged_format_and_modifier = false;
@@ -382,11 +389,12 @@ static void on_release_layer(void *userdata) {
 
 static int egl_gbm_render_surface_present_kms(struct surface *s, const struct fl_layer_props *props, struct kms_req_builder *builder) {
     struct egl_gbm_render_surface *egl_surface;
+    struct kms_fb_layer layer;
     struct gbm_bo_meta *meta;
     struct drmdev *drmdev;
     struct gbm_bo *bo;
     enum pixfmt pixel_format;
-    uint32_t fb_id, opaque_fb_id;
+    uint32_t fb_id;
     int ok;
 
     egl_surface = CAST_THIS(s);
@@ -416,49 +424,14 @@ static int egl_gbm_render_surface_present_kms(struct surface *s, const struct fl
         struct drm_crtc *crtc = kms_req_builder_get_crtc(builder);
         ASSERT_NOT_NULL(crtc);
 
-        if (drm_crtc_any_plane_supports_format(drmdev, crtc, egl_surface->pixel_format)) {
-            TRACER_BEGIN(egl_surface->surface.tracer, "drmdev_add_fb (non-opaque)");
-            fb_id = drmdev_add_fb_from_gbm_bo(
-                drmdev,
-                bo,
-                /* cast_opaque */ false
-            );
-            TRACER_END(egl_surface->surface.tracer, "drmdev_add_fb (non-opaque)");
-
-            if (fb_id == 0) {
-                ok = EIO;
-                LOG_ERROR("Couldn't add GBM buffer as DRM framebuffer.\n");
-                goto fail_free_meta;
-            }
-
-            meta->has_nonopaque_fb_id = true;
-            meta->nonopaque_fb_id = fb_id;
-        } else {
-            meta->has_nonopaque_fb_id = false;
-            meta->nonopaque_fb_id = 0;
-        }
+        meta->has_nonopaque_fb_id = drm_crtc_any_plane_supports_format(drmdev, crtc, egl_surface->pixel_format);
+        meta->nonopaque_fb_id = 0;
 
         // if this EGL surface is non-opaque and has an opaque equivalent
-        if (!get_pixfmt_info(egl_surface->pixel_format)->is_opaque &&
-            pixfmt_opaque(egl_surface->pixel_format) != egl_surface->pixel_format &&
-            drm_crtc_any_plane_supports_format(drmdev, crtc, pixfmt_opaque(egl_surface->pixel_format))) {
-            opaque_fb_id = drmdev_add_fb_from_gbm_bo(
-                drmdev,
-                bo,
-                /* cast_opaque */ true
-            );
-            if (opaque_fb_id == 0) {
-                ok = EIO;
-                LOG_ERROR("Couldn't add GBM buffer as opaque DRM framebuffer.\n");
-                goto fail_remove_fb;
-            }
-
-            meta->has_opaque_fb_id = true;
-            meta->opaque_fb_id = opaque_fb_id;
-        } else {
-            meta->has_opaque_fb_id = false;
-            meta->opaque_fb_id = 0;
-        }
+        meta->has_opaque_fb_id = !get_pixfmt_info(egl_surface->pixel_format)->is_opaque &&
+                                 pixfmt_opaque(egl_surface->pixel_format) != egl_surface->pixel_format &&
+                                 drm_crtc_any_plane_supports_format(drmdev, crtc, pixfmt_opaque(egl_surface->pixel_format));
+        meta->opaque_fb_id = 0;
 
         if (!meta->has_nonopaque_fb_id && !meta->has_opaque_fb_id) {
             ok = EIO;
@@ -466,8 +439,21 @@ static int egl_gbm_render_surface_present_kms(struct surface *s, const struct fl
             goto fail_free_meta;
         }
 
+        // If the buffer was rendered on another GPU, this imports it only once for both framebuffers.
+        TRACER_BEGIN(egl_surface->surface.tracer, "drmdev_add_fbs_from_gbm_bo");
+        ok = drmdev_add_fbs_from_gbm_bo(
+            drmdev,
+            bo,
+            meta->has_nonopaque_fb_id ? &meta->nonopaque_fb_id : NULL,
+            meta->has_opaque_fb_id ? &meta->opaque_fb_id : NULL
+        );
+        TRACER_END(egl_surface->surface.tracer, "drmdev_add_fbs_from_gbm_bo");
+        if (ok != 0) {
+            LOG_ERROR("Couldn't add GBM buffer as DRM framebuffer.\n");
+            goto fail_free_meta;
+        }
+
         meta->drmdev = drmdev_ref(drmdev);
-        meta->nonopaque_fb_id = fb_id;
         gbm_bo_set_user_data(bo, meta, on_destroy_gbm_bo_meta);
     } else {
         // We can only add this GBM BO to a single KMS device as an fb right now.
@@ -514,35 +500,48 @@ static int egl_gbm_render_surface_present_kms(struct surface *s, const struct fl
         }
     }
 
+    layer = (struct kms_fb_layer){
+        .drm_fb_id = fb_id,
+        .format = pixel_format,
+        .has_modifier = gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_INVALID,
+        .modifier = gbm_bo_get_modifier(bo),
+
+        .dst_x = (int32_t) props->aa_rect.offset.x,
+        .dst_y = (int32_t) props->aa_rect.offset.y,
+        .dst_w = (uint32_t) props->aa_rect.size.x,
+        .dst_h = (uint32_t) props->aa_rect.size.y,
+
+        .src_x = 0,
+        .src_y = 0,
+        .src_w = DOUBLE_TO_FP1616_ROUNDED(egl_surface->render_surface.size.x),
+        .src_h = DOUBLE_TO_FP1616_ROUNDED(egl_surface->render_surface.size.y),
+
+        .has_rotation = false,
+        .rotation = PLANE_TRANSFORM_ROTATE_0,
+
+        .has_in_fence_fd = false,
+        .in_fence_fd = 0,
+
+        .has_alpha = props->opacity < 1.0,
+        .alpha = drm_blend_alpha_from_opacity(props->opacity),
+
+        // flutter renders with premultiplied alpha.
+        .has_blend_mode = true,
+        .blend_mode = kPremultiplied_DrmBlendMode,
+    };
+
     TRACER_BEGIN(egl_surface->surface.tracer, "kms_req_builder_push_fb_layer");
-    ok = kms_req_builder_push_fb_layer(
-        builder,
-        &(const struct kms_fb_layer){
-            .drm_fb_id = fb_id,
-            .format = pixel_format,
-            .has_modifier = gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_INVALID,
-            .modifier = gbm_bo_get_modifier(bo),
-
-            .dst_x = (int32_t) props->aa_rect.offset.x,
-            .dst_y = (int32_t) props->aa_rect.offset.y,
-            .dst_w = (uint32_t) props->aa_rect.size.x,
-            .dst_h = (uint32_t) props->aa_rect.size.y,
-
-            .src_x = 0,
-            .src_y = 0,
-            .src_w = DOUBLE_TO_FP1616_ROUNDED(egl_surface->render_surface.size.x),
-            .src_h = DOUBLE_TO_FP1616_ROUNDED(egl_surface->render_surface.size.y),
-
-            .has_rotation = false,
-            .rotation = PLANE_TRANSFORM_ROTATE_0,
-
-            .has_in_fence_fd = false,
-            .in_fence_fd = 0,
-        },
-        on_release_layer,
-        NULL,
-        locked_fb_ref(egl_surface->locked_front_fb)
-    );
+    ok = kms_req_builder_push_fb_layer(builder, &layer, on_release_layer, NULL, locked_fb_ref(egl_surface->locked_front_fb));
+    if (ok == EOPNOTSUPP && layer.has_alpha) {
+        locked_fb_unref(egl_surface->locked_front_fb);
+
+        // No free plane supports plane alpha. Better to show the layer opaque than not at all.
+        LOG_DEBUG("Couldn't find a plane with alpha support for the layer, presenting it opaque.\n");
+        layer.has_alpha = false;
+        layer.alpha = DRM_BLEND_ALPHA_OPAQUE;
+
+        ok = kms_req_builder_push_fb_layer(builder, &layer, on_release_layer, NULL, locked_fb_ref(egl_surface->locked_front_fb));
+    }
     TRACER_END(egl_surface->surface.tracer, "kms_req_builder_push_fb_layer");
     if (ok != 0) {
         goto fail_unref_locked_fb;
@@ -555,9 +554,6 @@ fail_unref_locked_fb:
     locked_fb_unref(egl_surface->locked_front_fb);
     goto fail_unlock;
 
-fail_remove_fb:
-    drmdev_rm_fb(drmdev, fb_id);
-
 fail_free_meta:
     free(meta);
 
@@ -569,17 +565,92 @@ fail_unlock:
 static int
 egl_gbm_render_surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder) {
     struct egl_gbm_render_surface *egl_surface;
+    struct gbm_bo *bo;
+    uint32_t stride;
+    void *map, *map_data;
+    int ok;
 
-    /// TODO: Implement by mmapping the current front bo, copy it into the fbdev
-    /// TODO: Print a warning here if we're not using explicit linear tiling and use glReadPixels instead of gbm_bo_map in that case
+    egl_surface = CAST_THIS(s);
+
+    /// TODO: Implement non axis-aligned fl_layer_props
+    ASSERT_MSG(props->is_aa_rect, "only axis aligned view geometry is supported right now");
+
+    surface_lock(s);
+
+    ASSERT_NOT_NULL_MSG(
+        egl_surface->locked_front_fb,
+        "There's no framebuffer available for scanout right now. Make sure you called render_surface_queue_present() before presenting."
+    );
+
+    bo = egl_surface->locked_front_fb->bo;
+
+    // gbm_bo_map will do a (slow) detiling blit if the buffer is not linear.
+    if (!egl_surface->warned_about_modifier && gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_LINEAR) {
+        LOG_ERROR("EGL surface is not using a linear modifier. Presenting it on a fbdev will be slow.\n");
+        egl_surface->warned_about_modifier = true;
+    }
+
+    TRACER_BEGIN(egl_surface->surface.tracer, "gbm_bo_map");
+    map_data = NULL;
+    map = gbm_bo_map(bo, 0, 0, gbm_bo_get_width(bo), gbm_bo_get_height(bo), GBM_BO_TRANSFER_READ, &stride, &map_data);
+    TRACER_END(egl_surface->surface.tracer, "gbm_bo_map");
+    if (map == NULL) {
+        ok = errno ? errno : EIO;
+        LOG_ERROR("Couldn't map GBM buffer for presenting it on a fbdev. gbm_bo_map: %s\n", strerror(ok));
+        goto fail_unlock;
+    }
+
+    TRACER_BEGIN(egl_surface->surface.tracer, "fbdev_commit_builder_push_layer");
+    ok = fbdev_commit_builder_push_layer(
+        builder,
+        &(const struct fbdev_layer){
+            .map = map,
+            .stride = stride,
+            .format = egl_surface->pixel_format,
+            .src_w = gbm_bo_get_width(bo),
+            .src_h = gbm_bo_get_height(bo),
+            .dst_x = (int) props->aa_rect.offset.x,
+            .dst_y = (int) props->aa_rect.offset.y,
+            .dst_w = (int) props->aa_rect.size.x,
+            .dst_h = (int) props->aa_rect.size.y,
+            .opacity = props->opacity,
+        }
+    );
+    TRACER_END(egl_surface->surface.tracer, "fbdev_commit_builder_push_layer");
+
+    gbm_bo_unmap(bo, map_data);
+
+    if (ok != 0) {
+        goto fail_unlock;
+    }
+
+    surface_unlock(s);
+    return 0;
+
+fail_unlock:
+    surface_unlock(s);
+    return ok;
+}
+
+static int egl_gbm_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out) {
+    struct egl_gbm_render_surface *egl_surface;
 
     egl_surface = CAST_THIS(s);
-    (void) egl_surface;
-    (void) props;
-    (void) builder;
 
-    UNIMPLEMENTED();
+    surface_lock(s);
 
+    if (egl_surface->locked_front_fb == NULL) {
+        surface_unlock(s);
+        return EAGAIN;
+    }
+
+    // Keeping the front fb locked makes sure flutter won't render into it until the snapshot is released.
+    snapshot_out->bo = egl_surface->locked_front_fb->bo;
+    snapshot_out->format = egl_surface->pixel_format;
+    snapshot_out->release = on_release_layer;
+    snapshot_out->release_userdata = locked_fb_ref(egl_surface->locked_front_fb);
+
+    surface_unlock(s);
     return 0;
 }
 
@@ -0,0 +1,775 @@
+// SPDX-License-Identifier: MIT
+/*
+ * fbdev
+ *
+ * - output for linux framebuffer devices (/dev/fbX)
+ * - offscreen fbdevs backed by ordinary memory
+ *
+ * Copyright (c) 2023, Hannes Winkler <hanneswinkler2000@web.de>
+ */
+
+#define _GNU_SOURCE
+#include "fbdev.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/fb.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "pixel_format.h"
+#include "util/collection.h"
+#include "util/lock_ops.h"
+#include "util/logging.h"
+#include "util/refcounting.h"
+
+struct fbdev {
+    refcount_t n_refs;
+    pthread_mutex_t mutex;
+
+    int fd;
+    struct fb_var_screeninfo var_info;
+    struct fb_fix_screeninfo fix_info;
+
+    /**
+     * @brief Visible size of the framebuffer, in pixels.
+     */
+    int width, height;
+
+    /**
+     * @brief The pixel format of the framebuffer.
+     */
+    int bytes_per_pixel;
+    struct fbdev_pixfmt format;
+
+    /**
+     * @brief The mapped framebuffer memory.
+     */
+    uint8_t *map;
+    size_t map_size;
+
+    /**
+     * @brief 2 if we can do double buffering using FBIOPAN_DISPLAY, 1 otherwise.
+     */
+    int n_buffers;
+
+    /**
+     * @brief The buffer that's currently being scanned out.
+     */
+    int front_buffer;
+
+    /**
+     * @brief The composited frame, as premultiplied ARGB8888. (native-endian, 0xAARRGGBB)
+     *
+     * This is kept around between frames, so we only need to touch the parts
+     * that are covered by the new layers.
+     */
+    uint32_t *composition;
+
+    /**
+     * @brief For each buffer, a copy of what's in the framebuffer memory right now.
+     *
+     * We compare against this to find out which rows actually changed, so we don't need to read back
+     * the framebuffer memory, which is possibly uncached.
+     */
+    uint8_t *shadows[2];
+
+    /**
+     * @brief For each buffer, true if we don't know the contents of the framebuffer memory yet
+     * and can't compare against the shadow copy.
+     */
+    bool shadow_invalid[2];
+
+    /**
+     * @brief For each buffer, the rows [top, bottom) of @ref composition that were changed
+     * and are not yet copied into the framebuffer memory.
+     */
+    int dirty_top[2], dirty_bottom[2];
+
+    /**
+     * @brief Temporary storage for a single row of pixels.
+     */
+    uint32_t *argb_row;
+    uint8_t *fb_row;
+};
+
+struct fbdev_commit_builder {
+    struct fbdev *fbdev;
+    int n_layers;
+    int dirty_top, dirty_bottom;
+};
+
+DEFINE_STATIC_LOCK_OPS(fbdev, mutex)
+
+static bool fb_bitfield_equals(const struct fb_bitfield *a, const struct fb_bitfield *b) {
+    if (a->length == 0 && b->length == 0) {
+        return true;
+    }
+
+    return a->length == b->length && a->offset == b->offset && a->msb_right == b->msb_right;
+}
+
+static bool fbdev_pixfmt_equals(const struct fbdev_pixfmt *a, const struct fbdev_pixfmt *b) {
+    return fb_bitfield_equals(&a->r, &b->r) && fb_bitfield_equals(&a->g, &b->g) && fb_bitfield_equals(&a->b, &b->b) &&
+           fb_bitfield_equals(&a->a, &b->a);
+}
+
+static int fbdev_init(
+    struct fbdev *fbdev,
+    int fd,
+    const struct fb_var_screeninfo *var_info,
+    const struct fb_fix_screeninfo *fix_info,
+    uint8_t *map,
+    size_t map_size,
+    int n_buffers
+) {
+    size_t shadow_size;
+    int bytes_per_pixel;
+
+    bytes_per_pixel = var_info->bits_per_pixel / 8;
+
+    fbdev->composition = calloc((size_t) var_info->xres * var_info->yres, sizeof(uint32_t));
+    if (fbdev->composition == NULL) {
+        return ENOMEM;
+    }
+
+    shadow_size = (size_t) var_info->xres * var_info->yres * bytes_per_pixel;
+
+    fbdev->shadows[0] = malloc(shadow_size);
+    if (fbdev->shadows[0] == NULL) {
+        goto fail_free_composition;
+    }
+
+    if (n_buffers == 2) {
+        fbdev->shadows[1] = malloc(shadow_size);
+        if (fbdev->shadows[1] == NULL) {
+            goto fail_free_shadow_0;
+        }
+    } else {
+        fbdev->shadows[1] = NULL;
+    }
+
+    fbdev->argb_row = malloc(var_info->xres * sizeof(uint32_t));
+    if (fbdev->argb_row == NULL) {
+        goto fail_free_shadow_1;
+    }
+
+    fbdev->fb_row = malloc(var_info->xres * bytes_per_pixel);
+    if (fbdev->fb_row == NULL) {
+        goto fail_free_argb_row;
+    }
+
+    pthread_mutex_init(&fbdev->mutex, NULL);
+    fbdev->n_refs = REFCOUNT_INIT_1;
+    fbdev->fd = fd;
+    fbdev->var_info = *var_info;
+    fbdev->fix_info = *fix_info;
+    fbdev->width = var_info->xres;
+    fbdev->height = var_info->yres;
+    fbdev->bytes_per_pixel = bytes_per_pixel;
+    fbdev->format.r = var_info->red;
+    fbdev->format.g = var_info->green;
+    fbdev->format.b = var_info->blue;
+    fbdev->format.a = var_info->transp;
+    fbdev->map = map;
+    fbdev->map_size = map_size;
+    fbdev->n_buffers = n_buffers;
+    fbdev->front_buffer = n_buffers == 2 && var_info->yoffset >= var_info->yres ? 1 : 0;
+    for (int i = 0; i < 2; i++) {
+        // We don't know what's in the framebuffer memory right now,
+        // so the first frame for each buffer is copied completely.
+        fbdev->shadow_invalid[i] = true;
+        fbdev->dirty_top[i] = 0;
+        fbdev->dirty_bottom[i] = fbdev->height;
+    }
+    return 0;
+
+fail_free_argb_row:
+    free(fbdev->argb_row);
+
+fail_free_shadow_1:
+    free(fbdev->shadows[1]);
+
+fail_free_shadow_0:
+    free(fbdev->shadows[0]);
+
+fail_free_composition:
+    free(fbdev->composition);
+    return ENOMEM;
+}
+
+struct fbdev *fbdev_new_from_path(const char *path) {
+    struct fb_var_screeninfo var_info;
+    struct fb_fix_screeninfo fix_info;
+    struct fbdev *fbdev;
+    uint8_t *map;
+    int ok, fd, n_buffers;
+
+    ASSERT_NOT_NULL(path);
+
+    fbdev = malloc(sizeof *fbdev);
+    if (fbdev == NULL) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Couldn't open fbdev \"%s\". open: %s\n", path, strerror(errno));
+        goto fail_free_fbdev;
+    }
+
+    ok = ioctl(fd, FBIOGET_FSCREENINFO, &fix_info);
+    if (ok < 0) {
+        LOG_ERROR("Couldn't query fbdev fixed screen info. ioctl: %s\n", strerror(errno));
+        goto fail_close_fd;
+    }
+
+    ok = ioctl(fd, FBIOGET_VSCREENINFO, &var_info);
+    if (ok < 0) {
+        LOG_ERROR("Couldn't query fbdev variable screen info. ioctl: %s\n", strerror(errno));
+        goto fail_close_fd;
+    }
+
+    if (fix_info.type != FB_TYPE_PACKED_PIXELS || (fix_info.visual != FB_VISUAL_TRUECOLOR && fix_info.visual != FB_VISUAL_DIRECTCOLOR)) {
+        LOG_ERROR("fbdev \"%s\" is not a packed-pixel truecolor framebuffer, which is not supported.\n", path);
+        goto fail_close_fd;
+    }
+
+    if (var_info.bits_per_pixel != 16 && var_info.bits_per_pixel != 24 && var_info.bits_per_pixel != 32) {
+        LOG_ERROR("fbdev \"%s\" has an unsupported bits per pixel value of %" PRIu32 ".\n", path, var_info.bits_per_pixel);
+        goto fail_close_fd;
+    }
+
+    // Try to make the virtual framebuffer twice as high as the visible one,
+    // so we can render into the invisible half and then pan to it.
+    if (fix_info.ypanstep != 0 && var_info.yres_virtual < var_info.yres * 2) {
+        struct fb_var_screeninfo double_buffered_var_info = var_info;
+
+        double_buffered_var_info.yres_virtual = var_info.yres * 2;
+        double_buffered_var_info.yoffset = 0;
+
+        ok = ioctl(fd, FBIOPUT_VSCREENINFO, &double_buffered_var_info);
+        if (ok == 0) {
+            ioctl(fd, FBIOGET_FSCREENINFO, &fix_info);
+            ioctl(fd, FBIOGET_VSCREENINFO, &var_info);
+        } else {
+            LOG_DEBUG("Couldn't resize fbdev virtual framebuffer for double buffering. ioctl: %s\n", strerror(errno));
+        }
+    }
+
+    if (fix_info.ypanstep != 0 && var_info.yres % fix_info.ypanstep == 0 && var_info.yres_virtual >= var_info.yres * 2 &&
+        fix_info.smem_len >= 2 * fix_info.line_length * var_info.yres) {
+        n_buffers = 2;
+    } else {
+        n_buffers = 1;
+    }
+
+    map = mmap(NULL, fix_info.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Couldn't map fbdev framebuffer memory. mmap: %s\n", strerror(errno));
+        goto fail_close_fd;
+    }
+
+    ok = fbdev_init(fbdev, fd, &var_info, &fix_info, map, fix_info.smem_len, n_buffers);
+    if (ok != 0) {
+        goto fail_unmap;
+    }
+
+    LOG_DEBUG_UNPREFIXED(
+        "fbdev:\n"
+        "  path: %s\n"
+        "  resolution: %" PRIu32 " x %" PRIu32 "\n"
+        "  bits per pixel: %" PRIu32 "\n"
+        "  double buffering: %s\n",
+        path,
+        var_info.xres,
+        var_info.yres,
+        var_info.bits_per_pixel,
+        n_buffers == 2 ? "yes" : "no"
+    );
+
+    return fbdev;
+
+fail_unmap:
+    munmap(map, fix_info.smem_len);
+
+fail_close_fd:
+    close(fd);
+
+fail_free_fbdev:
+    free(fbdev);
+    return NULL;
+}
+
+struct fbdev *fbdev_new_offscreen(struct vec2i size) {
+    struct fb_var_screeninfo var_info;
+    struct fb_fix_screeninfo fix_info;
+    struct fbdev *fbdev;
+    uint8_t *map;
+    int ok;
+
+    assert(size.x > 0 && size.y > 0);
+
+    fbdev = malloc(sizeof *fbdev);
+    if (fbdev == NULL) {
+        return NULL;
+    }
+
+    memset(&var_info, 0, sizeof var_info);
+    var_info.xres = var_info.xres_virtual = size.x;
+    var_info.yres = var_info.yres_virtual = size.y;
+    var_info.bits_per_pixel = 32;
+    var_info.red = (struct fb_bitfield){ .offset = 16, .length = 8 };
+    var_info.green = (struct fb_bitfield){ .offset = 8, .length = 8 };
+    var_info.blue = (struct fb_bitfield){ .offset = 0, .length = 8 };
+    var_info.transp = (struct fb_bitfield){ .offset = 0, .length = 0 };
+
+    memset(&fix_info, 0, sizeof fix_info);
+    fix_info.type = FB_TYPE_PACKED_PIXELS;
+    fix_info.visual = FB_VISUAL_TRUECOLOR;
+    fix_info.line_length = size.x * 4;
+    fix_info.smem_len = fix_info.line_length * size.y;
+
+    map = calloc(1, fix_info.smem_len);
+    if (map == NULL) {
+        goto fail_free_fbdev;
+    }
+
+    ok = fbdev_init(fbdev, -1, &var_info, &fix_info, map, fix_info.smem_len, 1);
+    if (ok != 0) {
+        goto fail_free_map;
+    }
+
+    return fbdev;
+
+fail_free_map:
+    free(map);
+
+fail_free_fbdev:
+    free(fbdev);
+    return NULL;
+}
+
+void fbdev_destroy(struct fbdev *fbdev) {
+    ASSERT_NOT_NULL(fbdev);
+
+    free(fbdev->fb_row);
+    free(fbdev->argb_row);
+    free(fbdev->shadows[1]);
+    free(fbdev->shadows[0]);
+    free(fbdev->composition);
+    if (fbdev->fd >= 0) {
+        munmap(fbdev->map, fbdev->map_size);
+        close(fbdev->fd);
+    } else {
+        // offscreen fbdev
+        free(fbdev->map);
+    }
+    pthread_mutex_destroy(&fbdev->mutex);
+    free(fbdev);
+}
+
+DEFINE_REF_OPS(fbdev, n_refs)
+
+struct vec2i fbdev_get_size(struct fbdev *fbdev) {
+    ASSERT_NOT_NULL(fbdev);
+    return VEC2I(fbdev->width, fbdev->height);
+}
+
+bool fbdev_get_physical_size(struct fbdev *fbdev, int *width_mm_out, int *height_mm_out) {
+    ASSERT_NOT_NULL(fbdev);
+    ASSERT_NOT_NULL(width_mm_out);
+    ASSERT_NOT_NULL(height_mm_out);
+
+    // Drivers report 0 or -1 if they don't know the physical size.
+    if (fbdev->var_info.width == 0 || fbdev->var_info.height == 0 || fbdev->var_info.width == UINT32_MAX ||
+        fbdev->var_info.height == UINT32_MAX) {
+        return false;
+    }
+
+    *width_mm_out = fbdev->var_info.width;
+    *height_mm_out = fbdev->var_info.height;
+    return true;
+}
+
+double fbdev_get_refresh_rate(struct fbdev *fbdev) {
+    const struct fb_var_screeninfo *info;
+    uint64_t htotal, vtotal;
+
+    ASSERT_NOT_NULL(fbdev);
+
+    info = &fbdev->var_info;
+    if (info->pixclock == 0) {
+        return 60.0;
+    }
+
+    htotal = (uint64_t) info->left_margin + info->xres + info->right_margin + info->hsync_len;
+    vtotal = (uint64_t) info->upper_margin + info->yres + info->lower_margin + info->vsync_len;
+
+    // pixclock is the length of a pixel in picoseconds.
+    return 1e12 / ((double) info->pixclock * htotal * vtotal);
+}
+
+bool fbdev_get_pixel_format(struct fbdev *fbdev, enum pixfmt *format_out) {
+    ASSERT_NOT_NULL(fbdev);
+    ASSERT_NOT_NULL(format_out);
+
+    for (int i = 0; i < n_pixfmt_infos; i++) {
+        const struct pixfmt_info *info = get_pixfmt_info(i);
+
+        if (pixfmt_is_float(info->format)) {
+            continue;
+        }
+
+        if (info->bits_per_pixel == fbdev->var_info.bits_per_pixel && fbdev_pixfmt_equals(&info->fbdev_format, &fbdev->format)) {
+            *format_out = info->format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct fbdev_commit_builder *fbdev_create_commit_builder(struct fbdev *fbdev) {
+    struct fbdev_commit_builder *builder;
+
+    ASSERT_NOT_NULL(fbdev);
+
+    builder = malloc(sizeof *builder);
+    if (builder == NULL) {
+        return NULL;
+    }
+
+    // Unlocked in fbdev_commit_builder_destroy.
+    fbdev_lock(fbdev);
+
+    builder->fbdev = fbdev_ref(fbdev);
+    builder->n_layers = 0;
+    builder->dirty_top = fbdev->height;
+    builder->dirty_bottom = 0;
+    return builder;
+}
+
+void fbdev_commit_builder_destroy(struct fbdev_commit_builder *builder) {
+    ASSERT_NOT_NULL(builder);
+
+    fbdev_unlock(builder->fbdev);
+    fbdev_unref(builder->fbdev);
+    free(builder);
+}
+
+struct fbdev *fbdev_commit_builder_get_fbdev(struct fbdev_commit_builder *builder) {
+    ASSERT_NOT_NULL(builder);
+    return builder->fbdev;
+}
+
+static inline uint32_t read_pixel(const uint8_t *pixel, int bytes_per_pixel) {
+    uint16_t value16;
+    uint32_t value32;
+
+    switch (bytes_per_pixel) {
+        case 2: memcpy(&value16, pixel, 2); return value16;
+        case 3: return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+        case 4: memcpy(&value32, pixel, 4); return value32;
+        default: UNREACHABLE();
+    }
+}
+
+static inline void write_pixel(uint8_t *pixel, int bytes_per_pixel, uint32_t value) {
+    uint16_t value16;
+
+    switch (bytes_per_pixel) {
+        case 2:
+            value16 = (uint16_t) value;
+            memcpy(pixel, &value16, 2);
+            break;
+        case 3:
+            pixel[0] = value & 0xFF;
+            pixel[1] = (value >> 8) & 0xFF;
+            pixel[2] = (value >> 16) & 0xFF;
+            break;
+        case 4: memcpy(pixel, &value, 4); break;
+        default: UNREACHABLE();
+    }
+}
+
+static inline uint32_t unpack_channel(uint32_t value, const struct fb_bitfield *field, uint32_t default_value) {
+    uint32_t max;
+
+    if (field->length == 0) {
+        return default_value;
+    }
+
+    max = (1u << field->length) - 1;
+    value = (value >> field->offset) & max;
+
+    if (field->length >= 8) {
+        return value >> (field->length - 8);
+    } else {
+        // scale, so the maximum value maps to 0xFF.
+        return (value * 255 + max / 2) / max;
+    }
+}
+
+static inline uint32_t pack_channel(uint32_t value, const struct fb_bitfield *field) {
+    if (field->length == 0) {
+        return 0;
+    } else if (field->length >= 8) {
+        return (value << (field->length - 8)) << field->offset;
+    } else {
+        return (value >> (8 - field->length)) << field->offset;
+    }
+}
+
+/**
+ * @brief Convert a pixel value described by @param format to premultiplied ARGB8888.
+ */
+static inline uint32_t unpack_pixel(uint32_t value, const struct fbdev_pixfmt *format) {
+    return (unpack_channel(value, &format->a, 0xFF) << 24) | (unpack_channel(value, &format->r, 0) << 16) |
+           (unpack_channel(value, &format->g, 0) << 8) | unpack_channel(value, &format->b, 0);
+}
+
+static inline uint32_t pack_pixel(uint32_t argb, const struct fbdev_pixfmt *format) {
+    return pack_channel(argb >> 24, &format->a) | pack_channel((argb >> 16) & 0xFF, &format->r) |
+           pack_channel((argb >> 8) & 0xFF, &format->g) | pack_channel(argb & 0xFF, &format->b);
+}
+
+/**
+ * @brief Multiply all 4 channels of @param argb with @param alpha / 255.
+ */
+static inline uint32_t mul_un8x4(uint32_t argb, uint32_t alpha) {
+    uint32_t rb, ag;
+
+    rb = (argb & 0x00FF00FF) * alpha + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+
+    ag = ((argb >> 8) & 0x00FF00FF) * alpha + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+    return rb | ag;
+}
+
+/**
+ * @brief Convert @param n pixels, starting at @param src in the pixel format @param format, to premultiplied ARGB8888.
+ *
+ * If @param src_w equals @param n, the pixels are just converted. Otherwise they're scaled (nearest-neighbor)
+ * from @param src_w source pixels, beginning at @param src_x_offset destination pixels.
+ *
+ * The loops for the common formats are kept simple so the compiler can vectorize them.
+ */
+static void unpack_row(uint32_t *restrict dst, const uint8_t *restrict src, enum pixfmt format, int n, int src_w, int dst_w, int dst_x_offset) {
+    const struct pixfmt_info *info;
+    int bytes_per_pixel;
+
+    info = get_pixfmt_info(format);
+    bytes_per_pixel = info->bits_per_pixel / 8;
+
+    if (src_w != dst_w) {
+        for (int i = 0; i < n; i++) {
+            int src_x = (int) (((int64_t) (i + dst_x_offset) * src_w) / dst_w);
+            dst[i] = unpack_pixel(read_pixel(src + src_x * bytes_per_pixel, bytes_per_pixel), &info->fbdev_format);
+        }
+        return;
+    }
+
+    src += dst_x_offset * bytes_per_pixel;
+
+    if (format == PIXFMT_ARGB8888) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    } else if (format == PIXFMT_XRGB8888) {
+        const uint32_t *src32 = (const uint32_t *) src;
+        for (int i = 0; i < n; i++) {
+            dst[i] = src32[i] | 0xFF000000;
+        }
+    } else if (format == PIXFMT_RGB565) {
+        const uint16_t *src16 = (const uint16_t *) src;
+        for (int i = 0; i < n; i++) {
+            uint32_t r = (src16[i] >> 11) & 0x1F;
+            uint32_t g = (src16[i] >> 5) & 0x3F;
+            uint32_t b = src16[i] & 0x1F;
+
+            dst[i] = 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            dst[i] = unpack_pixel(read_pixel(src + i * bytes_per_pixel, bytes_per_pixel), &info->fbdev_format);
+        }
+    }
+}
+
+/**
+ * @brief Convert @param n premultiplied ARGB8888 pixels to the framebuffer pixel format.
+ */
+static void pack_row(struct fbdev *fbdev, uint8_t *restrict dst, const uint32_t *restrict src, int n) {
+    static const struct fb_bitfield r8 = { .offset = 16, .length = 8 }, g8 = { .offset = 8, .length = 8 }, b8 = { .offset = 0, .length = 8 };
+    static const struct fb_bitfield r5 = { .offset = 11, .length = 5 }, g6 = { .offset = 5, .length = 6 }, b5 = { .offset = 0, .length = 5 };
+
+    const struct fbdev_pixfmt *format = &fbdev->format;
+
+    if (fbdev->bytes_per_pixel == 4 && fb_bitfield_equals(&format->r, &r8) && fb_bitfield_equals(&format->g, &g8) &&
+        fb_bitfield_equals(&format->b, &b8)) {
+        // XRGB8888 / ARGB8888
+        memcpy(dst, src, n * sizeof(uint32_t));
+    } else if (fbdev->bytes_per_pixel == 2 && fb_bitfield_equals(&format->r, &r5) && fb_bitfield_equals(&format->g, &g6) &&
+               fb_bitfield_equals(&format->b, &b5)) {
+        // RGB565
+        uint16_t *dst16 = (uint16_t *) dst;
+        for (int i = 0; i < n; i++) {
+            dst16[i] = ((src[i] >> 8) & 0xF800) | ((src[i] >> 5) & 0x07E0) | ((src[i] >> 3) & 0x001F);
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            write_pixel(dst + i * fbdev->bytes_per_pixel, fbdev->bytes_per_pixel, pack_pixel(src[i], format));
+        }
+    }
+}
+
+int fbdev_commit_builder_push_layer(struct fbdev_commit_builder *builder, const struct fbdev_layer *layer) {
+    struct fbdev *fbdev;
+    uint32_t alpha;
+    bool blend;
+    int x0, y0, x1, y1;
+
+    ASSERT_NOT_NULL(builder);
+    ASSERT_NOT_NULL(layer);
+    ASSERT_NOT_NULL(layer->map);
+    fbdev = builder->fbdev;
+
+    if (pixfmt_is_float(layer->format)) {
+        LOG_ERROR("Floating point pixel formats can't be presented on a fbdev.\n");
+        return EOPNOTSUPP;
+    }
+
+    if (layer->dst_w <= 0 || layer->dst_h <= 0 || layer->src_w <= 0 || layer->src_h <= 0) {
+        return 0;
+    }
+
+    // clip the destination rect to the visible area.
+    x0 = MAX2(layer->dst_x, 0);
+    y0 = MAX2(layer->dst_y, 0);
+    x1 = MIN2(layer->dst_x + layer->dst_w, fbdev->width);
+    y1 = MIN2(layer->dst_y + layer->dst_h, fbdev->height);
+
+    if (builder->n_layers == 0 && (x0 != 0 || y0 != 0 || x1 != fbdev->width || y1 != fbdev->height)) {
+        // The bottom-most layer doesn't cover the whole screen,
+        // so clear the parts of the old frame that are still visible.
+        memset(fbdev->composition, 0, (size_t) fbdev->width * fbdev->height * sizeof(uint32_t));
+        builder->dirty_top = 0;
+        builder->dirty_bottom = fbdev->height;
+    }
+
+    builder->n_layers++;
+
+    if (x0 >= x1 || y0 >= y1) {
+        return 0;
+    }
+
+    alpha = (uint32_t) (CLAMP(layer->opacity, 0.0, 1.0) * 255.0 + 0.5);
+
+    // The bottom-most layer is presented on black, so we can just copy it.
+    blend = builder->n_layers > 1 && !(alpha == 0xFF && get_pixfmt_info(layer->format)->is_opaque);
+
+    for (int y = y0; y < y1; y++) {
+        int src_y = (int) (((int64_t) (y - layer->dst_y) * layer->src_h) / layer->dst_h);
+        const uint8_t *src_row = (const uint8_t *) layer->map + (size_t) src_y * layer->stride;
+        uint32_t *dst_row = fbdev->composition + (size_t) y * fbdev->width + x0;
+        int n = x1 - x0;
+
+        if (!blend && alpha == 0xFF) {
+            unpack_row(dst_row, src_row, layer->format, n, layer->src_w, layer->dst_w, x0 - layer->dst_x);
+            continue;
+        }
+
+        unpack_row(fbdev->argb_row, src_row, layer->format, n, layer->src_w, layer->dst_w, x0 - layer->dst_x);
+
+        if (alpha != 0xFF) {
+            for (int i = 0; i < n; i++) {
+                fbdev->argb_row[i] = mul_un8x4(fbdev->argb_row[i], alpha);
+            }
+        }
+
+        if (blend) {
+            // premultiplied source-over
+            for (int i = 0; i < n; i++) {
+                uint32_t src = fbdev->argb_row[i];
+                dst_row[i] = src + mul_un8x4(dst_row[i], 0xFF - (src >> 24));
+            }
+        } else {
+            memcpy(dst_row, fbdev->argb_row, n * sizeof(uint32_t));
+        }
+    }
+
+    builder->dirty_top = MIN2(builder->dirty_top, y0);
+    builder->dirty_bottom = MAX2(builder->dirty_bottom, y1);
+    return 0;
+}
+
+int fbdev_commit_builder_commit(struct fbdev_commit_builder *builder) {
+    struct fbdev *fbdev;
+    size_t row_size;
+    int ok, target;
+
+    ASSERT_NOT_NULL(builder);
+    fbdev = builder->fbdev;
+
+    // Both buffers need to get the rows that changed in this frame at some point.
+    for (int i = 0; i < fbdev->n_buffers; i++) {
+        if (builder->dirty_top < builder->dirty_bottom) {
+            fbdev->dirty_top[i] = MIN2(fbdev->dirty_top[i], builder->dirty_top);
+            fbdev->dirty_bottom[i] = MAX2(fbdev->dirty_bottom[i], builder->dirty_bottom);
+        }
+    }
+
+    target = fbdev->n_buffers == 2 ? !fbdev->front_buffer : 0;
+    row_size = (size_t) fbdev->width * fbdev->bytes_per_pixel;
+
+    for (int y = fbdev->dirty_top[target]; y < fbdev->dirty_bottom[target]; y++) {
+        uint8_t *shadow_row = fbdev->shadows[target] + y * row_size;
+        uint8_t *fb_row = fbdev->map + ((size_t) target * fbdev->height + y) * fbdev->fix_info.line_length;
+
+        pack_row(fbdev, fbdev->fb_row, fbdev->composition + (size_t) y * fbdev->width, fbdev->width);
+
+        // Only write the row to the framebuffer memory if it actually changed.
+        if (fbdev->shadow_invalid[target] || memcmp(fbdev->fb_row, shadow_row, row_size) != 0) {
+            memcpy(fb_row, fbdev->fb_row, row_size);
+            memcpy(shadow_row, fbdev->fb_row, row_size);
+        }
+    }
+
+    fbdev->shadow_invalid[target] = false;
+    fbdev->dirty_top[target] = fbdev->height;
+    fbdev->dirty_bottom[target] = 0;
+
+    if (fbdev->n_buffers == 2) {
+        fbdev->var_info.xoffset = 0;
+        fbdev->var_info.yoffset = target * fbdev->height;
+
+        ok = ioctl(fbdev->fd, FBIOPAN_DISPLAY, &fbdev->var_info);
+        if (ok < 0) {
+            ok = errno;
+            LOG_ERROR("Couldn't pan fbdev to the new frame. ioctl: %s\n", strerror(ok));
+            return ok;
+        }
+
+        fbdev->front_buffer = target;
+    }
+
+    return 0;
+}
+
+const void *fbdev_commit_builder_peek_frame(struct fbdev_commit_builder *builder, int *stride_out) {
+    struct fbdev *fbdev;
+
+    ASSERT_NOT_NULL(builder);
+    ASSERT_NOT_NULL(stride_out);
+    fbdev = builder->fbdev;
+
+    *stride_out = fbdev->fix_info.line_length;
+    return fbdev->map + (size_t) fbdev->front_buffer * fbdev->height * fbdev->fix_info.line_length;
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+/*
+ * fbdev
+ *
+ * - output for linux framebuffer devices (/dev/fbX)
+ * - composites the layers pushed to a @ref fbdev_commit_builder on the CPU and
+ *   copies only the rows that changed into the framebuffer memory
+ * - double buffering using FBIOPAN_DISPLAY if the device supports it
+ *
+ * Copyright (c) 2023, Hannes Winkler <hanneswinkler2000@web.de>
+ */
+
+#ifndef _FLUTTERPI_SRC_FBDEV_H
+#define _FLUTTERPI_SRC_FBDEV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pixel_format.h"
+#include "util/collection.h"
+#include "util/geometry.h"
+#include "util/refcounting.h"
+
+struct fbdev;
+struct fbdev_commit_builder;
+
+/**
+ * @brief A CPU-accessible buffer that should be presented on a fbdev.
+ */
+struct fbdev_layer {
+    /**
+     * @brief Pointer to the first pixel of the buffer.
+     */
+    const void *map;
+
+    /**
+     * @brief Number of bytes per row of the buffer.
+     */
+    int stride;
+
+    /**
+     * @brief Pixel format of the buffer.
+     */
+    enum pixfmt format;
+
+    /**
+     * @brief Size of the buffer in pixels.
+     */
+    int src_w, src_h;
+
+    /**
+     * @brief The rectangle on the display this buffer should be presented in.
+     *
+     * If this differs from the buffer size, the buffer is scaled (nearest neighbor).
+     */
+    int dst_x, dst_y, dst_w, dst_h;
+
+    /**
+     * @brief Opacity as a normalized float from 0 (transparent) to 1 (opaque).
+     */
+    double opacity;
+};
+
+/**
+ * @brief Opens the fbdev at @param path and maps its framebuffer memory.
+ *
+ * If the device supports panning and its virtual size can be made twice as high
+ * as the visible size, double buffering is used.
+ *
+ * @param path Path to the fbdev, for example /dev/fb0.
+ * @return struct fbdev* The new fbdev, or NULL on error.
+ */
+struct fbdev *fbdev_new_from_path(const char *path);
+
+/**
+ * @brief Creates a new fbdev that's not backed by a real framebuffer device, but by
+ * ordinary memory, with the pixel format XRGB8888.
+ *
+ * Useful for compositing layers on the CPU without having a display,
+ * for example for testing.
+ *
+ * @param size The size of the framebuffer in pixels.
+ * @return struct fbdev* The new fbdev, or NULL on error.
+ */
+struct fbdev *fbdev_new_offscreen(struct vec2i size);
+
+void fbdev_destroy(struct fbdev *fbdev);
+
+DECLARE_REF_OPS(fbdev)
+
+/**
+ * @brief Get the visible size of the fbdev in pixels.
+ */
+struct vec2i fbdev_get_size(struct fbdev *fbdev);
+
+/**
+ * @brief Get the physical size of the display in millimeters, if the driver reports it.
+ *
+ * @return true if the physical size is known and was written to @param width_mm_out and @param height_mm_out.
+ */
+bool fbdev_get_physical_size(struct fbdev *fbdev, int *width_mm_out, int *height_mm_out);
+
+/**
+ * @brief Get the refresh rate of the fbdev, calculated from the pixel clock and timings.
+ * Defaults to 60Hz if the driver doesn't report any timings.
+ */
+double fbdev_get_refresh_rate(struct fbdev *fbdev);
+
+/**
+ * @brief Get the @ref pixfmt that exactly matches the pixel format of the fbdev, if there's one.
+ *
+ * Rendering in that pixel format avoids a pixel format conversion when presenting.
+ *
+ * @return true if there's a matching pixel format and it was written to @param format_out.
+ */
+bool fbdev_get_pixel_format(struct fbdev *fbdev, enum pixfmt *format_out);
+
+/**
+ * @brief Start building a new frame.
+ *
+ * There can only be one commit builder per fbdev at a time. (This will block
+ * until the previous one is destroyed.)
+ */
+struct fbdev_commit_builder *fbdev_create_commit_builder(struct fbdev *fbdev);
+
+void fbdev_commit_builder_destroy(struct fbdev_commit_builder *builder);
+
+struct fbdev *fbdev_commit_builder_get_fbdev(struct fbdev_commit_builder *builder);
+
+/**
+ * @brief Composite a new layer on top of all the previously pushed layers.
+ *
+ * The pixels are copied (and converted) immediately, so the buffer can be unmapped
+ * as soon as this returns.
+ *
+ * @param builder The commit builder.
+ * @param layer The buffer that should be presented.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int fbdev_commit_builder_push_layer(struct fbdev_commit_builder *builder, const struct fbdev_layer *layer);
+
+/**
+ * @brief Copy the composited frame into the framebuffer memory and show it.
+ *
+ * Only the rows that actually changed are written to the framebuffer memory.
+ * That's important for SPI displays using deferred io, which will only transfer the
+ * touched memory pages to the display.
+ *
+ * @param builder The commit builder.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int fbdev_commit_builder_commit(struct fbdev_commit_builder *builder);
+
+/**
+ * @brief Get the contents of the framebuffer that's being shown right now,
+ * in the pixel format of the fbdev. (See @ref fbdev_get_pixel_format)
+ *
+ * The returned pointer is only valid until the commit builder is destroyed.
+ *
+ * @param builder The commit builder.
+ * @param stride_out Will be set to the number of bytes per row.
+ * @return const void* Pointer to the first pixel.
+ */
+const void *fbdev_commit_builder_peek_frame(struct fbdev_commit_builder *builder, int *stride_out);
+
+#endif  // _FLUTTERPI_SRC_FBDEV_H
@@ -10,6 +10,7 @@
 #include <locale.h>
 #include <math.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -36,13 +37,17 @@
 #include <libudev.h>
 #include <linux/input.h>
 #include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <systemd/sd-event.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 #include "compositor_ng.h"
+#include "display_color.h"
+#include "fbdev.h"
 #include "filesystem_layout.h"
 #include "frame_scheduler.h"
+#include "idle_manager.h"
 #include "keyboard.h"
 #include "locales.h"
 #include "modesetting.h"
@@ -141,6 +146,39 @@ OPTIONS:\n\
                              without a display attached.\n\
   --dummy-display-size \"width,height\" The width & height of the dummy display\n\
                              in pixels.\n\
+  --dummy-display-output <directory> Write every frame presented on the dummy\n\
+                             display to <directory> as a PPM image, and log the\n\
+                             frame number, timestamp and hash of every frame\n\
+                             to <directory>/frames.txt. Useful for golden-image\n\
+                             tests.\n\
+\n\
+  --fbdev <path>             Output to the linux framebuffer device at <path>\n\
+                             (for example /dev/fb0) instead of using KMS.\n\
+                             Useful for displays that don't have a KMS driver,\n\
+                             like some SPI displays.\n\
+\n\
+  --render-device <path>     Render using the DRM device at <path> (for example\n\
+                             /dev/dri/renderD128), and only use the display\n\
+                             device for scanout. The rendered frames are shared\n\
+                             with the display device using PRIME. Useful for\n\
+                             boards where the GPU and the display controller are\n\
+                             separate devices. Only supported with OpenGL ES.\n\
+\n\
+  --dim-timeout <seconds>    Dim the display after <seconds> without user input.\n\
+                             Any input makes it bright again. (KMS only)\n\
+  --blank-timeout <seconds>  Turn the display off after <seconds> without user\n\
+                             input. Flutter is told the app is paused and no\n\
+                             frames are rendered while the display is off.\n\
+                             Any input turns it on again. (KMS only)\n\
+  --dim-brightness <factor>  The brightness while the display is dimmed, from\n\
+                             0 to 1. (default: 0.3)\n\
+\n\
+  --hdr <pq|hlg>             Switch the display into HDR mode, with the BT.2020\n\
+                             colorspace and the given transfer function, and use\n\
+                             a 10-bit pixel format if possible. The app needs to\n\
+                             render its content accordingly. (KMS only)\n\
+  --hdr-max-luminance <nits> The peak luminance of the content, signalled to the\n\
+                             display in the HDR metadata. (default: 1000)\n\
 \n\
   -h, --help                 Show this help and exit.\n\
 \n\
@@ -208,8 +246,20 @@ struct flutterpi {
     /**
 	 * @brief The locales instance. Provides the system locales to flutter.
 	 *
+	 * Replaced on the platform thread when the locale configuration changes, but read
+	 * on the UI thread in the compute_platform_resolved_locale callback.
 	 */
-    struct locales *locales;
+    _Atomic(struct locales *) locales;
+
+    /**
+     * @brief Locales that were replaced by a reload.
+     *
+     * The engine might still be using a locale returned from the compute_platform_resolved_locale
+     * callback, which points into these. They're kept alive until flutter-pi is destroyed.
+     * Reloads are rare, so this doesn't grow much.
+     */
+    struct locales **retired_locales;
+    size_t n_retired_locales;
 
     /**
 	 * @brief flutter stuff.
@@ -262,6 +312,49 @@ struct flutterpi {
     bool session_active;
 
     char *desired_videomode;
+
+    /**
+     * @brief udev monitor for DRM hotplug events, or NULL if we're not using KMS.
+     */
+    struct udev_monitor *drm_monitor;
+
+    /**
+     * @brief True if the keyboard or locale configuration changed and a reload is already scheduled.
+     *
+     * Editors and package managers usually touch the config files multiple times in a row,
+     * so the reload is delayed a bit and all those changes are handled at once.
+     */
+    bool config_reload_scheduled;
+    bool keyboard_config_changed;
+    bool locale_config_changed;
+
+    /**
+     * @brief The thread compiling the new keyboard configuration, if one was started.
+     *
+     * Joined before the next one is started and in @ref flutterpi_destroy, so it never
+     * posts a task to a destroyed flutter-pi instance.
+     */
+    pthread_t keyboard_config_loader;
+    bool has_keyboard_config_loader;
+
+    /**
+     * @brief Dims / blanks the display when there's no user input, or NULL if that's disabled.
+     */
+    struct idle_manager *idle_manager;
+
+    /**
+     * @brief The input that woke up the blanked display is not forwarded to flutter.
+     *
+     * For pointers, that's everything until all pointers that went down since are up again.
+     * For keys, it's the waking key, until it's released. @ref swallowing_key_event tells the
+     * text callbacks following a GTK key event whether that key event was swallowed.
+     */
+    bool swallowing_wake_gesture;
+    int n_wake_gesture_pointers;
+
+    bool has_wake_key;
+    uint32_t wake_key_code;
+    bool swallowing_key_event;
 };
 
 struct device_id_and_fd {
@@ -580,7 +673,9 @@ UNUSED static FlutterTransformation on_get_transformation(void *userdata) {
     ASSERT_NOT_NULL(userdata);
     flutterpi = userdata;
 
-    compositor_get_view_geometry(flutterpi->compositor, &geometry);
+    // Called on the raster thread when flutter begins rasterizing a frame. While an orientation change
+    // is pending, that frame was most likely still laid out for the old orientation.
+    compositor_get_frame_view_geometry(flutterpi->compositor, &geometry);
 
     return MAT3F_AS_FLUTTER_TRANSFORM(geometry.view_to_display_transform);
 }
@@ -1042,6 +1137,121 @@ void flutterpi_set_pointer_kind(struct flutterpi *flutterpi, enum pointer_kind k
     return compositor_set_cursor(flutterpi->compositor, false, false, true, kind, false, VEC2F(0, 0));
 }
 
+int flutterpi_set_pointer_icon(struct flutterpi *flutterpi, const struct pointer_icon *icon) {
+    ASSERT_NOT_NULL(flutterpi);
+    return compositor_set_cursor_icon(flutterpi->compositor, icon);
+}
+
+void flutterpi_get_frame_stats(struct flutterpi *flutterpi, struct frame_stats *stats_out) {
+    ASSERT_NOT_NULL(flutterpi);
+    compositor_get_frame_stats(flutterpi->compositor, stats_out);
+}
+
+int flutterpi_set_display_color(struct flutterpi *flutterpi, const struct display_color_settings *settings) {
+    ASSERT_NOT_NULL(flutterpi);
+    return compositor_set_display_color(flutterpi->compositor, settings);
+}
+
+int flutterpi_capture_frame(
+    struct flutterpi *flutterpi,
+    void (*callback)(void *userdata, int error, const struct window_frame_capture *capture),
+    void *userdata
+) {
+    ASSERT_NOT_NULL(flutterpi);
+    return compositor_capture_frame(flutterpi->compositor, callback, userdata);
+}
+
+int flutterpi_set_display_power(struct flutterpi *flutterpi, enum display_power_state state, double dim_brightness) {
+    ASSERT_NOT_NULL(flutterpi);
+    return compositor_set_display_power(flutterpi->compositor, state, dim_brightness);
+}
+
+enum device_orientation flutterpi_get_orientation(struct flutterpi *flutterpi) {
+    ASSERT_NOT_NULL(flutterpi);
+    return compositor_get_orientation(flutterpi->compositor);
+}
+
+/**
+ * @brief Send the current view geometry of the compositor to user input and flutter,
+ * after it was changed at runtime.
+ */
+static int on_view_geometry_changed(struct flutterpi *flutterpi) {
+    FlutterWindowMetricsEvent window_metrics_event;
+    struct view_geometry geometry;
+    FlutterEngineResult engine_result;
+
+    compositor_get_view_geometry(flutterpi->compositor, &geometry);
+
+    // Touch & mouse coordinates need to be transformed differently now.
+    if (flutterpi->user_input != NULL) {
+        user_input_set_transform(
+            flutterpi->user_input,
+            &geometry.display_to_view_transform,
+            &geometry.view_to_display_transform,
+            geometry.display_size.x,
+            geometry.display_size.y
+        );
+    }
+
+    memset(&window_metrics_event, 0, sizeof(window_metrics_event));
+
+    window_metrics_event.struct_size = sizeof(FlutterWindowMetricsEvent);
+    window_metrics_event.width = geometry.view_size.x;
+    window_metrics_event.height = geometry.view_size.y;
+    window_metrics_event.pixel_ratio = geometry.device_pixel_ratio;
+
+    if (flutterpi->flutter.engine == NULL) {
+        // The engine isn't running yet. It'll get the current window metrics when it's started.
+        return 0;
+    }
+
+    engine_result = flutterpi->flutter.procs.SendWindowMetricsEvent(flutterpi->flutter.engine, &window_metrics_event);
+    if (engine_result != kSuccess) {
+        LOG_ERROR(
+            "Could not send window metrics to flutter engine. FlutterEngineSendWindowMetricsEvent: %s\n",
+            FLUTTER_RESULT_TO_STRING(engine_result)
+        );
+        return EIO;
+    }
+
+    return 0;
+}
+
+int flutterpi_set_orientation(struct flutterpi *flutterpi, enum device_orientation orientation) {
+    int ok;
+
+    ASSERT_NOT_NULL(flutterpi);
+    ASSERT(ORIENTATION_IS_VALID(orientation));
+
+    if (compositor_get_orientation(flutterpi->compositor) == orientation) {
+        return 0;
+    }
+
+    ok = compositor_set_orientation(flutterpi->compositor, orientation);
+    if (ok != 0) {
+        return ok;
+    }
+
+    // The render surface doesn't change (flutter rotates the view using the root surface transform).
+    // The compositor switches the root surface transform once the first frame with the new metrics arrives.
+    return on_view_geometry_changed(flutterpi);
+}
+
+void flutterpi_schedule_frame(struct flutterpi *flutterpi) {
+    FlutterEngineResult engine_result;
+
+    ASSERT_NOT_NULL(flutterpi);
+
+    if (flutterpi->flutter.engine == NULL) {
+        return;
+    }
+
+    engine_result = flutterpi->flutter.procs.ScheduleFrame(flutterpi->flutter.engine);
+    if (engine_result != kSuccess) {
+        LOG_ERROR("Could not schedule a new flutter frame. FlutterEngineScheduleFrame: %s\n", FLUTTER_RESULT_TO_STRING(engine_result));
+    }
+}
+
 void flutterpi_trace_event_instant(struct flutterpi *flutterpi, const char *name) {
     flutterpi->flutter.procs.TraceEventInstant(name);
 }
@@ -1092,6 +1302,290 @@ static int on_drmdev_ready(sd_event_source *s, int fd, uint32_t revents, void *u
     return drmdev_on_event_fd_ready(drmdev);
 }
 
+static int on_drm_monitor_ready(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    struct udev_device *device;
+    struct flutterpi *flutterpi;
+    const char *hotplug;
+    struct stat drm_stat;
+    bool geometry_changed;
+    int ok;
+
+    (void) s;
+    (void) fd;
+    (void) revents;
+
+    ASSERT_NOT_NULL(userdata);
+    flutterpi = userdata;
+
+    device = udev_monitor_receive_device(flutterpi->drm_monitor);
+    if (device == NULL) {
+        return 0;
+    }
+
+    hotplug = udev_device_get_property_value(device, "HOTPLUG");
+    if (hotplug == NULL || !streq(hotplug, "1")) {
+        goto out_unref_device;
+    }
+
+    // Only handle hotplug events of the DRM device we're using.
+    ok = fstat(drmdev_get_fd(flutterpi->drmdev), &drm_stat);
+    if (ok == 0 && udev_device_get_devnum(device) != drm_stat.st_rdev) {
+        goto out_unref_device;
+    }
+
+    ok = compositor_on_hotplug(flutterpi->compositor, &geometry_changed);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't handle display hotplug. compositor_on_hotplug: %s\n", strerror(ok));
+        goto out_unref_device;
+    }
+
+    if (geometry_changed) {
+        on_view_geometry_changed(flutterpi);
+    }
+
+out_unref_device:
+    udev_device_unref(device);
+    return 0;
+}
+
+static struct udev_monitor *listen_for_drm_hotplug(sd_event *event_loop, struct flutterpi *flutterpi) {
+    struct udev_monitor *monitor;
+    struct udev *udev;
+    int ok;
+
+    udev = udev_new();
+    if (udev == NULL) {
+        LOG_ERROR("Couldn't create udev instance. udev_new: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    monitor = udev_monitor_new_from_netlink(udev, "udev");
+
+    // the monitor keeps its own reference to the udev instance.
+    udev_unref(udev);
+
+    if (monitor == NULL) {
+        LOG_ERROR("Couldn't create udev monitor. udev_monitor_new_from_netlink: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    ok = udev_monitor_filter_add_match_subsystem_devtype(monitor, "drm", "drm_minor");
+    if (ok < 0) {
+        LOG_ERROR("Couldn't add udev monitor filter. udev_monitor_filter_add_match_subsystem_devtype: %s\n", strerror(-ok));
+        goto fail_unref_monitor;
+    }
+
+    ok = udev_monitor_enable_receiving(monitor);
+    if (ok < 0) {
+        LOG_ERROR("Couldn't enable udev monitor. udev_monitor_enable_receiving: %s\n", strerror(-ok));
+        goto fail_unref_monitor;
+    }
+
+    ok = sd_event_add_io(event_loop, NULL, udev_monitor_get_fd(monitor), EPOLLIN, on_drm_monitor_ready, flutterpi);
+    if (ok < 0) {
+        LOG_ERROR("Couldn't add DRM hotplug listener. sd_event_add_io: %s\n", strerror(-ok));
+        goto fail_unref_monitor;
+    }
+
+    return monitor;
+
+fail_unref_monitor:
+    udev_monitor_unref(monitor);
+    return NULL;
+}
+
+#define CONFIG_RELOAD_DELAY_US 250000
+
+static int on_keyboard_config_loaded(void *userdata) {
+    struct keyboard_config *config;
+
+    ASSERT_NOT_NULL(userdata);
+    config = userdata;
+
+    if (flutterpi->user_input == NULL) {
+        keyboard_config_destroy(config);
+        return 0;
+    }
+
+    // This runs on the platform thread, same as the key event processing,
+    // so no key event sees a half-replaced keymap.
+    user_input_replace_keyboard_config(flutterpi->user_input, config);
+
+    LOG_DEBUG("Reloaded keyboard configuration.\n");
+    return 0;
+}
+
+static void *keyboard_config_loader_entry(void *userdata) {
+    struct keyboard_config *config;
+    int ok;
+
+    (void) userdata;
+
+    // Compiling the keymap and compose table takes a while, so that's done here and not on the platform thread.
+    config = keyboard_config_new();
+    if (config == NULL) {
+        LOG_ERROR("Couldn't reload keyboard configuration. The previous keyboard configuration will be used.\n");
+        return NULL;
+    }
+
+    ok = flutterpi_post_platform_task(on_keyboard_config_loaded, config);
+    if (ok != 0) {
+        keyboard_config_destroy(config);
+    }
+
+    return NULL;
+}
+
+static void join_keyboard_config_loader(struct flutterpi *flutterpi) {
+    if (flutterpi->has_keyboard_config_loader) {
+        pthread_join(flutterpi->keyboard_config_loader, NULL);
+        flutterpi->has_keyboard_config_loader = false;
+    }
+}
+
+static void reload_keyboard_config(struct flutterpi *flutterpi) {
+    int ok;
+
+    // Reloads are at least CONFIG_RELOAD_DELAY_US apart, so the previous loader is most likely done already.
+    join_keyboard_config_loader(flutterpi);
+
+    ok = pthread_create(&flutterpi->keyboard_config_loader, NULL, keyboard_config_loader_entry, NULL);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't create keyboard config loader thread. pthread_create: %s\n", strerror(ok));
+        return;
+    }
+
+    flutterpi->has_keyboard_config_loader = true;
+}
+
+static void reload_locales(struct flutterpi *flutterpi) {
+    struct locales *locales, **retired;
+    int ok;
+
+    locales = locales_new_from_system_config();
+    if (locales == NULL) {
+        LOG_ERROR("Couldn't reload locales. The previous locales will be used.\n");
+        return;
+    }
+
+    if (flutterpi->flutter.engine != NULL) {
+        ok = locales_add_to_fl_engine(locales, flutterpi->flutter.engine, flutterpi->flutter.procs.UpdateLocales);
+        if (ok != 0) {
+            locales_destroy(locales);
+            return;
+        }
+    }
+
+    retired = realloc(flutterpi->retired_locales, (flutterpi->n_retired_locales + 1) * sizeof *retired);
+    if (retired == NULL) {
+        // We can't destroy the old locales while the engine might still be using them,
+        // so just leak them.
+        LOG_ERROR("Couldn't remember the previous locales. They will be leaked.\n");
+    } else {
+        retired[flutterpi->n_retired_locales] = flutterpi->locales;
+        flutterpi->retired_locales = retired;
+        flutterpi->n_retired_locales++;
+    }
+
+    flutterpi->locales = locales;
+
+    locales_print(locales);
+}
+
+static int on_reload_config(void *userdata) {
+    struct flutterpi *flutterpi;
+
+    ASSERT_NOT_NULL(userdata);
+    flutterpi = userdata;
+
+    if (flutterpi->locale_config_changed) {
+        reload_locales(flutterpi);
+    }
+
+    if (flutterpi->keyboard_config_changed) {
+        reload_keyboard_config(flutterpi);
+    }
+
+    flutterpi->config_reload_scheduled = false;
+    flutterpi->keyboard_config_changed = false;
+    flutterpi->locale_config_changed = false;
+    return 0;
+}
+
+static bool is_file_in_path(const char *name, const char *path) {
+    return streq(name, strrchr(path, '/') + 1);
+}
+
+static int on_config_dir_changed(sd_event_source *s, const struct inotify_event *event, void *userdata) {
+    struct flutterpi *flutterpi;
+    int ok;
+
+    (void) s;
+
+    ASSERT_NOT_NULL(event);
+    ASSERT_NOT_NULL(userdata);
+    flutterpi = userdata;
+
+    if (event->len == 0) {
+        return 0;
+    }
+
+#ifdef BUILD_TEXT_INPUT_PLUGIN
+    if (is_file_in_path(event->name, KEYBOARD_CONFIG_PATH)) {
+        flutterpi->keyboard_config_changed = true;
+    }
+#endif
+
+    if (is_file_in_path(event->name, LOCALE_CONF_PATH) || is_file_in_path(event->name, DEFAULT_LOCALE_PATH)) {
+        flutterpi->locale_config_changed = true;
+    }
+
+    if (!flutterpi->keyboard_config_changed && !flutterpi->locale_config_changed) {
+        return 0;
+    }
+
+    if (!flutterpi->config_reload_scheduled) {
+        ok = flutterpi_post_platform_task_with_time(on_reload_config, flutterpi, get_monotonic_time() / 1000 + CONFIG_RELOAD_DELAY_US);
+        if (ok != 0) {
+            return 0;
+        }
+
+        flutterpi->config_reload_scheduled = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Watch the directories containing the keyboard and locale configuration files, so changes
+ * to those are picked up without restarting.
+ *
+ * The directories are watched instead of the files themselves, since most tools replace
+ * config files by renaming a new file over them.
+ */
+static void listen_for_config_changes(sd_event *event_loop, struct flutterpi *flutterpi) {
+    static const char *const dirs[] = { "/etc", "/etc/default" };
+    int ok;
+
+    for (size_t i = 0; i < ARRAY_SIZE(dirs); i++) {
+        ok = sd_event_add_inotify(
+            event_loop,
+            NULL,
+            dirs[i],
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR,
+            on_config_dir_changed,
+            flutterpi
+        );
+        if (ok < 0) {
+            LOG_ERROR(
+                "Couldn't watch \"%s\" for keyboard and locale configuration changes. sd_event_add_inotify: %s\n",
+                dirs[i],
+                strerror(-ok)
+            );
+        }
+    }
+}
+
 static const FlutterLocale *on_compute_platform_resolved_locales(const FlutterLocale **locales, size_t n_locales) {
     return locales_on_compute_platform_resolved_locale(flutterpi->locales, locales, n_locales);
 }
@@ -1613,12 +2107,79 @@ void flutterpi_schedule_exit(struct flutterpi *flutterpi) {
 /**************
  * USER INPUT *
  **************/
+/**
+ * @brief Report user activity to the idle manager.
+ *
+ * @returns true if the display was off and this activity woke it up.
+ */
+static bool on_user_activity(struct flutterpi *flutterpi) {
+    if (flutterpi->idle_manager != NULL) {
+        return idle_manager_on_activity(flutterpi->idle_manager);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Remove the events belonging to the gesture that woke up the display from @param events.
+ *
+ * Pointers that are added or removed are still forwarded, so flutter knows about all devices.
+ * Returns the number of events left in @param filtered_out, which must have room for @param n_events.
+ */
+static size_t
+filter_wake_gesture(struct flutterpi *flutterpi, const FlutterPointerEvent *events, size_t n_events, FlutterPointerEvent *filtered_out) {
+    size_t n_filtered = 0;
+
+    for (size_t i = 0; i < n_events; i++) {
+        switch (events[i].phase) {
+            case kAdd:
+            case kRemove: filtered_out[n_filtered++] = events[i]; break;
+            case kDown: flutterpi->n_wake_gesture_pointers++; break;
+            case kUp:
+            case kCancel:
+                if (flutterpi->n_wake_gesture_pointers > 0) {
+                    flutterpi->n_wake_gesture_pointers--;
+                }
+                break;
+            default: break;
+        }
+    }
+
+    // Once every pointer is up again, the next gesture goes to flutter.
+    if (flutterpi->n_wake_gesture_pointers == 0) {
+        flutterpi->swallowing_wake_gesture = false;
+    }
+
+    return n_filtered;
+}
+
 static void on_flutter_pointer_event(void *userdata, const FlutterPointerEvent *events, size_t n_events) {
     FlutterEngineResult engine_result;
+    FlutterPointerEvent *filtered;
     struct flutterpi *flutterpi;
 
     ASSERT_NOT_NULL(userdata);
     flutterpi = userdata;
+    filtered = NULL;
+
+    if (on_user_activity(flutterpi)) {
+        flutterpi->swallowing_wake_gesture = true;
+        flutterpi->n_wake_gesture_pointers = 0;
+    }
+
+    if (flutterpi->swallowing_wake_gesture) {
+        filtered = malloc(n_events * sizeof *filtered);
+        if (filtered == NULL) {
+            return;
+        }
+
+        n_events = filter_wake_gesture(flutterpi, events, n_events, filtered);
+        events = filtered;
+
+        if (n_events == 0) {
+            goto out_free_filtered;
+        }
+    }
 
     /// TODO: make this atomic
     flutterpi->flutter.next_frame_request_is_secondary = true;
@@ -1631,6 +2192,9 @@ static void on_flutter_pointer_event(void *userdata, const FlutterPointerEvent *
         );
         //flutterpi_schedule_exit(flutterpi);
     }
+
+out_free_filtered:
+    free(filtered);
 }
 
 static void on_utf8_character(void *userdata, uint8_t *character) {
@@ -1639,7 +2203,10 @@ static void on_utf8_character(void *userdata, uint8_t *character) {
 
     flutterpi = userdata;
 
-    (void) flutterpi;
+    // Belongs to the key press that woke up the display.
+    if (flutterpi->swallowing_key_event) {
+        return;
+    }
 
 #ifdef BUILD_TEXT_INPUT_PLUGIN
     ok = textin_on_utf8_char(character);
@@ -1655,7 +2222,12 @@ static void on_xkb_keysym(void *userdata, xkb_keysym_t keysym) {
     int ok;
 
     flutterpi = userdata;
-    (void) flutterpi;
+
+    if (flutterpi->swallowing_key_event) {
+        return;
+    }
+
+    on_user_activity(flutterpi);
 
 #ifdef BUILD_TEXT_INPUT_PLUGIN
     ok = textin_on_xkb_keysym(keysym);
@@ -1672,7 +2244,22 @@ on_gtk_keyevent(void *userdata, uint32_t unicode_scalar_values, uint32_t key_cod
     int ok;
 
     flutterpi = userdata;
-    (void) flutterpi;
+
+    // Swallow the key that woke up the display, including its repeats and the release.
+    if (on_user_activity(flutterpi)) {
+        flutterpi->has_wake_key = is_down;
+        flutterpi->wake_key_code = key_code;
+        flutterpi->swallowing_key_event = true;
+        return;
+    }
+
+    flutterpi->swallowing_key_event = flutterpi->has_wake_key && key_code == flutterpi->wake_key_code;
+    if (flutterpi->swallowing_key_event) {
+        if (!is_down) {
+            flutterpi->has_wake_key = false;
+        }
+        return;
+    }
 
 #ifdef BUILD_RAW_KEYBOARD_PLUGIN
     ok = rawkb_send_gtk_keyevent(unicode_scalar_values, key_code, scan_code, modifiers, is_down);
@@ -1830,6 +2417,18 @@ static int on_user_input_fd_ready(sd_event_source *s, int fd, uint32_t revents,
     return user_input_on_fd_ready(input);
 }
 
+static int on_user_input_repeat_timer_fd_ready(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    struct user_input *input;
+
+    (void) s;
+    (void) fd;
+    (void) revents;
+
+    input = userdata;
+
+    return user_input_on_repeat_timer_fd_ready(input);
+}
+
 static struct flutter_paths *setup_paths(enum flutter_runtime_mode runtime_mode, const char *app_bundle_path) {
 #if defined(FILESYSTEM_LAYOUT_DEFAULT)
     return fs_layout_flutterpi_resolve(app_bundle_path, runtime_mode);
@@ -1875,6 +2474,14 @@ bool flutterpi_parse_cmdline_args(int argc, char **argv, struct flutterpi_cmdlin
         { "videomode", required_argument, NULL, 'v' },
         { "dummy-display", no_argument, &dummy_display_int, 1 },
         { "dummy-display-size", required_argument, NULL, 's' },
+        { "dummy-display-output", required_argument, NULL, 'O' },
+        { "fbdev", required_argument, NULL, 'f' },
+        { "render-device", required_argument, NULL, 'R' },
+        { "dim-timeout", required_argument, NULL, 'T' },
+        { "blank-timeout", required_argument, NULL, 'B' },
+        { "dim-brightness", required_argument, NULL, 'L' },
+        { "hdr", required_argument, NULL, 'H' },
+        { "hdr-max-luminance", required_argument, NULL, 'M' },
         { 0, 0, 0, 0 },
     };
 
@@ -1996,6 +2603,92 @@ valid_format:
 
                 break;
 
+            case 'O':;  // --dummy-display-output
+                char *output_dir_dup = strdup(optarg);
+                if (output_dir_dup == NULL) {
+                    return false;
+                }
+
+                result_out->dummy_display_output_dir = output_dir_dup;
+                break;
+
+            case 'f':;  // --fbdev
+                char *fbdev_path_dup = strdup(optarg);
+                if (fbdev_path_dup == NULL) {
+                    return false;
+                }
+
+                result_out->fbdev_path = fbdev_path_dup;
+                break;
+
+            case 'R':;  // --render-device
+                char *render_device_path_dup = strdup(optarg);
+                if (render_device_path_dup == NULL) {
+                    return false;
+                }
+
+                result_out->render_device_path = render_device_path_dup;
+                break;
+
+            case 'T':  // --dim-timeout
+            case 'B':;  // --blank-timeout
+                char *timeout_end;
+
+                errno = 0;
+                unsigned long timeout = strtoul(optarg, &timeout_end, 10);
+                if (errno != 0 || timeout_end == optarg || *timeout_end != '\0' || timeout > UINT_MAX) {
+                    LOG_ERROR("ERROR: Invalid argument for --%s passed.\n", opt == 'T' ? "dim-timeout" : "blank-timeout");
+                    return false;
+                }
+
+                if (opt == 'T') {
+                    result_out->dim_timeout_s = timeout;
+                } else {
+                    result_out->blank_timeout_s = timeout;
+                }
+                break;
+
+            case 'L':;  // --dim-brightness
+                char *brightness_end;
+
+                errno = 0;
+                double brightness = strtod(optarg, &brightness_end);
+                if (errno != 0 || brightness_end == optarg || *brightness_end != '\0' || !(brightness >= 0.0 && brightness <= 1.0)) {
+                    LOG_ERROR("ERROR: Invalid argument for --dim-brightness passed. Expected a number between 0 and 1.\n");
+                    return false;
+                }
+
+                result_out->has_dim_brightness = true;
+                result_out->dim_brightness = brightness;
+                break;
+
+            case 'H':  // --hdr
+                if (streq(optarg, "pq")) {
+                    result_out->hdr_use_hlg = false;
+                } else if (streq(optarg, "hlg")) {
+                    result_out->hdr_use_hlg = true;
+                } else {
+                    LOG_ERROR("ERROR: Invalid argument for --hdr passed. Valid values are: pq, hlg\n");
+                    return false;
+                }
+
+                result_out->hdr = true;
+                break;
+
+            case 'M':;  // --hdr-max-luminance
+                char *luminance_end;
+
+                errno = 0;
+                double luminance = strtod(optarg, &luminance_end);
+                if (errno != 0 || luminance_end == optarg || *luminance_end != '\0' || !(luminance > 0.0 && luminance <= 65535.0)) {
+                    LOG_ERROR("ERROR: Invalid argument for --hdr-max-luminance passed. Expected a positive number of nits.\n");
+                    return false;
+                }
+
+                result_out->has_hdr_max_luminance = true;
+                result_out->hdr_max_luminance = luminance;
+                break;
+
             case 'h': printf("%s", usage); return false;
 
             case '?':
@@ -2135,7 +2828,7 @@ static struct drmdev *find_drmdev(struct libseat *libseat) {
         }
 
         for_each_connector_in_drmdev(drmdev, connector) {
-            if (connector->variable_state.connection_state == kConnected_DrmConnectionState) {
+            if (drm_connector_is_display_connected(connector)) {
                 goto found_connected_connector;
             }
         }
@@ -2227,12 +2920,30 @@ static void on_session_enable(struct libseat *seat, void *userdata) {
     ASSERT_NOT_NULL(seat);
     ASSERT_NOT_NULL(userdata);
     fpi = userdata;
-    (void) fpi;
     (void) seat;
 
-    /// TODO: Implement
     LOG_DEBUG("on_session_enable\n");
 
+    // When the seat is first enabled, the drmdev already has DRM master.
+    // We only need to resume it if we were disabled before.
+    if (fpi->drmdev != NULL && !drmdev_can_modeset(fpi->drmdev)) {
+        ok = drmdev_resume(fpi->drmdev);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't resume drmdev.\n");
+        } else {
+            // Re-present the last frame and resume the frame scheduler.
+            ok = compositor_resume(fpi->compositor);
+            if (ok != 0) {
+                LOG_ERROR("Couldn't resume compositor.\n");
+            }
+
+            // Make flutter render a fresh frame, the last one might be outdated.
+            if (fpi->flutter.engine != NULL) {
+                fpi->flutter.procs.ScheduleFrame(fpi->flutter.engine);
+            }
+        }
+    }
+
     if (fpi->user_input != NULL) {
         ok = user_input_resume(fpi->user_input);
         if (ok != 0) {
@@ -2240,13 +2951,6 @@ static void on_session_enable(struct libseat *seat, void *userdata) {
         }
     }
 
-    // if (fpi->drmdev != NULL) {
-    //     ok = drmdev_resume(fpi->drmdev);
-    //     if (ok != 0) {
-    //         LOG_ERROR("Couldn't resume drmdev.\n");
-    //     }
-    // }
-
     fpi->session_active = true;
 }
 
@@ -2256,18 +2960,20 @@ static void on_session_disable(struct libseat *seat, void *userdata) {
     ASSERT_NOT_NULL(seat);
     ASSERT_NOT_NULL(userdata);
     fpi = userdata;
-    (void) fpi;
 
-    /// TODO: Implement
     LOG_DEBUG("on_session_disable\n");
 
     if (fpi->user_input != NULL) {
         user_input_suspend(fpi->user_input);
     }
 
-    // if (fpi->drmdev != NULL) {
-    //     drmdev_suspend(fpi->drmdev);
-    // }
+    if (fpi->drmdev != NULL) {
+        // Stop presenting frames before we drop DRM master.
+        // The last composition (and the GBM buffers / DRM framebuffers it references)
+        // is kept around so we can present it again immediately when we're resumed.
+        compositor_suspend(fpi->compositor);
+        drmdev_suspend(fpi->drmdev);
+    }
 
     libseat_disable_seat(seat);
 
@@ -2315,6 +3021,7 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
     struct libseat *libseat;
     struct locales *locales;
     struct drmdev *drmdev;
+    struct fbdev *fbdev;
     struct tracer *tracer;
     struct window *window;
     void *engine_handle;
@@ -2329,6 +3036,22 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
     /// TODO: Remove this
     flutterpi = fpi;
 
+    fpi->flutter.engine = NULL;
+    fpi->session_active = false;
+    fpi->drm_monitor = NULL;
+    fpi->config_reload_scheduled = false;
+    fpi->keyboard_config_changed = false;
+    fpi->locale_config_changed = false;
+    fpi->has_keyboard_config_loader = false;
+    fpi->retired_locales = NULL;
+    fpi->n_retired_locales = 0;
+    fpi->idle_manager = NULL;
+    fpi->swallowing_wake_gesture = false;
+    fpi->n_wake_gesture_pointers = 0;
+    fpi->has_wake_key = false;
+    fpi->wake_key_code = 0;
+    fpi->swallowing_key_event = false;
+
     ok = flutterpi_parse_cmdline_args(argc, argv, &cmd_args);
     if (ok == false) {
         goto fail_free_fpi;
@@ -2437,6 +3160,7 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
 
     if (cmd_args.dummy_display) {
         drmdev = NULL;
+        fbdev = NULL;
 
         // for off-screen rendering, we just open the unprivileged /dev/dri/renderD128 (or whatever)
         // render node as a GBM device.
@@ -2446,16 +3170,45 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
         if (gbm_device == NULL) {
             goto fail_destroy_locales;
         }
+    } else if (cmd_args.fbdev_path != NULL) {
+        drmdev = NULL;
+
+        fbdev = fbdev_new_from_path(cmd_args.fbdev_path);
+        if (fbdev == NULL) {
+            goto fail_destroy_locales;
+        }
+
+        // We still need a GPU to render, but we can't scanout the buffers directly.
+        // So just use the render node, same as for the dummy display.
+        gbm_device = open_rendernode_as_gbm_device();
+        if (gbm_device == NULL) {
+            fbdev_unref(fbdev);
+            goto fail_destroy_locales;
+        }
     } else {
+        fbdev = NULL;
         drmdev = find_drmdev(libseat);
         if (drmdev == NULL) {
             goto fail_destroy_locales;
         }
 
-        gbm_device = drmdev_get_gbm_device(drmdev);
-        if (gbm_device == NULL) {
-            LOG_ERROR("Couldn't create GBM device.\n");
-            goto fail_destroy_drmdev;
+        if (cmd_args.render_device_path != NULL && renderer_type == kOpenGL_RendererType) {
+            // Render on a different GPU than the one driving the display.
+            // The render surfaces will be shared with the display device as dmabufs.
+            gbm_device = drmdev_open_render_device(drmdev, cmd_args.render_device_path);
+            if (gbm_device == NULL) {
+                goto fail_destroy_drmdev;
+            }
+        } else {
+            if (cmd_args.render_device_path != NULL) {
+                LOG_ERROR("--render-device is only supported with OpenGL ES. Rendering on the display device instead.\n");
+            }
+
+            gbm_device = drmdev_get_gbm_device(drmdev);
+            if (gbm_device == NULL) {
+                LOG_ERROR("Couldn't create GBM device.\n");
+                goto fail_destroy_drmdev;
+            }
         }
     }
 
@@ -2514,6 +3267,16 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
         goto fail_unref_scheduler;
     }
 
+    if (cmd_args.hdr && (cmd_args.dummy_display || fbdev != NULL)) {
+        LOG_ERROR("--hdr is only supported when using KMS.\n");
+    }
+
+    // The dummy display and fbdev flatten the frame on the CPU, which only works for integer formats.
+    if (cmd_args.has_pixel_format && pixfmt_is_float(cmd_args.pixel_format) && (cmd_args.dummy_display || fbdev != NULL)) {
+        LOG_ERROR("The pixel format %s is only supported when using KMS.\n", get_pixfmt_info(cmd_args.pixel_format)->arg_name);
+        goto fail_unref_renderer;
+    }
+
     if (cmd_args.dummy_display) {
         window = dummy_window_new(
             tracer,
@@ -2525,9 +3288,49 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
             cmd_args.has_physical_dimensions,
             cmd_args.physical_dimensions.x,
             cmd_args.physical_dimensions.y,
-            60.0
+            60.0,
+            cmd_args.dummy_display_output_dir
+        );
+        if (window == NULL) {
+            LOG_ERROR("Couldn't create dummy window.\n");
+            goto fail_unref_renderer;
+        }
+    } else if (fbdev != NULL) {
+        window = fbdev_window_new(
+            // clang-format off
+            tracer,
+            scheduler,
+            renderer_type,
+            gl_renderer,
+            vk_renderer,
+            fbdev,
+            gbm_device,
+            cmd_args.has_rotation,
+            cmd_args.rotation == 0   ? PLANE_TRANSFORM_ROTATE_0   :
+                cmd_args.rotation == 90  ? PLANE_TRANSFORM_ROTATE_90  :
+                cmd_args.rotation == 180 ? PLANE_TRANSFORM_ROTATE_180 :
+                cmd_args.rotation == 270 ? PLANE_TRANSFORM_ROTATE_270 :
+                (assert(0 && "invalid rotation"), PLANE_TRANSFORM_ROTATE_0),
+            cmd_args.has_orientation, cmd_args.orientation,
+            cmd_args.has_physical_dimensions, cmd_args.physical_dimensions.x, cmd_args.physical_dimensions.y,
+            cmd_args.has_pixel_format, cmd_args.pixel_format
+            // clang-format on
         );
+        if (window == NULL) {
+            LOG_ERROR("Couldn't create fbdev window.\n");
+            goto fail_unref_renderer;
+        }
     } else {
+        struct display_hdr_metadata hdr_metadata;
+
+        if (cmd_args.hdr) {
+            display_hdr_metadata_init(
+                &hdr_metadata,
+                cmd_args.hdr_use_hlg ? kHLG_DrmHdrEotf : kSMPTEST2084_DrmHdrEotf,
+                cmd_args.has_hdr_max_luminance ? cmd_args.hdr_max_luminance : DISPLAY_HDR_DEFAULT_MAX_LUMINANCE
+            );
+        }
+
         window = kms_window_new(
             // clang-format off
             tracer,
@@ -2544,6 +3347,7 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
             cmd_args.has_orientation, cmd_args.orientation,
             cmd_args.has_physical_dimensions, cmd_args.physical_dimensions.x, cmd_args.physical_dimensions.y,
             cmd_args.has_pixel_format, cmd_args.pixel_format,
+            cmd_args.hdr ? &hdr_metadata : NULL,
             drmdev,
             desired_videomode
             // clang-format on
@@ -2567,6 +3371,12 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
             LOG_ERROR("Could not add DRM pageflip event listener. sd_event_add_io: %s\n", strerror(-ok));
             goto fail_unref_compositor;
         }
+
+        // If this fails, we just won't notice when displays are connected / disconnected.
+        fpi->drm_monitor = listen_for_drm_hotplug(event_loop, fpi);
+        if (fpi->drm_monitor == NULL) {
+            LOG_ERROR("Couldn't listen for display hotplug events. Flutter-pi will run without display hotplug support.\n");
+        }
     }
 
     compositor_get_view_geometry(compositor, &geometry);
@@ -2620,6 +3430,40 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
         sd_event_source_unref(user_input_event_source);
     }
 
+    if (input != NULL) {
+        // libinput doesn't emit key repeat events, user_input generates them using this timer.
+        ok = sd_event_add_io(
+            event_loop,
+            NULL,
+            user_input_get_repeat_timer_fd(input),
+            EPOLLIN,
+            on_user_input_repeat_timer_fd_ready,
+            input
+        );
+        if (ok < 0) {
+            LOG_ERROR("Couldn't listen for key repeat timer. Keys won't repeat when held down. sd_event_add_io: %s\n", strerror(-ok));
+        }
+    }
+
+    listen_for_config_changes(event_loop, fpi);
+
+    if (cmd_args.dim_timeout_s != 0 || cmd_args.blank_timeout_s != 0) {
+        if (drmdev == NULL) {
+            LOG_ERROR("--dim-timeout and --blank-timeout are only supported when using KMS.\n");
+        } else {
+            // If this fails, the display just stays on.
+            fpi->idle_manager = idle_manager_new(
+                fpi,
+                event_loop,
+                &(const struct idle_config){
+                    .dim_timeout_s = cmd_args.dim_timeout_s,
+                    .blank_timeout_s = cmd_args.blank_timeout_s,
+                    .dim_brightness = cmd_args.has_dim_brightness ? cmd_args.dim_brightness : IDLE_DEFAULT_DIM_BRIGHTNESS,
+                }
+            );
+        }
+    }
+
     engine_handle = load_flutter_engine_lib(paths);
     if (engine_handle == NULL) {
         goto fail_destroy_user_input;
@@ -2694,6 +3538,12 @@ struct flutterpi *flutterpi_new_from_args(int argc, char **argv) {
     // We don't need these anymore.
     frame_scheduler_unref(scheduler);
     window_unref(window);
+    if (fbdev != NULL) {
+        fbdev_unref(fbdev);
+    }
+    free(cmd_args.dummy_display_output_dir);
+    free(cmd_args.fbdev_path);
+    free(cmd_args.render_device_path);
 
     pthread_mutex_init(&fpi->event_loop_mutex, get_default_mutex_attrs());
     fpi->event_loop_thread = pthread_self();
@@ -2728,9 +3578,15 @@ fail_unload_engine:
     unload_flutter_engine_lib(engine_handle);
 
 fail_destroy_user_input:
+    if (fpi->idle_manager != NULL) {
+        idle_manager_destroy(fpi->idle_manager);
+    }
     user_input_destroy(input);
 
 fail_unref_compositor:
+    if (fpi->drm_monitor != NULL) {
+        udev_monitor_unref(fpi->drm_monitor);
+    }
     compositor_unref(compositor);
 
 fail_unref_window:
@@ -2759,7 +3615,12 @@ fail_unref_tracer:
     tracer_unref(tracer);
 
 fail_destroy_drmdev:
-    drmdev_unref(drmdev);
+    if (drmdev != NULL) {
+        drmdev_unref(drmdev);
+    }
+    if (fbdev != NULL) {
+        fbdev_unref(fbdev);
+    }
 
 fail_destroy_locales:
     locales_destroy(locales);
@@ -2783,6 +3644,9 @@ fail_free_paths:
     flutter_paths_free(paths);
 
 fail_free_cmd_args:
+    free(cmd_args.dummy_display_output_dir);
+    free(cmd_args.fbdev_path);
+    free(cmd_args.render_device_path);
     free(cmd_args.bundle_path);
 
 fail_free_fpi:
@@ -2795,10 +3659,16 @@ void flutterpi_destroy(struct flutterpi *flutterpi) {
     (void) flutterpi;
     LOG_DEBUG("deinit\n");
 
+    // The loader thread posts to the event loop, so it needs to be done before we tear that down.
+    join_keyboard_config_loader(flutterpi);
+
     pthread_mutex_destroy(&flutterpi->event_loop_mutex);
     texture_registry_destroy(flutterpi->texture_registry);
     plugin_registry_destroy(flutterpi->plugin_registry);
     unload_flutter_engine_lib(flutterpi->flutter.engine_handle);
+    if (flutterpi->idle_manager != NULL) {
+        idle_manager_destroy(flutterpi->idle_manager);
+    }
     user_input_destroy(flutterpi->user_input);
     compositor_unref(flutterpi->compositor);
     if (flutterpi->gl_renderer) {
@@ -2816,8 +3686,15 @@ void flutterpi_destroy(struct flutterpi *flutterpi) {
 #endif
     }
     tracer_unref(flutterpi->tracer);
+    if (flutterpi->drm_monitor != NULL) {
+        udev_monitor_unref(flutterpi->drm_monitor);
+    }
     drmdev_unref(flutterpi->drmdev);
     locales_destroy(flutterpi->locales);
+    for (size_t i = 0; i < flutterpi->n_retired_locales; i++) {
+        locales_destroy(flutterpi->retired_locales[i]);
+    }
+    free(flutterpi->retired_locales);
     if (flutterpi->libseat != NULL) {
 #ifdef HAVE_LIBSEAT
         libseat_close_seat(flutterpi->libseat);
@@ -34,6 +34,19 @@
 
 enum device_orientation { kPortraitUp, kLandscapeLeft, kPortraitDown, kLandscapeRight };
 
+/**
+ * @brief Power states of the display, used to save power (and avoid burn-in) while no one is using it.
+ */
+enum display_power_state {
+    DISPLAY_POWER_ON,
+
+    /// The display is still on, but with reduced brightness.
+    DISPLAY_POWER_DIMMED,
+
+    /// The display is turned off (blanked) and no frames are presented.
+    DISPLAY_POWER_OFF,
+};
+
 #define ORIENTATION_IS_LANDSCAPE(orientation) ((orientation) == kLandscapeLeft || (orientation) == kLandscapeRight)
 #define ORIENTATION_IS_PORTRAIT(orientation) ((orientation) == kPortraitUp || (orientation) == kPortraitDown)
 #define ORIENTATION_IS_VALID(orientation) \
@@ -92,6 +105,9 @@ struct drmdev;
 struct locales;
 struct vk_renderer;
 struct flutterpi;
+struct frame_stats;
+struct display_color_settings;
+struct window_frame_capture;
 
 /// TODO: Remove this
 extern struct flutterpi *flutterpi;
@@ -141,6 +157,23 @@ struct flutterpi_cmdline_args {
 
     bool dummy_display;
     struct vec2i dummy_display_size;
+    char *dummy_display_output_dir;
+
+    char *fbdev_path;
+
+    char *render_device_path;
+
+    unsigned int dim_timeout_s;
+    unsigned int blank_timeout_s;
+
+    bool has_dim_brightness;
+    double dim_brightness;
+
+    bool hdr;
+    bool hdr_use_hlg;
+
+    bool has_hdr_max_luminance;
+    double hdr_max_luminance;
 };
 
 int flutterpi_fill_view_properties(bool has_orientation, enum device_orientation orientation, bool has_rotation, int rotation);
@@ -190,6 +223,60 @@ struct gl_renderer *flutterpi_get_gl_renderer(struct flutterpi *flutterpi);
 
 void flutterpi_set_pointer_kind(struct flutterpi *flutterpi, enum pointer_kind kind);
 
+int flutterpi_set_pointer_icon(struct flutterpi *flutterpi, const struct pointer_icon *icon);
+
+/**
+ * @brief Get the number of frames flutter presented so far, how many of them were slow or frozen,
+ * and when the first frame was presented.
+ */
+void flutterpi_get_frame_stats(struct flutterpi *flutterpi, struct frame_stats *stats_out);
+
+/**
+ * @brief Set the brightness, contrast, color temperature and calibration of the display,
+ * using the color pipeline of the display controller.
+ *
+ * @returns Zero if successful, EOPNOTSUPP if the display doesn't support it, errno-code otherwise.
+ */
+int flutterpi_set_display_color(struct flutterpi *flutterpi, const struct display_color_settings *settings);
+
+/**
+ * @brief Capture the frame that's currently shown on the display, without blocking the rendering thread.
+ *
+ * @param callback Called exactly once, from an internal thread, when the capture is done.
+ *                 The pixels are only valid until it returns. See @ref window_capture_frame.
+ * @returns Zero if the capture was started, EAGAIN if there's no frame yet, EBUSY if too many
+ *          captures are in flight, errno-code otherwise.
+ */
+int flutterpi_capture_frame(
+    struct flutterpi *flutterpi,
+    void (*callback)(void *userdata, int error, const struct window_frame_capture *capture),
+    void *userdata
+);
+
+/**
+ * @brief Dim the display, turn it off or on again. See @ref window_set_display_power.
+ */
+int flutterpi_set_display_power(struct flutterpi *flutterpi, enum display_power_state state, double dim_brightness);
+
+enum device_orientation flutterpi_get_orientation(struct flutterpi *flutterpi);
+
+/**
+ * @brief Rotate the flutter view to a new device orientation at runtime.
+ *
+ * Updates the root surface transform, the pointer input transform and sends
+ * the new window metrics to flutter.
+ *
+ * @param flutterpi The flutter-pi instance.
+ * @param orientation The new device orientation.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int flutterpi_set_orientation(struct flutterpi *flutterpi, enum device_orientation orientation);
+
+/**
+ * @brief Make flutter render a new frame, even if nothing changed. Can be called on any thread.
+ */
+void flutterpi_schedule_frame(struct flutterpi *flutterpi);
+
 void flutterpi_trace_event_instant(struct flutterpi *flutterpi, const char *name);
 
 void flutterpi_trace_event_begin(struct flutterpi *flutterpi, const char *name);
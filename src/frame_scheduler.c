@@ -24,6 +24,17 @@ struct frame_scheduler {
     fl_vsync_callback_t vsync_cb;
     void *userdata;
 
+    /**
+     * @brief True if we're not allowed to present frames right now, for example because
+     * the session is inactive.
+     *
+     * While paused, frames are cancelled and flutter vsync requests are deferred until
+     * we're resumed again.
+     */
+    bool paused;
+    bool has_pending_vsync_baton;
+    intptr_t pending_vsync_baton;
+
     pthread_mutex_t mutex;
 };
 
@@ -42,15 +53,20 @@ frame_scheduler_new(bool uses_frame_requests, enum present_mode present_mode, fl
         return NULL;
     }
 
+    pthread_mutex_init(&scheduler->mutex, NULL);
     scheduler->n_refs = REFCOUNT_INIT_1;
     scheduler->uses_frame_requests = uses_frame_requests;
     scheduler->present_mode = present_mode;
     scheduler->vsync_cb = vsync_cb;
     scheduler->userdata = userdata;
+    scheduler->paused = false;
+    scheduler->has_pending_vsync_baton = false;
+    scheduler->pending_vsync_baton = 0;
     return scheduler;
 }
 
 void frame_scheduler_destroy(struct frame_scheduler *scheduler) {
+    pthread_mutex_destroy(&scheduler->mutex);
     free(scheduler);
 }
 
@@ -59,6 +75,16 @@ void frame_scheduler_on_fl_vsync_request(struct frame_scheduler *scheduler, intp
     assert(vsync_baton != 0);
     assert(scheduler->uses_frame_requests);
 
+    frame_scheduler_lock(scheduler);
+    if (scheduler->paused) {
+        // Reply to this one when we're resumed.
+        scheduler->has_pending_vsync_baton = true;
+        scheduler->pending_vsync_baton = vsync_baton;
+        frame_scheduler_unlock(scheduler);
+        return;
+    }
+    frame_scheduler_unlock(scheduler);
+
     // flutter called the vsync callback.
     //  - when do we reply to it?
     //  - what timestamps do we send as a reply?
@@ -121,13 +147,49 @@ void frame_scheduler_request_fb(struct frame_scheduler *scheduler, uint64_t scan
 void frame_scheduler_present_frame(struct frame_scheduler *scheduler, void_callback_t present_cb, void *userdata, void_callback_t cancel_cb) {
     ASSERT_NOT_NULL(scheduler);
     ASSERT_NOT_NULL(present_cb);
-    (void) scheduler;
-    (void) cancel_cb;
+
+    frame_scheduler_lock(scheduler);
+    bool paused = scheduler->paused;
+    frame_scheduler_unlock(scheduler);
+
+    if (paused) {
+        if (cancel_cb != NULL) {
+            cancel_cb(userdata);
+        }
+        return;
+    }
 
     /// TODO: Implement
     present_cb(userdata);
 }
 
+void frame_scheduler_pause(struct frame_scheduler *scheduler) {
+    ASSERT_NOT_NULL(scheduler);
+
+    frame_scheduler_lock(scheduler);
+    scheduler->paused = true;
+    frame_scheduler_unlock(scheduler);
+}
+
+void frame_scheduler_resume(struct frame_scheduler *scheduler) {
+    bool has_pending_vsync_baton;
+    intptr_t vsync_baton;
+
+    ASSERT_NOT_NULL(scheduler);
+
+    frame_scheduler_lock(scheduler);
+    scheduler->paused = false;
+    has_pending_vsync_baton = scheduler->has_pending_vsync_baton;
+    vsync_baton = scheduler->pending_vsync_baton;
+    scheduler->has_pending_vsync_baton = false;
+    scheduler->pending_vsync_baton = 0;
+    frame_scheduler_unlock(scheduler);
+
+    if (has_pending_vsync_baton) {
+        scheduler->vsync_cb(scheduler->userdata, vsync_baton, 0, 0);
+    }
+}
+
 void frame_scheduler_on_scanout(struct frame_scheduler *scheduler, bool has_timestamp, uint64_t timestamp_ns) {
     ASSERT_NOT_NULL(scheduler);
     assert(!has_timestamp || timestamp_ns != 0);
@@ -80,4 +80,21 @@ void frame_scheduler_on_fb_released(struct frame_scheduler *scheduler, bool has_
  */
 void frame_scheduler_present_frame(struct frame_scheduler *scheduler, void_callback_t present_cb, void *userdata, void_callback_t cancel_cb);
 
+/**
+ * @brief Stop presenting frames, for example because our session was deactivated.
+ *
+ * Frames passed to @ref frame_scheduler_present_frame will be cancelled and flutter vsync requests
+ * will be deferred until @ref frame_scheduler_resume is called.
+ *
+ * @param scheduler The frame scheduler instance.
+ */
+void frame_scheduler_pause(struct frame_scheduler *scheduler);
+
+/**
+ * @brief Resume presenting frames and reply to any flutter vsync request that was deferred while paused.
+ *
+ * @param scheduler The frame scheduler instance.
+ */
+void frame_scheduler_resume(struct frame_scheduler *scheduler);
+
 #endif  // _FLUTTERPI_SRC_FRAME_SCHEDULER_H
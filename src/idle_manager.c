@@ -0,0 +1,201 @@
+#include "idle_manager.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <systemd/sd-event.h>
+
+#include "flutter-pi.h"
+#include "util/asserts.h"
+#include "util/collection.h"
+#include "util/logging.h"
+
+#define LIFECYCLE_CHANNEL "flutter/lifecycle"
+
+/**
+ * @brief How precise the idle timeouts need to be. Allows the event loop to coalesce wakeups.
+ */
+#define IDLE_TIMER_ACCURACY_USEC 100000
+
+struct idle_manager {
+    struct flutterpi *flutterpi;
+    struct idle_config config;
+
+    sd_event_source *timer;
+
+    /**
+     * @brief The time of the last user activity, in microseconds of the monotonic clock.
+     */
+    uint64_t last_activity_usec;
+
+    enum display_power_state state;
+};
+
+static uint64_t get_monotonic_time_usec(void) {
+    return get_monotonic_time() / 1000;
+}
+
+static void send_lifecycle_state(struct idle_manager *manager, const char *state) {
+    int ok;
+
+    // The framework synthesizes the intermediate states (inactive, hidden) itself
+    // if we go straight from resumed to paused and back.
+    ok = flutterpi_send_platform_message(manager->flutterpi, LIFECYCLE_CHANNEL, (const uint8_t *) state, strlen(state), NULL);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't send app lifecycle state to flutter. flutterpi_send_platform_message: %s\n", strerror(ok));
+    }
+}
+
+static void set_state(struct idle_manager *manager, enum display_power_state state) {
+    int ok;
+
+    if (state == manager->state) {
+        return;
+    }
+
+    ok = flutterpi_set_display_power(manager->flutterpi, state, manager->config.dim_brightness);
+    if (ok == EOPNOTSUPP && state == DISPLAY_POWER_DIMMED) {
+        // The display can't be dimmed, just keep it at full brightness until it's turned off.
+        LOG_DEBUG("The display doesn't support dimming.\n");
+    } else if (ok != 0) {
+        LOG_ERROR("Couldn't change display power state. flutterpi_set_display_power: %s\n", strerror(ok));
+        return;
+    }
+
+    if (state == DISPLAY_POWER_OFF) {
+        send_lifecycle_state(manager, "AppLifecycleState.paused");
+    } else if (manager->state == DISPLAY_POWER_OFF) {
+        send_lifecycle_state(manager, "AppLifecycleState.resumed");
+    }
+
+    manager->state = state;
+}
+
+/**
+ * @brief Get the state the display should be in after @param idle_usec without user input,
+ * and when that state ends (relative to the last activity), or UINT64_MAX if never.
+ */
+static enum display_power_state get_state_for_idle_time(struct idle_manager *manager, uint64_t idle_usec, uint64_t *state_end_usec_out) {
+    uint64_t dim_usec, blank_usec;
+
+    dim_usec = manager->config.dim_timeout_s != 0 ? manager->config.dim_timeout_s * UINT64_C(1000000) : UINT64_MAX;
+    blank_usec = manager->config.blank_timeout_s != 0 ? manager->config.blank_timeout_s * UINT64_C(1000000) : UINT64_MAX;
+
+    if (idle_usec >= blank_usec) {
+        *state_end_usec_out = UINT64_MAX;
+        return DISPLAY_POWER_OFF;
+    } else if (idle_usec >= dim_usec) {
+        *state_end_usec_out = blank_usec;
+        return DISPLAY_POWER_DIMMED;
+    } else {
+        *state_end_usec_out = MIN2(dim_usec, blank_usec);
+        return DISPLAY_POWER_ON;
+    }
+}
+
+static void update(struct idle_manager *manager) {
+    enum display_power_state state;
+    uint64_t now, state_end;
+    int ok;
+
+    now = get_monotonic_time_usec();
+
+    state = get_state_for_idle_time(manager, now - manager->last_activity_usec, &state_end);
+    set_state(manager, state);
+
+    if (state_end == UINT64_MAX) {
+        sd_event_source_set_enabled(manager->timer, SD_EVENT_OFF);
+        return;
+    }
+
+    ok = sd_event_source_set_time(manager->timer, manager->last_activity_usec + state_end);
+    if (ok < 0) {
+        LOG_ERROR("Couldn't arm idle timer. sd_event_source_set_time: %s\n", strerror(-ok));
+        return;
+    }
+
+    sd_event_source_set_enabled(manager->timer, SD_EVENT_ONESHOT);
+}
+
+static int on_idle_timer(sd_event_source *s, uint64_t usec, void *userdata) {
+    struct idle_manager *manager;
+
+    ASSERT_NOT_NULL(userdata);
+    manager = userdata;
+    (void) s;
+    (void) usec;
+
+    // This might be an old deadline, if there was activity in the meantime.
+    // update() figures out the right state and re-arms the timer for the next one.
+    update(manager);
+    return 0;
+}
+
+struct idle_manager *idle_manager_new(struct flutterpi *flutterpi, sd_event *loop, const struct idle_config *config) {
+    struct idle_manager *manager;
+    int ok;
+
+    ASSERT_NOT_NULL(flutterpi);
+    ASSERT_NOT_NULL(loop);
+    ASSERT_NOT_NULL(config);
+
+    manager = malloc(sizeof *manager);
+    if (manager == NULL) {
+        return NULL;
+    }
+
+    manager->flutterpi = flutterpi;
+    manager->config = *config;
+    manager->last_activity_usec = get_monotonic_time_usec();
+    manager->state = DISPLAY_POWER_ON;
+
+    // Fires right away, on_idle_timer will then arm it for the first timeout.
+    ok = sd_event_add_time(
+        loop,
+        &manager->timer,
+        CLOCK_MONOTONIC,
+        manager->last_activity_usec,
+        IDLE_TIMER_ACCURACY_USEC,
+        on_idle_timer,
+        manager
+    );
+    if (ok < 0) {
+        LOG_ERROR("Couldn't create idle timer. sd_event_add_time: %s\n", strerror(-ok));
+        goto fail_free_manager;
+    }
+
+    return manager;
+
+fail_free_manager:
+    free(manager);
+    return NULL;
+}
+
+void idle_manager_destroy(struct idle_manager *manager) {
+    ASSERT_NOT_NULL(manager);
+
+    sd_event_source_disable_unref(manager->timer);
+    free(manager);
+}
+
+bool idle_manager_on_activity(struct idle_manager *manager) {
+    bool was_off;
+
+    ASSERT_NOT_NULL(manager);
+
+    manager->last_activity_usec = get_monotonic_time_usec();
+
+    // Input events arrive all the time while the user is interacting, so don't
+    // touch the timer in that case. It'll re-arm itself when it fires.
+    if (manager->state == DISPLAY_POWER_ON) {
+        return false;
+    }
+
+    was_off = manager->state == DISPLAY_POWER_OFF;
+
+    update(manager);
+
+    return was_off;
+}
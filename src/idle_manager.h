@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Idle manager
+ *
+ * Dims and then blanks the display when there was no user input for a while,
+ * and wakes it up again with the next input event.
+ *
+ * Copyright (c) 2023, Hannes Winkler <hanneswinkler2000@web.de>
+ */
+
+#ifndef _FLUTTERPI_SRC_IDLE_MANAGER_H
+#define _FLUTTERPI_SRC_IDLE_MANAGER_H
+
+#include <stdbool.h>
+
+#include <systemd/sd-event.h>
+
+struct flutterpi;
+struct idle_manager;
+
+/**
+ * @brief The brightness factor used while the display is dimmed, if none is specified.
+ */
+#define IDLE_DEFAULT_DIM_BRIGHTNESS 0.3
+
+struct idle_config {
+    /**
+     * @brief Seconds without user input until the display is dimmed, or 0 to never dim.
+     */
+    unsigned int dim_timeout_s;
+
+    /**
+     * @brief Seconds without user input until the display is turned off, or 0 to never turn it off.
+     */
+    unsigned int blank_timeout_s;
+
+    /**
+     * @brief Brightness factor (0 to 1) while the display is dimmed.
+     */
+    double dim_brightness;
+};
+
+/**
+ * @brief Create a new idle manager that starts counting idle time right away.
+ *
+ * Must be used on the platform thread only, @param loop is the platform event loop.
+ *
+ * When the display is turned off, flutter is told the app is paused (see `AppLifecycleState`)
+ * and no more frames are scheduled until the display is turned on again.
+ */
+struct idle_manager *idle_manager_new(struct flutterpi *flutterpi, sd_event *loop, const struct idle_config *config);
+
+void idle_manager_destroy(struct idle_manager *manager);
+
+/**
+ * @brief Report user activity (for example an input event). Resets the idle time and
+ * turns the display on again right away if it was dimmed or off.
+ *
+ * @returns true if the display was off, i.e. this activity is what woke it up. The input
+ *          causing it should not be forwarded to the app, since the user couldn't see what
+ *          they were interacting with.
+ */
+bool idle_manager_on_activity(struct idle_manager *manager);
+
+#endif  // _FLUTTERPI_SRC_IDLE_MANAGER_H
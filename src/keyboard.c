@@ -20,9 +20,14 @@
 #include <xkbcommon/xkbcommon-compose.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "util/asserts.h"
 #include "util/collection.h"
 #include "util/logging.h"
 
+// Same as the X server defaults.
+#define DEFAULT_REPEAT_DELAY_MS 660
+#define DEFAULT_REPEAT_RATE 25
+
 static int find_var_offset_in_string(const char *varname, const char *buffer, regmatch_t *match) {
     regmatch_t matches[2];
     char *pattern;
@@ -150,7 +155,7 @@ static struct xkb_keymap *load_default_keymap(struct xkb_context *context) {
     struct xkb_keymap *keymap;
     char *file, *xkbmodel, *xkblayout, *xkbvariant, *xkboptions;
 
-    file = load_file("/etc/default/keyboard");
+    file = load_file(KEYBOARD_CONFIG_PATH);
     if (file == NULL) {
         LOG_ERROR(
             "Could not load keyboard configuration from \"/etc/default/keyboard\". Default keyboard config will be used. load_file: %s\n",
@@ -205,6 +210,46 @@ static struct xkb_keymap *load_default_keymap(struct xkb_context *context) {
     return keymap;
 }
 
+static void load_default_repeat_info(int *delay_ms_out, int *rate_out) {
+    char *file, *value;
+    int delay_ms, rate;
+
+    delay_ms = DEFAULT_REPEAT_DELAY_MS;
+    rate = DEFAULT_REPEAT_RATE;
+
+    // The repeat delay and rate are not part of the xkb keymap, so we just use
+    // the same defaults as the X server, unless they're configured in /etc/default/keyboard.
+    file = load_file(KEYBOARD_CONFIG_PATH);
+    if (file != NULL) {
+        value = get_value_allocated("KEYREPEAT_DELAY", file);
+        if (value != NULL) {
+            delay_ms = atoi(value);
+            free(value);
+        }
+
+        value = get_value_allocated("KEYREPEAT_RATE", file);
+        if (value != NULL) {
+            rate = atoi(value);
+            free(value);
+        }
+
+        free(file);
+    }
+
+    if (delay_ms < 0) {
+        LOG_ERROR("Invalid \"KEYREPEAT_DELAY\" property inside \"/etc/default/keyboard\". Default value will be used.\n");
+        delay_ms = DEFAULT_REPEAT_DELAY_MS;
+    }
+
+    if (rate < 0) {
+        LOG_ERROR("Invalid \"KEYREPEAT_RATE\" property inside \"/etc/default/keyboard\". Default value will be used.\n");
+        rate = DEFAULT_REPEAT_RATE;
+    }
+
+    *delay_ms_out = delay_ms;
+    *rate_out = rate;
+}
+
 static struct xkb_compose_table *load_default_compose_table(struct xkb_context *context) {
     struct xkb_compose_table *tbl;
 
@@ -249,6 +294,8 @@ struct keyboard_config *keyboard_config_new(void) {
     cfg->context = ctx;
     cfg->default_compose_table = compose_table;
     cfg->default_keymap = keymap;
+    cfg->generation = 0;
+    load_default_repeat_info(&cfg->repeat_delay_ms, &cfg->repeat_rate);
 
     return cfg;
 
@@ -272,6 +319,30 @@ void keyboard_config_destroy(struct keyboard_config *config) {
     free(config);
 }
 
+void keyboard_config_replace(struct keyboard_config *config, struct keyboard_config *replacement) {
+    struct keyboard_config old;
+
+    ASSERT_NOT_NULL(config);
+    ASSERT_NOT_NULL(replacement);
+
+    old = *config;
+
+    // The keyboard states still hold references to the old keymap and compose table
+    // (and through those, the old xkb context) until they're synced.
+    config->context = replacement->context;
+    config->default_keymap = replacement->default_keymap;
+    config->default_compose_table = replacement->default_compose_table;
+    config->repeat_delay_ms = replacement->repeat_delay_ms;
+    config->repeat_rate = replacement->repeat_rate;
+    config->generation = old.generation + 1;
+
+    replacement->context = old.context;
+    replacement->default_keymap = old.default_keymap;
+    replacement->default_compose_table = old.default_compose_table;
+
+    keyboard_config_destroy(replacement);
+}
+
 struct keyboard_state *
 keyboard_state_new(struct keyboard_config *config, struct xkb_keymap *keymap_override, struct xkb_compose_table *compose_table_override) {
     struct keyboard_state *state;
@@ -309,6 +380,8 @@ keyboard_state_new(struct keyboard_config *config, struct xkb_keymap *keymap_ove
     state->state = xkb_state;
     state->plain_state = plain_xkb_state;
     state->compose_state = compose_state;
+    state->uses_config = keymap_override == NULL && compose_table_override == NULL;
+    state->config_generation = config->generation;
 
     return state;
 
@@ -332,6 +405,73 @@ void keyboard_state_destroy(struct keyboard_state *state) {
     free(state);
 }
 
+static xkb_mod_mask_t get_mod_mask(struct xkb_keymap *keymap, const char *name) {
+    xkb_mod_index_t index;
+
+    index = xkb_keymap_mod_get_index(keymap, name);
+    if (index == XKB_MOD_INVALID) {
+        return 0;
+    }
+
+    return 1u << index;
+}
+
+int keyboard_state_sync_config(struct keyboard_state *state) {
+    struct xkb_compose_state *compose_state;
+    struct xkb_state *xkb_state, *plain_xkb_state;
+    xkb_mod_mask_t locked;
+
+    if (!state->uses_config || state->config_generation == state->config->generation) {
+        return 0;
+    }
+
+    xkb_state = xkb_state_new(state->config->default_keymap);
+    if (xkb_state == NULL) {
+        LOG_ERROR("Could not create new XKB state.\n");
+        return ENOMEM;
+    }
+
+    plain_xkb_state = xkb_state_new(state->config->default_keymap);
+    if (plain_xkb_state == NULL) {
+        LOG_ERROR("Could not create new XKB state.\n");
+        goto fail_free_xkb_state;
+    }
+
+    compose_state = xkb_compose_state_new(state->config->default_compose_table, XKB_COMPOSE_STATE_NO_FLAGS);
+    if (compose_state == NULL) {
+        LOG_ERROR("Could not create new XKB compose state.\n");
+        goto fail_free_plain_xkb_state;
+    }
+
+    // The modifier indices can be different in the new keymap, so carry the locks over by name.
+    locked = 0;
+    if (keyboard_state_is_capslock_active(state)) {
+        locked |= get_mod_mask(state->config->default_keymap, XKB_MOD_NAME_CAPS);
+    }
+    if (keyboard_state_is_numlock_active(state)) {
+        locked |= get_mod_mask(state->config->default_keymap, XKB_MOD_NAME_NUM);
+    }
+
+    xkb_state_update_mask(xkb_state, 0, 0, locked, 0, 0, 0);
+
+    xkb_compose_state_unref(state->compose_state);
+    xkb_state_unref(state->plain_state);
+    xkb_state_unref(state->state);
+
+    state->state = xkb_state;
+    state->plain_state = plain_xkb_state;
+    state->compose_state = compose_state;
+    state->config_generation = state->config->generation;
+    return 0;
+
+fail_free_plain_xkb_state:
+    xkb_state_unref(plain_xkb_state);
+
+fail_free_xkb_state:
+    xkb_state_unref(xkb_state);
+    return ENOMEM;
+}
+
 int keyboard_state_process_key_event(
     struct keyboard_state *state,
     uint16_t evdev_keycode,
@@ -351,6 +491,8 @@ int keyboard_state_process_key_event(
      * evdev_value = 2: repeat
      */
 
+    keyboard_state_sync_config(state);
+
     keysym = 0;
     codepoint = 0;
     xkb_keycode = evdev_keycode + 8;
@@ -374,7 +516,10 @@ int keyboard_state_process_key_event(
         codepoint = xkb_state_key_get_utf32(state->state, xkb_keycode);
     }
 
-    xkb_state_update_key(state->state, xkb_keycode, (enum xkb_key_direction) evdev_value);
+    // repeats don't change the modifier state.
+    if (evdev_value != KEY_REPEAT) {
+        xkb_state_update_key(state->state, xkb_keycode, evdev_value == KEY_PRESS ? XKB_KEY_DOWN : XKB_KEY_UP);
+    }
 
     if (keysym_out)
         *keysym_out = keysym;
@@ -14,10 +14,27 @@
 
 #include <xkbcommon/xkbcommon.h>
 
+#define KEYBOARD_CONFIG_PATH "/etc/default/keyboard"
+
 struct keyboard_config {
     struct xkb_context *context;
     struct xkb_keymap *default_keymap;
     struct xkb_compose_table *default_compose_table;
+
+    /**
+     * @brief Incremented every time the keymap and compose table are replaced using @ref keyboard_config_replace.
+     */
+    unsigned int generation;
+
+    /**
+     * @brief Time a key needs to be held down before it starts repeating, in milliseconds.
+     */
+    int repeat_delay_ms;
+
+    /**
+     * @brief Number of key repeats per second. 0 if keys shouldn't repeat at all.
+     */
+    int repeat_rate;
 };
 
 struct keyboard_state {
@@ -28,6 +45,13 @@ struct keyboard_state {
     int n_iso_level2;
     int n_iso_level3;
     int n_iso_level5;
+
+    /**
+     * @brief False if this state was created with a keymap or compose table override,
+     * in which case it doesn't follow changes of the keyboard config.
+     */
+    bool uses_config;
+    unsigned int config_generation;
 };
 
 struct keyboard_modifier_state {
@@ -48,11 +72,34 @@ struct keyboard_config *keyboard_config_new(void);
 
 void keyboard_config_destroy(struct keyboard_config *config);
 
+/**
+ * @brief Replace the keymap, compose table and repeat info of @param config with the ones of
+ * @param replacement, and destroy @param replacement.
+ *
+ * The keyboard states created from @param config keep using the old keymap until
+ * @ref keyboard_state_sync_config is called, which happens automatically on the next key event.
+ * That way, a key event is always processed completely using either the old or the new keymap.
+ *
+ * @param config The keyboard config that's used by keyboard states right now.
+ * @param replacement The new keyboard config, for example created on a background thread using @ref keyboard_config_new.
+ */
+void keyboard_config_replace(struct keyboard_config *config, struct keyboard_config *replacement);
+
 struct keyboard_state *
 keyboard_state_new(struct keyboard_config *config, struct xkb_keymap *keymap_override, struct xkb_compose_table *compose_table_override);
 
 void keyboard_state_destroy(struct keyboard_state *state);
 
+/**
+ * @brief If the keyboard config was replaced since the last key event, switch to the new keymap and compose table.
+ *
+ * Locked modifiers (caps lock and num lock) are kept. Any pending compose sequence is cancelled.
+ *
+ * @param state The keyboard state.
+ * @return int Zero if successful (or the state was already up to date), errno-code otherwise.
+ */
+int keyboard_state_sync_config(struct keyboard_state *state);
+
 int keyboard_state_process_key_event(
     struct keyboard_state *state,
     uint16_t evdev_keycode,
@@ -279,9 +279,84 @@ fail_return_ok:
     return ok;
 }
 
-struct locales *locales_new(void) {
+/**
+ * @brief Get the value of @param varname in a shell-style KEY=VALUE configuration file, like /etc/default/locale.
+ */
+static char *get_config_file_value(const char *path, const char *varname) {
+    size_t varname_len, line_size;
+    char *line, *value, *cursor, *end;
+    FILE *file;
+
+    file = fopen(path, "re");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    varname_len = strlen(varname);
+    value = NULL;
+    line = NULL;
+    line_size = 0;
+    while (getline(&line, &line_size, file) >= 0) {
+        cursor = line;
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+
+        if (strncmp(cursor, "export ", 7) == 0) {
+            cursor += 7;
+        }
+
+        if (strncmp(cursor, varname, varname_len) != 0 || cursor[varname_len] != '=') {
+            continue;
+        }
+
+        cursor += varname_len + 1;
+
+        end = cursor + strcspn(cursor, "\r\n");
+        if (end - cursor >= 2 && (*cursor == '"' || *cursor == '\'') && end[-1] == *cursor) {
+            cursor++;
+            end--;
+        }
+
+        // later assignments override earlier ones.
+        free(value);
+        value = strndup(cursor, end - cursor);
+    }
+
+    free(line);
+    fclose(file);
+
+    if (value != NULL && *value == '\0') {
+        free(value);
+        value = NULL;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Get the configured system locale from the locale config files, using the same
+ * precedence as @ref get_system_locale_string. Returns NULL if none is configured.
+ */
+static char *get_config_file_locale_string(void) {
+    static const char *const paths[] = { LOCALE_CONF_PATH, DEFAULT_LOCALE_PATH };
+    static const char *const varnames[] = { "LANGUAGE", "LC_ALL", "LC_MESSAGES", "LANG" };
+    char *value;
+
+    for (size_t i = 0; i < ARRAY_SIZE(paths); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(varnames); j++) {
+            value = get_config_file_value(paths[i], varnames[j]);
+            if (value != NULL) {
+                return value;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static struct locales *locales_new_from_string(const char *system_locales) {
     struct locales *locales;
-    const char *system_locales;
     char *system_locales_modifiable, *syslocale;
     const FlutterLocale **fl_locales;
     size_t n_locales;
@@ -294,8 +369,6 @@ struct locales *locales_new(void) {
     list_inithead(&locales->locales);
 
     // Add our system locales.
-    system_locales = get_system_locale_string();
-
     system_locales_modifiable = strdup(system_locales);
     if (system_locales_modifiable == NULL) {
         goto fail_free_locales;
@@ -347,6 +420,26 @@ fail_return_null:
     return NULL;
 }
 
+struct locales *locales_new(void) {
+    return locales_new_from_string(get_system_locale_string());
+}
+
+struct locales *locales_new_from_system_config(void) {
+    struct locales *locales;
+    char *system_locales;
+
+    system_locales = get_config_file_locale_string();
+    if (system_locales == NULL) {
+        return locales_new();
+    }
+
+    locales = locales_new_from_string(system_locales);
+
+    free(system_locales);
+
+    return locales;
+}
+
 void locales_destroy(struct locales *locales) {
     assert(locales != NULL);
 
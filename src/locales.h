@@ -12,6 +12,12 @@
 
 #include <flutter_embedder.h>
 
+/**
+ * @brief The system locale configuration files, as used by systemd and debian respectively.
+ */
+#define LOCALE_CONF_PATH "/etc/locale.conf"
+#define DEFAULT_LOCALE_PATH "/etc/default/locale"
+
 struct locale;
 struct locales;
 struct concurrent_pointer_set;
@@ -32,6 +38,14 @@ const char *locale_get_modifier(struct locale *locale);
 
 struct locales *locales_new(void);
 
+/**
+ * @brief Like @ref locales_new, but prefers the locale configured in @ref LOCALE_CONF_PATH or @ref DEFAULT_LOCALE_PATH
+ * over the locale environment variables of this process.
+ *
+ * Useful for picking up changes of the system locale at runtime, since the environment of this process won't change.
+ */
+struct locales *locales_new_from_system_config(void);
+
 void locales_destroy(struct locales *locales);
 
 int locales_get_flutter_locales(struct locales *locales, const FlutterLocale ***fl_locales_out, size_t *n_fl_locales_out);
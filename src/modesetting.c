@@ -80,6 +80,39 @@ struct kms_req_builder {
     bool unset_mode;
     bool has_mode;
     drmModeModeInfo mode;
+
+    bool has_gamma_lut;
+    size_t gamma_lut_size;
+    struct drm_color_lut *gamma_lut;
+
+    bool has_ctm;
+    bool reset_ctm;
+    struct drm_color_ctm ctm;
+
+    bool has_max_bpc;
+    uint32_t max_bpc;
+
+    bool has_colorspace;
+    enum drm_colorspace colorspace;
+
+    bool has_hdr_metadata;
+    bool reset_hdr_metadata;
+    struct drm_hdr_output_metadata hdr_metadata;
+
+    struct {
+        struct drm_connector *connector;
+        uint32_t fb_id;
+        int32_t out_fence_fd;
+        kms_writeback_cb_t callback;
+        void *userdata;
+    } writeback;
+
+    struct {
+        struct drm_connector *connector;
+        uint32_t crtc_id;
+    } writeback_route;
+
+    struct drm_crtc *disable_crtc;
 };
 
 COMPILE_ASSERT(BITSET_SIZE(((struct kms_req_builder *) 0)->available_planes) == 32);
@@ -91,6 +124,7 @@ struct drmdev {
     pthread_mutex_t mutex;
     bool supports_atomic_modesetting;
     bool supports_dumb_buffers;
+    struct vec2i max_cursor_size;
 
     size_t n_connectors;
     struct drm_connector *connectors;
@@ -109,6 +143,12 @@ struct drmdev {
 
     struct gbm_device *gbm_device;
 
+    /**
+     * @brief The separate render GPU opened with @ref drmdev_open_render_device, or NULL / -1.
+     */
+    struct gbm_device *render_gbm_device;
+    int render_fd;
+
     int event_fd;
 
     struct {
@@ -179,7 +219,9 @@ static int fetch_connector(int drm_fd, uint32_t connector_id, struct drm_connect
     drmModePropertyRes *prop_info;
     drmModeConnector *connector;
     drmModeModeInfo *modes;
-    uint32_t crtc_id;
+    uint32_t crtc_id, writeback_formats_blob_id, max_bpc_limit;
+    uint64_t colorspace_values[kCount_DrmColorspace];
+    bool supported_colorspaces[kCount_DrmColorspace] = { 0 };
     int ok;
 
     drm_connector_prop_ids_init(&ids);
@@ -199,6 +241,9 @@ static int fetch_connector(int drm_fd, uint32_t connector_id, struct drm_connect
     }
 
     crtc_id = DRM_ID_NONE;
+    writeback_formats_blob_id = 0;
+    max_bpc_limit = 0;
+    memset(colorspace_values, 0, sizeof colorspace_values);
     for (int i = 0; i < props->count_props; i++) {
         prop_info = drmModeGetProperty(drm_fd, props->props[i]);
         if (prop_info == NULL) {
@@ -221,6 +266,30 @@ static int fetch_connector(int drm_fd, uint32_t connector_id, struct drm_connect
 
         if (strncmp(prop_info->name, "CRTC_ID", DRM_PROP_NAME_LEN) == 0) {
             crtc_id = props->prop_values[i];
+        } else if (strncmp(prop_info->name, "WRITEBACK_PIXEL_FORMATS", DRM_PROP_NAME_LEN) == 0) {
+            writeback_formats_blob_id = props->prop_values[i];
+        } else if (strncmp(prop_info->name, "max bpc", DRM_PROP_NAME_LEN) == 0) {
+            if ((prop_info->flags & DRM_MODE_PROP_RANGE) && prop_info->count_values == 2) {
+                max_bpc_limit = (uint32_t) prop_info->values[1];
+            }
+        } else if (strncmp(prop_info->name, "Colorspace", DRM_PROP_NAME_LEN) == 0) {
+            // The values of the enum entries depend on the connector type, so we need to look them up by name.
+            for (int j = 0; j < prop_info->count_enums; j++) {
+                enum drm_colorspace colorspace;
+
+                if (streq(prop_info->enums[j].name, "Default")) {
+                    colorspace = kDefault_DrmColorspace;
+                } else if (streq(prop_info->enums[j].name, "BT2020_RGB")) {
+                    colorspace = kBT2020RGB_DrmColorspace;
+                } else if (streq(prop_info->enums[j].name, "BT2020_YCC")) {
+                    colorspace = kBT2020YCC_DrmColorspace;
+                } else {
+                    continue;
+                }
+
+                supported_colorspaces[colorspace] = true;
+                colorspace_values[colorspace] = prop_info->enums[j].value;
+            }
         }
 
         drmModeFreeProperty(prop_info);
@@ -254,6 +323,28 @@ static int fetch_connector(int drm_fd, uint32_t connector_id, struct drm_connect
     connector_out->variable_state.modes = modes;
     connector_out->committed_state.crtc_id = crtc_id;
     connector_out->committed_state.encoder_id = connector->encoder_id;
+
+    connector_out->max_bpc_limit = max_bpc_limit;
+    memcpy(connector_out->supported_colorspaces, supported_colorspaces, sizeof supported_colorspaces);
+    memcpy(connector_out->colorspace_values, colorspace_values, sizeof colorspace_values);
+
+    memset(connector_out->writeback_formats, 0, sizeof connector_out->writeback_formats);
+    if (writeback_formats_blob_id != 0) {
+        drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(drm_fd, writeback_formats_blob_id);
+        if (blob != NULL) {
+            // The blob is just an array of DRM fourccs.
+            for (uint32_t i = 0; i < blob->length / sizeof(uint32_t); i++) {
+                uint32_t fourcc = ((const uint32_t *) blob->data)[i];
+                if (has_pixfmt_for_drm_format(fourcc)) {
+                    connector_out->writeback_formats[get_pixfmt_for_drm_format(fourcc)] = true;
+                }
+            }
+            drmModeFreePropertyBlob(blob);
+        } else {
+            LOG_ERROR("Couldn't get writeback pixel formats of connector. drmModeGetPropertyBlob: %s\n", strerror(errno));
+        }
+    }
+
     drmModeFreeObjectProperties(props);
     drmModeFreeConnector(connector);
     return 0;
@@ -375,6 +466,7 @@ static int fetch_crtc(int drm_fd, int crtc_index, uint32_t crtc_id, struct drm_c
     drmModeObjectProperties *props;
     drmModePropertyRes *prop_info;
     drmModeCrtc *crtc;
+    uint32_t gamma_lut_size;
     int ok;
 
     drm_crtc_prop_ids_init(&ids);
@@ -386,6 +478,10 @@ static int fetch_crtc(int drm_fd, int crtc_index, uint32_t crtc_id, struct drm_c
         return ok;
     }
 
+    // If the driver doesn't have the atomic GAMMA_LUT_SIZE property,
+    // fall back to the legacy gamma ramp size.
+    gamma_lut_size = crtc->gamma_size > 0 ? crtc->gamma_size : 0;
+
     props = drmModeObjectGetProperties(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC);
     if (props == NULL) {
         ok = errno;
@@ -413,6 +509,10 @@ static int fetch_crtc(int drm_fd, int crtc_index, uint32_t crtc_id, struct drm_c
 
 #undef CHECK_ASSIGN_PROPERTY_ID
 
+        if (prop_info->prop_id == ids.gamma_lut_size) {
+            gamma_lut_size = props->prop_values[i];
+        }
+
         drmModeFreeProperty(prop_info);
         prop_info = NULL;
     }
@@ -421,6 +521,7 @@ static int fetch_crtc(int drm_fd, int crtc_index, uint32_t crtc_id, struct drm_c
     crtc_out->index = crtc_index;
     crtc_out->bitmask = 1u << crtc_index;
     crtc_out->ids = ids;
+    crtc_out->gamma_lut_size = gamma_lut_size;
     crtc_out->committed_state.has_mode = crtc->mode_valid;
     crtc_out->committed_state.mode = crtc->mode;
     crtc_out->committed_state.mode_blob = NULL;
@@ -620,6 +721,7 @@ static int fetch_plane(int drm_fd, uint32_t plane_id, struct drm_plane *plane_ou
     uint16_t committed_alpha;
     int64_t min_zpos, max_zpos, hardcoded_zpos, committed_zpos;
     bool supported_blend_modes[kCount_DrmBlendMode] = { 0 };
+    uint64_t blend_mode_values[kCount_DrmBlendMode] = { 0 };
     bool supported_formats[PIXFMT_COUNT] = { 0 };
     bool has_type, has_rotation, has_zpos, has_hardcoded_zpos, has_hardcoded_rotation, has_alpha, has_blend_mode;
     int ok;
@@ -766,16 +868,18 @@ static int fetch_plane(int drm_fd, uint32_t plane_id, struct drm_plane *plane_ou
             has_blend_mode = true;
             assert(info->flags == DRM_MODE_PROP_ENUM);
 
+            // Match the blend modes by name and remember the value the kernel uses for each,
+            // don't rely on it matching the order of enum drm_blend_mode.
             for (int i = 0; i < info->count_enums; i++) {
                 if (streq(info->enums[i].name, "None")) {
-                    ASSERT_EQUALS(info->enums[i].value, kNone_DrmBlendMode);
                     supported_blend_modes[kNone_DrmBlendMode] = true;
+                    blend_mode_values[kNone_DrmBlendMode] = info->enums[i].value;
                 } else if (streq(info->enums[i].name, "Pre-multiplied")) {
-                    ASSERT_EQUALS(info->enums[i].value, kPremultiplied_DrmBlendMode);
                     supported_blend_modes[kPremultiplied_DrmBlendMode] = true;
+                    blend_mode_values[kPremultiplied_DrmBlendMode] = info->enums[i].value;
                 } else if (streq(info->enums[i].name, "Coverage")) {
-                    ASSERT_EQUALS(info->enums[i].value, kCoverage_DrmBlendMode);
                     supported_blend_modes[kCoverage_DrmBlendMode] = true;
+                    blend_mode_values[kCoverage_DrmBlendMode] = info->enums[i].value;
                 } else {
                     LOG_DEBUG(
                         "Unknown KMS pixel blend mode: %s (value: %" PRIu64 ")\n",
@@ -785,9 +889,12 @@ static int fetch_plane(int drm_fd, uint32_t plane_id, struct drm_plane *plane_ou
                 }
             }
 
-            committed_blend_mode = props->prop_values[j];
-            assert(committed_blend_mode >= 0 && committed_blend_mode <= kMax_DrmBlendMode);
-            assert(supported_blend_modes[committed_blend_mode]);
+            committed_blend_mode = kPremultiplied_DrmBlendMode;
+            for (int i = 0; i < kCount_DrmBlendMode; i++) {
+                if (supported_blend_modes[i] && blend_mode_values[i] == props->prop_values[j]) {
+                    committed_blend_mode = i;
+                }
+            }
         }
 
 #define CHECK_ASSIGN_PROPERTY_ID(_name_str, _name)                     \
@@ -857,6 +964,7 @@ static int fetch_plane(int drm_fd, uint32_t plane_id, struct drm_plane *plane_ou
     plane_out->has_alpha = has_alpha;
     plane_out->has_blend_mode = has_blend_mode;
     memcpy(plane_out->supported_blend_modes, supported_blend_modes, sizeof supported_blend_modes);
+    memcpy(plane_out->blend_mode_values, blend_mode_values, sizeof blend_mode_values);
     plane_out->committed_state.crtc_id = plane->crtc_id;
     plane_out->committed_state.fb_id = plane->fb_id;
     plane_out->committed_state.src_x = comitted_src_x;
@@ -1016,6 +1124,15 @@ static int set_drm_client_caps(int fd, bool *supports_atomic_modesetting) {
         if (supports_atomic_modesetting != NULL) {
             *supports_atomic_modesetting = true;
         }
+
+    #ifdef DRM_CLIENT_CAP_WRITEBACK_CONNECTORS
+        // Writeback connectors are only exposed to atomic clients that ask for them.
+        // Not supported by older kernels, but we can live without them.
+        ok = drmSetClientCap(fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1);
+        if (ok < 0) {
+            LOG_DEBUG("Could not set DRM client writeback connectors capable. drmSetClientCap: %s\n", strerror(errno));
+        }
+    #endif
     }
 #endif
 
@@ -1028,6 +1145,7 @@ struct drmdev *drmdev_new_from_interface_fd(int fd, void *fd_metadata, const str
     uint64_t cap;
     bool supports_atomic_modesetting;
     bool supports_dumb_buffers;
+    struct vec2i max_cursor_size;
     int ok, master_fd, event_fd;
 
     assert_rotations_work();
@@ -1052,6 +1170,21 @@ struct drmdev *drmdev_new_from_interface_fd(int fd, void *fd_metadata, const str
         supports_dumb_buffers = !!cap;
     }
 
+    // If the driver doesn't tell us, the kernel assumes 64x64 as well.
+    max_cursor_size = VEC2I(64, 64);
+
+    cap = 0;
+    ok = drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &cap);
+    if (ok >= 0 && cap != 0) {
+        max_cursor_size.x = (int) cap;
+    }
+
+    cap = 0;
+    ok = drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &cap);
+    if (ok >= 0 && cap != 0) {
+        max_cursor_size.y = (int) cap;
+    }
+
     drmdev->res = drmModeGetResources(fd);
     if (drmdev->res == NULL) {
         ok = errno;
@@ -1135,7 +1268,10 @@ struct drmdev *drmdev_new_from_interface_fd(int fd, void *fd_metadata, const str
     drmdev->fd = fd;
     drmdev->supports_atomic_modesetting = supports_atomic_modesetting;
     drmdev->supports_dumb_buffers = supports_dumb_buffers;
+    drmdev->max_cursor_size = max_cursor_size;
     drmdev->gbm_device = gbm_device;
+    drmdev->render_gbm_device = NULL;
+    drmdev->render_fd = -1;
     drmdev->event_fd = event_fd;
     memset(drmdev->per_crtc_state, 0, sizeof(drmdev->per_crtc_state));
     drmdev->master_fd = master_fd;
@@ -1204,7 +1340,11 @@ struct drmdev *drmdev_new_from_path(const char *path, const struct drmdev_interf
 static void drmdev_destroy(struct drmdev *drmdev) {
     assert(refcount_is_zero(&drmdev->n_refs));
 
-    drmdev->interface.close(drmdev->master_fd, drmdev->master_fd_metadata, drmdev->userdata);
+    if (drmdev->render_gbm_device != NULL) {
+        gbm_device_destroy(drmdev->render_gbm_device);
+        close(drmdev->render_fd);
+    }
+    drmdev->interface.close(drmdev->fd, drmdev->master_fd_metadata, drmdev->userdata);
     close(drmdev->event_fd);
     gbm_device_destroy(drmdev->gbm_device);
     free_planes(drmdev->planes, drmdev->n_planes);
@@ -1232,6 +1372,11 @@ bool drmdev_supports_dumb_buffers(struct drmdev *drmdev) {
     return drmdev->supports_dumb_buffers;
 }
 
+struct vec2i drmdev_get_max_cursor_size(struct drmdev *drmdev) {
+    ASSERT_NOT_NULL(drmdev);
+    return drmdev->max_cursor_size;
+}
+
 int drmdev_create_dumb_buffer(
     struct drmdev *drmdev,
     int width,
@@ -1349,6 +1494,14 @@ drmdev_on_page_flip_locked(int fd, unsigned int sequence, unsigned int tv_sec, u
 
     ASSERT_NOT_NULL_MSG(crtc, "Invalid CRTC id");
 
+    if (crtc != builder->crtc) {
+        // This request turned off this CRTC (see kms_req_builder_disable_crtc),
+        // so it doesn't scan out its last frame anymore.
+        kms_req_swap_ptrs(&drmdev->per_crtc_state[crtc->index].last_flipped, NULL);
+        kms_req_unref(req);
+        return;
+    }
+
     if (drmdev->per_crtc_state[crtc->index].scanout_callback != NULL) {
         uint64_t vblank_ns = tv_sec * 1000000000ull + tv_usec * 1000ull;
         drmdev->per_crtc_state[crtc->index].scanout_callback(drmdev, vblank_ns, drmdev->per_crtc_state[crtc->index].userdata);
@@ -1381,7 +1534,9 @@ static int drmdev_on_modesetting_fd_ready_locked(struct drmdev *drmdev) {
         .sequence_handler = NULL,
     };
 
-    ok = drmHandleEvent(drmdev->master_fd, &ctx);
+    // Use the plain fd here, we might still get pageflip events
+    // for commits that were done before we were suspended.
+    ok = drmHandleEvent(drmdev->fd, &ctx);
     if (ok != 0) {
         return EIO;
     }
@@ -1435,6 +1590,35 @@ struct gbm_device *drmdev_get_gbm_device(struct drmdev *drmdev) {
     return drmdev->gbm_device;
 }
 
+struct gbm_device *drmdev_open_render_device(struct drmdev *drmdev, const char *path) {
+    struct gbm_device *gbm;
+    int fd;
+
+    ASSERT_NOT_NULL(drmdev);
+    ASSERT_NOT_NULL(path);
+    ASSERT_MSG(drmdev->render_gbm_device == NULL, "A render device was already opened for this drmdev.");
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Could not open render device \"%s\". open: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    gbm = gbm_create_device(fd);
+    if (gbm == NULL) {
+        LOG_ERROR("Could not create gbm device from render device \"%s\".\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    drmdev_lock(drmdev);
+    drmdev->render_gbm_device = gbm;
+    drmdev->render_fd = fd;
+    drmdev_unlock(drmdev);
+
+    return gbm;
+}
+
 int drmdev_get_last_vblank_locked(struct drmdev *drmdev, uint32_t crtc_id, uint64_t *last_vblank_ns_out) {
     int ok;
 
@@ -1608,6 +1792,43 @@ uint32_t drmdev_add_fb(
     );
 }
 
+/**
+ * @brief Close the GEM handles we got by importing a DMA-buffer.
+ *
+ * The framebuffers keep their own reference on the buffer, so the handles can be closed
+ * as soon as the framebuffers are added. Planes of the same buffer can share a handle,
+ * that one is only closed once.
+ */
+static void close_gem_handles(struct drmdev *drmdev, const uint32_t handles[4]) {
+    struct drm_gem_close args;
+    bool closed;
+    int ok;
+
+    for (int i = 0; i < 4; i++) {
+        if (handles[i] == 0) {
+            continue;
+        }
+
+        closed = false;
+        for (int j = 0; j < i; j++) {
+            if (handles[j] == handles[i]) {
+                closed = true;
+            }
+        }
+        if (closed) {
+            continue;
+        }
+
+        memset(&args, 0, sizeof args);
+        args.handle = handles[i];
+
+        ok = drmIoctl(drmdev->fd, DRM_IOCTL_GEM_CLOSE, &args);
+        if (ok < 0) {
+            LOG_ERROR("Couldn't close GEM handle. DRM_IOCTL_GEM_CLOSE: %s\n", strerror(errno));
+        }
+    }
+}
+
 uint32_t drmdev_add_fb_from_dmabuf_locked(
     struct drmdev *drmdev,
     uint32_t width,
@@ -1619,7 +1840,7 @@ uint32_t drmdev_add_fb_from_dmabuf_locked(
     bool has_modifier,
     uint64_t modifier
 ) {
-    uint32_t bo_handle;
+    uint32_t bo_handle, fb_id;
     int ok;
 
     ok = drmPrimeFDToHandle(drmdev->fd, prime_fd, &bo_handle);
@@ -1628,7 +1849,11 @@ uint32_t drmdev_add_fb_from_dmabuf_locked(
         return 0;
     }
 
-    return drmdev_add_fb_locked(drmdev, width, height, pixel_format, prime_fd, pitch, offset, has_modifier, modifier);
+    fb_id = drmdev_add_fb_locked(drmdev, width, height, pixel_format, bo_handle, pitch, offset, has_modifier, modifier);
+
+    close_gem_handles(drmdev, (uint32_t[4]){ bo_handle, 0 });
+
+    return fb_id;
 }
 
 uint32_t drmdev_add_fb_from_dmabuf(
@@ -1665,17 +1890,24 @@ uint32_t drmdev_add_fb_from_dmabuf_multiplanar_locked(
     const uint64_t modifiers[4]
 ) {
     uint32_t bo_handles[4] = { 0 };
+    uint32_t fb_id;
     int ok;
 
     for (int i = 0; (i < 4) && (prime_fds[i] != 0); i++) {
         ok = drmPrimeFDToHandle(drmdev->fd, prime_fds[i], bo_handles + i);
         if (ok < 0) {
             LOG_ERROR("Couldn't import DMA-buffer as GEM buffer. drmPrimeFDToHandle: %s\n", strerror(errno));
+            bo_handles[i] = 0;
+            close_gem_handles(drmdev, bo_handles);
             return 0;
         }
     }
 
-    return drmdev_add_fb_multiplanar_locked(drmdev, width, height, pixel_format, bo_handles, pitches, offsets, has_modifiers, modifiers);
+    fb_id = drmdev_add_fb_multiplanar_locked(drmdev, width, height, pixel_format, bo_handles, pitches, offsets, has_modifiers, modifiers);
+
+    close_gem_handles(drmdev, bo_handles);
+
+    return fb_id;
 }
 
 uint32_t drmdev_add_fb_from_dmabuf_multiplanar(
@@ -1710,34 +1942,67 @@ uint32_t drmdev_add_fb_from_dmabuf_multiplanar(
     return fb;
 }
 
-uint32_t drmdev_add_fb_from_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *bo, bool cast_opaque) {
-    enum pixfmt format;
-    uint32_t fourcc;
-    int n_planes;
-
-    n_planes = gbm_bo_get_plane_count(bo);
-    ASSERT(0 <= n_planes && n_planes <= 4);
+/**
+ * @brief Import a GBM buffer that was allocated on another DRM device (a separate render GPU, for example)
+ * into this drmdev, by exporting it as a DMA-buffer.
+ *
+ * Only single-planar buffers are supported, which is all the render surfaces ever allocate.
+ * The handle must be closed with @ref close_gem_handles when the framebuffers were added.
+ */
+static int import_foreign_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *bo, uint32_t handles_out[4], uint32_t pitches_out[4]) {
+    uint32_t pitch;
+    int fd, ok;
+
+    if (gbm_bo_get_plane_count(bo) != 1) {
+        LOG_ERROR("Only single-planar GBM buffers can be shared with another DRM device.\n");
+        return EINVAL;
+    }
 
-    fourcc = gbm_bo_get_format(bo);
+    // gbm_bo_get_stride_for_plane will return 0 and set errno on failure.
+    errno = 0;
+    pitch = gbm_bo_get_stride_for_plane(bo, 0);
+    if (pitch == 0 && errno != 0) {
+        ok = errno;
+        LOG_ERROR("Could not get framebuffer stride: %s\n", strerror(ok));
+        return ok;
+    }
 
-    if (!has_pixfmt_for_gbm_format(fourcc)) {
-        LOG_ERROR("GBM pixel format is not supported.\n");
-        return 0;
+    // gbm_bo_get_fd will dup us a new dmabuf fd.
+    fd = gbm_bo_get_fd(bo);
+    if (fd < 0) {
+        ok = errno;
+        LOG_ERROR("Couldn't get dmabuf fd for GBM buffer. gbm_bo_get_fd: %s\n", strerror(ok));
+        return ok;
     }
 
-    format = get_pixfmt_for_gbm_format(fourcc);
+    memset(handles_out, 0, 4 * sizeof *handles_out);
+    memset(pitches_out, 0, 4 * sizeof *pitches_out);
 
-    if (cast_opaque) {
-        format = pixfmt_opaque(format);
+    ok = drmPrimeFDToHandle(drmdev->fd, fd, handles_out);
+    if (ok < 0) {
+        ok = errno;
+        LOG_ERROR("Couldn't import DMA-buffer as GEM buffer. drmPrimeFDToHandle: %s\n", strerror(ok));
+        close(fd);
+        return ok;
     }
 
-    uint32_t handles[4];
-    uint32_t pitches[4];
+    // The GEM handle keeps a reference on the imported buffer, so we don't need the fd anymore.
+    close(fd);
 
-    // Returns DRM_FORMAT_MOD_INVALID on failure, or DRM_FORMAT_MOD_LINEAR
-    // for dumb buffers.
-    uint64_t modifier = gbm_bo_get_modifier(bo);
-    bool has_modifiers = modifier != DRM_FORMAT_MOD_INVALID;
+    pitches_out[0] = pitch;
+    return 0;
+}
+
+/**
+ * @brief Get the GEM handles and pitches of a GBM buffer allocated on the GBM device of this drmdev.
+ *
+ * The handles are owned by the GBM buffer.
+ */
+static int get_native_gbm_bo_handles(struct gbm_bo *bo, uint32_t handles_out[4], uint32_t pitches_out[4]) {
+    int n_planes;
+
+    n_planes = gbm_bo_get_plane_count(bo);
+    ASSERT(0 <= n_planes && n_planes <= 4);
 
     for (int i = 0; i < n_planes; i++) {
         // gbm_bo_get_handle_for_plane will return -1 (in gbm_bo_handle.s32) and
@@ -1746,27 +2011,46 @@ uint32_t drmdev_add_fb_from_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *
         union gbm_bo_handle handle = gbm_bo_get_handle_for_plane(bo, i);
         if (handle.s32 == -1) {
             LOG_ERROR("Could not get GEM handle for plane %d: %s\n", i, strerror(errno));
-            return 0;
+            return EIO;
         }
 
-        handles[i] = handle.u32;
+        handles_out[i] = handle.u32;
 
         // gbm_bo_get_stride_for_plane will return 0 and set errno on failure.
         errno = 0;
         uint32_t pitch = gbm_bo_get_stride_for_plane(bo, i);
         if (pitch == 0 && errno != 0) {
             LOG_ERROR("Could not get framebuffer stride for plane %d: %s\n", i, strerror(errno));
-            return 0;
+            return EIO;
         }
 
-        pitches[i] = pitch;
+        pitches_out[i] = pitch;
     }
 
     for (int i = n_planes; i < 4; i++) {
-        handles[i] = 0;
-        pitches[i] = 0;
+        handles_out[i] = 0;
+        pitches_out[i] = 0;
     }
 
+    return 0;
+}
+
+static uint32_t add_fb_from_gbm_bo_handles_locked(
+    struct drmdev *drmdev,
+    struct gbm_bo *bo,
+    enum pixfmt format,
+    const uint32_t handles[4],
+    const uint32_t pitches[4]
+) {
+    int n_planes;
+
+    n_planes = gbm_bo_get_plane_count(bo);
+
+    // Returns DRM_FORMAT_MOD_INVALID on failure, or DRM_FORMAT_MOD_LINEAR
+    // for dumb buffers.
+    uint64_t modifier = gbm_bo_get_modifier(bo);
+    bool has_modifiers = modifier != DRM_FORMAT_MOD_INVALID;
+
     return drmdev_add_fb_multiplanar_locked(
         drmdev,
         gbm_bo_get_width(bo),
@@ -1790,6 +2074,106 @@ uint32_t drmdev_add_fb_from_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *
     );
 }
 
+int drmdev_add_fbs_from_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *bo, uint32_t *fb_id_out, uint32_t *opaque_fb_id_out) {
+    enum pixfmt format;
+    uint32_t handles[4], pitches[4];
+    uint32_t fb_id, opaque_fb_id;
+    uint32_t fourcc;
+    bool imported;
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+    ASSERT_NOT_NULL(bo);
+    assert(fb_id_out != NULL || opaque_fb_id_out != NULL);
+
+    fourcc = gbm_bo_get_format(bo);
+
+    if (!has_pixfmt_for_gbm_format(fourcc)) {
+        LOG_ERROR("GBM pixel format is not supported.\n");
+        return EINVAL;
+    }
+
+    format = get_pixfmt_for_gbm_format(fourcc);
+
+    // GEM handles are only valid on the device the buffer was allocated on.
+    // If it was rendered on another GPU, we need to go through PRIME instead.
+    // Both framebuffers share the one imported handle.
+    imported = gbm_bo_get_device(bo) != drmdev->gbm_device;
+    if (imported) {
+        ok = import_foreign_gbm_bo_locked(drmdev, bo, handles, pitches);
+    } else {
+        ok = get_native_gbm_bo_handles(bo, handles, pitches);
+    }
+    if (ok != 0) {
+        return ok;
+    }
+
+    fb_id = 0;
+    opaque_fb_id = 0;
+
+    if (fb_id_out != NULL) {
+        fb_id = add_fb_from_gbm_bo_handles_locked(drmdev, bo, format, handles, pitches);
+        if (fb_id == 0) {
+            ok = EIO;
+            goto out_close_handles;
+        }
+    }
+
+    if (opaque_fb_id_out != NULL) {
+        opaque_fb_id = add_fb_from_gbm_bo_handles_locked(drmdev, bo, pixfmt_opaque(format), handles, pitches);
+        if (opaque_fb_id == 0) {
+            ok = EIO;
+            goto out_rm_fb;
+        }
+    }
+
+    if (fb_id_out != NULL) {
+        *fb_id_out = fb_id;
+    }
+    if (opaque_fb_id_out != NULL) {
+        *opaque_fb_id_out = opaque_fb_id;
+    }
+
+    ok = 0;
+    goto out_close_handles;
+
+out_rm_fb:
+    if (fb_id != 0) {
+        drmdev_rm_fb_locked(drmdev, fb_id);
+    }
+
+out_close_handles:
+    if (imported) {
+        close_gem_handles(drmdev, handles);
+    }
+    return ok;
+}
+
+int drmdev_add_fbs_from_gbm_bo(struct drmdev *drmdev, struct gbm_bo *bo, uint32_t *fb_id_out, uint32_t *opaque_fb_id_out) {
+    int ok;
+
+    drmdev_lock(drmdev);
+
+    ok = drmdev_add_fbs_from_gbm_bo_locked(drmdev, bo, fb_id_out, opaque_fb_id_out);
+
+    drmdev_unlock(drmdev);
+
+    return ok;
+}
+
+uint32_t drmdev_add_fb_from_gbm_bo_locked(struct drmdev *drmdev, struct gbm_bo *bo, bool cast_opaque) {
+    uint32_t fb_id;
+    int ok;
+
+    if (cast_opaque) {
+        ok = drmdev_add_fbs_from_gbm_bo_locked(drmdev, bo, NULL, &fb_id);
+    } else {
+        ok = drmdev_add_fbs_from_gbm_bo_locked(drmdev, bo, &fb_id, NULL);
+    }
+
+    return ok == 0 ? fb_id : 0;
+}
+
 uint32_t drmdev_add_fb_from_gbm_bo(struct drmdev *drmdev, struct gbm_bo *bo, bool cast_opaque) {
     uint32_t fb;
 
@@ -1849,73 +2233,168 @@ bool drmdev_can_modeset(struct drmdev *drmdev) {
     return can_modeset;
 }
 
-void drmdev_suspend(struct drmdev *drmdev) {
-    ASSERT_NOT_NULL(drmdev);
-
-    drmdev_lock(drmdev);
-
-    if (drmdev->master_fd <= 0) {
-        LOG_ERROR("drmdev_suspend was called, but drmdev is already suspended\n");
-        drmdev_unlock(drmdev);
-        return;
-    }
-
-    drmdev->interface.close(drmdev->master_fd, drmdev->master_fd_metadata, drmdev->userdata);
-    drmdev->master_fd = -1;
-    drmdev->master_fd_metadata = NULL;
-
-    drmdev_unlock(drmdev);
-}
+static int drmdev_refetch_committed_state_locked(struct drmdev *drmdev) {
+    struct drm_connector *connector;
+    struct drm_crtc *crtc;
+    struct drm_plane *plane;
 
-int drmdev_resume(struct drmdev *drmdev) {
-    drmDevicePtr device;
-    void *fd_metadata;
-    int ok, master_fd;
+    // While we were suspended, some other DRM master (a different session, fbcon, ...)
+    // might've changed the connector routing, CRTC modes and plane configuration.
+    // Re-read the parts of the state that we use to decide what to commit.
+    for_each_connector_in_drmdev(drmdev, connector) {
+        drmModeConnector *kms_connector = drmModeGetConnector(drmdev->fd, connector->id);
+        if (kms_connector == NULL) {
+            LOG_ERROR("Could not re-probe DRM connector. drmModeGetConnector: %s\n", strerror(errno));
+            return errno;
+        }
 
-    ASSERT_NOT_NULL(drmdev);
+        connector->variable_state.connection_state = (enum drm_connection_state) kms_connector->connection;
+        connector->committed_state.encoder_id = kms_connector->encoder_id;
+        connector->committed_state.crtc_id = DRM_ID_NONE;
 
-    drmdev_lock(drmdev);
+        if (kms_connector->encoder_id != 0) {
+            drmModeEncoder *encoder = drmModeGetEncoder(drmdev->fd, kms_connector->encoder_id);
+            if (encoder != NULL) {
+                connector->committed_state.crtc_id = encoder->crtc_id;
+                drmModeFreeEncoder(encoder);
+            }
+        }
 
-    if (drmdev->master_fd > 0) {
-        ok = EINVAL;
-        LOG_ERROR("drmdev_resume was called, but drmdev is already resumed\n");
-        goto fail_unlock;
+        drmModeFreeConnector(kms_connector);
     }
 
-    ok = drmGetDevice(drmdev->fd, &device);
-    if (ok < 0) {
-        ok = errno;
-        LOG_ERROR("Couldn't query DRM device info. drmGetDevice: %s\n", strerror(ok));
-        goto fail_unlock;
-    }
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        // We don't know whether the mode that's active right now was applied
+        // with the connector routing we want, so always do a full modeset on the
+        // next commit.
+        if (crtc->committed_state.mode_blob != NULL) {
+            drm_mode_blob_destroy(crtc->committed_state.mode_blob);
+            crtc->committed_state.mode_blob = NULL;
+        }
 
-    ok = drmdev->interface.open(device->nodes[DRM_NODE_PRIMARY], O_CLOEXEC | O_NONBLOCK, &fd_metadata, drmdev->userdata);
-    if (ok < 0) {
-        ok = -ok;
-        LOG_ERROR("Couldn't open DRM device.\n");
-        goto fail_free_device;
+        crtc->committed_state.has_mode = false;
     }
 
-    master_fd = ok;
+    for_each_plane_in_drmdev(drmdev, plane) {
+        drmModePlane *kms_plane = drmModeGetPlane(drmdev->fd, plane->id);
+        if (kms_plane == NULL) {
+            LOG_ERROR("Could not re-probe DRM plane. drmModeGetPlane: %s\n", strerror(errno));
+            return errno;
+        }
 
-    drmFreeDevice(&device);
+        plane->committed_state.crtc_id = kms_plane->crtc_id;
+        plane->committed_state.fb_id = kms_plane->fb_id;
 
-    ok = set_drm_client_caps(master_fd, NULL);
-    if (ok != 0) {
-        goto fail_close_device;
+        // The framebuffer on this plane was possibly added by someone else,
+        // so we don't know its format anymore.
+        plane->committed_state.has_format = false;
+        list_for_each_entry(struct drm_fb, fb, &drmdev->fbs, entry) {
+            if (fb->id == kms_plane->fb_id) {
+                plane->committed_state.has_format = true;
+                plane->committed_state.format = fb->format;
+                break;
+            }
+        }
+
+        drmModeFreePlane(kms_plane);
     }
 
-    drmdev->master_fd = master_fd;
-    drmdev->master_fd_metadata = fd_metadata;
-    drmdev_unlock(drmdev);
     return 0;
+}
 
-fail_close_device:
-    drmdev->interface.close(master_fd, fd_metadata, drmdev->userdata);
-    goto fail_unlock;
+int drmdev_reprobe_connectors(struct drmdev *drmdev) {
+    struct drm_connector *connector;
+    struct drm_connector reprobed;
+    int ok;
 
-fail_free_device:
-    drmFreeDevice(&device);
+    ASSERT_NOT_NULL(drmdev);
+
+    drmdev_lock(drmdev);
+
+    for_each_connector_in_drmdev(drmdev, connector) {
+        // drmModeGetConnector (called by fetch_connector) will force the kernel to
+        // probe the connector again, so we'll get the new list of modes too.
+        ok = fetch_connector(drmdev->fd, connector->id, &reprobed);
+        if (ok != 0) {
+            LOG_ERROR("Could not re-probe DRM connector. fetch_connector: %s\n", strerror(ok));
+            drmdev_unlock(drmdev);
+            return ok;
+        }
+
+        // Update in-place, so pointers to this connector stay valid.
+        // Pointers to the old modes of this connector are invalid from here on.
+        free_connector(connector);
+        connector->variable_state = reprobed.variable_state;
+        connector->committed_state = reprobed.committed_state;
+    }
+
+    drmdev_unlock(drmdev);
+    return 0;
+}
+
+void drmdev_suspend(struct drmdev *drmdev) {
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+
+    drmdev_lock(drmdev);
+
+    if (drmdev->master_fd <= 0) {
+        LOG_ERROR("drmdev_suspend was called, but drmdev is already suspended\n");
+        drmdev_unlock(drmdev);
+        return;
+    }
+
+    // We don't close the fd here, so all the GBM buffers & DRM framebuffers
+    // we created stay valid and we can just re-present them when we're resumed.
+    //
+    // When we're using libseat, the seat daemon / logind will revoke DRM master
+    // for us anyway, so it's fine if this fails.
+    ok = drmDropMaster(drmdev->fd);
+    if (ok < 0) {
+        LOG_DEBUG("Couldn't drop DRM master. drmDropMaster: %s\n", strerror(errno));
+    }
+
+    drmdev->master_fd = -1;
+
+    drmdev_unlock(drmdev);
+}
+
+int drmdev_resume(struct drmdev *drmdev) {
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+
+    drmdev_lock(drmdev);
+
+    if (drmdev->master_fd > 0) {
+        ok = EINVAL;
+        LOG_ERROR("drmdev_resume was called, but drmdev is already resumed\n");
+        goto fail_unlock;
+    }
+
+    // libseat / logind will give us DRM master back when our session is
+    // activated again. If we opened the device ourselves, we need to re-acquire it.
+    if (!is_drm_master(drmdev->fd)) {
+        ok = drmSetMaster(drmdev->fd);
+        if (ok < 0) {
+            ok = errno;
+            LOG_ERROR("Couldn't become DRM master. drmSetMaster: %s\n", strerror(ok));
+            goto fail_unlock;
+        }
+    }
+
+    ok = drmdev_refetch_committed_state_locked(drmdev);
+    if (ok != 0) {
+        goto fail_drop_master;
+    }
+
+    drmdev->master_fd = drmdev->fd;
+    drmdev_unlock(drmdev);
+    return 0;
+
+fail_drop_master:
+    drmDropMaster(drmdev->fd);
 
 fail_unlock:
     drmdev_unlock(drmdev);
@@ -1932,6 +2411,84 @@ int drmdev_move_cursor(struct drmdev *drmdev, uint32_t crtc_id, struct vec2i pos
     return 0;
 }
 
+int drmdev_set_crtc_active(struct drmdev *drmdev, uint32_t crtc_id, uint32_t connector_id, bool active) {
+    struct drm_connector *connector;
+    drmModeAtomicReq *req;
+    struct drm_crtc *crtc;
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+
+    drmdev_lock(drmdev);
+
+    if (drmdev->master_fd <= 0) {
+        ok = EBUSY;
+        goto fail_unlock;
+    }
+
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        if (crtc->id == crtc_id) {
+            break;
+        }
+    }
+
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (connector->id == connector_id) {
+            break;
+        }
+    }
+
+    if (crtc == NULL || connector == NULL) {
+        LOG_ERROR("Could not find CRTC or connector with given id.\n");
+        ok = EINVAL;
+        goto fail_unlock;
+    }
+
+    if (drmdev->supports_atomic_modesetting && DRM_ID_IS_VALID(crtc->ids.active)) {
+        req = drmModeAtomicAlloc();
+        if (req == NULL) {
+            ok = ENOMEM;
+            goto fail_unlock;
+        }
+
+        drmModeAtomicAddProperty(req, crtc->id, crtc->ids.active, active ? 1 : 0);
+
+        // Toggling ACTIVE is a modeset, even though the mode stays the same.
+        // This is a blocking commit, so it'll wait for any frames that are still pending on this CRTC.
+        ok = drmModeAtomicCommit(drmdev->master_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+        if (ok < 0) {
+            ok = errno;
+            LOG_ERROR("Could not turn display %s. drmModeAtomicCommit: %s\n", active ? "on" : "off", strerror(ok));
+            drmModeAtomicFree(req);
+            goto fail_unlock;
+        }
+
+        drmModeAtomicFree(req);
+    } else if (DRM_ID_IS_VALID(connector->ids.dpms)) {
+        ok = drmModeConnectorSetProperty(
+            drmdev->master_fd,
+            connector->id,
+            connector->ids.dpms,
+            active ? DRM_MODE_DPMS_ON : DRM_MODE_DPMS_OFF
+        );
+        if (ok < 0) {
+            ok = errno;
+            LOG_ERROR("Could not turn display %s. drmModeConnectorSetProperty: %s\n", active ? "on" : "off", strerror(ok));
+            goto fail_unlock;
+        }
+    } else {
+        ok = EOPNOTSUPP;
+        goto fail_unlock;
+    }
+
+    drmdev_unlock(drmdev);
+    return 0;
+
+fail_unlock:
+    drmdev_unlock(drmdev);
+    return ok;
+}
+
 static void drmdev_set_scanout_callback_locked(
     struct drmdev *drmdev,
     uint32_t crtc_id,
@@ -2059,6 +2616,8 @@ static bool plane_qualifies(
     bool has_modifier, uint64_t modifier,
     bool has_zpos, int64_t zpos_lower_limit, int64_t zpos_upper_limit,
     bool has_rotation, drm_plane_transform_t rotation,
+    bool needs_alpha,
+    bool has_blend_mode, enum drm_blend_mode blend_mode,
     bool has_id_range, uint32_t id_lower_limit
     // clang-format on
 ) {
@@ -2171,6 +2730,21 @@ static bool plane_qualifies(
         }
     }
 
+    if (needs_alpha && !plane->has_alpha) {
+        LOG_DRM_PLANE_ALLOCATION_DEBUG("    does not qualify: plane alpha requested but plane has no alpha property.\n");
+        return false;
+    }
+    if (has_blend_mode) {
+        if (plane->has_blend_mode && !plane->supported_blend_modes[blend_mode]) {
+            LOG_DRM_PLANE_ALLOCATION_DEBUG("    does not qualify: requested pixel blend mode is not supported by the plane.\n");
+            return false;
+        } else if (!plane->has_blend_mode && blend_mode != kPremultiplied_DrmBlendMode) {
+            // Planes without a pixel blend mode property blend premultiplied alpha.
+            LOG_DRM_PLANE_ALLOCATION_DEBUG("    does not qualify: requested pixel blend mode but plane has no blend mode property.\n");
+            return false;
+        }
+    }
+
     LOG_DRM_PLANE_ALLOCATION_DEBUG("    does qualify.\n");
     return true;
 }
@@ -2185,6 +2759,8 @@ static struct drm_plane *allocate_plane(
     bool has_modifier, uint64_t modifier,
     bool has_zpos, int64_t zpos_lower_limit, int64_t zpos_upper_limit,
     bool has_rotation, drm_plane_transform_t rotation,
+    bool needs_alpha,
+    bool has_blend_mode, enum drm_blend_mode blend_mode,
     bool has_id_range, uint32_t id_lower_limit
     // clang-format on
 ) {
@@ -2206,6 +2782,9 @@ static struct drm_plane *allocate_plane(
                 zpos_upper_limit,
                 has_rotation,
                 rotation,
+                needs_alpha,
+                has_blend_mode,
+                blend_mode,
                 has_id_range,
                 id_lower_limit
             );
@@ -2315,6 +2894,25 @@ struct kms_req_builder *drmdev_create_request_builder(struct drmdev *drmdev, uin
     builder->n_layers = 0;
     builder->has_mode = false;
     builder->unset_mode = false;
+    builder->has_gamma_lut = false;
+    builder->gamma_lut_size = 0;
+    builder->gamma_lut = NULL;
+    builder->has_ctm = false;
+    builder->reset_ctm = false;
+    builder->has_max_bpc = false;
+    builder->max_bpc = 0;
+    builder->has_colorspace = false;
+    builder->colorspace = kDefault_DrmColorspace;
+    builder->has_hdr_metadata = false;
+    builder->reset_hdr_metadata = false;
+    builder->writeback.connector = NULL;
+    builder->writeback.fb_id = 0;
+    builder->writeback.out_fence_fd = -1;
+    builder->writeback.callback = NULL;
+    builder->writeback.userdata = NULL;
+    builder->writeback_route.connector = NULL;
+    builder->writeback_route.crtc_id = 0;
+    builder->disable_crtc = NULL;
     return builder;
 
 fail_free_builder:
@@ -2327,6 +2925,10 @@ fail_unlock:
 
 static void kms_req_builder_destroy(struct kms_req_builder *builder) {
     /// TODO: Is this complete?
+    if (builder->writeback.callback != NULL) {
+        // The request was never (successfully) committed.
+        builder->writeback.callback(builder->writeback.userdata, -1);
+    }
     for (int i = 0; i < builder->n_layers; i++) {
         if (builder->layers[i].release_callback != NULL) {
             builder->layers[i].release_callback(builder->layers[i].release_callback_userdata);
@@ -2335,6 +2937,7 @@ static void kms_req_builder_destroy(struct kms_req_builder *builder) {
     if (builder->req != NULL) {
         drmModeAtomicFree(builder->req);
     }
+    free(builder->gamma_lut);
     drmdev_unref(builder->drmdev);
     free(builder);
 }
@@ -2369,6 +2972,271 @@ int kms_req_builder_unset_mode(struct kms_req_builder *builder) {
     return 0;
 }
 
+int kms_req_builder_set_gamma_lut(struct kms_req_builder *builder, size_t size, const struct drm_color_lut *lut) {
+    struct drm_color_lut *copy;
+
+    ASSERT_NOT_NULL(builder);
+
+    if (builder->crtc->gamma_lut_size == 0) {
+        return EOPNOTSUPP;
+    }
+
+    if (builder->supports_atomic && !DRM_ID_IS_VALID(builder->crtc->ids.gamma_lut)) {
+        return EOPNOTSUPP;
+    }
+
+    if (lut != NULL) {
+        if (size != builder->crtc->gamma_lut_size) {
+            LOG_ERROR(
+                "Gamma LUT has the wrong size. expected: %" PRIu32 ", got: %zu\n",
+                builder->crtc->gamma_lut_size,
+                size
+            );
+            return EINVAL;
+        }
+
+        copy = memdup(lut, size * sizeof *lut);
+        if (copy == NULL) {
+            return ENOMEM;
+        }
+    } else {
+        copy = NULL;
+        size = 0;
+    }
+
+    free(builder->gamma_lut);
+    builder->has_gamma_lut = true;
+    builder->gamma_lut_size = size;
+    builder->gamma_lut = copy;
+    return 0;
+}
+
+int kms_req_builder_set_ctm(struct kms_req_builder *builder, const struct drm_color_ctm *ctm) {
+    ASSERT_NOT_NULL(builder);
+
+    if (builder->use_legacy || !DRM_ID_IS_VALID(builder->crtc->ids.ctm)) {
+        return EOPNOTSUPP;
+    }
+
+    builder->has_ctm = true;
+    if (ctm != NULL) {
+        builder->reset_ctm = false;
+        builder->ctm = *ctm;
+    } else {
+        builder->reset_ctm = true;
+    }
+    return 0;
+}
+
+int kms_req_builder_set_max_bpc(struct kms_req_builder *builder, uint32_t max_bpc) {
+    ASSERT_NOT_NULL(builder);
+
+    if (builder->connector == NULL) {
+        return EINVAL;
+    }
+
+    if (builder->use_legacy || !DRM_ID_IS_VALID(builder->connector->ids.max_bpc) || builder->connector->max_bpc_limit == 0) {
+        return EOPNOTSUPP;
+    }
+
+    builder->has_max_bpc = true;
+    builder->max_bpc = MIN2(max_bpc, builder->connector->max_bpc_limit);
+    return 0;
+}
+
+int kms_req_builder_set_colorspace(struct kms_req_builder *builder, enum drm_colorspace colorspace) {
+    ASSERT_NOT_NULL(builder);
+    assert(colorspace >= 0 && colorspace <= kMax_DrmColorspace);
+
+    if (builder->connector == NULL) {
+        return EINVAL;
+    }
+
+    if (builder->use_legacy || !DRM_ID_IS_VALID(builder->connector->ids.colorspace)) {
+        return EOPNOTSUPP;
+    }
+
+    if (!builder->connector->supported_colorspaces[colorspace]) {
+        return EOPNOTSUPP;
+    }
+
+    builder->has_colorspace = true;
+    builder->colorspace = colorspace;
+    return 0;
+}
+
+int kms_req_builder_set_hdr_output_metadata(struct kms_req_builder *builder, const struct drm_hdr_output_metadata *metadata) {
+    ASSERT_NOT_NULL(builder);
+
+    if (builder->connector == NULL) {
+        return EINVAL;
+    }
+
+    if (builder->use_legacy || !DRM_ID_IS_VALID(builder->connector->ids.hdr_output_metadata)) {
+        return EOPNOTSUPP;
+    }
+
+    builder->has_hdr_metadata = true;
+    if (metadata != NULL) {
+        builder->reset_hdr_metadata = false;
+        builder->hdr_metadata = *metadata;
+    } else {
+        builder->reset_hdr_metadata = true;
+    }
+    return 0;
+}
+
+int kms_req_builder_set_writeback(
+    struct kms_req_builder *builder,
+    uint32_t connector_id,
+    uint32_t fb_id,
+    kms_writeback_cb_t callback,
+    void *userdata
+) {
+    struct drm_connector *conn;
+
+    ASSERT_NOT_NULL(builder);
+    ASSERT_NOT_NULL(callback);
+    assert(DRM_ID_IS_VALID(connector_id));
+    assert(DRM_ID_IS_VALID(fb_id));
+
+    if (builder->use_legacy) {
+        return EOPNOTSUPP;
+    }
+
+    if (builder->writeback.callback != NULL) {
+        // There can only be one writeback job per commit.
+        return EBUSY;
+    }
+
+    for_each_connector_in_drmdev(builder->drmdev, conn) {
+        if (conn->id == connector_id) {
+            break;
+        }
+    }
+
+    if (conn == NULL || conn->type != kWRITEBACK_DrmConnectorType) {
+        LOG_ERROR("Could not find writeback connector with id %" PRIu32 "\n", connector_id);
+        return EINVAL;
+    }
+
+    if (!DRM_ID_IS_VALID(conn->ids.writeback_fb_id) || !DRM_ID_IS_VALID(conn->ids.writeback_out_fence_ptr)) {
+        return EOPNOTSUPP;
+    }
+
+    // The connector needs to be routed to our CRTC, either already or with this request.
+    if (builder->writeback_route.connector == conn ? builder->writeback_route.crtc_id != builder->crtc->id :
+                                                      conn->committed_state.crtc_id != builder->crtc->id) {
+        LOG_ERROR("Writeback connector %" PRIu32 " is not routed to this CRTC.\n", connector_id);
+        return EINVAL;
+    }
+
+    builder->writeback.connector = conn;
+    builder->writeback.fb_id = fb_id;
+    builder->writeback.out_fence_fd = -1;
+    builder->writeback.callback = callback;
+    builder->writeback.userdata = userdata;
+    return 0;
+}
+
+int kms_req_builder_route_writeback_connector(struct kms_req_builder *builder, uint32_t connector_id, bool attach) {
+    struct drm_connector *conn;
+
+    ASSERT_NOT_NULL(builder);
+    assert(DRM_ID_IS_VALID(connector_id));
+
+    if (builder->use_legacy) {
+        return EOPNOTSUPP;
+    }
+
+    for_each_connector_in_drmdev(builder->drmdev, conn) {
+        if (conn->id == connector_id) {
+            break;
+        }
+    }
+
+    if (conn == NULL || conn->type != kWRITEBACK_DrmConnectorType) {
+        LOG_ERROR("Could not find writeback connector with id %" PRIu32 "\n", connector_id);
+        return EINVAL;
+    }
+
+    if (builder->writeback.connector == conn && !attach) {
+        // We can't write back a frame using a connector we're detaching.
+        return EBUSY;
+    }
+
+    builder->writeback_route.connector = conn;
+    builder->writeback_route.crtc_id = attach ? builder->crtc->id : 0;
+    return 0;
+}
+
+static int get_crtc_active(struct drmdev *drmdev, struct drm_crtc *crtc, bool *active_out) {
+    drmModeObjectProperties *props;
+    drmModeCrtc *kms_crtc;
+    int ok;
+
+    if (drmdev->supports_atomic_modesetting && DRM_ID_IS_VALID(crtc->ids.active)) {
+        props = drmModeObjectGetProperties(drmdev->fd, crtc->id, DRM_MODE_OBJECT_CRTC);
+        if (props == NULL) {
+            ok = errno;
+            LOG_ERROR("Could not query CRTC state. drmModeObjectGetProperties: %s\n", strerror(ok));
+            return ok;
+        }
+
+        *active_out = false;
+        for (uint32_t i = 0; i < props->count_props; i++) {
+            if (props->props[i] == crtc->ids.active) {
+                *active_out = props->prop_values[i] != 0;
+                break;
+            }
+        }
+
+        drmModeFreeObjectProperties(props);
+    } else {
+        kms_crtc = drmModeGetCrtc(drmdev->fd, crtc->id);
+        if (kms_crtc == NULL) {
+            ok = errno;
+            LOG_ERROR("Could not query CRTC state. drmModeGetCrtc: %s\n", strerror(ok));
+            return ok;
+        }
+
+        *active_out = kms_crtc->mode_valid;
+        drmModeFreeCrtc(kms_crtc);
+    }
+
+    return 0;
+}
+
+int kms_req_builder_disable_crtc(struct kms_req_builder *builder, uint32_t crtc_id) {
+    struct drm_crtc *crtc;
+    bool active;
+    int ok;
+
+    ASSERT_NOT_NULL(builder);
+    assert(DRM_ID_IS_VALID(crtc_id));
+
+    for_each_crtc_in_drmdev(builder->drmdev, crtc) {
+        if (crtc->id == crtc_id) {
+            break;
+        }
+    }
+
+    if (crtc == NULL || crtc == builder->crtc) {
+        LOG_ERROR("Could not disable invalid CRTC %" PRIu32 ".\n", crtc_id);
+        return EINVAL;
+    }
+
+    // We don't track whether a CRTC is on across a reprobe, so ask the kernel.
+    // It rejects commits requesting a page flip event for a CRTC that's off and stays off.
+    ok = get_crtc_active(builder->drmdev, crtc, &active);
+    if (ok != 0) {
+        return ok;
+    }
+
+    builder->disable_crtc = active ? crtc : NULL;
+    return 0;
+}
+
 int kms_req_builder_set_connector(struct kms_req_builder *builder, uint32_t connector_id) {
     struct drm_connector *conn;
 
@@ -2400,6 +3268,7 @@ int kms_req_builder_push_fb_layer(
     struct drm_plane *plane;
     int64_t zpos;
     bool has_zpos;
+    bool needs_alpha, needs_blend_mode;
     bool close_in_fence_fd_after;
     int ok, index;
 
@@ -2418,6 +3287,16 @@ int kms_req_builder_push_fb_layer(
         return EINVAL;
     }
 
+    // Planes without a pixel blend mode property blend premultiplied, so that's only a requirement
+    // for the plane if it's another blend mode.
+    needs_alpha = layer->has_alpha && layer->alpha != DRM_BLEND_ALPHA_OPAQUE;
+    needs_blend_mode = layer->has_blend_mode && layer->blend_mode != kPremultiplied_DrmBlendMode;
+    if (builder->use_legacy && (needs_alpha || needs_blend_mode)) {
+        // legacy modesetting has no way to set plane properties.
+        LOG_DEBUG("Plane alpha and pixel blend modes are not supported for legacy modesetting.\n");
+        return EOPNOTSUPP;
+    }
+
     close_in_fence_fd_after = false;
     if (builder->use_legacy && layer->has_in_fence_fd) {
         LOG_DEBUG("Explicit fencing is not supported for legacy modesetting. Implicit fencing will be used instead.\n");
@@ -2440,6 +3319,8 @@ int kms_req_builder_push_fb_layer(
             /* modifier */ layer->has_modifier, layer->modifier,
             /* zpos */ false, 0, 0,
             /* rotation */ layer->has_rotation, layer->rotation,
+            /* alpha */ needs_alpha,
+            /* blend_mode */ layer->has_blend_mode, layer->blend_mode,
             /* id_range */ false, 0
             // clang-format on
         );
@@ -2464,6 +3345,8 @@ int kms_req_builder_push_fb_layer(
             /* modifier */ layer->has_modifier, layer->modifier,
             /* zpos */ false, 0, 0,
             /* rotation */ layer->has_rotation, layer->rotation,
+            /* alpha */ needs_alpha,
+            /* blend_mode */ layer->has_blend_mode, layer->blend_mode,
             /* id_range */ false, 0
             // clang-format on
         );
@@ -2480,6 +3363,8 @@ int kms_req_builder_push_fb_layer(
                 /* modifier */ layer->has_modifier, layer->modifier,
                 /* zpos */ false, 0, 0,
                 /* rotation */ layer->has_rotation, layer->rotation,
+                /* alpha */ needs_alpha,
+                /* blend_mode */ layer->has_blend_mode, layer->blend_mode,
                 /* id_range */ false, 0
                 // clang-format on
             );
@@ -2496,6 +3381,8 @@ int kms_req_builder_push_fb_layer(
             /* modifier */ layer->has_modifier, layer->modifier,
             /* zpos */ true, builder->next_zpos, INT64_MAX,
             /* rotation */ layer->has_rotation, layer->rotation,
+            /* alpha */ needs_alpha,
+            /* blend_mode */ layer->has_blend_mode, layer->blend_mode,
             /* id_range */ false, 0
             // clang-format on
         );
@@ -2515,13 +3402,19 @@ int kms_req_builder_push_fb_layer(
                 /* modifier */ layer->has_modifier, layer->modifier,
                 /* zpos */ false, 0, 0,
                 /* rotation */ layer->has_rotation, layer->rotation,
+                /* alpha */ needs_alpha,
+                /* blend_mode */ layer->has_blend_mode, layer->blend_mode,
                 /* id_range */ true, builder->layers[index - 1].plane_id + 1
                 // clang-format on
             );
         }
     }
 
-    if (plane == NULL) {
+    if (plane == NULL && (needs_alpha || needs_blend_mode)) {
+        // Let the caller decide whether it wants to try again without blending.
+        LOG_DEBUG("Could not find an unused DRM plane that supports the requested plane alpha / blend mode.\n");
+        return EOPNOTSUPP;
+    } else if (plane == NULL) {
         LOG_ERROR("Could not find a suitable unused DRM plane for pushing the framebuffer.\n");
         return EIO;
     }
@@ -2566,14 +3459,17 @@ int kms_req_builder_push_fb_layer(
             drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.rotation, layer->rotation.u64);
         }
 
-        if (index == 0) {
-            if (plane->has_alpha) {
-                drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.alpha, DRM_BLEND_ALPHA_OPAQUE);
-            }
+        // Always set the alpha, so we don't inherit a non-opaque alpha from a previous
+        // user of this plane.
+        if (plane->has_alpha) {
+            drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.alpha, needs_alpha ? layer->alpha : DRM_BLEND_ALPHA_OPAQUE);
+        }
 
-            if (plane->has_blend_mode && plane->supported_blend_modes[kNone_DrmBlendMode]) {
-                drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.pixel_blend_mode, kNone_DrmBlendMode);
-            }
+        if (plane->has_blend_mode && layer->has_blend_mode) {
+            drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.pixel_blend_mode, plane->blend_mode_values[layer->blend_mode]);
+        } else if (plane->has_blend_mode && index == 0 && plane->supported_blend_modes[kNone_DrmBlendMode]) {
+            // There's nothing below the first layer to blend with anyway.
+            drmModeAtomicAddProperty(builder->req, plane_id, plane->ids.pixel_blend_mode, plane->blend_mode_values[kNone_DrmBlendMode]);
         }
     }
 
@@ -2643,11 +3539,144 @@ static bool drm_plane_is_active(struct drm_plane *plane) {
     return plane->committed_state.fb_id != 0 && plane->committed_state.crtc_id != 0;
 }
 
+static bool kms_req_builder_uses_plane(struct kms_req_builder *builder, struct drm_plane *plane) {
+    for (int i = 0; i < builder->n_layers; i++) {
+        if (builder->layers[i].plane == plane) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int set_legacy_gamma_locked(struct kms_req_builder *builder) {
+    uint16_t *ramps;
+    size_t size;
+    int ok;
+
+    size = builder->crtc->gamma_lut_size;
+
+    ramps = malloc(3 * size * sizeof *ramps);
+    if (ramps == NULL) {
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        if (builder->gamma_lut != NULL) {
+            ramps[i] = builder->gamma_lut[i].red;
+            ramps[size + i] = builder->gamma_lut[i].green;
+            ramps[2 * size + i] = builder->gamma_lut[i].blue;
+        } else {
+            // reset to a linear ramp
+            uint16_t value = size > 1 ? (uint16_t) ((i * 0xFFFF) / (size - 1)) : 0xFFFF;
+            ramps[i] = value;
+            ramps[size + i] = value;
+            ramps[2 * size + i] = value;
+        }
+    }
+
+    ok = drmModeCrtcSetGamma(builder->drmdev->master_fd, builder->crtc->id, size, ramps, ramps + size, ramps + 2 * size);
+    if (ok != 0) {
+        ok = errno;
+        LOG_ERROR("Could not set gamma ramp. drmModeCrtcSetGamma: %s\n", strerror(ok));
+    }
+
+    free(ramps);
+    return ok;
+}
+
+static int add_color_props_locked(struct kms_req_builder *builder, uint32_t *gamma_lut_blob_id_out, uint32_t *ctm_blob_id_out) {
+    uint32_t gamma_lut_blob_id, ctm_blob_id;
+    int ok;
+
+    gamma_lut_blob_id = 0;
+    ctm_blob_id = 0;
+
+    if (builder->has_gamma_lut && builder->gamma_lut != NULL) {
+        ok = drmModeCreatePropertyBlob(
+            builder->drmdev->fd,
+            builder->gamma_lut,
+            builder->gamma_lut_size * sizeof *builder->gamma_lut,
+            &gamma_lut_blob_id
+        );
+        if (ok != 0) {
+            ok = errno;
+            LOG_ERROR("Couldn't upload gamma LUT to kernel. drmModeCreatePropertyBlob: %s\n", strerror(ok));
+            return ok;
+        }
+    }
+
+    if (builder->has_ctm && !builder->reset_ctm) {
+        ok = drmModeCreatePropertyBlob(builder->drmdev->fd, &builder->ctm, sizeof builder->ctm, &ctm_blob_id);
+        if (ok != 0) {
+            ok = errno;
+            LOG_ERROR("Couldn't upload color transformation matrix to kernel. drmModeCreatePropertyBlob: %s\n", strerror(ok));
+            goto fail_maybe_destroy_gamma_lut_blob;
+        }
+    }
+
+    // A blob id of zero resets the property, which disables the LUT / CTM.
+    if (builder->has_gamma_lut) {
+        drmModeAtomicAddProperty(builder->req, builder->crtc->id, builder->crtc->ids.gamma_lut, gamma_lut_blob_id);
+    }
+    if (builder->has_ctm) {
+        drmModeAtomicAddProperty(builder->req, builder->crtc->id, builder->crtc->ids.ctm, ctm_blob_id);
+    }
+
+    *gamma_lut_blob_id_out = gamma_lut_blob_id;
+    *ctm_blob_id_out = ctm_blob_id;
+    return 0;
+
+fail_maybe_destroy_gamma_lut_blob:
+    if (gamma_lut_blob_id != 0) {
+        drmModeDestroyPropertyBlob(builder->drmdev->fd, gamma_lut_blob_id);
+    }
+    return ok;
+}
+
+/**
+ * @brief Add the connector output format properties (max bpc, colorspace, HDR metadata) to the atomic request.
+ *
+ * @returns Zero if successful, errno-code otherwise. @param hdr_metadata_blob_id_out is set to the
+ *          uploaded HDR metadata blob (or 0), which should be destroyed after the commit.
+ */
+static int add_connector_props_locked(struct kms_req_builder *builder, uint32_t *hdr_metadata_blob_id_out) {
+    struct drm_connector *connector;
+    uint32_t hdr_metadata_blob_id;
+    int ok;
+
+    connector = builder->connector;
+    hdr_metadata_blob_id = 0;
+
+    if (builder->has_hdr_metadata && !builder->reset_hdr_metadata) {
+        ok = drmModeCreatePropertyBlob(builder->drmdev->fd, &builder->hdr_metadata, sizeof builder->hdr_metadata, &hdr_metadata_blob_id);
+        if (ok != 0) {
+            ok = errno;
+            LOG_ERROR("Couldn't upload HDR output metadata to kernel. drmModeCreatePropertyBlob: %s\n", strerror(ok));
+            return ok;
+        }
+    }
+
+    if (builder->has_max_bpc) {
+        drmModeAtomicAddProperty(builder->req, connector->id, connector->ids.max_bpc, builder->max_bpc);
+    }
+    if (builder->has_colorspace) {
+        drmModeAtomicAddProperty(builder->req, connector->id, connector->ids.colorspace, connector->colorspace_values[builder->colorspace]);
+    }
+    if (builder->has_hdr_metadata) {
+        // A blob id of zero stops sending HDR metadata.
+        drmModeAtomicAddProperty(builder->req, connector->id, connector->ids.hdr_output_metadata, hdr_metadata_blob_id);
+    }
+
+    *hdr_metadata_blob_id_out = hdr_metadata_blob_id;
+    return 0;
+}
+
 static int
 kms_req_commit_common(struct kms_req *req, bool blocking, kms_scanout_cb_t scanout_cb, void *userdata, void_callback_t destroy_cb) {
     struct kms_req_builder *builder;
     struct drm_mode_blob *mode_blob;
-    uint32_t flags;
+    uint32_t flags, gamma_lut_blob_id, ctm_blob_id, hdr_metadata_blob_id;
     bool internally_blocking;
     bool update_mode;
     int ok;
@@ -2715,6 +3744,27 @@ kms_req_commit_common(struct kms_req *req, bool blocking, kms_scanout_cb_t scano
 
         bool needs_set_crtc = update_mode;
 
+        if (builder->disable_crtc != NULL) {
+            ok = drmModeSetCrtc(builder->drmdev->master_fd, builder->disable_crtc->id, 0, 0, 0, NULL, 0, NULL);
+            if (ok != 0) {
+                ok = errno;
+                LOG_ERROR("Could not turn off the previous CRTC. drmModeSetCrtc: %s\n", strerror(ok));
+                goto fail_maybe_destroy_mode_blob;
+            }
+
+            // The connector moves over to our CRTC.
+            needs_set_crtc = true;
+        }
+
+        // There's no way to do this atomically with legacy modesetting,
+        // so just set the gamma ramp right before the flip.
+        if (builder->has_gamma_lut) {
+            ok = set_legacy_gamma_locked(builder);
+            if (ok != 0) {
+                goto fail_maybe_destroy_mode_blob;
+            }
+        }
+
         // check if the plane pixel format changed.
         // that needs a drmModeSetCrtc for legacy KMS as well.
         // get the current, committed fb for the plane, check if we have info
@@ -2835,13 +3885,104 @@ kms_req_commit_common(struct kms_req *req, bool blocking, kms_scanout_cb_t scano
             }
         }
 
+        if (builder->disable_crtc != NULL) {
+            struct drm_crtc *crtc = builder->disable_crtc;
+            struct drm_connector *conn;
+            struct drm_plane *plane;
+
+            // The kernel rejects turning off a CRTC that still has planes or connectors attached.
+            for_each_plane_in_drmdev(builder->drmdev, plane) {
+                if (drm_plane_is_active(plane) && plane->committed_state.crtc_id == crtc->id &&
+                    !kms_req_builder_uses_plane(builder, plane)) {
+                    drmModeAtomicAddProperty(builder->req, plane->id, plane->ids.crtc_id, 0);
+                    drmModeAtomicAddProperty(builder->req, plane->id, plane->ids.fb_id, 0);
+                }
+            }
+
+            for_each_connector_in_drmdev(builder->drmdev, conn) {
+                if (conn->committed_state.crtc_id == crtc->id && conn != builder->connector &&
+                    conn != builder->writeback_route.connector) {
+                    drmModeAtomicAddProperty(builder->req, conn->id, conn->ids.crtc_id, 0);
+                }
+            }
+
+            drmModeAtomicAddProperty(builder->req, crtc->id, crtc->ids.active, 0);
+            drmModeAtomicAddProperty(builder->req, crtc->id, crtc->ids.mode_id, 0);
+            flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        }
+
+        if (builder->writeback_route.connector != NULL) {
+            struct drm_connector *wb_conn = builder->writeback_route.connector;
+
+            drmModeAtomicAddProperty(builder->req, wb_conn->id, wb_conn->ids.crtc_id, builder->writeback_route.crtc_id);
+
+            // Changing the CRTC of a connector is a modeset, that's why the writeback
+            // connector is routed once and not with every writeback.
+            if (wb_conn->committed_state.crtc_id != builder->writeback_route.crtc_id) {
+                flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+            }
+        }
+
+        if (builder->writeback.connector != NULL) {
+            struct drm_connector *wb_conn = builder->writeback.connector;
+
+            // The kernel writes the out fence fd to this pointer when the commit succeeds.
+            builder->writeback.out_fence_fd = -1;
+            drmModeAtomicAddProperty(builder->req, wb_conn->id, wb_conn->ids.writeback_fb_id, builder->writeback.fb_id);
+            drmModeAtomicAddProperty(
+                builder->req,
+                wb_conn->id,
+                wb_conn->ids.writeback_out_fence_ptr,
+                (uint64_t) (uintptr_t) &builder->writeback.out_fence_fd
+            );
+        }
+
+        ok = add_color_props_locked(builder, &gamma_lut_blob_id, &ctm_blob_id);
+        if (ok != 0) {
+            goto fail_maybe_destroy_mode_blob;
+        }
+
+        hdr_metadata_blob_id = 0;
+        if (builder->has_max_bpc || builder->has_colorspace || builder->has_hdr_metadata) {
+            ok = add_connector_props_locked(builder, &hdr_metadata_blob_id);
+            if (ok != 0) {
+                goto fail_destroy_color_blobs;
+            }
+
+            // Changing the link bit depth or colorimetry might need a modeset.
+            flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        }
+
         /// TODO: If we're on raspberry pi and only have one layer, we can do an async pageflip
         /// on the primary plane to replace the next queued frame. (To do _real_ triple buffering
         /// with fully decoupled framerate, potentially)
+        if (builder->disable_crtc != NULL) {
+            // The kernel sends a page flip event for every CRTC in the commit, and each one drops a reference.
+            kms_req_builder_ref(builder);
+        }
+
         ok = drmModeAtomicCommit(builder->drmdev->master_fd, builder->req, flags, kms_req_builder_ref(builder));
         if (ok != 0) {
             ok = errno;
             LOG_ERROR("Could not commit display update. drmModeAtomicCommit: %s\n", strerror(ok));
+
+            if (builder->disable_crtc != NULL) {
+                kms_req_builder_unref(builder);
+            }
+        }
+
+        // If the commit succeeded, the CRTC holds its own reference on the blobs now.
+        if (gamma_lut_blob_id != 0) {
+            drmModeDestroyPropertyBlob(builder->drmdev->fd, gamma_lut_blob_id);
+        }
+        if (ctm_blob_id != 0) {
+            drmModeDestroyPropertyBlob(builder->drmdev->fd, ctm_blob_id);
+        }
+        if (hdr_metadata_blob_id != 0) {
+            drmModeDestroyPropertyBlob(builder->drmdev->fd, hdr_metadata_blob_id);
+        }
+
+        if (ok != 0) {
             goto fail_unref_builder;
         }
     }
@@ -2895,10 +4036,47 @@ kms_req_commit_common(struct kms_req *req, bool blocking, kms_scanout_cb_t scano
         }
     }
 
+    if (builder->disable_crtc != NULL) {
+        struct drm_crtc *crtc = builder->disable_crtc;
+        struct drm_connector *conn;
+        struct drm_plane *plane;
+
+        for_each_plane_in_drmdev(builder->drmdev, plane) {
+            if (plane->committed_state.crtc_id == crtc->id && !kms_req_builder_uses_plane(builder, plane)) {
+                plane->committed_state.crtc_id = 0;
+                plane->committed_state.fb_id = 0;
+            }
+        }
+
+        for_each_connector_in_drmdev(builder->drmdev, conn) {
+            if (conn->committed_state.crtc_id == crtc->id) {
+                conn->committed_state.crtc_id = 0;
+            }
+        }
+
+        if (crtc->committed_state.mode_blob != NULL) {
+            drm_mode_blob_destroy(crtc->committed_state.mode_blob);
+            crtc->committed_state.mode_blob = NULL;
+        }
+        crtc->committed_state.has_mode = false;
+    }
+
     // update struct drm_connector.committed_state
     builder->connector->committed_state.crtc_id = builder->crtc->id;
     // builder->connector->committed_state.encoder_id = 0;
 
+    if (builder->writeback_route.connector != NULL) {
+        builder->writeback_route.connector->committed_state.crtc_id = builder->writeback_route.crtc_id;
+    }
+
+    if (builder->writeback.callback != NULL) {
+        // The writeback job is queued now, hand over the out fence.
+        builder->writeback.callback(builder->writeback.userdata, builder->writeback.out_fence_fd);
+        builder->writeback.callback = NULL;
+        builder->writeback.userdata = NULL;
+        builder->writeback.out_fence_fd = -1;
+    }
+
     drmdev_set_scanout_callback_locked(builder->drmdev, builder->crtc->id, scanout_cb, userdata, destroy_cb);
 
     if (internally_blocking) {
@@ -2940,6 +4118,15 @@ fail_unset_scanout_callback:
     builder->drmdev->per_crtc_state[builder->crtc->index].userdata = NULL;
     goto fail_unlock;
 
+fail_destroy_color_blobs:
+    if (gamma_lut_blob_id != 0) {
+        drmModeDestroyPropertyBlob(builder->drmdev->fd, gamma_lut_blob_id);
+    }
+    if (ctm_blob_id != 0) {
+        drmModeDestroyPropertyBlob(builder->drmdev->fd, ctm_blob_id);
+    }
+    goto fail_maybe_destroy_mode_blob;
+
 fail_unref_builder:
     kms_req_builder_unref(builder);
 
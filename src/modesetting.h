@@ -217,6 +217,19 @@
 
 #define DRM_BLEND_ALPHA_OPAQUE 0xFFFF
 
+/**
+ * @brief Convert an opacity from 0 to 1 to the value of the plane alpha property.
+ */
+static inline uint16_t drm_blend_alpha_from_opacity(double opacity) {
+    if (opacity <= 0.0) {
+        return 0;
+    } else if (opacity >= 1.0) {
+        return DRM_BLEND_ALPHA_OPAQUE;
+    }
+
+    return (uint16_t) (opacity * DRM_BLEND_ALPHA_OPAQUE + 0.5);
+}
+
 enum drm_blend_mode {
     kPremultiplied_DrmBlendMode,
     kCoverage_DrmBlendMode,
@@ -359,6 +372,59 @@ enum drm_subpixel_layout {
     kNone_DrmSubpixelLayout = DRM_MODE_SUBPIXEL_NONE
 };
 
+/**
+ * @brief The colorimetry signalled to the display using the connector "Colorspace" property.
+ *
+ * The values of the property are driver-specific, see @ref drm_connector.colorspace_values.
+ */
+enum drm_colorspace {
+    kDefault_DrmColorspace,
+    kBT2020RGB_DrmColorspace,
+    kBT2020YCC_DrmColorspace,
+
+    kMax_DrmColorspace = kBT2020YCC_DrmColorspace,
+    kCount_DrmColorspace = kMax_DrmColorspace + 1
+};
+
+/**
+ * @brief The electro-optical transfer functions that can be signalled in the HDR output metadata.
+ *
+ * Same values as in the HDMI dynamic range and mastering infoframe (CTA-861-G).
+ */
+enum drm_hdr_eotf {
+    kTraditionalSDR_DrmHdrEotf = 0,
+    kTraditionalHDR_DrmHdrEotf = 1,
+    kSMPTEST2084_DrmHdrEotf = 2,
+    kHLG_DrmHdrEotf = 3,
+};
+
+/**
+ * @brief The contents of the connector HDR_OUTPUT_METADATA blob.
+ *
+ * Same layout as `struct hdr_output_metadata` of the kernel UAPI, which older libdrm
+ * headers don't have. Chromaticity coordinates are in units of 0.00002, the minimum
+ * mastering luminance in units of 0.0001 cd/m², all other luminances in cd/m².
+ */
+struct drm_hdr_output_metadata {
+    uint32_t metadata_type;
+    struct {
+        uint8_t eotf;
+        uint8_t metadata_type;
+        struct {
+            uint16_t x, y;
+        } display_primaries[3];
+        struct {
+            uint16_t x, y;
+        } white_point;
+        uint16_t max_display_mastering_luminance;
+        uint16_t min_display_mastering_luminance;
+        uint16_t max_cll;
+        uint16_t max_fall;
+    } hdmi_metadata_type1;
+};
+
+COMPILE_ASSERT(sizeof(struct drm_hdr_output_metadata) == 32);
+
 struct drm_connector {
     uint32_t id;
 
@@ -382,8 +448,32 @@ struct drm_connector {
         uint32_t crtc_id;
         uint32_t encoder_id;
     } committed_state;
+
+    /// @brief The pixel formats a writeback connector can write frames in.
+    /// All false if this is not a writeback connector.
+    bool writeback_formats[PIXFMT_COUNT];
+
+    /// @brief The highest value the "max bpc" property can be set to, or 0 if the
+    /// connector doesn't have a "max bpc" property.
+    uint32_t max_bpc_limit;
+
+    /// @brief Which colorspaces can be set using the "Colorspace" property, and the
+    /// property value for each of them. All false if there's no "Colorspace" property.
+    bool supported_colorspaces[kCount_DrmColorspace];
+    uint64_t colorspace_values[kCount_DrmColorspace];
 };
 
+/**
+ * @brief True if there's a display connected to this connector.
+ *
+ * Writeback connectors always report themselves as connected, but there's no display
+ * behind them, so they're never considered connected here.
+ */
+static inline bool drm_connector_is_display_connected(const struct drm_connector *connector) {
+    return connector->variable_state.connection_state == kConnected_DrmConnectionState &&
+           connector->type != kWRITEBACK_DrmConnectorType;
+}
+
 struct drm_encoder {
     drmModeEncoder *encoder;
 };
@@ -395,6 +485,10 @@ struct drm_crtc {
 
     struct drm_crtc_prop_ids ids;
 
+    /// @brief The number of entries of the gamma LUT, or 0 if gamma correction
+    /// is not supported by this CRTC.
+    uint32_t gamma_lut_size;
+
     struct {
         bool has_mode;
         drmModeModeInfo mode;
@@ -510,6 +604,11 @@ struct drm_plane {
     /// Only valid if @ref has_blend_mode is true.
     bool supported_blend_modes[kCount_DrmBlendMode];
 
+    /// @brief The value of the pixel blend mode property for each of the supported blend modes.
+    ///
+    /// Only valid if @ref has_blend_mode is true and the blend mode is supported.
+    uint64_t blend_mode_values[kCount_DrmBlendMode];
+
     struct {
         /// @brief The committed CRTC id.
         ///
@@ -630,6 +729,12 @@ struct _drmModeModeInfo;
 int drmdev_get_fd(struct drmdev *drmdev);
 int drmdev_get_event_fd(struct drmdev *drmdev);
 bool drmdev_supports_dumb_buffers(struct drmdev *drmdev);
+
+/**
+ * @brief The biggest cursor buffer the driver supports (DRM_CAP_CURSOR_WIDTH / DRM_CAP_CURSOR_HEIGHT).
+ */
+struct vec2i drmdev_get_max_cursor_size(struct drmdev *drmdev);
+
 int drmdev_create_dumb_buffer(
     struct drmdev *drmdev,
     int width,
@@ -650,6 +755,16 @@ const struct _drmModeModeInfo *drmdev_get_selected_mode(struct drmdev *drmdev);
 
 struct gbm_device *drmdev_get_gbm_device(struct drmdev *drmdev);
 
+/**
+ * @brief Open the DRM device at @param path as a separate GPU to render on, while this drmdev scans out.
+ *
+ * Buffers allocated on the returned GBM device are imported via PRIME when they're added as framebuffers.
+ * The GBM device and its fd are owned by the drmdev and destroyed with it. Can only be called once.
+ *
+ * @returns The GBM device of the render GPU, or NULL on failure.
+ */
+struct gbm_device *drmdev_open_render_device(struct drmdev *drmdev, const char *path);
+
 uint32_t drmdev_add_fb(
     struct drmdev *drmdev,
     uint32_t width,
@@ -674,6 +789,13 @@ uint32_t drmdev_add_fb_multiplanar(
     const uint64_t modifiers[4]
 );
 
+/**
+ * @brief Add a framebuffer for the DMA-buffer @param prime_fd.
+ *
+ * The buffer is imported as a GEM handle, which is closed again once the framebuffer is added.
+ * GEM handles aren't reference counted, so the buffer must not be one this drmdev already has a
+ * handle for (e.g. one allocated on its own GBM device). Use @ref drmdev_add_fb for those.
+ */
 uint32_t drmdev_add_fb_from_dmabuf(
     struct drmdev *drmdev,
     uint32_t width,
@@ -700,6 +822,16 @@ uint32_t drmdev_add_fb_from_dmabuf_multiplanar(
 
 uint32_t drmdev_add_fb_from_gbm_bo(struct drmdev *drmdev, struct gbm_bo *bo, bool cast_opaque);
 
+/**
+ * @brief Add a framebuffer for @param bo, and one that scans it out with the opaque variant of its pixel format.
+ *
+ * Either of @param fb_id_out and @param opaque_fb_id_out can be NULL if that framebuffer is not needed.
+ * If the buffer was allocated on another DRM device, it's only imported once for both framebuffers.
+ *
+ * @returns 0 on success, or an errno code. On failure, no framebuffers are added.
+ */
+int drmdev_add_fbs_from_gbm_bo(struct drmdev *drmdev, struct gbm_bo *bo, uint32_t *fb_id_out, uint32_t *opaque_fb_id_out);
+
 int drmdev_rm_fb_locked(struct drmdev *drmdev, uint32_t fb_id);
 
 int drmdev_rm_fb(struct drmdev *drmdev, uint32_t fb_id);
@@ -708,12 +840,43 @@ int drmdev_get_last_vblank(struct drmdev *drmdev, uint32_t crtc_id, uint64_t *la
 
 bool drmdev_can_modeset(struct drmdev *drmdev);
 
+/**
+ * @brief Drop DRM master, for example because our session was deactivated.
+ *
+ * The DRM fd stays open, so all GBM buffers and DRM framebuffers stay valid.
+ * Commits will fail with EBUSY until @ref drmdev_resume is called.
+ */
 void drmdev_suspend(struct drmdev *drmdev);
 
+/**
+ * @brief Re-acquire DRM master and re-read the connector, CRTC and plane state
+ * (which might've been changed by another DRM master in the meantime).
+ *
+ * The next commit that sets a mode will do a full modeset.
+ */
 int drmdev_resume(struct drmdev *drmdev);
 
+/**
+ * @brief Probe all connectors again and update their connection state, physical size and list of modes.
+ *
+ * Should be called when the kernel reports a hotplug event for this device.
+ * Any pointers to modes of the connectors (from the variable_state) are invalid afterwards.
+ */
+int drmdev_reprobe_connectors(struct drmdev *drmdev);
+
 int drmdev_move_cursor(struct drmdev *drmdev, uint32_t crtc_id, struct vec2i pos);
 
+/**
+ * @brief Turn the display driven by @param crtc_id and @param connector_id off or on again (DPMS),
+ * without changing the mode or the planes.
+ *
+ * Commits (blocking) CRTC ACTIVE with atomic modesetting, or sets the connector DPMS property with legacy modesetting.
+ * While the display is off, no frames should be committed on this CRTC.
+ *
+ * @returns Zero if successful, EOPNOTSUPP if neither is supported, errno-code otherwise.
+ */
+int drmdev_set_crtc_active(struct drmdev *drmdev, uint32_t crtc_id, uint32_t connector_id, bool active);
+
 static inline double mode_get_vrefresh(const drmModeModeInfo *mode) {
     return mode->clock * 1000.0 / (mode->htotal * mode->vtotal);
 }
@@ -735,6 +898,20 @@ struct kms_fb_layer {
     bool has_in_fence_fd;
     int in_fence_fd;
 
+    /// @brief Per-plane alpha this layer is blended with, from 0 (transparent) to
+    /// @ref DRM_BLEND_ALPHA_OPAQUE.
+    ///
+    /// If this is true and alpha is not opaque, only planes with an alpha property qualify.
+    bool has_alpha;
+    uint16_t alpha;
+
+    /// @brief How the pixel alpha of the framebuffer is blended with the layers below.
+    ///
+    /// If this is true, only planes that support this blend mode qualify. Planes without a
+    /// pixel blend mode property are treated as supporting premultiplied alpha only.
+    bool has_blend_mode;
+    enum drm_blend_mode blend_mode;
+
     bool prefer_cursor;
 };
 
@@ -742,6 +919,15 @@ typedef void (*kms_fb_release_cb_t)(void *userdata);
 
 typedef void (*kms_deferred_fb_release_cb_t)(void *userdata, int syncfile_fd);
 
+/**
+ * @brief Called with the writeback out fence after the KMS request was committed.
+ *
+ * @param userdata The userdata given to @ref kms_req_builder_set_writeback.
+ * @param out_fence_fd A sync file that signals when the frame was written to the writeback
+ *                     framebuffer. The callee owns it. -1 if the request was never committed.
+ */
+typedef void (*kms_writeback_cb_t)(void *userdata, int out_fence_fd);
+
 struct kms_req_builder;
 
 struct kms_req_builder *drmdev_create_request_builder(struct drmdev *drmdev, uint32_t crtc_id);
@@ -785,6 +971,124 @@ int kms_req_builder_set_mode(struct kms_req_builder *builder, const drmModeModeI
  */
 int kms_req_builder_unset_mode(struct kms_req_builder *builder);
 
+/**
+ * @brief Adds a property to the KMS request that will set the gamma LUT of this
+ * CRTC on commit. The LUT is copied.
+ *
+ * With legacy modesetting, the gamma ramp is set right before the page flip.
+ *
+ * @param builder The KMS request builder.
+ * @param size The number of entries in @param lut. Must be equal to the
+ *             @ref drm_crtc.gamma_lut_size of the CRTC.
+ * @param lut The gamma LUT, or NULL to disable gamma correction.
+ * @returns Zero if successful, EOPNOTSUPP if the CRTC has no gamma LUT,
+ *          EINVAL if the size is wrong.
+ */
+int kms_req_builder_set_gamma_lut(struct kms_req_builder *builder, size_t size, const struct drm_color_lut *lut);
+
+/**
+ * @brief Adds a property to the KMS request that will set the color transformation
+ * matrix of this CRTC on commit.
+ *
+ * @param builder The KMS request builder.
+ * @param ctm The color transformation matrix, or NULL to disable it.
+ * @returns Zero if successful, EOPNOTSUPP if the CRTC has no CTM property or
+ *          legacy modesetting is used.
+ */
+int kms_req_builder_set_ctm(struct kms_req_builder *builder, const struct drm_color_ctm *ctm);
+
+/**
+ * @brief Adds a property to the KMS request that will limit the bits per color channel
+ * sent to the display to @param max_bpc.
+ *
+ * Needed for 10-bit output, since most drivers default to 8 bits per channel.
+ * The value is clamped to the range supported by the connector.
+ *
+ * @param builder The KMS request builder.
+ * @param max_bpc The maximum bits per channel.
+ * @returns Zero if successful, EINVAL if no connector was set using @ref kms_req_builder_set_connector,
+ *          EOPNOTSUPP if the connector has no "max bpc" property or legacy modesetting is used.
+ */
+int kms_req_builder_set_max_bpc(struct kms_req_builder *builder, uint32_t max_bpc);
+
+/**
+ * @brief Adds a property to the KMS request that will set the colorimetry signalled to the display.
+ *
+ * @param builder The KMS request builder.
+ * @param colorspace The colorspace.
+ * @returns Zero if successful, EINVAL if no connector was set using @ref kms_req_builder_set_connector,
+ *          EOPNOTSUPP if the connector doesn't support @param colorspace or legacy modesetting is used.
+ */
+int kms_req_builder_set_colorspace(struct kms_req_builder *builder, enum drm_colorspace colorspace);
+
+/**
+ * @brief Adds a property to the KMS request that will send @param metadata to the display,
+ * which switches it into HDR mode. The metadata is copied.
+ *
+ * @param builder The KMS request builder.
+ * @param metadata The HDR static metadata, or NULL to stop sending HDR metadata (i.e. SDR mode).
+ * @returns Zero if successful, EINVAL if no connector was set using @ref kms_req_builder_set_connector,
+ *          EOPNOTSUPP if the connector has no HDR_OUTPUT_METADATA property or legacy modesetting is used.
+ */
+int kms_req_builder_set_hdr_output_metadata(struct kms_req_builder *builder, const struct drm_hdr_output_metadata *metadata);
+
+/**
+ * @brief Writes the frame this KMS request will present into @param fb_id using
+ * the writeback connector @param connector_id.
+ *
+ * The writeback connector must already be routed to this CRTC, or be routed with this request,
+ * see @ref kms_req_builder_route_writeback_connector.
+ * Only supported with atomic modesetting. There can only be one writeback per request.
+ *
+ * @param builder The KMS request builder.
+ * @param connector_id The writeback connector. Must be able to use this CRTC.
+ * @param fb_id The framebuffer the frame should be written to. Must have the size of the
+ *              current mode and one of the writeback formats of the connector.
+ * @param callback Called exactly once: With the writeback out fence when the request was
+ *                 committed, or with -1 if it wasn't.
+ * @param userdata Userdata for @param callback.
+ * @returns Zero if successful, EOPNOTSUPP if legacy modesetting is used, EBUSY if there's
+ *          already a writeback for this request, EINVAL if @param connector_id is not a
+ *          writeback connector routed to this CRTC.
+ */
+int kms_req_builder_set_writeback(
+    struct kms_req_builder *builder,
+    uint32_t connector_id,
+    uint32_t fb_id,
+    kms_writeback_cb_t callback,
+    void *userdata
+);
+
+/**
+ * @brief Routes the writeback connector @param connector_id to this CRTC, or detaches it again.
+ *
+ * Changing the CRTC of a connector is a modeset, so this request will be committed with
+ * DRM_MODE_ATOMIC_ALLOW_MODESET if the routing actually changes.
+ *
+ * @param builder The KMS request builder.
+ * @param connector_id The writeback connector. Must be able to use this CRTC.
+ * @param attach True to route the connector to this CRTC, false to detach it from any CRTC.
+ * @returns Zero if successful, EOPNOTSUPP if legacy modesetting is used, EINVAL if
+ *          @param connector_id is not a writeback connector, EBUSY if a frame is written back
+ *          using the connector that should be detached.
+ */
+int kms_req_builder_route_writeback_connector(struct kms_req_builder *builder, uint32_t connector_id, bool attach);
+
+/**
+ * @brief Turns off the CRTC @param crtc_id with this request, for example because the connector
+ * it was driving moves to the CRTC of this request.
+ *
+ * All planes scanning out on that CRTC are disabled and all other connectors still routed to it
+ * are detached, so the CRTC doesn't keep its display resources (and the last frame) around.
+ * This is a modeset, so the request will be committed with DRM_MODE_ATOMIC_ALLOW_MODESET.
+ * Does nothing if the CRTC is already off.
+ *
+ * @param builder The KMS request builder.
+ * @param crtc_id The CRTC to turn off. Must not be the CRTC of this request.
+ * @returns Zero if successful, EINVAL if @param crtc_id is not a valid CRTC or the CRTC of this request.
+ */
+int kms_req_builder_disable_crtc(struct kms_req_builder *builder, uint32_t crtc_id);
+
 /**
  * @brief Adds a property to the KMS request that will change the connector
  * that this CRTC is displaying content on to @param connector_id.
@@ -36,10 +36,25 @@ struct fbdev_pixfmt {
 
 #ifdef HAVE_GBM
     #include <gbm.h>
+
+    // Older GBM headers don't have the half-float formats yet.
+    #ifndef GBM_FORMAT_XBGR16161616F
+        #define GBM_FORMAT_XBGR16161616F __gbm_fourcc_code('X', 'B', '4', 'H')
+    #endif
+    #ifndef GBM_FORMAT_ABGR16161616F
+        #define GBM_FORMAT_ABGR16161616F __gbm_fourcc_code('A', 'B', '4', 'H')
+    #endif
 #endif
 
 #ifdef HAVE_KMS
     #include <drm_fourcc.h>
+
+    #ifndef DRM_FORMAT_XBGR16161616F
+        #define DRM_FORMAT_XBGR16161616F fourcc_code('X', 'B', '4', 'H')
+    #endif
+    #ifndef DRM_FORMAT_ABGR16161616F
+        #define DRM_FORMAT_ABGR16161616F fourcc_code('A', 'B', '4', 'H')
+    #endif
 #endif
 
 #ifdef HAVE_VULKAN
@@ -63,204 +78,280 @@ enum pixfmt {
     PIXFMT_BGRX8888,
     PIXFMT_RGBA8888,
     PIXFMT_RGBX8888,
-    PIXFMT_MAX = PIXFMT_RGBX8888,
+    PIXFMT_ARGB2101010,
+    PIXFMT_XRGB2101010,
+    PIXFMT_ABGR16161616F,
+    PIXFMT_XBGR16161616F,
+    PIXFMT_MAX = PIXFMT_XBGR16161616F,
     PIXFMT_COUNT = PIXFMT_MAX + 1
 };
 
 // Just a pedantic check so we don't update the pixfmt enum without changing PIXFMT_MAX
-COMPILE_ASSERT(PIXFMT_MAX == PIXFMT_RGBX8888);
+COMPILE_ASSERT(PIXFMT_MAX == PIXFMT_XBGR16161616F);
 
 // Vulkan doesn't support that many sRGB formats actually.
 // There's two more (one packed and one non-packed) that aren't listed here.
+// The 10-bit and half-float formats have no sRGB variant at all, so they're listed
+// with their UNORM / SFLOAT format. (The sRGB ones are treated as UNORM anyway, see vk_gbm_render_surface.c)
+// The half-float formats have no integer bitfields, so all their channel lengths and offsets are 0.
+// See pixfmt_is_float.
 /// TODO: We could support other formats as well though with manual colorspace conversions.
-#define PIXFMT_LIST(V)                           \
-    V("RGB 5:6:5",                               \
-      "RGB565",                                  \
-      PIXFMT_RGB565,                             \
-      /*bpp*/ 16,                                \
-      /*bit_depth*/ 16,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 5,                                   \
-      11,                                        \
-      /*G*/ 6,                                   \
-      5,                                         \
-      /*B*/ 5,                                   \
-      0,                                         \
-      /*A*/ 0,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_RGB565,          \
-      /*DRM fourcc*/ DRM_FORMAT_RGB565)          \
-    V("ARGB 4:4:4:4",                            \
-      "ARGB4444",                                \
-      PIXFMT_ARGB4444,                           \
-      /*bpp*/ 16,                                \
-      /*bit_depth*/ 12,                          \
-      /*opaque*/ false,                          \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 4,                                   \
-      8,                                         \
-      /*G*/ 4,                                   \
-      4,                                         \
-      /*B*/ 4,                                   \
-      0,                                         \
-      /*A*/ 4,                                   \
-      12,                                        \
-      /*GBM fourcc*/ GBM_FORMAT_ARGB4444,        \
-      /*DRM fourcc*/ DRM_FORMAT_ARGB4444)        \
-    V("XRGB 4:4:4:4",                            \
-      "XRGB4444",                                \
-      PIXFMT_XRGB4444,                           \
-      /*bpp*/ 16,                                \
-      /*bit_depth*/ 12,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 4,                                   \
-      8,                                         \
-      /*G*/ 4,                                   \
-      4,                                         \
-      /*B*/ 4,                                   \
-      0,                                         \
-      /*A*/ 0,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_XRGB4444,        \
-      /*DRM fourcc*/ DRM_FORMAT_XRGB4444)        \
-    V("ARGB 1:5:5:5",                            \
-      "ARGB1555",                                \
-      PIXFMT_ARGB1555,                           \
-      /*bpp*/ 16,                                \
-      /*bit_depth*/ 15,                          \
-      /*opaque*/ false,                          \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 5,                                   \
-      10,                                        \
-      /*G*/ 5,                                   \
-      5,                                         \
-      /*B*/ 5,                                   \
-      0,                                         \
-      /*A*/ 1,                                   \
-      15,                                        \
-      /*GBM fourcc*/ GBM_FORMAT_ARGB1555,        \
-      /*DRM fourcc*/ DRM_FORMAT_ARGB1555)        \
-    V("XRGB 1:5:5:5",                            \
-      "XRGB1555",                                \
-      PIXFMT_XRGB1555,                           \
-      /*bpp*/ 16,                                \
-      /*bit_depth*/ 15,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 5,                                   \
-      10,                                        \
-      /*G*/ 5,                                   \
-      5,                                         \
-      /*B*/ 5,                                   \
-      0,                                         \
-      /*A*/ 0,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_XRGB1555,        \
-      /*DRM fourcc*/ DRM_FORMAT_XRGB1555)        \
-    V("ARGB 8:8:8:8",                            \
-      "ARGB8888",                                \
-      PIXFMT_ARGB8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ false,                          \
-      /*Vulkan format*/ VK_FORMAT_B8G8R8A8_SRGB, \
-      /*R*/ 8,                                   \
-      16,                                        \
-      /*G*/ 8,                                   \
-      8,                                         \
-      /*B*/ 8,                                   \
-      0,                                         \
-      /*A*/ 8,                                   \
-      24,                                        \
-      /*GBM fourcc*/ GBM_FORMAT_ARGB8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_ARGB8888)        \
-    V("XRGB 8:8:8:8",                            \
-      "XRGB8888",                                \
-      PIXFMT_XRGB8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 8,                                   \
-      16,                                        \
-      /*G*/ 8,                                   \
-      8,                                         \
-      /*B*/ 8,                                   \
-      0,                                         \
-      /*A*/ 0,                                   \
-      24,                                        \
-      /*GBM fourcc*/ GBM_FORMAT_XRGB8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_XRGB8888)        \
-    V("BGRA 8:8:8:8",                            \
-      "BGRA8888",                                \
-      PIXFMT_BGRA8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ false,                          \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 8,                                   \
-      8,                                         \
-      /*G*/ 8,                                   \
-      16,                                        \
-      /*B*/ 8,                                   \
-      24,                                        \
-      /*A*/ 8,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_BGRA8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_BGRA8888)        \
-    V("BGRX 8:8:8:8",                            \
-      "BGRX8888",                                \
-      PIXFMT_BGRX8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 8,                                   \
-      8,                                         \
-      /*G*/ 8,                                   \
-      16,                                        \
-      /*B*/ 8,                                   \
-      24,                                        \
-      /*A*/ 0,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_BGRX8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_BGRX8888)        \
-    V("RGBA 8:8:8:8",                            \
-      "RGBA8888",                                \
-      PIXFMT_RGBA8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ false,                          \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 8,                                   \
-      24,                                        \
-      /*G*/ 8,                                   \
-      16,                                        \
-      /*B*/ 8,                                   \
-      8,                                         \
-      /*A*/ 8,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_RGBA8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_RGBA8888)        \
-    V("RGBX 8:8:8:8",                            \
-      "RGBX8888",                                \
-      PIXFMT_RGBX8888,                           \
-      /*bpp*/ 32,                                \
-      /*bit_depth*/ 24,                          \
-      /*opaque*/ true,                           \
-      /*Vulkan format*/ VK_FORMAT_UNDEFINED,     \
-      /*R*/ 8,                                   \
-      24,                                        \
-      /*G*/ 8,                                   \
-      16,                                        \
-      /*B*/ 8,                                   \
-      8,                                         \
-      /*A*/ 0,                                   \
-      0,                                         \
-      /*GBM fourcc*/ GBM_FORMAT_RGBX8888,        \
-      /*DRM fourcc*/ DRM_FORMAT_RGBX8888)
+#define PIXFMT_LIST(V)                                      \
+    V("RGB 5:6:5",                                          \
+      "RGB565",                                             \
+      PIXFMT_RGB565,                                        \
+      /*bpp*/ 16,                                           \
+      /*bit_depth*/ 16,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 5,                                              \
+      11,                                                   \
+      /*G*/ 6,                                              \
+      5,                                                    \
+      /*B*/ 5,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_RGB565,                     \
+      /*DRM fourcc*/ DRM_FORMAT_RGB565)                     \
+    V("ARGB 4:4:4:4",                                       \
+      "ARGB4444",                                           \
+      PIXFMT_ARGB4444,                                      \
+      /*bpp*/ 16,                                           \
+      /*bit_depth*/ 12,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 4,                                              \
+      8,                                                    \
+      /*G*/ 4,                                              \
+      4,                                                    \
+      /*B*/ 4,                                              \
+      0,                                                    \
+      /*A*/ 4,                                              \
+      12,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_ARGB4444,                   \
+      /*DRM fourcc*/ DRM_FORMAT_ARGB4444)                   \
+    V("XRGB 4:4:4:4",                                       \
+      "XRGB4444",                                           \
+      PIXFMT_XRGB4444,                                      \
+      /*bpp*/ 16,                                           \
+      /*bit_depth*/ 12,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 4,                                              \
+      8,                                                    \
+      /*G*/ 4,                                              \
+      4,                                                    \
+      /*B*/ 4,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_XRGB4444,                   \
+      /*DRM fourcc*/ DRM_FORMAT_XRGB4444)                   \
+    V("ARGB 1:5:5:5",                                       \
+      "ARGB1555",                                           \
+      PIXFMT_ARGB1555,                                      \
+      /*bpp*/ 16,                                           \
+      /*bit_depth*/ 15,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 5,                                              \
+      10,                                                   \
+      /*G*/ 5,                                              \
+      5,                                                    \
+      /*B*/ 5,                                              \
+      0,                                                    \
+      /*A*/ 1,                                              \
+      15,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_ARGB1555,                   \
+      /*DRM fourcc*/ DRM_FORMAT_ARGB1555)                   \
+    V("XRGB 1:5:5:5",                                       \
+      "XRGB1555",                                           \
+      PIXFMT_XRGB1555,                                      \
+      /*bpp*/ 16,                                           \
+      /*bit_depth*/ 15,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 5,                                              \
+      10,                                                   \
+      /*G*/ 5,                                              \
+      5,                                                    \
+      /*B*/ 5,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_XRGB1555,                   \
+      /*DRM fourcc*/ DRM_FORMAT_XRGB1555)                   \
+    V("ARGB 8:8:8:8",                                       \
+      "ARGB8888",                                           \
+      PIXFMT_ARGB8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_B8G8R8A8_SRGB,            \
+      /*R*/ 8,                                              \
+      16,                                                   \
+      /*G*/ 8,                                              \
+      8,                                                    \
+      /*B*/ 8,                                              \
+      0,                                                    \
+      /*A*/ 8,                                              \
+      24,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_ARGB8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_ARGB8888)                   \
+    V("XRGB 8:8:8:8",                                       \
+      "XRGB8888",                                           \
+      PIXFMT_XRGB8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 8,                                              \
+      16,                                                   \
+      /*G*/ 8,                                              \
+      8,                                                    \
+      /*B*/ 8,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      24,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_XRGB8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_XRGB8888)                   \
+    V("BGRA 8:8:8:8",                                       \
+      "BGRA8888",                                           \
+      PIXFMT_BGRA8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 8,                                              \
+      8,                                                    \
+      /*G*/ 8,                                              \
+      16,                                                   \
+      /*B*/ 8,                                              \
+      24,                                                   \
+      /*A*/ 8,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_BGRA8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_BGRA8888)                   \
+    V("BGRX 8:8:8:8",                                       \
+      "BGRX8888",                                           \
+      PIXFMT_BGRX8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 8,                                              \
+      8,                                                    \
+      /*G*/ 8,                                              \
+      16,                                                   \
+      /*B*/ 8,                                              \
+      24,                                                   \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_BGRX8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_BGRX8888)                   \
+    V("RGBA 8:8:8:8",                                       \
+      "RGBA8888",                                           \
+      PIXFMT_RGBA8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 8,                                              \
+      24,                                                   \
+      /*G*/ 8,                                              \
+      16,                                                   \
+      /*B*/ 8,                                              \
+      8,                                                    \
+      /*A*/ 8,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_RGBA8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_RGBA8888)                   \
+    V("RGBX 8:8:8:8",                                       \
+      "RGBX8888",                                           \
+      PIXFMT_RGBX8888,                                      \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 24,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 8,                                              \
+      24,                                                   \
+      /*G*/ 8,                                              \
+      16,                                                   \
+      /*B*/ 8,                                              \
+      8,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_RGBX8888,                   \
+      /*DRM fourcc*/ DRM_FORMAT_RGBX8888)                   \
+    V("ARGB 2:10:10:10",                                    \
+      "ARGB2101010",                                        \
+      PIXFMT_ARGB2101010,                                   \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 30,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_A2R10G10B10_UNORM_PACK32, \
+      /*R*/ 10,                                             \
+      20,                                                   \
+      /*G*/ 10,                                             \
+      10,                                                   \
+      /*B*/ 10,                                             \
+      0,                                                    \
+      /*A*/ 2,                                              \
+      30,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_ARGB2101010,                \
+      /*DRM fourcc*/ DRM_FORMAT_ARGB2101010)                \
+    V("XRGB 2:10:10:10",                                    \
+      "XRGB2101010",                                        \
+      PIXFMT_XRGB2101010,                                   \
+      /*bpp*/ 32,                                           \
+      /*bit_depth*/ 30,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 10,                                             \
+      20,                                                   \
+      /*G*/ 10,                                             \
+      10,                                                   \
+      /*B*/ 10,                                             \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      30,                                                   \
+      /*GBM fourcc*/ GBM_FORMAT_XRGB2101010,                \
+      /*DRM fourcc*/ DRM_FORMAT_XRGB2101010)                \
+    V("ABGR 16:16:16:16 (half float)",                      \
+      "ABGR16161616F",                                      \
+      PIXFMT_ABGR16161616F,                                 \
+      /*bpp*/ 64,                                           \
+      /*bit_depth*/ 48,                                     \
+      /*opaque*/ false,                                     \
+      /*Vulkan format*/ VK_FORMAT_R16G16B16A16_SFLOAT,      \
+      /*R*/ 0,                                              \
+      0,                                                    \
+      /*G*/ 0,                                              \
+      0,                                                    \
+      /*B*/ 0,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_ABGR16161616F,              \
+      /*DRM fourcc*/ DRM_FORMAT_ABGR16161616F)              \
+    V("XBGR 16:16:16:16 (half float)",                      \
+      "XBGR16161616F",                                      \
+      PIXFMT_XBGR16161616F,                                 \
+      /*bpp*/ 64,                                           \
+      /*bit_depth*/ 48,                                     \
+      /*opaque*/ true,                                      \
+      /*Vulkan format*/ VK_FORMAT_UNDEFINED,                \
+      /*R*/ 0,                                              \
+      0,                                                    \
+      /*G*/ 0,                                              \
+      0,                                                    \
+      /*B*/ 0,                                              \
+      0,                                                    \
+      /*A*/ 0,                                              \
+      0,                                                    \
+      /*GBM fourcc*/ GBM_FORMAT_XBGR16161616F,              \
+      /*DRM fourcc*/ DRM_FORMAT_XBGR16161616F)
 
 // make sure the macro list we defined has as many elements as the pixfmt enum.
 #define __COUNT(...) +1
@@ -278,12 +369,26 @@ static inline enum pixfmt pixfmt_opaque(enum pixfmt format) {
         return PIXFMT_BGRX8888;
     } else if (format == PIXFMT_RGBA8888) {
         return PIXFMT_RGBX8888;
+    } else if (format == PIXFMT_ARGB2101010) {
+        return PIXFMT_XRGB2101010;
+    } else if (format == PIXFMT_ABGR16161616F) {
+        return PIXFMT_XBGR16161616F;
     }
 
     /// TODO: We're potentially returning a non-opaque format here.
     return format;
 }
 
+/**
+ * @brief Whether the channels of @param format are floating point values.
+ *
+ * These formats can be rendered to and scanned out, but not converted on the CPU,
+ * so they can't be used with fbdev or the dummy display.
+ */
+static inline bool pixfmt_is_float(enum pixfmt format) {
+    return format == PIXFMT_ABGR16161616F || format == PIXFMT_XBGR16161616F;
+}
+
 /**
  * @brief Information about a pixel format.
  *
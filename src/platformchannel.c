@@ -1320,6 +1320,38 @@ int platch_respond_native_error_std(const FlutterPlatformMessageResponseHandle *
     return platch_respond_error_std(handle, "nativeerror", strerror(_errno), &STDINT32(_errno));
 }
 
+int platch_respond_success_std_string(const FlutterPlatformMessageResponseHandle *handle, const char *string, size_t length) {
+    uint8_t *buffer, *buffer_cursor;
+    uintptr_t size;
+    int ok;
+
+    if (length > INT32_MAX) {
+        return EOVERFLOW;
+    }
+
+    // success byte + type byte + size + string
+    size = 2;
+    _advance_size_bytes(&size, length, NULL);
+    _advance(&size, length, NULL);
+
+    buffer = malloc(size);
+    if (buffer == NULL) {
+        return ENOMEM;
+    }
+
+    buffer_cursor = buffer;
+    _write_u8(&buffer_cursor, 0x00, NULL);
+    _write_u8(&buffer_cursor, kStdString, NULL);
+    _writeSize(&buffer_cursor, (int) length, NULL);
+    _write(&buffer_cursor, (void *) string, (int) length, NULL);
+
+    ok = flutterpi_respond_to_platform_message(handle, buffer, size);
+
+    free(buffer);
+
+    return ok;
+}
+
 /************************
  * JSON METHOD CHANNELS *
  ************************/
@@ -1491,6 +1491,11 @@ int platch_respond_illegal_arg_ext_std(const FlutterPlatformMessageResponseHandl
 
 int platch_respond_native_error_std(const FlutterPlatformMessageResponseHandle *handle, int _errno);
 
+/// Responds to a standard method call with a string of exactly `length` bytes.
+/// Unlike STDSTRING, which is measured using strlen, the string doesn't need to be
+/// null-terminated and can contain null-bytes (U+0000 characters).
+int platch_respond_success_std_string(const FlutterPlatformMessageResponseHandle *handle, const char *string, size_t length);
+
 int platch_respond_success_json(const FlutterPlatformMessageResponseHandle *handle, struct json_value *return_value);
 
 int platch_respond_error_json(
@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <gst/gst.h>
+
+#include "util/refcounting.h"
+
 struct audio_player;
 
 struct audio_player *audio_player_new(char *playerId, char *channel);
@@ -49,4 +53,122 @@ bool audio_player_set_subscription_status(struct audio_player *self, const char
 
 void audio_player_release(struct audio_player *self);
 
+///Enables or disables low latency mode.
+///
+///In low latency mode, short sources are decoded into memory once
+///and played back from there, without setting up a decoding pipeline every time.
+void audio_player_set_low_latency(struct audio_player *self, bool low_latency);
+
+///Sets how often position updates are sent while playing.
+///
+///A value <= 0 restores the default of 200ms.
+void audio_player_set_position_update_interval(struct audio_player *self, int64_t interval_ms);
+
+///Returns the measured latency in milliseconds between the last play request
+///and the sound actually leaving the speaker, or -1 if nothing was measured yet.
+int64_t audio_player_get_start_latency(struct audio_player *self);
+
+///Sends a log message to the dart side, using the `audio.onLog` event.
+void audio_player_emit_log(struct audio_player *self, const char *message);
+
+///Sends an error to the dart side, on the player's event channel.
+void audio_player_emit_error(struct audio_player *self, const char *code, const char *message);
+
+// Shared audio mixer
+//
+// All players output into one long-lived `audiomixer ! autoaudiosink` pipeline,
+// so there's only one audio device opened for all of them.
+
+struct audio_mixer;
+struct audio_mixer_input;
+struct audio_clip;
+struct audio_clip_load;
+
+typedef void (*audio_mixer_clip_end_cb_t)(void *userdata);
+
+typedef void (*audio_clip_loaded_cb_t)(struct audio_clip *clip, void *userdata);
+
+///Returns the shared audio mixer, creating it if it doesn't exist yet.
+///
+///Returns NULL if the mixer pipeline can't be created, e.g. because the audiomixer element is missing.
+struct audio_mixer *audio_mixer_get(void);
+
+void audio_mixer_destroy(struct audio_mixer *mixer);
+
+DECLARE_REF_OPS(audio_mixer)
+
+///The current running time of the mixer pipeline.
+GstClockTime audio_mixer_get_running_time(struct audio_mixer *mixer);
+
+///Enables low latency output for one more user (or one less, if `low_latency` is false).
+///
+///As long as there's at least one user, the audio sink uses a small `buffer-time`/`latency-time`.
+///All players share the one mixer output, so this applies to every player, not just the one asking for it.
+///Must be called on the platform thread. Calls must be balanced.
+void audio_mixer_set_low_latency(struct audio_mixer *mixer, bool low_latency);
+
+///The latency from the mixer to the audio device, in nanoseconds.
+uint64_t audio_mixer_get_output_latency_ns(struct audio_mixer *mixer);
+
+///Creates a bin that converts audio into the mixer format and hands it to `*appsink_out`.
+///
+///Can be used as the `audio-sink` of a playbin. The buffers pulled from the appsink
+///can then be pushed into a mixer input.
+GstElement *audio_mixer_make_input_sink(GstElement **appsink_out);
+
+///Adds a new input to the mixer, with its own volume and stereo balance.
+struct audio_mixer_input *audio_mixer_add_input(struct audio_mixer *mixer);
+
+void audio_mixer_input_destroy(struct audio_mixer_input *input);
+
+///Queues `buffer` (in the mixer format) to be played after the previously pushed buffers,
+///or right away if those already finished playing. Takes ownership of `buffer`.
+int audio_mixer_input_push(struct audio_mixer_input *input, GstBuffer *buffer);
+
+///Drops all buffers that were pushed but not yet played.
+void audio_mixer_input_flush(struct audio_mixer_input *input);
+
+void audio_mixer_input_set_volume(struct audio_mixer_input *input, double volume);
+
+void audio_mixer_input_set_balance(struct audio_mixer_input *input, double balance);
+
+///Plays `clip` starting at `offset`, replacing whatever this input was playing.
+///
+///`on_clip_end` is called on a gstreamer streaming thread when the clip finished playing.
+int audio_mixer_input_play_clip(
+    struct audio_mixer_input *input,
+    struct audio_clip *clip,
+    GstClockTime offset,
+    audio_mixer_clip_end_cb_t on_clip_end,
+    void *userdata
+);
+
+///Returns `true` and the current position in the clip if a clip is currently playing.
+bool audio_mixer_input_get_clip_position(struct audio_mixer_input *input, GstClockTime *position_out);
+
+///Starts measuring the start latency. The measurement ends when the next buffer reaches the mixer.
+void audio_mixer_input_mark_start(struct audio_mixer_input *input);
+
+///Returns the last measured latency from @ref audio_mixer_input_mark_start until the sound reaches the
+///audio device, in nanoseconds.
+uint64_t audio_mixer_input_get_start_latency_ns(struct audio_mixer_input *input);
+
+///Decodes the audio at `uri` into memory on a worker thread, or uses the already decoded clip if it's cached.
+///
+///`on_loaded` is called on the platform thread with a new reference to the clip, or with NULL if the source
+///can't be decoded or is too long to be kept in memory. It's never called synchronously.
+///
+///The returned handle is valid until `on_loaded` was called or the load was cancelled.
+///Returns NULL if the load couldn't be started.
+struct audio_clip_load *audio_clip_load_async(const char *uri, audio_clip_loaded_cb_t on_loaded, void *userdata);
+
+///Makes sure the `on_loaded` callback of `load` is not called. Must be called on the platform thread.
+void audio_clip_load_cancel(struct audio_clip_load *load);
+
+void audio_clip_destroy(struct audio_clip *clip);
+
+DECLARE_REF_OPS(audio_clip)
+
+GstClockTime audio_clip_get_duration(struct audio_clip *clip);
+
 #endif  // AUDIOPLAYERS_H_
@@ -0,0 +1,1043 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+
+#include "flutter-pi.h"
+#include "plugins/audioplayers.h"
+#include "util/asserts.h"
+#include "util/collection.h"
+#include "util/list.h"
+#include "util/logging.h"
+#include "util/refcounting.h"
+
+// The format everything is converted to before it's fed into the mixer.
+#define MIXER_RATE 48000
+#define MIXER_CHANNELS 2
+#define MIXER_BYTES_PER_FRAME (MIXER_CHANNELS * sizeof(float))
+#define MIXER_CAPS "audio/x-raw,format=F32LE,layout=interleaved,rate=48000,channels=2"
+
+// How far behind realtime the mixer runs. Buffers are timestamped with the current running time,
+// so this is the headroom inputs have to get their buffers into the mixer.
+#define MIXER_LATENCY (20 * GST_MSECOND)
+
+// Used while at least one player is in low latency mode.
+// buffer-time and latency-time are configured on the audio sink (e.g. alsasink) and are in microseconds.
+#define LOW_LATENCY_MIXER_LATENCY (5 * GST_MSECOND)
+#define LOW_LATENCY_BUFFER_TIME_US 10000
+#define LOW_LATENCY_LATENCY_TIME_US 2000
+
+// The gstreamer audio sink defaults.
+#define DEFAULT_BUFFER_TIME_US 200000
+#define DEFAULT_LATENCY_TIME_US 10000
+
+// Clips longer than this are not decoded into memory.
+#define MAX_CLIP_DURATION (10 * GST_SECOND)
+
+// How much audio a mixer input queues at most before pushing blocks.
+// A whole clip must fit in, since clips are pushed at once from the platform thread.
+#define MAX_INPUT_QUEUE_DURATION (MAX_CLIP_DURATION + GST_SECOND)
+#define MAX_INPUT_QUEUE_BYTES ((guint64) (MAX_INPUT_QUEUE_DURATION / GST_MSECOND) * (MIXER_RATE / 1000) * MIXER_BYTES_PER_FRAME)
+
+struct audio_mixer {
+    refcount_t n_refs;
+
+    GstElement *pipeline;
+    GstElement *mixer;
+    GstElement *sink;
+    GstBus *bus;
+    sd_event_source *busfd_event_source;
+
+    /**
+     * @brief The pipeline (and with it, the audio device) only runs while there are inputs.
+     */
+    int n_inputs;
+
+    int n_low_latency_users;
+    bool low_latency;
+};
+
+struct audio_mixer_input {
+    struct audio_mixer *mixer;
+
+    GstElement *bin;
+    GstElement *appsrc;
+    GstElement *panorama;
+    GstPad *mixer_pad;
+
+    /**
+     * @brief The running time (of the mixer pipeline) the next buffer pushed will be played at,
+     * if it's not in the past already.
+     *
+     * Buffers are pushed from the player streaming threads and the platform thread,
+     * so this is guarded by @ref pts_lock.
+     */
+    pthread_mutex_t pts_lock;
+    GstClockTime next_pts;
+
+    /**
+     * @brief Running times the clip that's currently playing started and ends at.
+     */
+    pthread_mutex_t clip_lock;
+    bool has_clip;
+    GstClockTime clip_start, clip_end;
+    audio_mixer_clip_end_cb_t on_clip_end;
+    void *userdata;
+    gulong probe_id;
+
+    /**
+     * @brief For measuring how long it takes from a play request until the first buffer reaches the mixer.
+     */
+    bool awaiting_first_buffer;
+    uint64_t start_requested_ns;
+    uint64_t start_dispatch_latency_ns;
+};
+
+struct audio_clip {
+    refcount_t n_refs;
+    struct list_head entry;
+
+    char *uri;
+    GstBufferList *buffers;
+    GstClockTime duration;
+};
+
+struct audio_clip_load {
+    char *uri;
+    audio_clip_loaded_cb_t on_loaded;
+    void *userdata;
+
+    /**
+     * @brief The decoded clip, or NULL if decoding failed. Set by the worker thread.
+     */
+    struct audio_clip *clip;
+
+    /**
+     * @brief Set by @ref audio_clip_load_cancel. Only accessed on the platform thread.
+     */
+    bool cancelled;
+};
+
+static struct audio_mixer *shared_mixer = NULL;
+
+static struct list_head clip_cache = { &clip_cache, &clip_cache };
+
+static int on_bus_fd_ready(sd_event_source *src, int fd, uint32_t revents, void *userdata) {
+    struct audio_mixer *mixer = userdata;
+    GstMessage *msg;
+    GError *error;
+    gchar *debug;
+
+    (void) src;
+    (void) fd;
+    (void) revents;
+
+    while ((msg = gst_bus_pop_filtered(mixer->bus, GST_MESSAGE_ERROR | GST_MESSAGE_WARNING)) != NULL) {
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            gst_message_parse_error(msg, &error, &debug);
+            LOG_ERROR("audio mixer error: %s (debug: %s)\n", error->message, debug);
+        } else {
+            gst_message_parse_warning(msg, &error, &debug);
+            LOG_DEBUG("audio mixer warning: %s (debug: %s)\n", error->message, debug);
+        }
+
+        g_error_free(error);
+        g_free(debug);
+        gst_message_unref(msg);
+    }
+
+    return 0;
+}
+
+static struct audio_mixer *audio_mixer_new(void) {
+    struct audio_mixer *mixer;
+    GError *error;
+    GPollFD fd;
+    int ok;
+
+    mixer = malloc(sizeof *mixer);
+    if (mixer == NULL) {
+        return NULL;
+    }
+
+    gst_init(NULL, NULL);
+
+    // The silent source keeps the mixer (and the audio sink) running while players exist but aren't playing,
+    // so starting a sound doesn't have to wait for the audio device to be opened.
+    // The pipeline is only started with the first input though, see audio_mixer_add_input.
+    error = NULL;
+    mixer->pipeline = gst_parse_launch(
+        "audiotestsrc wave=silence is-live=true ! " MIXER_CAPS " ! audiomixer name=mixer ! audioconvert ! audioresample ! autoaudiosink name=sink",
+        &error
+    );
+    if (mixer->pipeline == NULL || error != NULL) {
+        LOG_ERROR("Could not create audio mixer pipeline. gst_parse_launch: %s\n", error != NULL ? error->message : "");
+        if (error != NULL) {
+            g_error_free(error);
+        }
+        if (mixer->pipeline != NULL) {
+            gst_object_unref(mixer->pipeline);
+        }
+        goto fail_free_mixer;
+    }
+
+    mixer->mixer = gst_bin_get_by_name(GST_BIN(mixer->pipeline), "mixer");
+    ASSERT_NOT_NULL(mixer->mixer);
+
+    mixer->sink = gst_bin_get_by_name(GST_BIN(mixer->pipeline), "sink");
+    ASSERT_NOT_NULL(mixer->sink);
+
+    g_object_set(G_OBJECT(mixer->mixer), "latency", (guint64) MIXER_LATENCY, NULL);
+
+    mixer->bus = gst_element_get_bus(mixer->pipeline);
+    gst_bus_get_pollfd(mixer->bus, &fd);
+
+    ok = flutterpi_sd_event_add_io(&mixer->busfd_event_source, fd.fd, EPOLLIN, on_bus_fd_ready, mixer);
+    if (ok != 0) {
+        LOG_ERROR("Could not listen for audio mixer bus messages.\n");
+        goto fail_unref_pipeline;
+    }
+
+    mixer->n_refs = REFCOUNT_INIT_1;
+    mixer->n_inputs = 0;
+    mixer->n_low_latency_users = 0;
+    mixer->low_latency = false;
+    return mixer;
+
+fail_unref_pipeline:
+    gst_object_unref(mixer->bus);
+    gst_object_unref(mixer->sink);
+    gst_object_unref(mixer->mixer);
+    gst_element_set_state(mixer->pipeline, GST_STATE_NULL);
+    gst_object_unref(mixer->pipeline);
+
+fail_free_mixer:
+    free(mixer);
+    return NULL;
+}
+
+struct audio_mixer *audio_mixer_get(void) {
+    if (shared_mixer != NULL) {
+        return audio_mixer_ref(shared_mixer);
+    }
+
+    shared_mixer = audio_mixer_new();
+    return shared_mixer;
+}
+
+void audio_mixer_destroy(struct audio_mixer *mixer) {
+    if (shared_mixer == mixer) {
+        shared_mixer = NULL;
+    }
+
+    sd_event_source_unrefp(&mixer->busfd_event_source);
+    gst_element_set_state(mixer->pipeline, GST_STATE_NULL);
+    gst_object_unref(mixer->bus);
+    gst_object_unref(mixer->sink);
+    gst_object_unref(mixer->mixer);
+    gst_object_unref(mixer->pipeline);
+    free(mixer);
+}
+
+DEFINE_REF_OPS(audio_mixer, n_refs)
+
+static void configure_sink_buffering(struct audio_mixer *mixer, bool low_latency) {
+    GValue value = G_VALUE_INIT;
+    GstIterator *iterator;
+    GstElement *element;
+
+    // autoaudiosink is a bin around the actual sink (alsasink, pulsesink, ...).
+    // buffer-time and latency-time are properties of GstAudioBaseSink.
+    iterator = gst_bin_iterate_recurse(GST_BIN(mixer->sink));
+    while (gst_iterator_next(iterator, &value) == GST_ITERATOR_OK) {
+        element = g_value_get_object(&value);
+
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), "buffer-time") != NULL &&
+            g_object_class_find_property(G_OBJECT_GET_CLASS(element), "latency-time") != NULL) {
+            g_object_set(
+                G_OBJECT(element),
+                "buffer-time", (gint64) (low_latency ? LOW_LATENCY_BUFFER_TIME_US : DEFAULT_BUFFER_TIME_US),
+                "latency-time", (gint64) (low_latency ? LOW_LATENCY_LATENCY_TIME_US : DEFAULT_LATENCY_TIME_US),
+                NULL
+            );
+        }
+
+        g_value_reset(&value);
+    }
+    g_value_unset(&value);
+    gst_iterator_free(iterator);
+
+    g_object_set(G_OBJECT(mixer->mixer), "latency", (guint64) (low_latency ? LOW_LATENCY_MIXER_LATENCY : MIXER_LATENCY), NULL);
+}
+
+struct sink_reconfiguration {
+    struct audio_mixer *mixer;
+    bool low_latency;
+};
+
+static GstPadProbeReturn on_sink_blocked(GstPad *pad, GstPadProbeInfo *info, void *userdata) {
+    struct sink_reconfiguration *reconfiguration = userdata;
+    struct audio_mixer *mixer = reconfiguration->mixer;
+
+    (void) pad;
+    (void) info;
+
+    // We're on a streaming thread here, mixer->low_latency belongs to the platform thread.
+    // If the mode was toggled again in the meantime, the probes run in the order they were added,
+    // so the last one wins.
+    //
+    // The sink only picks up new buffer sizes when it (re-)acquires its ringbuffer.
+    // We're blocking the data flow into the sink right now, so it's safe to restart it.
+    gst_element_set_state(mixer->sink, GST_STATE_READY);
+    configure_sink_buffering(mixer, reconfiguration->low_latency);
+    gst_element_sync_state_with_parent(mixer->sink);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void audio_mixer_set_low_latency(struct audio_mixer *mixer, bool low_latency) {
+    struct sink_reconfiguration *reconfiguration;
+    GstPad *sinkpad, *peer;
+
+    mixer->n_low_latency_users += low_latency ? 1 : -1;
+    ASSERT_MSG(mixer->n_low_latency_users >= 0, "unbalanced audio_mixer_set_low_latency calls");
+
+    if ((mixer->n_low_latency_users > 0) == mixer->low_latency) {
+        return;
+    }
+
+    mixer->low_latency = mixer->n_low_latency_users > 0;
+    LOG_DEBUG("Switching audio mixer output to %s buffering.\n", mixer->low_latency ? "low latency" : "default");
+
+    sinkpad = gst_element_get_static_pad(mixer->sink, "sink");
+    peer = gst_pad_get_peer(sinkpad);
+    if (peer != NULL) {
+        reconfiguration = malloc(sizeof *reconfiguration);
+        if (reconfiguration != NULL) {
+            reconfiguration->mixer = mixer;
+            reconfiguration->low_latency = mixer->low_latency;
+            gst_pad_add_probe(peer, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, on_sink_blocked, reconfiguration, free);
+        } else {
+            LOG_ERROR("Couldn't switch audio sink buffering. Out of memory.\n");
+        }
+        gst_object_unref(peer);
+    }
+    gst_object_unref(sinkpad);
+}
+
+uint64_t audio_mixer_get_output_latency_ns(struct audio_mixer *mixer) {
+    GstClockTime min_latency, max_latency;
+    gboolean live;
+    GstQuery *query;
+    uint64_t latency;
+
+    query = gst_query_new_latency();
+
+    latency = 0;
+    if (gst_element_query(mixer->pipeline, query)) {
+        gst_query_parse_latency(query, &live, &min_latency, &max_latency);
+        if (GST_CLOCK_TIME_IS_VALID(min_latency)) {
+            latency = min_latency;
+        }
+    }
+
+    gst_query_unref(query);
+    return latency;
+}
+
+GstClockTime audio_mixer_get_running_time(struct audio_mixer *mixer) {
+    GstClockTime now, base_time;
+    GstClock *clock;
+
+    clock = gst_element_get_clock(mixer->pipeline);
+    if (clock == NULL) {
+        return 0;
+    }
+
+    now = gst_clock_get_time(clock);
+    base_time = gst_element_get_base_time(mixer->pipeline);
+    gst_object_unref(clock);
+
+    return now > base_time ? now - base_time : 0;
+}
+
+static int audio_mixer_start(struct audio_mixer *mixer) {
+    GstStateChangeReturn state_change;
+
+    // autoaudiosink creates the actual sink when going to READY. Configure its buffering
+    // before it's started, it only picks that up when acquiring its ringbuffer.
+    state_change = gst_element_set_state(mixer->pipeline, GST_STATE_READY);
+    if (state_change == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("Could not start audio mixer pipeline.\n");
+        return EIO;
+    }
+
+    configure_sink_buffering(mixer, mixer->low_latency);
+
+    state_change = gst_element_set_state(mixer->pipeline, GST_STATE_PLAYING);
+    if (state_change == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("Could not start audio mixer pipeline.\n");
+        gst_element_set_state(mixer->pipeline, GST_STATE_NULL);
+        return EIO;
+    }
+
+    return 0;
+}
+
+static void audio_mixer_stop(struct audio_mixer *mixer) {
+    // Closes the audio device and stops the silent source.
+    gst_element_set_state(mixer->pipeline, GST_STATE_NULL);
+}
+
+static GstPadProbeReturn on_input_buffer(GstPad *pad, GstPadProbeInfo *info, void *userdata) {
+    struct audio_mixer_input *input;
+    GstBuffer *buffer;
+    bool ended;
+
+    (void) pad;
+
+    input = userdata;
+    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    pthread_mutex_lock(&input->clip_lock);
+    if (input->awaiting_first_buffer) {
+        input->awaiting_first_buffer = false;
+        input->start_dispatch_latency_ns = get_monotonic_time() - input->start_requested_ns;
+    }
+
+    ended = input->has_clip && GST_BUFFER_PTS(buffer) + GST_BUFFER_DURATION(buffer) >= input->clip_end;
+    if (ended) {
+        input->has_clip = false;
+
+        // Called with the clip lock held, so once audio_mixer_input_flush returns,
+        // the clip end of the flushed clip can't be reported anymore.
+        if (input->on_clip_end != NULL) {
+            input->on_clip_end(input->userdata);
+        }
+    }
+    pthread_mutex_unlock(&input->clip_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+struct audio_mixer_input *audio_mixer_add_input(struct audio_mixer *mixer) {
+    struct audio_mixer_input *input;
+    GstPadLinkReturn link_ok;
+    GstCaps *caps;
+    GstPad *pad, *ghost_pad;
+
+    input = malloc(sizeof *input);
+    if (input == NULL) {
+        return NULL;
+    }
+
+    input->bin = gst_bin_new(NULL);
+    input->appsrc = gst_element_factory_make("appsrc", NULL);
+    input->panorama = gst_element_factory_make("audiopanorama", NULL);
+    if (input->appsrc == NULL || input->panorama == NULL) {
+        LOG_ERROR("Could not create audio mixer input elements. Make sure the appsrc and audiopanorama gstreamer elements are installed.\n");
+        if (input->appsrc != NULL) {
+            gst_object_unref(input->appsrc);
+        }
+        if (input->panorama != NULL) {
+            gst_object_unref(input->panorama);
+        }
+        gst_object_unref(input->bin);
+        goto fail_free_input;
+    }
+
+    caps = gst_caps_from_string(MIXER_CAPS);
+    g_object_set(
+        G_OBJECT(input->appsrc),
+        "caps", caps,
+        "format", GST_FORMAT_TIME,
+        "is-live", TRUE,
+        "max-bytes", MAX_INPUT_QUEUE_BYTES,
+        "block", TRUE,
+        NULL
+    );
+    gst_caps_unref(caps);
+
+    g_object_set(G_OBJECT(input->panorama), "method", 1, NULL);
+
+    gst_bin_add_many(GST_BIN(input->bin), input->appsrc, input->panorama, NULL);
+    gst_element_link(input->appsrc, input->panorama);
+
+    pad = gst_element_get_static_pad(input->panorama, "src");
+    ghost_pad = gst_ghost_pad_new("src", pad);
+    gst_element_add_pad(input->bin, ghost_pad);
+    gst_object_unref(pad);
+
+    gst_bin_add(GST_BIN(mixer->pipeline), input->bin);
+
+#if GST_CHECK_VERSION(1, 20, 0)
+    input->mixer_pad = gst_element_request_pad_simple(mixer->mixer, "sink_%u");
+#else
+    input->mixer_pad = gst_element_get_request_pad(mixer->mixer, "sink_%u");
+#endif
+    if (input->mixer_pad == NULL) {
+        LOG_ERROR("Could not request audio mixer sink pad.\n");
+        goto fail_remove_bin;
+    }
+
+    link_ok = gst_pad_link(ghost_pad, input->mixer_pad);
+    if (link_ok != GST_PAD_LINK_OK) {
+        LOG_ERROR("Could not link audio mixer input. gst_pad_link: %s\n", gst_pad_link_get_name(link_ok));
+        goto fail_release_pad;
+    }
+
+    if (mixer->n_inputs == 0) {
+        // Starts the input bin along with the pipeline.
+        if (audio_mixer_start(mixer) != 0) {
+            goto fail_release_pad;
+        }
+    } else if (!gst_element_sync_state_with_parent(input->bin)) {
+        LOG_ERROR("Could not start audio mixer input.\n");
+        goto fail_release_pad;
+    }
+
+    mixer->n_inputs++;
+
+    input->mixer = audio_mixer_ref(mixer);
+    pthread_mutex_init(&input->pts_lock, NULL);
+    input->next_pts = 0;
+    pthread_mutex_init(&input->clip_lock, NULL);
+    input->has_clip = false;
+    input->clip_start = 0;
+    input->clip_end = 0;
+    input->on_clip_end = NULL;
+    input->userdata = NULL;
+    input->awaiting_first_buffer = false;
+    input->start_requested_ns = 0;
+    input->start_dispatch_latency_ns = 0;
+
+    pad = gst_element_get_static_pad(input->appsrc, "src");
+    input->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_input_buffer, input, NULL);
+    gst_object_unref(pad);
+
+    return input;
+
+fail_release_pad:
+    gst_element_release_request_pad(mixer->mixer, input->mixer_pad);
+    gst_object_unref(input->mixer_pad);
+
+fail_remove_bin:
+    gst_bin_remove(GST_BIN(mixer->pipeline), input->bin);
+
+fail_free_input:
+    free(input);
+    return NULL;
+}
+
+void audio_mixer_input_destroy(struct audio_mixer_input *input) {
+    struct audio_mixer *mixer = input->mixer;
+
+    // Stop the appsrc streaming thread first, so nothing is flowing into the pad anymore
+    // when we release it.
+    gst_element_set_locked_state(input->bin, TRUE);
+    gst_element_set_state(input->bin, GST_STATE_NULL);
+
+    GstPad *pad = gst_element_get_static_pad(input->appsrc, "src");
+    gst_pad_remove_probe(pad, input->probe_id);
+    gst_object_unref(pad);
+
+    gst_element_release_request_pad(mixer->mixer, input->mixer_pad);
+    gst_object_unref(input->mixer_pad);
+    gst_bin_remove(GST_BIN(mixer->pipeline), input->bin);
+
+    mixer->n_inputs--;
+    if (mixer->n_inputs == 0) {
+        audio_mixer_stop(mixer);
+    }
+
+    pthread_mutex_destroy(&input->clip_lock);
+    pthread_mutex_destroy(&input->pts_lock);
+    audio_mixer_unref(mixer);
+    free(input);
+}
+
+/**
+ * @brief Reserve @param duration of playback time for the next buffers pushed into @param input.
+ *
+ * Returns the running time the first of them should be played at.
+ */
+static GstClockTime reserve_pts(struct audio_mixer_input *input, GstClockTime duration) {
+    GstClockTime now, pts;
+
+    now = audio_mixer_get_running_time(input->mixer);
+
+    pthread_mutex_lock(&input->pts_lock);
+
+    // If we were paused, or the producer lagged behind, the next buffer is played right away.
+    if (input->next_pts < now) {
+        input->next_pts = now;
+    }
+
+    pts = input->next_pts;
+    input->next_pts += duration;
+
+    pthread_mutex_unlock(&input->pts_lock);
+
+    return pts;
+}
+
+static GstClockTime get_buffer_duration(GstBuffer *buffer) {
+    return gst_util_uint64_scale(gst_buffer_get_size(buffer) / MIXER_BYTES_PER_FRAME, GST_SECOND, MIXER_RATE);
+}
+
+static int push_buffer_at(struct audio_mixer_input *input, GstBuffer *buffer, GstClockTime pts, GstClockTime duration) {
+    GstFlowReturn flow;
+
+    buffer = gst_buffer_make_writable(buffer);
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION(buffer) = duration;
+
+    // Blocks if the appsrc queue is full, so a producer can't run arbitrarily far ahead of the mixer.
+    flow = gst_app_src_push_buffer(GST_APP_SRC(input->appsrc), buffer);
+    if (flow != GST_FLOW_OK && flow != GST_FLOW_FLUSHING) {
+        LOG_ERROR("Could not push buffer into audio mixer. gst_app_src_push_buffer: %s\n", gst_flow_get_name(flow));
+        return EIO;
+    }
+
+    return 0;
+}
+
+int audio_mixer_input_push(struct audio_mixer_input *input, GstBuffer *buffer) {
+    GstClockTime duration;
+
+    duration = get_buffer_duration(buffer);
+    return push_buffer_at(input, buffer, reserve_pts(input, duration), duration);
+}
+
+void audio_mixer_input_flush(struct audio_mixer_input *input) {
+    pthread_mutex_lock(&input->clip_lock);
+    input->has_clip = false;
+    pthread_mutex_unlock(&input->clip_lock);
+
+    // appsrc drops everything it has queued on flush-stop.
+    gst_element_send_event(input->appsrc, gst_event_new_flush_start());
+    gst_element_send_event(input->appsrc, gst_event_new_flush_stop(FALSE));
+
+    pthread_mutex_lock(&input->pts_lock);
+    input->next_pts = 0;
+    pthread_mutex_unlock(&input->pts_lock);
+}
+
+void audio_mixer_input_set_volume(struct audio_mixer_input *input, double volume) {
+    g_object_set(G_OBJECT(input->mixer_pad), "volume", volume, NULL);
+}
+
+void audio_mixer_input_set_balance(struct audio_mixer_input *input, double balance) {
+    g_object_set(G_OBJECT(input->panorama), "panorama", (gfloat) balance, NULL);
+}
+
+int audio_mixer_input_play_clip(
+    struct audio_mixer_input *input,
+    struct audio_clip *clip,
+    GstClockTime offset,
+    audio_mixer_clip_end_cb_t on_clip_end,
+    void *userdata
+) {
+    GstClockTime position, duration, pts;
+    GstBuffer *buffer;
+    unsigned n_buffers, first;
+    int ok;
+
+    audio_mixer_input_flush(input);
+
+    audio_mixer_input_mark_start(input);
+
+    n_buffers = gst_buffer_list_length(clip->buffers);
+
+    // Find the buffer @param offset is in.
+    position = 0;
+    for (first = 0; first < n_buffers; first++) {
+        duration = GST_BUFFER_DURATION(gst_buffer_list_get(clip->buffers, first));
+        if (position + duration > offset) {
+            break;
+        }
+        position += duration;
+    }
+
+    if (first == n_buffers) {
+        // We were asked to play from the end of the clip.
+        if (on_clip_end != NULL) {
+            on_clip_end(userdata);
+        }
+        return 0;
+    }
+
+    // The clip starts wherever its first buffer is scheduled.
+    pts = reserve_pts(input, clip->duration - position);
+
+    pthread_mutex_lock(&input->clip_lock);
+    input->on_clip_end = on_clip_end;
+    input->userdata = userdata;
+    input->clip_start = pts - (offset - position);
+    input->clip_end = input->clip_start + clip->duration;
+    input->has_clip = true;
+    pthread_mutex_unlock(&input->clip_lock);
+
+    // Push the whole (rest of the) clip at once. The buffers get consecutive timestamps,
+    // so the mixer will play them back one after the other.
+    // The clip lock must not be held here: pushing can block until the streaming thread
+    // made room, and the input buffer probe takes the clip lock on the streaming thread.
+    for (unsigned i = first; i < n_buffers; i++) {
+        buffer = gst_buffer_list_get(clip->buffers, i);
+        duration = GST_BUFFER_DURATION(buffer);
+
+        ok = push_buffer_at(input, gst_buffer_ref(buffer), pts, duration);
+        if (ok != 0) {
+            pthread_mutex_lock(&input->clip_lock);
+            input->has_clip = false;
+            pthread_mutex_unlock(&input->clip_lock);
+            return ok;
+        }
+
+        pts += duration;
+    }
+
+    return 0;
+}
+
+void audio_mixer_input_mark_start(struct audio_mixer_input *input) {
+    pthread_mutex_lock(&input->clip_lock);
+    input->awaiting_first_buffer = true;
+    input->start_requested_ns = get_monotonic_time();
+    pthread_mutex_unlock(&input->clip_lock);
+}
+
+uint64_t audio_mixer_input_get_start_latency_ns(struct audio_mixer_input *input) {
+    uint64_t dispatch_latency;
+
+    pthread_mutex_lock(&input->clip_lock);
+    dispatch_latency = input->start_dispatch_latency_ns;
+    pthread_mutex_unlock(&input->clip_lock);
+
+    // Time until the first buffer reached the mixer, plus the time it takes from there to the speaker.
+    return dispatch_latency + audio_mixer_get_output_latency_ns(input->mixer);
+}
+
+bool audio_mixer_input_get_clip_position(struct audio_mixer_input *input, GstClockTime *position_out) {
+    GstClockTime now;
+    bool has_clip;
+
+    now = audio_mixer_get_running_time(input->mixer);
+
+    pthread_mutex_lock(&input->clip_lock);
+    has_clip = input->has_clip;
+    if (has_clip) {
+        if (now <= input->clip_start) {
+            *position_out = 0;
+        } else if (now >= input->clip_end) {
+            *position_out = input->clip_end - input->clip_start;
+        } else {
+            *position_out = now - input->clip_start;
+        }
+    }
+    pthread_mutex_unlock(&input->clip_lock);
+
+    return has_clip;
+}
+
+static GstElement *make_converting_appsink(GstElement **appsink_out) {
+    GstElement *bin, *convert, *resample, *capsfilter, *appsink;
+    GstCaps *caps;
+    GstPad *pad;
+
+    bin = gst_bin_new(NULL);
+    convert = gst_element_factory_make("audioconvert", NULL);
+    resample = gst_element_factory_make("audioresample", NULL);
+    capsfilter = gst_element_factory_make("capsfilter", NULL);
+    appsink = gst_element_factory_make("appsink", NULL);
+    if (convert == NULL || resample == NULL || capsfilter == NULL || appsink == NULL) {
+        LOG_ERROR("Could not create audio conversion elements.\n");
+        if (convert != NULL) {
+            gst_object_unref(convert);
+        }
+        if (resample != NULL) {
+            gst_object_unref(resample);
+        }
+        if (capsfilter != NULL) {
+            gst_object_unref(capsfilter);
+        }
+        if (appsink != NULL) {
+            gst_object_unref(appsink);
+        }
+        gst_object_unref(bin);
+        return NULL;
+    }
+
+    caps = gst_caps_from_string(MIXER_CAPS);
+    g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    gst_bin_add_many(GST_BIN(bin), convert, resample, capsfilter, appsink, NULL);
+    gst_element_link_many(convert, resample, capsfilter, appsink, NULL);
+
+    pad = gst_element_get_static_pad(convert, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+
+    *appsink_out = appsink;
+    return bin;
+}
+
+GstElement *audio_mixer_make_input_sink(GstElement **appsink_out) {
+    GstElement *bin, *appsink;
+
+    bin = make_converting_appsink(&appsink);
+    if (bin == NULL) {
+        return NULL;
+    }
+
+    // Let the player pipeline play the buffers back in realtime, the mixer input just
+    // takes them over as they come in.
+    g_object_set(G_OBJECT(appsink), "sync", TRUE, "max-buffers", 4, NULL);
+
+    *appsink_out = appsink;
+    return bin;
+}
+
+static struct audio_clip *audio_clip_decode(const char *uri) {
+    struct audio_clip *clip;
+    GstStateChangeReturn state_change;
+    GstElement *playbin, *sinkbin, *appsink;
+    GstBufferList *buffers;
+    GstClockTime duration;
+    GstMessage *msg;
+    GstSample *sample;
+    GstBuffer *buffer;
+
+    playbin = gst_element_factory_make("playbin", NULL);
+    if (playbin == NULL) {
+        LOG_ERROR("Could not create gstreamer playbin.\n");
+        return NULL;
+    }
+
+    sinkbin = make_converting_appsink(&appsink);
+    if (sinkbin == NULL) {
+        gst_object_unref(playbin);
+        return NULL;
+    }
+
+    // Decode as fast as possible.
+    g_object_set(G_OBJECT(appsink), "sync", FALSE, NULL);
+    g_object_set(G_OBJECT(playbin), "uri", uri, "audio-sink", sinkbin, NULL);
+
+    state_change = gst_element_set_state(playbin, GST_STATE_PLAYING);
+    if (state_change == GST_STATE_CHANGE_FAILURE) {
+        LOG_ERROR("Could not start decoding audio clip \"%s\".\n", uri);
+        goto fail_unref_playbin;
+    }
+
+    buffers = gst_buffer_list_new();
+    duration = 0;
+
+    while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), 5 * GST_SECOND)) != NULL) {
+        buffer = gst_sample_get_buffer(sample);
+        if (buffer != NULL) {
+            buffer = gst_buffer_copy(buffer);
+            GST_BUFFER_DURATION(buffer) =
+                gst_util_uint64_scale(gst_buffer_get_size(buffer) / MIXER_BYTES_PER_FRAME, GST_SECOND, MIXER_RATE);
+            duration += GST_BUFFER_DURATION(buffer);
+            gst_buffer_list_add(buffers, buffer);
+        }
+        gst_sample_unref(sample);
+
+        if (duration > MAX_CLIP_DURATION) {
+            LOG_DEBUG("Audio clip \"%s\" is too long to be played from memory.\n", uri);
+            goto fail_unref_buffers;
+        }
+    }
+
+    msg = gst_bus_pop_filtered(GST_ELEMENT_BUS(playbin), GST_MESSAGE_ERROR);
+    if (msg != NULL) {
+        GError *error;
+        gchar *debug;
+
+        gst_message_parse_error(msg, &error, &debug);
+        LOG_ERROR("Could not decode audio clip \"%s\": %s\n", uri, error->message);
+        g_error_free(error);
+        g_free(debug);
+        gst_message_unref(msg);
+        goto fail_unref_buffers;
+    }
+
+    if (!gst_app_sink_is_eos(GST_APP_SINK(appsink)) || gst_buffer_list_length(buffers) == 0) {
+        LOG_ERROR("Could not decode audio clip \"%s\".\n", uri);
+        goto fail_unref_buffers;
+    }
+
+    gst_element_set_state(playbin, GST_STATE_NULL);
+    gst_object_unref(playbin);
+
+    clip = malloc(sizeof *clip);
+    if (clip == NULL) {
+        gst_buffer_list_unref(buffers);
+        return NULL;
+    }
+
+    clip->uri = strdup(uri);
+    if (clip->uri == NULL) {
+        gst_buffer_list_unref(buffers);
+        free(clip);
+        return NULL;
+    }
+
+    clip->n_refs = REFCOUNT_INIT_1;
+    list_inithead(&clip->entry);
+    clip->buffers = buffers;
+    clip->duration = duration;
+    return clip;
+
+fail_unref_buffers:
+    gst_buffer_list_unref(buffers);
+
+fail_unref_playbin:
+    gst_element_set_state(playbin, GST_STATE_NULL);
+    gst_object_unref(playbin);
+    return NULL;
+}
+
+static struct audio_clip *lookup_cached_clip(const char *uri) {
+    list_for_each_entry(struct audio_clip, cached, &clip_cache, entry) {
+        if (streq(cached->uri, uri)) {
+            return audio_clip_ref(cached);
+        }
+    }
+
+    return NULL;
+}
+
+static void audio_clip_load_destroy(struct audio_clip_load *load) {
+    if (load->clip != NULL) {
+        audio_clip_unref(load->clip);
+    }
+    free(load->uri);
+    free(load);
+}
+
+static int on_clip_loaded(void *userdata) {
+    struct audio_clip_load *load;
+    struct audio_clip *cached;
+
+    load = userdata;
+
+    if (load->clip != NULL) {
+        // Someone else might've decoded the same uri in the meantime.
+        cached = lookup_cached_clip(load->uri);
+        if (cached != NULL) {
+            audio_clip_unref(load->clip);
+            load->clip = cached;
+        } else {
+            list_add(&load->clip->entry, &clip_cache);
+        }
+    }
+
+    if (!load->cancelled) {
+        load->on_loaded(load->clip, load->userdata);
+
+        // on_loaded took over the reference.
+        load->clip = NULL;
+    }
+
+    audio_clip_load_destroy(load);
+    return 0;
+}
+
+static void *clip_decode_thread_entry(void *userdata) {
+    struct audio_clip_load *load;
+    int ok;
+
+    load = userdata;
+
+    load->clip = audio_clip_decode(load->uri);
+
+    ok = flutterpi_post_platform_task(on_clip_loaded, load);
+    if (ok != 0) {
+        // We're shutting down.
+        audio_clip_load_destroy(load);
+    }
+
+    return NULL;
+}
+
+struct audio_clip_load *audio_clip_load_async(const char *uri, audio_clip_loaded_cb_t on_loaded, void *userdata) {
+    struct audio_clip_load *load;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ok;
+
+    load = malloc(sizeof *load);
+    if (load == NULL) {
+        return NULL;
+    }
+
+    load->uri = strdup(uri);
+    if (load->uri == NULL) {
+        goto fail_free_load;
+    }
+
+    load->on_loaded = on_loaded;
+    load->userdata = userdata;
+    load->clip = lookup_cached_clip(uri);
+    load->cancelled = false;
+
+    if (load->clip != NULL) {
+        // Already decoded, but still report it asynchronously so callers only have one path.
+        ok = flutterpi_post_platform_task(on_clip_loaded, load);
+        if (ok != 0) {
+            goto fail_unref_clip;
+        }
+
+        return load;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    ok = pthread_create(&thread, &attr, clip_decode_thread_entry, load);
+    pthread_attr_destroy(&attr);
+    if (ok != 0) {
+        LOG_ERROR("Could not create audio clip decoding thread. pthread_create: %s\n", strerror(ok));
+        goto fail_free_uri;
+    }
+
+    return load;
+
+fail_unref_clip:
+    audio_clip_unref(load->clip);
+
+fail_free_uri:
+    free(load->uri);
+
+fail_free_load:
+    free(load);
+    return NULL;
+}
+
+void audio_clip_load_cancel(struct audio_clip_load *load) {
+    load->cancelled = true;
+}
+
+void audio_clip_destroy(struct audio_clip *clip) {
+    list_del(&clip->entry);
+    gst_buffer_list_unref(clip->buffers);
+    free(clip->uri);
+    free(clip);
+}
+
+DEFINE_REF_OPS(audio_clip, n_refs)
+
+GstClockTime audio_clip_get_duration(struct audio_clip *clip) {
+    return clip->duration;
+}
@@ -1,8 +1,17 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <gst/app/gstappsink.h>
 #include <gst/gst.h>
 #include <gst/gstelementfactory.h>
 #include <gst/gstmessage.h>
@@ -12,18 +21,51 @@
 #include "platformchannel.h"
 #include "plugins/audioplayers.h"
 #include "util/asserts.h"
+#include "util/collection.h"
 #include "util/logging.h"
 
+#define DEFAULT_POSITION_UPDATE_INTERVAL_MS 200
+
+// Position updates are coalesced so that at most one is sent per frame (at 60Hz).
+#define MIN_POSITION_UPDATE_PERIOD_NS (1000000000ull / 60)
+
 struct audio_player {
     GstElement *source;
     GstElement *playbin;
     GstBus *bus;
 
+    // The bus sync handler signals this eventfd, and the bus is then drained on the platform thread.
+    int bus_wakeup_fd;
+    sd_event_source *bus_event_source;
+
+    // Sends position updates periodically while playing.
+    int position_timer_fd;
+    sd_event_source *position_timer_event_source;
+    uint64_t position_update_interval_ns;
+    uint64_t last_position_update_ns;
+    bool has_pending_position_update;
+
     GstElement *panorama;
     GstElement *audiobin;
     GstElement *audiosink;
     GstPad *panoramaSinkPad;
 
+    // Output into the shared mixer, if available.
+    struct audio_mixer *mixer;
+    struct audio_mixer_input *input;
+
+    // Low latency mode: source decoded into memory, played back by the mixer input directly.
+    bool low_latency;
+    struct audio_clip_load *clip_load;
+    struct audio_clip *clip;
+    GstClockTime clip_position;
+
+    // Every clip playback gets a new generation. The mixer streaming thread stores the generation
+    // of the clip that ended and signals bus_wakeup_fd, so clip ends of clips that were stopped
+    // in the meantime are ignored on the platform thread. 0 means no clip ended.
+    _Atomic unsigned clip_generation;
+    _Atomic unsigned ended_clip_generation;
+
     bool is_initialized;
     bool is_playing;
     bool is_looping;
@@ -39,7 +81,6 @@ struct audio_player {
 
 // Private Class functions
 static gboolean audio_player_on_bus_message(GstBus *bus, GstMessage *message, struct audio_player *data);
-static gboolean audio_player_on_refresh(struct audio_player *data);
 static void audio_player_set_playback(struct audio_player *self, int64_t seekTo, double rate);
 static void audio_player_on_media_error(struct audio_player *self, GError *error, gchar *debug);
 static void audio_player_on_media_state_change(struct audio_player *self, GstObject *src, GstState *old_state, GstState *new_state);
@@ -48,24 +89,103 @@ static void audio_player_on_position_update(struct audio_player *self);
 static void audio_player_on_duration_update(struct audio_player *self);
 static void audio_player_on_seek_completed(struct audio_player *self);
 static void audio_player_on_playback_ended(struct audio_player *self);
+static void audio_player_on_clip_end(void *userdata);
+
+static GstBusSyncReply on_bus_sync_message(GstBus *bus, GstMessage *message, void *userdata) {
+    struct audio_player *player = userdata;
+    uint64_t value = 1;
+    ssize_t ok;
+
+    (void) bus;
+    (void) message;
+
+    // Called on the thread that posted the message. The message is still queued on the bus,
+    // we just wake up the platform thread so it gets handled without delay.
+    ok = write(player->bus_wakeup_fd, &value, sizeof value);
+    if (ok < 0 && errno != EAGAIN) {
+        LOG_ERROR("Could not wake up platform thread for bus message. write: %s\n", strerror(errno));
+    }
+
+    return GST_BUS_PASS;
+}
 
 static int on_bus_fd_ready(sd_event_source *src, int fd, uint32_t revents, void *userdata) {
     struct audio_player *player = userdata;
     GstMessage *msg;
+    uint64_t value;
+    unsigned ended;
 
     (void) src;
-    (void) fd;
     (void) revents;
 
-    /* DEBUG_TRACE_BEGIN(player, "on_bus_fd_ready"); */
+    // Reset the eventfd before draining, so messages posted while we're draining wake us up again.
+    (void) read(fd, &value, sizeof value);
 
-    msg = gst_bus_pop(player->bus);
-    if (msg != NULL) {
+    while ((msg = gst_bus_pop(player->bus)) != NULL) {
         audio_player_on_bus_message(player->bus, msg, player);
         gst_message_unref(msg);
     }
 
-    /* DEBUG_TRACE_END(player, "on_bus_fd_ready"); */
+    ended = atomic_exchange(&player->ended_clip_generation, 0);
+    if (ended != 0 && ended == atomic_load(&player->clip_generation) && player->clip != NULL) {
+        player->clip_position = audio_clip_get_duration(player->clip);
+        audio_player_on_playback_ended(player);
+    }
+
+    return 0;
+}
+
+static void audio_player_arm_position_timer(struct audio_player *self, uint64_t deadline_ns, uint64_t interval_ns) {
+    struct itimerspec spec;
+    int ok;
+
+    // A zero deadline disarms the timer.
+    spec.it_value.tv_sec = deadline_ns / 1000000000ull;
+    spec.it_value.tv_nsec = deadline_ns % 1000000000ull;
+    spec.it_interval.tv_sec = interval_ns / 1000000000ull;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000ull;
+
+    ok = timerfd_settime(self->position_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    if (ok < 0) {
+        LOG_ERROR("Could not arm position update timer. timerfd_settime: %s\n", strerror(errno));
+    }
+}
+
+static void audio_player_start_position_updates(struct audio_player *self) {
+    uint64_t now = get_monotonic_time();
+
+    self->has_pending_position_update = false;
+    audio_player_arm_position_timer(self, now + self->position_update_interval_ns, self->position_update_interval_ns);
+}
+
+static void audio_player_stop_position_updates(struct audio_player *self) {
+    self->has_pending_position_update = false;
+    audio_player_arm_position_timer(self, 0, 0);
+}
+
+static void audio_player_send_position_update(struct audio_player *self);
+
+static int on_position_timer_fd_ready(sd_event_source *src, int fd, uint32_t revents, void *userdata) {
+    struct audio_player *player = userdata;
+    uint64_t n_expirations;
+
+    (void) src;
+    (void) revents;
+
+    (void) read(fd, &n_expirations, sizeof n_expirations);
+
+    if (player->has_pending_position_update || (player->is_playing && player->is_initialized)) {
+        player->has_pending_position_update = false;
+        audio_player_send_position_update(player);
+    }
+
+    // If we were armed one-shot for a deferred update while playing, go back to periodic updates.
+    if (player->is_playing && player->is_initialized) {
+        struct itimerspec spec;
+        if (timerfd_gettime(player->position_timer_fd, &spec) == 0 && spec.it_interval.tv_sec == 0 && spec.it_interval.tv_nsec == 0) {
+            audio_player_start_position_updates(player);
+        }
+    }
 
     return 0;
 }
@@ -79,9 +199,66 @@ static void audio_player_source_setup(GstElement *playbin, GstElement *source, G
     }
 }
 
+static GstFlowReturn audio_player_on_appsink_new_sample(GstAppSink *appsink, void *userdata) {
+    struct audio_player *self = userdata;
+    GstSample *sample;
+    GstBuffer *buffer;
+
+    // Called on the streaming thread of the playbin, which already plays the buffers back in realtime.
+    sample = gst_app_sink_pull_sample(appsink);
+    if (sample == NULL) {
+        return GST_FLOW_OK;
+    }
+
+    buffer = gst_sample_get_buffer(sample);
+    if (buffer != NULL) {
+        audio_mixer_input_push(self->input, gst_buffer_ref(buffer));
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static bool audio_player_setup_mixer_output(struct audio_player *self) {
+    GstElement *appsink;
+
+    self->mixer = audio_mixer_get();
+    if (self->mixer == NULL) {
+        return false;
+    }
+
+    self->input = audio_mixer_add_input(self->mixer);
+    if (self->input == NULL) {
+        goto fail_unref_mixer;
+    }
+
+    self->audiobin = audio_mixer_make_input_sink(&appsink);
+    if (self->audiobin == NULL) {
+        goto fail_destroy_input;
+    }
+
+    gst_app_sink_set_callbacks(
+        GST_APP_SINK(appsink),
+        &(GstAppSinkCallbacks){ .new_sample = audio_player_on_appsink_new_sample },
+        self,
+        NULL
+    );
+
+    g_object_set(G_OBJECT(self->playbin), "audio-sink", self->audiobin, NULL);
+    return true;
+
+fail_destroy_input:
+    audio_mixer_input_destroy(self->input);
+    self->input = NULL;
+
+fail_unref_mixer:
+    audio_mixer_unref(self->mixer);
+    self->mixer = NULL;
+    return false;
+}
+
 struct audio_player *audio_player_new(char *player_id, char *channel) {
-    GPollFD fd;
-    sd_event_source *busfd_event_source;
+    int ok;
 
     struct audio_player *self = malloc(sizeof(struct audio_player));
     if (self == NULL) {
@@ -96,6 +273,14 @@ struct audio_player *audio_player_new(char *player_id, char *channel) {
     self->is_seek_completed = false;
     self->playback_rate = 1.0;
     self->event_subscribed = false;
+    self->mixer = NULL;
+    self->input = NULL;
+    self->low_latency = false;
+    self->clip_load = NULL;
+    self->clip = NULL;
+    self->clip_position = 0;
+    self->clip_generation = 1;
+    self->ended_clip_generation = 0;
 
     gst_init(NULL, NULL);
     self->playbin = gst_element_factory_make("playbin", NULL);
@@ -104,9 +289,14 @@ struct audio_player *audio_player_new(char *player_id, char *channel) {
         goto deinit_self;
     }
 
-    // Setup stereo balance controller
-    self->panorama = gst_element_factory_make("audiopanorama", NULL);
-    if (self->panorama) {
+    // Prefer the shared mixer, so we don't open an audio device per player.
+    // Volume and balance are then applied by the mixer input.
+    if (audio_player_setup_mixer_output(self)) {
+        self->panorama = NULL;
+        self->audiosink = NULL;
+        self->panoramaSinkPad = NULL;
+    } else if ((self->panorama = gst_element_factory_make("audiopanorama", NULL)) != NULL) {
+        // Setup stereo balance controller
         self->audiobin = gst_bin_new(NULL);
         self->audiosink = gst_element_factory_make("autoaudiosink", NULL);
 
@@ -130,16 +320,39 @@ struct audio_player *audio_player_new(char *player_id, char *channel) {
 
     self->bus = gst_element_get_bus(self->playbin);
 
-    gst_bus_get_pollfd(self->bus, &fd);
+    self->bus_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (self->bus_wakeup_fd < 0) {
+        LOG_ERROR("Could not create bus wakeup fd. eventfd: %s\n", strerror(errno));
+        goto deinit_player;
+    }
 
-    flutterpi_sd_event_add_io(&busfd_event_source, fd.fd, EPOLLIN, on_bus_fd_ready, self);
+    ok = flutterpi_sd_event_add_io(&self->bus_event_source, self->bus_wakeup_fd, EPOLLIN, on_bus_fd_ready, self);
+    if (ok != 0) {
+        goto close_bus_wakeup_fd;
+    }
+
+    gst_bus_set_sync_handler(self->bus, on_bus_sync_message, self, NULL);
 
-    // Refresh continuously to emit recurring events
-    g_timeout_add(1000, (GSourceFunc) audio_player_on_refresh, self);
+    // flutter-pi doesn't run a GLib main loop, so we use a timerfd on our own event loop
+    // for the recurring position updates.
+    self->position_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (self->position_timer_fd < 0) {
+        LOG_ERROR("Could not create position update timer. timerfd_create: %s\n", strerror(errno));
+        goto remove_bus_event_source;
+    }
+
+    ok = flutterpi_sd_event_add_io(&self->position_timer_event_source, self->position_timer_fd, EPOLLIN, on_position_timer_fd_ready, self);
+    if (ok != 0) {
+        goto close_position_timer_fd;
+    }
+
+    self->position_update_interval_ns = DEFAULT_POSITION_UPDATE_INTERVAL_MS * 1000000ull;
+    self->last_position_update_ns = 0;
+    self->has_pending_position_update = false;
 
     self->player_id = strdup(player_id);
     if (self->player_id == NULL) {
-        goto deinit_player;
+        goto remove_position_timer_event_source;
     }
 
     // audioplayers player event channel clang:
@@ -157,9 +370,27 @@ struct audio_player *audio_player_new(char *player_id, char *channel) {
 deinit_player_id:
     free(self->player_id);
 
+remove_position_timer_event_source:
+    sd_event_source_unrefp(&self->position_timer_event_source);
+
+close_position_timer_fd:
+    close(self->position_timer_fd);
+
+remove_bus_event_source:
+    gst_bus_set_sync_handler(self->bus, NULL, NULL, NULL);
+    sd_event_source_unrefp(&self->bus_event_source);
+
+close_bus_wakeup_fd:
+    close(self->bus_wakeup_fd);
+
 deinit_player:
     gst_object_unref(self->bus);
 
+    if (self->input != NULL) {
+        audio_mixer_input_destroy(self->input);
+        audio_mixer_unref(self->mixer);
+    }
+
     if (self->panorama != NULL) {
         gst_element_set_state(self->audiobin, GST_STATE_NULL);
 
@@ -223,17 +454,50 @@ gboolean audio_player_on_bus_message(GstBus *bus, GstMessage *message, struct au
     return TRUE;
 }
 
-gboolean audio_player_on_refresh(struct audio_player *self) {
-    if (self == NULL) {
-        return FALSE;
+static void audio_player_on_clip_end(void *userdata) {
+    struct audio_player *self = userdata;
+    uint64_t value = 1;
+    ssize_t ok;
+
+    // Called on the mixer streaming thread, with the mixer input's clip lock held. The input is
+    // flushed (and destroyed) before the player is freed, which waits for us, so self is valid here.
+    // Not posted on the playbin bus: the playbin stays in NULL in low latency mode, and going
+    // to NULL flushes the bus.
+    atomic_store(&self->ended_clip_generation, atomic_load(&self->clip_generation));
+
+    ok = write(self->bus_wakeup_fd, &value, sizeof value);
+    if (ok < 0 && errno != EAGAIN) {
+        LOG_ERROR("Could not wake up platform thread for clip end. write: %s\n", strerror(errno));
     }
+}
 
-    GstState playbinState;
-    gst_element_get_state(self->playbin, &playbinState, NULL, GST_CLOCK_TIME_NONE);
-    if (playbinState == GST_STATE_PLAYING) {
-        audio_player_on_position_update(self);
+static void audio_player_stop_clip(struct audio_player *self) {
+    audio_mixer_input_flush(self->input);
+
+    // The flush waited for a clip end callback that was still running, so anything
+    // reported from now on belongs to the next clip.
+    atomic_fetch_add(&self->clip_generation, 1);
+}
+
+static void audio_player_play_clip(struct audio_player *self) {
+    audio_player_stop_clip(self);
+    audio_mixer_input_play_clip(self->input, self->clip, self->clip_position, audio_player_on_clip_end, self);
+}
+
+static void audio_player_release_clip(struct audio_player *self) {
+    if (self->clip_load != NULL) {
+        audio_clip_load_cancel(self->clip_load);
+        self->clip_load = NULL;
     }
-    return TRUE;
+
+    if (self->clip == NULL) {
+        return;
+    }
+
+    audio_player_stop_clip(self);
+    audio_clip_unref(self->clip);
+    self->clip = NULL;
+    self->clip_position = 0;
 }
 
 void audio_player_set_playback(struct audio_player *self, int64_t seekTo, double rate) {
@@ -332,11 +596,13 @@ void audio_player_on_prepared(struct audio_player *self, bool value) {
     // clang-format on
 }
 
-void audio_player_on_position_update(struct audio_player *self) {
+static void audio_player_send_position_update(struct audio_player *self) {
     if (!self->event_subscribed) {
         return;
     }
 
+    self->last_position_update_ns = get_monotonic_time();
+
     // clang-format off
     platch_send_success_event_std(
         self->event_channel_name,
@@ -348,6 +614,28 @@ void audio_player_on_position_update(struct audio_player *self) {
     // clang-format on
 }
 
+void audio_player_on_position_update(struct audio_player *self) {
+    uint64_t now;
+
+    if (!self->event_subscribed) {
+        return;
+    }
+
+    now = get_monotonic_time();
+    if (now < self->last_position_update_ns + MIN_POSITION_UPDATE_PERIOD_NS) {
+        // We already sent a position update this frame.
+        // Send the latest position once the frame is over instead.
+        if (!self->has_pending_position_update) {
+            self->has_pending_position_update = true;
+            audio_player_arm_position_timer(self, self->last_position_update_ns + MIN_POSITION_UPDATE_PERIOD_NS, 0);
+        }
+        return;
+    }
+
+    self->has_pending_position_update = false;
+    audio_player_send_position_update(self);
+}
+
 void audio_player_on_duration_update(struct audio_player *self) {
     if (!self->event_subscribed) {
         return;
@@ -413,12 +701,26 @@ void audio_player_play(struct audio_player *self) {
 }
 
 void audio_player_pause(struct audio_player *self) {
+    GstClockTime position;
+
     self->is_playing = false;
 
+    if (self->clip != NULL) {
+        if (audio_mixer_input_get_clip_position(self->input, &position)) {
+            self->clip_position = position;
+        }
+        audio_player_stop_clip(self);
+        audio_player_stop_position_updates(self);
+        audio_player_on_position_update(self);
+        return;
+    }
+
     if (!self->is_initialized) {
         return;
     }
 
+    audio_player_stop_position_updates(self);
+
     GstStateChangeReturn ret = gst_element_set_state(self->playbin, GST_STATE_PAUSED);
     if (ret == GST_STATE_CHANGE_FAILURE) {
         LOG_ERROR("Unable to set the pipeline to the paused state.\n");
@@ -429,10 +731,22 @@ void audio_player_pause(struct audio_player *self) {
 
 void audio_player_resume(struct audio_player *self) {
     self->is_playing = true;
+
+    if (self->clip != NULL) {
+        audio_player_play_clip(self);
+        audio_player_on_position_update(self);
+        audio_player_on_duration_update(self);
+        audio_player_start_position_updates(self);
+        return;
+    }
     if (!self->is_initialized) {
         return;
     }
 
+    if (self->input != NULL) {
+        audio_mixer_input_mark_start(self->input);
+    }
+
     GstStateChangeReturn ret = gst_element_set_state(self->playbin, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE) {
         LOG_ERROR("Unable to set the pipeline to the playing state.\n");
@@ -440,6 +754,7 @@ void audio_player_resume(struct audio_player *self) {
     }
     audio_player_on_position_update(self);
     audio_player_on_duration_update(self);
+    audio_player_start_position_updates(self);
 }
 
 void audio_player_destroy(struct audio_player *self) {
@@ -452,6 +767,25 @@ void audio_player_destroy(struct audio_player *self) {
         self->source = NULL;
     }
 
+    audio_player_release_clip(self);
+
+    if (self->input != NULL) {
+        if (self->low_latency) {
+            audio_mixer_set_low_latency(self->mixer, false);
+        }
+        audio_mixer_input_destroy(self->input);
+        audio_mixer_unref(self->mixer);
+        self->input = NULL;
+        self->mixer = NULL;
+    }
+
+    sd_event_source_unrefp(&self->position_timer_event_source);
+    close(self->position_timer_fd);
+
+    gst_bus_set_sync_handler(self->bus, NULL, NULL, NULL);
+    sd_event_source_unrefp(&self->bus_event_source);
+    close(self->bus_wakeup_fd);
+
     gst_object_unref(self->bus);
     self->bus = NULL;
 
@@ -493,7 +827,15 @@ void audio_player_destroy(struct audio_player *self) {
 }
 
 int64_t audio_player_get_position(struct audio_player *self) {
+    GstClockTime position;
     gint64 current = 0;
+
+    if (self->clip != NULL) {
+        if (!self->is_playing || !audio_mixer_input_get_clip_position(self->input, &position)) {
+            position = self->clip_position;
+        }
+        return position / GST_MSECOND;
+    }
     if (!gst_element_query_position(self->playbin, GST_FORMAT_TIME, &current)) {
         LOG_ERROR("Could not query current position.\n");
         return 0;
@@ -503,6 +845,10 @@ int64_t audio_player_get_position(struct audio_player *self) {
 
 int64_t audio_player_get_duration(struct audio_player *self) {
     gint64 duration = 0;
+
+    if (self->clip != NULL) {
+        return audio_clip_get_duration(self->clip) / GST_MSECOND;
+    }
     if (!gst_element_query_duration(self->playbin, GST_FORMAT_TIME, &duration)) {
         LOG_ERROR("Could not query current duration.\n");
         return 0;
@@ -516,11 +862,16 @@ void audio_player_set_volume(struct audio_player *self, double volume) {
     } else if (volume < 0) {
         volume = 0;
     }
-    g_object_set(G_OBJECT(self->playbin), "volume", volume, NULL);
+
+    if (self->input != NULL) {
+        audio_mixer_input_set_volume(self->input, volume);
+    } else {
+        g_object_set(G_OBJECT(self->playbin), "volume", volume, NULL);
+    }
 }
 
 void audio_player_set_balance(struct audio_player *self, double balance) {
-    if (!self->panorama) {
+    if (!self->panorama && !self->input) {
         return;
     }
 
@@ -529,10 +880,20 @@ void audio_player_set_balance(struct audio_player *self, double balance) {
     } else if (balance < -1.0l) {
         balance = -1.0l;
     }
-    g_object_set(G_OBJECT(self->panorama), "panorama", balance, NULL);
+
+    if (self->input != NULL) {
+        audio_mixer_input_set_balance(self->input, balance);
+    } else {
+        g_object_set(G_OBJECT(self->panorama), "panorama", balance, NULL);
+    }
 }
 
 void audio_player_set_playback_rate(struct audio_player *self, double rate) {
+    if (self->clip != NULL) {
+        LOG_DEBUG("%s: playback rate is not supported in low latency mode.\n", self->player_id);
+        return;
+    }
+
     audio_player_set_playback(self, audio_player_get_position(self), rate);
 }
 
@@ -540,9 +901,55 @@ void audio_player_set_position(struct audio_player *self, int64_t position) {
     if (!self->is_initialized) {
         return;
     }
+
+    if (self->clip != NULL) {
+        self->clip_position = MIN(position * GST_MSECOND, audio_clip_get_duration(self->clip));
+        if (self->is_playing) {
+            audio_player_play_clip(self);
+        }
+        audio_player_on_seek_completed(self);
+        return;
+    }
+
     audio_player_set_playback(self, position, self->playback_rate);
 }
 
+static void audio_player_load_pipeline(struct audio_player *self) {
+    if (strlen(self->url) != 0) {
+        g_object_set(self->playbin, "uri", self->url, NULL);
+        if (self->playbin->current_state != GST_STATE_READY) {
+            if (gst_element_set_state(self->playbin, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+                //This should not happen generally
+                LOG_ERROR("Could not set player into ready state.\n");
+            }
+        }
+    }
+}
+
+static void audio_player_on_clip_loaded(struct audio_clip *clip, void *userdata) {
+    struct audio_player *self = userdata;
+
+    // Called on the platform thread, once the source was decoded on a worker thread.
+    self->clip_load = NULL;
+
+    if (clip == NULL) {
+        LOG_DEBUG("%s: source can't be played in low latency mode, using a regular pipeline.\n", self->player_id);
+        audio_player_load_pipeline(self);
+        return;
+    }
+
+    self->clip = clip;
+    self->clip_position = 0;
+    self->is_initialized = true;
+    audio_player_on_prepared(self, true);
+    audio_player_on_duration_update(self);
+
+    // resume might've been called while we were still decoding.
+    if (self->is_playing) {
+        audio_player_resume(self);
+    }
+}
+
 void audio_player_set_source_url(struct audio_player *self, char *url) {
     ASSERT_NOT_NULL(url);
     if (self->url == NULL || !streq(self->url, url)) {
@@ -553,19 +960,23 @@ void audio_player_set_source_url(struct audio_player *self, char *url) {
         }
         self->url = strdup(url);
         gst_element_set_state(self->playbin, GST_STATE_NULL);
+        audio_player_release_clip(self);
+        audio_player_stop_position_updates(self);
         self->is_initialized = false;
         self->is_playing = false;
 
-        if (strlen(self->url) != 0) {
-            g_object_set(self->playbin, "uri", self->url, NULL);
-            if (self->playbin->current_state != GST_STATE_READY) {
-                if (gst_element_set_state(self->playbin, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
-                    //This should not happen generally
-                    LOG_ERROR("Could not set player into ready state.\n");
-                }
+        if (self->low_latency && self->input != NULL && strlen(self->url) != 0) {
+            // Decoding can take a while, so it's done on a worker thread.
+            // onPrepared is sent once it's done, see audio_player_on_clip_loaded.
+            self->clip_load = audio_clip_load_async(self->url, audio_player_on_clip_loaded, self);
+            if (self->clip_load != NULL) {
+                return;
             }
         }
-    } else {
+
+        audio_player_load_pipeline(self);
+    } else if (self->clip_load == NULL) {
+        // If we're still decoding, onPrepared is sent once that's done.
         audio_player_on_prepared(self, true);
     }
 }
@@ -590,6 +1001,8 @@ bool audio_player_set_subscription_status(struct audio_player *self, const char
 void audio_player_release(struct audio_player *self) {
     self->is_initialized = false;
     self->is_playing = false;
+    audio_player_stop_position_updates(self);
+    audio_player_release_clip(self);
     if (self->url != NULL) {
         free(self->url);
         self->url = NULL;
@@ -602,3 +1015,82 @@ void audio_player_release(struct audio_player *self) {
         gst_element_set_state(self->playbin, GST_STATE_NULL);
     }
 }
+
+void audio_player_set_low_latency(struct audio_player *self, bool low_latency) {
+    char *url;
+
+    if (self->low_latency == low_latency) {
+        return;
+    }
+
+    self->low_latency = low_latency;
+
+    // Use smaller audio device buffers while there's a low latency player.
+    if (self->mixer != NULL) {
+        audio_mixer_set_low_latency(self->mixer, low_latency);
+    }
+
+    // Reload the current source, so it's played back using the right mode.
+    if (self->url != NULL) {
+        url = self->url;
+        self->url = NULL;
+        audio_player_set_source_url(self, url);
+        free(url);
+    }
+}
+
+void audio_player_set_position_update_interval(struct audio_player *self, int64_t interval_ms) {
+    if (interval_ms <= 0) {
+        interval_ms = DEFAULT_POSITION_UPDATE_INTERVAL_MS;
+    }
+
+    self->position_update_interval_ns = interval_ms * 1000000ull;
+
+    if (self->is_playing && self->is_initialized) {
+        audio_player_start_position_updates(self);
+    }
+}
+
+int64_t audio_player_get_start_latency(struct audio_player *self) {
+    uint64_t latency;
+
+    if (self->input == NULL) {
+        return -1;
+    }
+
+    latency = audio_mixer_input_get_start_latency_ns(self->input);
+    if (latency == 0) {
+        return -1;
+    }
+
+    LOG_DEBUG("%s: start latency: %" PRIu64 "us\n", self->player_id, latency / 1000);
+    return latency / 1000000;
+}
+
+void audio_player_emit_log(struct audio_player *self, const char *message) {
+    LOG_DEBUG("%s: %s\n", self->player_id, message);
+
+    if (!self->event_subscribed) {
+        return;
+    }
+
+    // clang-format off
+    platch_send_success_event_std(
+        self->event_channel_name,
+        &STDMAP2(
+            STDSTRING("event"), STDSTRING("audio.onLog"),
+            STDSTRING("value"), STDSTRING((char *) message)
+        )
+    );
+    // clang-format on
+}
+
+void audio_player_emit_error(struct audio_player *self, const char *code, const char *message) {
+    LOG_ERROR("%s: %s: %s\n", self->player_id, code, message);
+
+    if (!self->event_subscribed) {
+        return;
+    }
+
+    platch_send_error_event_std(self->event_channel_name, (char *) code, (char *) message, NULL);
+}
@@ -1,5 +1,8 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <stdlib.h>
+
 #include "flutter-pi.h"
 #include "platformchannel.h"
 #include "pluginregistry.h"
@@ -11,6 +14,9 @@
 #define AUDIOPLAYERS_LOCAL_CHANNEL "xyz.luan/audioplayers"
 #define AUDIOPLAYERS_GLOBAL_CHANNEL "xyz.luan/audioplayers.global"
 
+#define POSITION_INTERVAL_ENV_VAR "FLUTTERPI_AUDIOPLAYERS_POSITION_INTERVAL_MS"
+#define MAX_POSITION_UPDATE_INTERVAL_MS 60000
+
 static struct audio_player *audioplayers_linux_plugin_get_player(char *player_id, char *mode);
 static void audioplayers_linux_plugin_dispose_player(struct audio_player *player);
 
@@ -24,6 +30,8 @@ static struct plugin {
     bool initialized;
 
     struct list_head players;
+
+    int64_t position_update_interval_ms;
 } plugin;
 
 static int on_local_method_call(char *channel, struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
@@ -135,8 +143,14 @@ static int on_local_method_call(char *channel, struct platch_obj *object, Flutte
             return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['releaseMode']` to be a string.");
         }
     } else if (streq(method, "setPlayerMode")) {
-        // TODO check support for low latency mode:
-        // https://gstreamer.freedesktop.org/documentation/additional/design/latency.html?gi-language=c
+        tmp = stdmap_get_str(args, "playerMode");
+        if (tmp != NULL && STDVALUE_IS_STRING(*tmp)) {
+            char *player_mode = STDVALUE_AS_STRING(*tmp);
+            bool low_latency = strstr(player_mode, "lowLatency") != NULL;
+            audio_player_set_low_latency(player, low_latency);
+        } else {
+            return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['playerMode']` to be a string.");
+        }
     } else if (strcmp(method, "setBalance") == 0) {
         tmp = stdmap_get_str(args, "balance");
         if (tmp != NULL && STDVALUE_IS_FLOAT(*tmp)) {
@@ -156,8 +170,7 @@ static int on_local_method_call(char *channel, struct platch_obj *object, Flutte
             return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['message']` to be a string.");
         }
 
-        LOG_DEBUG("%s\n", message);
-        //TODO: https://github.com/bluefireteam/audioplayers/blob/main/packages/audioplayers_linux/linux/audio_player.cc#L247
+        audio_player_emit_log(player, message);
     } else if (strcmp(method, "emitError") == 0) {
         tmp = stdmap_get_str(args, "code");
         char *code;
@@ -181,8 +194,9 @@ static int on_local_method_call(char *channel, struct platch_obj *object, Flutte
             return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['message']` to be a string.");
         }
 
-        LOG_ERROR("Error: %s; message=%s\n", code, message);
-        //TODO: https://github.com/bluefireteam/audioplayers/blob/main/packages/audioplayers_linux/linux/audio_player.cc#L144
+        audio_player_emit_error(player, code, message);
+    } else if (streq(method, "getStartLatency")) {
+        result = STDINT64(audio_player_get_start_latency(player));
     } else if (strcmp(method, "dispose") == 0) {
         audioplayers_linux_plugin_dispose_player(player);
         player = NULL;
@@ -231,6 +245,35 @@ static int on_receive_event_ch(char *channel, struct platch_obj *object, Flutter
     return 0;
 }
 
+/**
+ * @brief The position update interval configured using the FLUTTERPI_AUDIOPLAYERS_POSITION_INTERVAL_MS
+ * environment variable, or 0 if it's not set or invalid (so the player uses its default of 200ms).
+ */
+static int64_t get_position_update_interval_ms(void) {
+    const char *str;
+    long long interval_ms;
+    char *end;
+
+    str = getenv(POSITION_INTERVAL_ENV_VAR);
+    if (str == NULL) {
+        return 0;
+    }
+
+    errno = 0;
+    interval_ms = strtoll(str, &end, 10);
+    if (end == str || *end != '\0' || errno != 0 || interval_ms < 1 || interval_ms > MAX_POSITION_UPDATE_INTERVAL_MS) {
+        LOG_ERROR(
+            "Invalid " POSITION_INTERVAL_ENV_VAR " value \"%s\". Expected a number of milliseconds between 1 and %d. "
+            "Using the default interval.\n",
+            str,
+            MAX_POSITION_UPDATE_INTERVAL_MS
+        );
+        return 0;
+    }
+
+    return interval_ms;
+}
+
 enum plugin_init_result audioplayers_plugin_init(struct flutterpi *flutterpi, void **userdata_out) {
     int ok;
 
@@ -240,6 +283,8 @@ enum plugin_init_result audioplayers_plugin_init(struct flutterpi *flutterpi, vo
     plugin.initialized = false;
     list_inithead(&plugin.players);
 
+    plugin.position_update_interval_ms = get_position_update_interval_ms();
+
     ok = plugin_registry_set_receiver_locked(AUDIOPLAYERS_GLOBAL_CHANNEL, kStandardMethodCall, on_global_method_call);
     if (ok != 0) {
         return PLUGIN_INIT_RESULT_ERROR;
@@ -310,6 +355,8 @@ static struct audio_player *audioplayers_linux_plugin_get_player(char *player_id
         return NULL;
     }
 
+    audio_player_set_position_update_interval(player, plugin.position_update_interval_ms);
+
     entry->entry = (struct list_head){ NULL, NULL };
     entry->player = player;
 
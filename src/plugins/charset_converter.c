@@ -1,44 +1,200 @@
 #include "plugins/charset_converter.h"
 #include "flutter-pi.h"
 #include "pluginregistry.h"
+#include "util/collection.h"
+#include "util/list.h"
 #include "util/logging.h"
+#include <ctype.h>
 #include <iconv.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Opening an iconv descriptor means loading the gconv module and its tables,
+// which is a lot more expensive than the conversion itself for short inputs.
+// So we keep the most recently used descriptors open.
+#define MAX_CACHED_CONVERTERS 16
+
+struct converter {
+    struct list_head entry;
+    char *from;
+    char *to;
+    iconv_t cd;
+};
+
+static struct plugin {
+    /**
+     * @brief Open iconv descriptors, most recently used first.
+     */
+    struct list_head converters;
+    unsigned n_converters;
+
+    /**
+     * @brief Output buffer that's reused for all conversions, grown as needed.
+     */
+    char *buffer;
+    size_t buffer_size;
+
+    /**
+     * @brief The charsets supported by iconv, as a list of std strings.
+     *
+     * Querying them means running `iconv --list`, so that's only done once they're first asked for.
+     */
+    bool charsets_loaded;
+    struct std_value *charsets;
+    size_t n_charsets;
+} plugin;
+
+static void converter_destroy(struct converter *converter) {
+    list_del(&converter->entry);
+    iconv_close(converter->cd);
+    free(converter->from);
+    free(converter->to);
+    free(converter);
+}
+
+static struct converter *get_converter(const char *from, const char *to) {
+    struct converter *converter;
+
+    list_for_each_entry(struct converter, cached, &plugin.converters, entry) {
+        if (streq(cached->from, from) && streq(cached->to, to)) {
+            // move to the front, so the least recently used one is always last.
+            list_del(&cached->entry);
+            list_add(&cached->entry, &plugin.converters);
+
+            // reset the conversion state, in case the last conversion was stopped midway.
+            iconv(cached->cd, NULL, NULL, NULL, NULL);
+            return cached;
+        }
+    }
 
-static bool convert(char *inbuf, char *outbuf, size_t len, const char *from, const char *to)
-{
-    iconv_t iconv_cd = iconv_open(to, from);
-    if (iconv_cd == (iconv_t) -1) {
+    converter = malloc(sizeof *converter);
+    if (converter == NULL) {
+        return NULL;
+    }
+
+    converter->cd = iconv_open(to, from);
+    if (converter->cd == (iconv_t) -1) {
         LOG_ERROR("Conversion from charset \"%s\" to charset \"%s\" is not supported. iconv_open: %s\n", from, to, strerror(errno));
-        return false;
+        free(converter);
+        return NULL;
+    }
+
+    converter->from = strdup(from);
+    converter->to = strdup(to);
+    if (converter->from == NULL || converter->to == NULL) {
+        iconv_close(converter->cd);
+        free(converter->from);
+        free(converter->to);
+        free(converter);
+        return NULL;
     }
 
-    size_t inlen = len;
-    size_t outlen = len;
-    size_t res = 0;
+    if (plugin.n_converters == MAX_CACHED_CONVERTERS) {
+        converter_destroy(list_last_entry(&plugin.converters, struct converter, entry));
+    } else {
+        plugin.n_converters++;
+    }
 
-    while (inlen > 0 && outlen > 0) {
-        res = iconv(iconv_cd, &inbuf, &inlen, &outbuf, &outlen);
-        if (res == 0) {
-            break;
+    list_add(&converter->entry, &plugin.converters);
+    return converter;
+}
+
+static int grow_buffer(size_t min_size) {
+    size_t size;
+    char *buffer;
+
+    size = plugin.buffer_size > 0 ? plugin.buffer_size : 256;
+    while (size < min_size) {
+        size *= 2;
+    }
+
+    if (size == plugin.buffer_size) {
+        return 0;
+    }
+
+    buffer = realloc(plugin.buffer, size);
+    if (buffer == NULL) {
+        return ENOMEM;
+    }
+
+    plugin.buffer = buffer;
+    plugin.buffer_size = size;
+    return 0;
+}
+
+/**
+ * @brief Converts @param inlen bytes at @param inbuf using @param converter into the plugin output buffer.
+ *
+ * The output is null-terminated, though it can contain null-bytes itself, depending on the target charset.
+ *
+ * @param outlen_out Is set to the number of bytes written, excluding the null-terminator.
+ * @return int Zero on success, EILSEQ or EINVAL if the input is not valid in the source charset,
+ *   ENOMEM if the output buffer couldn't be grown.
+ */
+static int convert(struct converter *converter, const char *inbuf, size_t inlen, size_t *outlen_out) {
+    size_t res, outleft, written;
+    char *in, *out;
+    bool flushing;
+    int ok;
+
+    // Most conversions don't grow the input by more than a factor of 2. If they do, we grow the buffer below.
+    ok = grow_buffer(2 * inlen + 4);
+    if (ok != 0) {
+        return ok;
+    }
+
+    in = (char *) inbuf;
+    written = 0;
+    flushing = false;
+    while (true) {
+        // leave space for the null-terminator.
+        out = plugin.buffer + written;
+        outleft = plugin.buffer_size - written - 1;
+
+        if (!flushing) {
+            res = iconv(converter->cd, &in, &inlen, &out, &outleft);
+        } else {
+            // write the shift sequence to return to the initial state, for stateful encodings.
+            res = iconv(converter->cd, NULL, NULL, &out, &outleft);
         }
 
-        if (res == (size_t) (-1)) {
-            iconv_close(iconv_cd);
-            *outbuf = '\0';
+        written = out - plugin.buffer;
+
+        if (res == (size_t) -1) {
+            if (errno != E2BIG) {
+                return errno;
+            }
 
-            return false;
+            ok = grow_buffer(plugin.buffer_size * 2);
+            if (ok != 0) {
+                return ok;
+            }
+        } else if (flushing) {
+            break;
+        } else {
+            flushing = true;
         }
     }
 
-    iconv_close(iconv_cd);
-    *outbuf = '\0';
+    plugin.buffer[written] = '\0';
+    *outlen_out = written;
+    return 0;
+}
+
+static int respond_conversion_error(FlutterPlatformMessageResponseHandle *response_handle, int error) {
+    if (error == EILSEQ || error == EINVAL) {
+        return platch_respond_error_std(response_handle, "error_id", "invalid_input", NULL);
+    }
 
-    return true;
+    return platch_respond_native_error_std(response_handle, error);
 }
 
 static int on_encode(struct platch_obj *object, FlutterPlatformMessageResponseHandle *response_handle) {
+    struct converter *converter;
     struct std_value *args, *tmp;
-    char *charset, *input, *output;
+    char *charset, *input;
+    size_t outlen;
+    int ok;
 
     args = &object->std_arg;
 
@@ -59,32 +215,33 @@ static int on_encode(struct platch_obj *object, FlutterPlatformMessageResponseHa
     }
 
     input = STDVALUE_AS_STRING(*tmp);
-    output = malloc(strlen(input) + 1);
 
-    bool res = convert(input, output, strlen(input) + 1, "UTF-8", charset);
-    if(!res) {
-        free(output);
+    converter = get_converter("UTF-8", charset);
+    if (converter == NULL) {
         return platch_respond_error_std(response_handle, "error_id", "charset_name_unrecognized", NULL);
     }
 
-    int ok = platch_respond_success_std(
+    ok = convert(converter, input, strlen(input), &outlen);
+    if (ok != 0) {
+        return respond_conversion_error(response_handle, ok);
+    }
+
+    return platch_respond_success_std(
         response_handle,
         &(struct std_value) {
             .type = kStdUInt8Array,
-            .size = strlen(output),
-            .uint8array = (uint8_t*) output,
+            .size = outlen,
+            .uint8array = (uint8_t*) plugin.buffer,
         }
     );
-
-    free(output);
-
-    return ok;
 }
 
 static int on_decode(struct platch_obj *object, FlutterPlatformMessageResponseHandle *response_handle) {
+    struct converter *converter;
     struct std_value *args, *tmp;
-    char *charset, *output;
-    const uint8_t *input;
+    char *charset;
+    size_t outlen;
+    int ok;
 
     args = &object->std_arg;
 
@@ -104,73 +261,137 @@ static int on_decode(struct platch_obj *object, FlutterPlatformMessageResponseHa
         return platch_respond_illegal_arg_std(response_handle, "Expected `arg['data'] to be a uint8_t list.");
     }
 
-    input = tmp->uint8array;
-    output = malloc(strlen((char*) input) + 1);
-
-    bool res = convert((char*) input, output, strlen((char*) input) + 1, "UTF-8", charset);
-    if(!res) {
-        free(output);
+    converter = get_converter(charset, "UTF-8");
+    if (converter == NULL) {
         return platch_respond_error_std(response_handle, "error_id", "charset_name_unrecognized", NULL);
     }
 
-    int ok = platch_respond_success_std(
-        response_handle,
-        &(struct std_value) {
-            .type = kStdUInt8Array,
-            .size = strlen(output),
-            .uint8array = (uint8_t*) output,
-        }
-    );
+    // The input is binary data, it's not null-terminated and may contain null-bytes.
+    ok = convert(converter, (const char *) tmp->uint8array, tmp->size, &outlen);
+    if (ok != 0) {
+        return respond_conversion_error(response_handle, ok);
+    }
 
-    free(output);
+    // STDSTRING would cut off the decoded text at the first U+0000 character.
+    return platch_respond_success_std_string(response_handle, plugin.buffer, outlen);
+}
 
-    return ok;
+static void free_charsets(void) {
+    for (size_t i = 0; i < plugin.n_charsets; i++) {
+        free(plugin.charsets[i].string_value);
+    }
+    free(plugin.charsets);
+
+    plugin.charsets = NULL;
+    plugin.n_charsets = 0;
 }
 
-static int on_available_charsets(struct platch_obj *object, FlutterPlatformMessageResponseHandle *response_handle) {
-    (void) object;
+static int add_charset(const char *name, size_t length, size_t *capacity) {
+    struct std_value *charsets;
+    char *copy;
 
-    char* output;
-    size_t length, count;
-    FILE *fp;
+    if (plugin.n_charsets == *capacity) {
+        *capacity = *capacity > 0 ? *capacity * 2 : 256;
 
-    // Count the available charsets
-    fp = popen("iconv --list | wc -w", "r");
-    if(!fp) {
-        return platch_respond_error_std(response_handle, "error_id", "charsets_not_available", NULL);
+        charsets = realloc(plugin.charsets, *capacity * sizeof *charsets);
+        if (charsets == NULL) {
+            return ENOMEM;
+        }
+
+        plugin.charsets = charsets;
     }
 
-    while (getline(&output, &length, fp) >= 0) {
-        count = atoi(output);
+    copy = strndup(name, length);
+    if (copy == NULL) {
+        return ENOMEM;
     }
 
-    pclose(fp);
+    plugin.charsets[plugin.n_charsets++] = STDSTRING(copy);
+    return 0;
+}
+
+/**
+ * @brief Queries the list of charsets supported by iconv.
+ *
+ * There's no API for this, so we need to parse the output of `iconv --list`.
+ * That lists one or more charsets per line, separated by commas, with a `//` suffix.
+ */
+static int load_charsets(void) {
+    size_t capacity, line_capacity, length;
+    char *line, *cursor;
+    FILE *fp;
+    int ok;
 
     fp = popen("iconv --list", "r");
-    if(!fp) {
-        return platch_respond_error_std(response_handle, "error_id", "charsets_not_available", NULL);
+    if (fp == NULL) {
+        ok = errno;
+        LOG_ERROR("Couldn't query available charsets. popen: %s\n", strerror(ok));
+        return ok;
     }
 
-    struct std_value values;
-
-    values.type = kStdList;
-    values.size = count;
-    values.list = alloca(sizeof(struct std_value) * count);
-
-    for (int index = 0; index < count; index++) {
-        if(getline(&output, &length, fp) < 0) {
-            break;
+    capacity = 0;
+    line = NULL;
+    line_capacity = 0;
+    ok = 0;
+    while (getline(&line, &line_capacity, fp) >= 0) {
+        cursor = line;
+        while (*cursor != '\0') {
+            while (*cursor == ',' || isspace(*cursor)) {
+                cursor++;
+            }
+
+            length = strcspn(cursor, ",/ \t\r\n");
+            if (length > 0) {
+                ok = add_charset(cursor, length, &capacity);
+                if (ok != 0) {
+                    goto fail_free_line;
+                }
+            }
+
+            cursor += length;
+            cursor += strspn(cursor, "/");
         }
+    }
 
-        strtok(output, "/");
+    free(line);
+    pclose(fp);
 
-        values.list[index].type = kStdString;
-        values.list[index].string_value = strdup(output);
+    if (plugin.n_charsets == 0) {
+        LOG_ERROR("Couldn't query available charsets. `iconv --list` didn't list any charsets.\n");
+        free_charsets();
+        return EINVAL;
     }
 
+    return 0;
+
+fail_free_line:
+    free(line);
     pclose(fp);
+    free_charsets();
+    return ok;
+}
+
+static int on_available_charsets(struct platch_obj *object, FlutterPlatformMessageResponseHandle *response_handle) {
+    (void) object;
+
+    if (!plugin.charsets_loaded) {
+        // If this fails, we don't try again and just respond with an error.
+        load_charsets();
+        plugin.charsets_loaded = true;
+    }
 
-    return platch_respond_success_std(response_handle, &values);
+    if (plugin.charsets == NULL) {
+        return platch_respond_error_std(response_handle, "error_id", "charsets_not_available", NULL);
+    }
+
+    return platch_respond_success_std(
+        response_handle,
+        &(struct std_value) {
+            .type = kStdList,
+            .size = plugin.n_charsets,
+            .list = plugin.charsets,
+        }
+    );
 }
 
 static int on_check(struct platch_obj *object, FlutterPlatformMessageResponseHandle *response_handle) {
@@ -190,16 +411,14 @@ static int on_check(struct platch_obj *object, FlutterPlatformMessageResponseHan
 
     charset = STDVALUE_AS_STRING(*tmp);
 
-    iconv_t iconv_cd = iconv_open("UTF-8", charset);
-    if (iconv_cd == (iconv_t) -1) {
+    // The converter will most likely be used right after, so keep it around.
+    if (get_converter(charset, "UTF-8") == NULL) {
         return platch_respond(
             response_handle,
             &(struct platch_obj){ .codec = kStandardMethodCallResponse, .success = true, .std_result = { .type = kStdFalse } }
         );
     }
 
-    iconv_close(iconv_cd);
-
     return platch_respond(
         response_handle,
         &(struct platch_obj){ .codec = kStandardMethodCallResponse, .success = true, .std_result = { .type = kStdTrue } }
@@ -230,8 +449,17 @@ enum plugin_init_result charset_converter_init(struct flutterpi *flutterpi, void
 
     int ok;
 
+    list_inithead(&plugin.converters);
+    plugin.n_converters = 0;
+    plugin.buffer = NULL;
+    plugin.buffer_size = 0;
+    plugin.charsets_loaded = false;
+    plugin.charsets = NULL;
+    plugin.n_charsets = 0;
+
     ok = plugin_registry_set_receiver_locked(CHARSET_CONVERTER_CHANNEL, kStandardMethodCall, on_receive);
     if (ok != 0) {
+        free_charsets();
         return PLUGIN_INIT_RESULT_ERROR;
     }
 
@@ -244,6 +472,17 @@ void charset_converter_deinit(struct flutterpi *flutterpi, void *userdata) {
     (void) userdata;
 
     plugin_registry_remove_receiver_v2_locked(flutterpi_get_plugin_registry(flutterpi), CHARSET_CONVERTER_CHANNEL);
+
+    list_for_each_entry_safe(struct converter, converter, &plugin.converters, entry) {
+        converter_destroy(converter);
+    }
+    plugin.n_converters = 0;
+
+    free(plugin.buffer);
+    plugin.buffer = NULL;
+    plugin.buffer_size = 0;
+
+    free_charsets();
 }
 
-FLUTTERPI_PLUGIN("charset converter plugin", charset_converter_plugin, charset_converter_init, charset_converter_deinit)
\ No newline at end of file
+FLUTTERPI_PLUGIN("charset converter plugin", charset_converter_plugin, charset_converter_init, charset_converter_deinit)
@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "display_color.h"
+#include "flutter-pi.h"
+#include "pluginregistry.h"
+#include "util/collection.h"
+#include "util/logging.h"
+
+#define DISPLAY_COLOR_CHANNEL "flutter-pi/display_color"
+
+// Adjusts the colors of the display using the gamma LUT and CTM of the display controller,
+// which doesn't cost any GPU time. (Unlike wrapping the app in a ColorFiltered widget,
+// which needs an additional offscreen pass every frame.)
+//
+// Methods:
+//   set({brightness?, contrast?, temperature?, calibrationFile?})
+//     Update the given settings. calibrationFile is the path of a calibration profile
+//     for the panel (see display_color_calibration_load), or null to remove the calibration.
+//   get() -> {brightness, contrast, temperature, calibrationFile}
+//   reset()
+//     Restore the neutral settings.
+
+static struct plugin {
+    struct flutterpi *flutterpi;
+
+    /**
+     * @brief The settings that are currently applied.
+     */
+    struct display_color_settings settings;
+
+    /**
+     * @brief The path of the calibration profile that's currently applied, or NULL.
+     */
+    char *calibration_file;
+} plugin;
+
+static int respond_apply_error(FlutterPlatformMessageResponseHandle *responsehandle, int error) {
+    if (error == EOPNOTSUPP) {
+        return platch_respond_error_std(responsehandle, "unsupported", "The display doesn't support color adjustments.", &STDNULL);
+    }
+
+    return platch_respond_native_error_std(responsehandle, error);
+}
+
+static int get_number_arg(struct std_value *arg, char *key, bool *has_value_out, double *value_out) {
+    struct std_value *value;
+
+    value = stdmap_get_str(arg, key);
+    if (value == NULL || STDVALUE_IS_NULL(*value)) {
+        *has_value_out = false;
+        return 0;
+    }
+
+    if (!STDVALUE_IS_NUM(*value)) {
+        return EINVAL;
+    }
+
+    *has_value_out = true;
+    *value_out = STDVALUE_AS_NUM(*value);
+    return 0;
+}
+
+static int on_set(struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
+    struct display_color_settings settings;
+    struct std_value *arg, *value;
+    char *calibration_file;
+    double number;
+    bool has_number;
+    int ok;
+
+    arg = &object->std_arg;
+    if (!STDVALUE_IS_MAP(*arg)) {
+        return platch_respond_illegal_arg_std(responsehandle, "Expected `arg` to be a map.");
+    }
+
+    settings = plugin.settings;
+
+    ok = get_number_arg(arg, "brightness", &has_number, &number);
+    if (ok != 0 || (has_number && !(number >= 0.0 && number <= 1.0))) {
+        return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['brightness']` to be null or a number between 0 and 1.");
+    } else if (has_number) {
+        settings.brightness = number;
+    }
+
+    ok = get_number_arg(arg, "contrast", &has_number, &number);
+    if (ok != 0 || (has_number && !(number >= 0.0))) {
+        return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['contrast']` to be null or a non-negative number.");
+    } else if (has_number) {
+        settings.contrast = number;
+    }
+
+    ok = get_number_arg(arg, "temperature", &has_number, &number);
+    if (ok != 0 || (has_number && !(number >= DISPLAY_COLOR_MIN_TEMPERATURE && number <= DISPLAY_COLOR_MAX_TEMPERATURE))) {
+        return platch_respond_illegal_arg_std(
+            responsehandle,
+            "Expected `arg['temperature']` to be null or a color temperature between 1000 and 40000 kelvin."
+        );
+    } else if (has_number) {
+        settings.temperature = number;
+    }
+
+    calibration_file = plugin.calibration_file;
+
+    value = stdmap_get_str(arg, "calibrationFile");
+    if (value != NULL && STDVALUE_IS_STRING(*value)) {
+        ok = display_color_calibration_load(STDVALUE_AS_STRING(*value), &settings.calibration);
+        if (ok != 0) {
+            return platch_respond_error_std(
+                responsehandle,
+                "invalid-calibration",
+                "Couldn't load the calibration file. See the flutter-pi log for details.",
+                &STDNULL
+            );
+        }
+
+        calibration_file = strdup(STDVALUE_AS_STRING(*value));
+        if (calibration_file == NULL) {
+            return platch_respond_native_error_std(responsehandle, ENOMEM);
+        }
+    } else if (value != NULL && STDVALUE_IS_NULL(*value)) {
+        display_color_calibration_init(&settings.calibration);
+        calibration_file = NULL;
+    } else if (value != NULL) {
+        return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['calibrationFile']` to be null or a string.");
+    }
+
+    ok = flutterpi_set_display_color(plugin.flutterpi, &settings);
+    if (ok != 0) {
+        if (calibration_file != plugin.calibration_file) {
+            free(calibration_file);
+        }
+        return respond_apply_error(responsehandle, ok);
+    }
+
+    plugin.settings = settings;
+    if (calibration_file != plugin.calibration_file) {
+        free(plugin.calibration_file);
+        plugin.calibration_file = calibration_file;
+    }
+
+    return platch_respond_success_std(responsehandle, &STDNULL);
+}
+
+static int on_get(FlutterPlatformMessageResponseHandle *responsehandle) {
+    return platch_respond_success_std(
+        responsehandle,
+        &STDMAP4(
+            STDSTRING("brightness"),
+            STDFLOAT64(plugin.settings.brightness),
+            STDSTRING("contrast"),
+            STDFLOAT64(plugin.settings.contrast),
+            STDSTRING("temperature"),
+            STDFLOAT64(plugin.settings.temperature),
+            STDSTRING("calibrationFile"),
+            plugin.calibration_file != NULL ? STDSTRING(plugin.calibration_file) : STDNULL
+        )
+    );
+}
+
+static int on_reset(FlutterPlatformMessageResponseHandle *responsehandle) {
+    struct display_color_settings settings;
+    int ok;
+
+    display_color_settings_init(&settings);
+
+    ok = flutterpi_set_display_color(plugin.flutterpi, &settings);
+    if (ok != 0) {
+        return respond_apply_error(responsehandle, ok);
+    }
+
+    plugin.settings = settings;
+    free(plugin.calibration_file);
+    plugin.calibration_file = NULL;
+
+    return platch_respond_success_std(responsehandle, &STDNULL);
+}
+
+static int on_receive(char *channel, struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
+    (void) channel;
+
+    if (streq(object->method, "set")) {
+        return on_set(object, responsehandle);
+    } else if (streq(object->method, "get")) {
+        return on_get(responsehandle);
+    } else if (streq(object->method, "reset")) {
+        return on_reset(responsehandle);
+    }
+
+    return platch_respond_not_implemented(responsehandle);
+}
+
+enum plugin_init_result display_color_init(struct flutterpi *flutterpi, void **userdata_out) {
+    int ok;
+
+    plugin.flutterpi = flutterpi;
+    display_color_settings_init(&plugin.settings);
+    plugin.calibration_file = NULL;
+
+    ok = plugin_registry_set_receiver_locked(DISPLAY_COLOR_CHANNEL, kStandardMethodCall, on_receive);
+    if (ok != 0) {
+        return PLUGIN_INIT_RESULT_ERROR;
+    }
+
+    *userdata_out = NULL;
+
+    return PLUGIN_INIT_RESULT_INITIALIZED;
+}
+
+void display_color_deinit(struct flutterpi *flutterpi, void *userdata) {
+    (void) userdata;
+
+    plugin_registry_remove_receiver_v2_locked(flutterpi_get_plugin_registry(flutterpi), DISPLAY_COLOR_CHANNEL);
+
+    free(plugin.calibration_file);
+    plugin.calibration_file = NULL;
+}
+
+FLUTTERPI_PLUGIN("display color", display_color, display_color_init, display_color_deinit)
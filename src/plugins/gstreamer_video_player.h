@@ -209,8 +209,24 @@ DECLARE_LOCK_OPS(frame_interface)
 
 DECLARE_REF_OPS(frame_interface)
 
+/**
+ * @brief Should be called on a gstreamer streaming thread when it starts. (GST_STREAM_STATUS_TYPE_ENTER)
+ *
+ * Frames created on this thread from then on will use an EGL context that's kept current
+ * on this thread, instead of locking and making the shared interface context current for every frame.
+ */
+void frame_interface_on_thread_enter(struct frame_interface *interface);
+
+/**
+ * @brief Should be called on a gstreamer streaming thread before it exits. (GST_STREAM_STATUS_TYPE_LEAVE)
+ *
+ * Clears the EGL context of this thread and returns it to the pool of the interface.
+ */
+void frame_interface_on_thread_leave(struct frame_interface *interface);
+
 typedef struct _GstVideoInfo GstVideoInfo;
 typedef struct _GstVideoMeta GstVideoMeta;
+typedef struct _GstCaps GstCaps;
 
 struct video_info {
     int width, height;
@@ -230,6 +246,20 @@ struct _GstSample;
 
 ATTR_CONST GstVideoFormat gst_video_format_from_drm_format(uint32_t drm_format);
 
+/**
+ * @brief Get the caps of all the video frames that can be imported by this frame interface.
+ *
+ * With gstreamer 1.24 and newer, this includes memory:DMABuf caps listing all
+ * the supported DRM formats with their explicit modifiers.
+ */
+GstCaps *frame_interface_get_caps(struct frame_interface *interface);
+
+/**
+ * @brief Like gst_video_info_from_caps, but also works for memory:DMABuf caps
+ * with an explicit drm-format. (See @ref frame_interface_get_caps)
+ */
+bool frame_video_info_from_caps(const GstCaps *caps, GstVideoInfo *info_out);
+
 struct video_frame *frame_new(struct frame_interface *interface, GstSample *sample, const GstVideoInfo *info);
 
 void frame_destroy(struct video_frame *frame);
@@ -16,6 +16,7 @@
 // This will error if we don't have EGL / OpenGL ES support.
 #include "gl_renderer.h"
 #include "plugins/gstreamer_video_player.h"
+#include "util/list.h"
 #include "util/logging.h"
 #include "util/refcounting.h"
 
@@ -32,6 +33,11 @@ struct video_frame {
 
     struct frame_interface *interface;
 
+    /**
+     * @brief The pooled BO the video frame was copied into, if it wasn't imported directly.
+     */
+    struct pooled_bo *bo;
+
     uint32_t drm_format;
 
     int n_dmabuf_fds;
@@ -43,16 +49,105 @@ struct video_frame {
     struct gl_texture_frame gl_frame;
 };
 
+/**
+ * @brief An EGL context that's kept current on a single gstreamer streaming thread,
+ * from the first frame uploaded on that thread until the thread leaves.
+ */
+struct pooled_context {
+    struct list_head entry;
+    EGLContext context;
+    bool in_use;
+};
+
+/**
+ * @brief A linear GBM BO that non-dmabuf video frames are copied into, so they can be
+ * imported as EGL images. Reused for the next frame as soon as the video frame is destroyed.
+ */
+struct pooled_bo {
+    struct list_head entry;
+    struct gbm_bo *bo;
+    size_t size;
+    bool in_use;
+
+    /**
+     * @brief Signalled when the GPU is done reading the last frame that was copied into this BO.
+     * EGL_NO_SYNC_KHR if there's nothing to wait for.
+     */
+    EGLSyncKHR release_fence;
+};
+
+/**
+ * @brief How the memory of video frames is made available to EGL.
+ */
+enum upload_strategy {
+    /**
+     * @brief The frame memory is dmabuf-backed and is imported as an EGL image directly (zero-copy).
+     */
+    kDmabufImport_UploadStrategy,
+
+    /**
+     * @brief The frame memory is ordinary memory, it's copied into a pooled linear GBM BO and that is imported.
+     */
+    kPooledBoCopy_UploadStrategy,
+};
+
+/**
+ * @brief The upload strategy chosen for the first frame with some caps.
+ */
+struct upload_strategy_entry {
+    struct list_head entry;
+    GstCaps *caps;
+    enum upload_strategy strategy;
+};
+
+#define MAX_N_UPLOAD_STRATEGY_ENTRIES 8
+
 struct frame_interface {
+    struct gl_renderer *renderer;
     struct gbm_device *gbm_device;
     EGLDisplay display;
 
+    /**
+     * @brief Context used for threads that are not streaming threads of this interface,
+     * for example for destroying frames on the flutter threads.
+     *
+     * Must only be made current while holding @ref context_lock.
+     */
     pthread_mutex_t context_lock;
     EGLContext context;
 
+    /**
+     * @brief Contexts for streaming threads. (See @ref frame_interface_on_thread_enter)
+     *
+     * Grows to the number of streaming threads that upload frames concurrently.
+     * Contexts of threads that left are reused.
+     */
+    pthread_mutex_t pool_lock;
+    struct list_head context_pool;
+
+    /**
+     * @brief BOs for copying non-dmabuf video frames into. Guarded by @ref pool_lock.
+     */
+    struct list_head bo_pool;
+
+    /**
+     * @brief Upload strategies for the most recently seen caps, most recently used last.
+     * Guarded by @ref pool_lock.
+     */
+    struct list_head strategies;
+    int n_strategies;
+
     PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
     PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
 
+    /**
+     * @brief EGL_KHR_fence_sync procedures, for knowing when a pooled BO can be reused.
+     * NULL if not supported.
+     */
+    PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+    PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+    PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
+
     bool supports_external_target;
     PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
 
@@ -250,6 +345,22 @@ struct frame_interface *frame_interface_new(struct gl_renderer *renderer) {
         goto fail_destroy_context;
     }
 
+    // Without fences, pooled BOs are reused without waiting for the GPU, like before.
+    PFNEGLCREATESYNCKHRPROC create_sync = NULL;
+    PFNEGLDESTROYSYNCKHRPROC destroy_sync = NULL;
+    PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync = NULL;
+    if (gl_renderer_supports_egl_extension(renderer, "EGL_KHR_fence_sync")) {
+        create_sync = (PFNEGLCREATESYNCKHRPROC) gl_renderer_get_proc_address(renderer, "eglCreateSyncKHR");
+        destroy_sync = (PFNEGLDESTROYSYNCKHRPROC) gl_renderer_get_proc_address(renderer, "eglDestroySyncKHR");
+        client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC) gl_renderer_get_proc_address(renderer, "eglClientWaitSyncKHR");
+        if (create_sync == NULL || destroy_sync == NULL || client_wait_sync == NULL) {
+            LOG_ERROR("Could not resolve EGL_KHR_fence_sync procedures, even though it is listed as supported.\n");
+            create_sync = NULL;
+            destroy_sync = NULL;
+            client_wait_sync = NULL;
+        }
+    }
+
     // These two are optional.
     // Might be useful in the future.
 #ifdef EGL_EXT_image_dma_buf_import_modifiers
@@ -285,12 +396,21 @@ struct frame_interface *frame_interface_new(struct gl_renderer *renderer) {
         formats = NULL;
     }
 
+    interface->renderer = gl_renderer_ref(renderer);
     interface->gbm_device = gbm_device;
     interface->display = display;
     pthread_mutex_init(&interface->context_lock, NULL);
     interface->context = context;
+    pthread_mutex_init(&interface->pool_lock, NULL);
+    list_inithead(&interface->context_pool);
+    list_inithead(&interface->bo_pool);
+    list_inithead(&interface->strategies);
+    interface->n_strategies = 0;
     interface->eglCreateImageKHR = create_image;
     interface->eglDestroyImageKHR = destroy_image;
+    interface->eglCreateSyncKHR = create_sync;
+    interface->eglDestroySyncKHR = destroy_sync;
+    interface->eglClientWaitSyncKHR = client_wait_sync;
     interface->supports_external_target = supports_external_target;
     interface->glEGLImageTargetTexture2DOES = gl_egl_image_target_texture2d;
     interface->supports_extended_imports = supports_extended_imports;
@@ -313,9 +433,48 @@ fail_free:
     return NULL;
 }
 
+/**
+ * @brief The frame interface the calling thread is a streaming thread of, if any.
+ */
+static __thread struct frame_interface *thread_interface = NULL;
+
+/**
+ * @brief The pooled context that's current on the calling thread, if any.
+ */
+static __thread struct pooled_context *thread_context = NULL;
+
+static void destroy_pooled_bo(struct frame_interface *interface, struct pooled_bo *pooled);
+
 void frame_interface_destroy(struct frame_interface *interface) {
     EGLBoolean egl_ok;
 
+    if (thread_interface == interface) {
+        frame_interface_on_thread_leave(interface);
+    }
+
+    list_for_each_entry_safe(struct pooled_context, pooled, &interface->context_pool, entry) {
+        // If the context is still current on a streaming thread (because we didn't get a LEAVE message),
+        // EGL will defer destroying it until it's not current anymore.
+        egl_ok = eglDestroyContext(interface->display, pooled->context);
+        ASSERT_EGL_TRUE(egl_ok);
+        list_del(&pooled->entry);
+        free(pooled);
+    }
+
+    list_for_each_entry_safe(struct pooled_bo, pooled, &interface->bo_pool, entry) {
+        // Frames keep a reference on the interface, so no BO can be in use here.
+        assert(!pooled->in_use);
+        destroy_pooled_bo(interface, pooled);
+    }
+
+    list_for_each_entry_safe(struct upload_strategy_entry, strategy, &interface->strategies, entry) {
+        gst_caps_unref(strategy->caps);
+        list_del(&strategy->entry);
+        free(strategy);
+    }
+
+    pthread_mutex_destroy(&interface->pool_lock);
+
     pthread_mutex_destroy(&interface->context_lock);
     egl_ok = eglDestroyContext(interface->display, interface->context);
     ASSERT_EGL_TRUE(egl_ok);
@@ -323,6 +482,7 @@ void frame_interface_destroy(struct frame_interface *interface) {
     if (interface->formats != NULL) {
         free(interface->formats);
     }
+    gl_renderer_unref(interface->renderer);
     free(interface);
 }
 
@@ -339,6 +499,152 @@ DEFINE_LOCK_OPS(frame_interface, context_lock)
 
 DEFINE_REF_OPS(frame_interface, n_refs)
 
+static struct pooled_context *acquire_pooled_context(struct frame_interface *interface) {
+    struct pooled_context *pooled;
+    EGLContext context;
+
+    pthread_mutex_lock(&interface->pool_lock);
+    list_for_each_entry(struct pooled_context, candidate, &interface->context_pool, entry) {
+        if (!candidate->in_use) {
+            candidate->in_use = true;
+            pthread_mutex_unlock(&interface->pool_lock);
+            return candidate;
+        }
+    }
+    pthread_mutex_unlock(&interface->pool_lock);
+
+    // No free context in the pool, create a new one.
+    pooled = malloc(sizeof *pooled);
+    if (pooled == NULL) {
+        return NULL;
+    }
+
+    context = gl_renderer_create_context(interface->renderer);
+    if (context == EGL_NO_CONTEXT) {
+        free(pooled);
+        return NULL;
+    }
+
+    pooled->context = context;
+    pooled->in_use = true;
+
+    pthread_mutex_lock(&interface->pool_lock);
+    list_addtail(&pooled->entry, &interface->context_pool);
+    pthread_mutex_unlock(&interface->pool_lock);
+
+    return pooled;
+}
+
+static void release_pooled_context(struct frame_interface *interface, struct pooled_context *pooled) {
+    pthread_mutex_lock(&interface->pool_lock);
+    pooled->in_use = false;
+    pthread_mutex_unlock(&interface->pool_lock);
+}
+
+void frame_interface_on_thread_enter(struct frame_interface *interface) {
+    ASSERT_NOT_NULL(interface);
+
+    if (thread_interface == interface) {
+        // We already know about this thread.
+        return;
+    }
+
+    // We don't make a context current here yet, since most streaming threads
+    // (sources, demuxers, queues) never upload any frames.
+    // That's done lazily in begin_gl instead.
+    thread_interface = interface;
+    thread_context = NULL;
+}
+
+void frame_interface_on_thread_leave(struct frame_interface *interface) {
+    EGLBoolean egl_ok;
+
+    ASSERT_NOT_NULL(interface);
+
+    if (thread_interface != interface) {
+        return;
+    }
+
+    if (thread_context != NULL) {
+        egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (egl_ok == EGL_FALSE) {
+            LOG_ERROR("Could not clear EGL context. eglMakeCurrent: %" PRId32 "\n", eglGetError());
+        }
+
+        release_pooled_context(interface, thread_context);
+    }
+
+    thread_interface = NULL;
+    thread_context = NULL;
+}
+
+/**
+ * @brief Make an EGL context current on the calling thread, so we can do GL calls.
+ *
+ * On streaming threads of this interface, a context from the pool is made current once
+ * and kept current until the thread leaves, so this is basically free.
+ * On any other thread, the shared interface context is made current while holding the context lock.
+ *
+ * @param interface The frame interface.
+ * @param is_temporary_out Will be set to true if @ref end_gl needs to clear the context again.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+static int begin_gl(struct frame_interface *interface, bool *is_temporary_out) {
+    EGLBoolean egl_ok;
+
+    if (thread_interface == interface) {
+        if (thread_context == NULL) {
+            thread_context = acquire_pooled_context(interface);
+            if (thread_context != NULL) {
+                egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, thread_context->context);
+                if (egl_ok == EGL_FALSE) {
+                    LOG_ERROR("Could not make pooled EGL context current. eglMakeCurrent: %" PRId32 "\n", eglGetError());
+                    release_pooled_context(interface, thread_context);
+                    thread_context = NULL;
+                }
+            }
+        }
+
+        if (thread_context != NULL) {
+            *is_temporary_out = false;
+            return 0;
+        }
+
+        // Fallback to the shared context.
+    }
+
+    frame_interface_lock(interface);
+
+    egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, interface->context);
+    if (egl_ok == EGL_FALSE) {
+        LOG_ERROR("Could not make EGL context current. eglMakeCurrent: %" PRId32 "\n", eglGetError());
+        frame_interface_unlock(interface);
+        return EIO;
+    }
+
+    *is_temporary_out = true;
+    return 0;
+}
+
+static void end_gl(struct frame_interface *interface, bool is_temporary) {
+    EGLBoolean egl_ok;
+
+    if (!is_temporary) {
+        // The pooled context stays current, so nothing implicitly flushes it.
+        // Flush explicitly so the commands we just issued (e.g. glEGLImageTargetTexture2DOES)
+        // are actually submitted before the frame is handed to the flutter raster thread.
+        glFlush();
+        return;
+    }
+
+    egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_ok == EGL_FALSE) {
+        LOG_ERROR("Could not clear EGL context. eglMakeCurrent: %" PRId32 "\n", eglGetError());
+    }
+
+    frame_interface_unlock(interface);
+}
+
 /**
  * @brief Create a dmabuf fd from the given GstBuffer.
  *
@@ -451,6 +757,217 @@ fail_unmap_buffer:
     return -1;
 }
 
+static void destroy_pooled_bo(struct frame_interface *interface, struct pooled_bo *pooled) {
+    if (pooled->release_fence != EGL_NO_SYNC_KHR) {
+        interface->eglDestroySyncKHR(interface->display, pooled->release_fence);
+    }
+    gbm_bo_destroy(pooled->bo);
+    list_del(&pooled->entry);
+    free(pooled);
+}
+
+/**
+ * @brief Wait until the GPU is done reading the previous contents of the pooled BO.
+ */
+static void wait_pooled_bo_idle(struct frame_interface *interface, struct pooled_bo *pooled) {
+    EGLint egl_result;
+
+    if (pooled->release_fence == EGL_NO_SYNC_KHR) {
+        return;
+    }
+
+    egl_result = interface->eglClientWaitSyncKHR(interface->display, pooled->release_fence, 0, EGL_FOREVER_KHR);
+    if (egl_result == EGL_FALSE) {
+        LOG_ERROR("Could not wait for video frame BO to be released by the GPU. eglClientWaitSyncKHR: %" PRId32 "\n", eglGetError());
+    }
+
+    interface->eglDestroySyncKHR(interface->display, pooled->release_fence);
+    pooled->release_fence = EGL_NO_SYNC_KHR;
+}
+
+static struct pooled_bo *acquire_pooled_bo(struct frame_interface *interface, size_t size) {
+    struct pooled_bo *pooled;
+    struct gbm_bo *bo;
+
+    pthread_mutex_lock(&interface->pool_lock);
+    list_for_each_entry_safe(struct pooled_bo, candidate, &interface->bo_pool, entry) {
+        if (candidate->in_use) {
+            continue;
+        }
+
+        if (candidate->size == size) {
+            candidate->in_use = true;
+            pthread_mutex_unlock(&interface->pool_lock);
+
+            // The fence is only touched by whoever owns the BO, so we can wait without holding the lock.
+            wait_pooled_bo_idle(interface, candidate);
+            return candidate;
+        }
+
+        // This BO is left over from frames with a different size, it won't be used again.
+        destroy_pooled_bo(interface, candidate);
+    }
+    pthread_mutex_unlock(&interface->pool_lock);
+
+    pooled = malloc(sizeof *pooled);
+    if (pooled == NULL) {
+        return NULL;
+    }
+
+    bo = gbm_bo_create(interface->gbm_device, size, 1, GBM_FORMAT_R8, GBM_BO_USE_LINEAR);
+    if (bo == NULL) {
+        LOG_ERROR("Couldn't create GBM BO to copy video frame into.\n");
+        free(pooled);
+        return NULL;
+    }
+
+    pooled->bo = bo;
+    pooled->size = size;
+    pooled->in_use = true;
+    pooled->release_fence = EGL_NO_SYNC_KHR;
+
+    pthread_mutex_lock(&interface->pool_lock);
+    list_addtail(&pooled->entry, &interface->bo_pool);
+    pthread_mutex_unlock(&interface->pool_lock);
+
+    return pooled;
+}
+
+/**
+ * @brief Give the pooled BO back to the pool.
+ *
+ * @param release_fence Fence that's signalled when the GPU is done reading the BO,
+ *                      or EGL_NO_SYNC_KHR. The pool takes ownership of it.
+ */
+static void release_pooled_bo(struct frame_interface *interface, struct pooled_bo *pooled, EGLSyncKHR release_fence) {
+    ASSERT_EQUALS(pooled->release_fence, EGL_NO_SYNC_KHR);
+    pooled->release_fence = release_fence;
+
+    pthread_mutex_lock(&interface->pool_lock);
+    pooled->in_use = false;
+    pthread_mutex_unlock(&interface->pool_lock);
+}
+
+/**
+ * @brief Copy the contents of the whole buffer into a pooled BO.
+ *
+ * Plane offsets into the BO are the same as the plane offsets into the buffer.
+ */
+static struct pooled_bo *copy_buffer_into_pooled_bo(struct frame_interface *interface, GstBuffer *buffer) {
+    struct pooled_bo *pooled;
+    GstMapInfo map_info;
+    uint32_t stride;
+    gboolean gst_ok;
+    void *map, *map_data;
+
+    gst_ok = gst_buffer_map(buffer, &map_info, GST_MAP_READ);
+    if (gst_ok == FALSE) {
+        LOG_ERROR("Couldn't map gstreamer video frame buffer to copy it into a dma buffer.\n");
+        return NULL;
+    }
+
+    pooled = acquire_pooled_bo(interface, map_info.size);
+    if (pooled == NULL) {
+        goto fail_unmap_buffer;
+    }
+
+    map_data = NULL;
+    map = gbm_bo_map(pooled->bo, 0, 0, map_info.size, 1, GBM_BO_TRANSFER_WRITE, &stride, &map_data);
+    if (map == NULL) {
+        LOG_ERROR("Couldn't mmap GBM BO to copy video frame into it.\n");
+        goto fail_release_bo;
+    }
+
+    memcpy(map, map_info.data, map_info.size);
+
+    gbm_bo_unmap(pooled->bo, map_data);
+    gst_buffer_unmap(buffer, &map_info);
+    return pooled;
+
+fail_release_bo:
+    release_pooled_bo(interface, pooled, EGL_NO_SYNC_KHR);
+
+fail_unmap_buffer:
+    gst_buffer_unmap(buffer, &map_info);
+    return NULL;
+}
+
+static bool is_dmabuf_buffer(GstBuffer *buffer) {
+    unsigned n_memories = gst_buffer_n_memory(buffer);
+
+    for (unsigned i = 0; i < n_memories; i++) {
+        if (!gst_is_dmabuf_memory(gst_buffer_peek_memory(buffer, i))) {
+            return false;
+        }
+    }
+
+    return n_memories > 0;
+}
+
+/**
+ * @brief Get the upload strategy for a buffer with the given caps.
+ *
+ * The strategy is determined using the first buffer for some caps and then
+ * used for all following buffers with the same caps. Strategies are remembered
+ * for the last @ref MAX_N_UPLOAD_STRATEGY_ENTRIES caps, so players with different
+ * caps sharing this interface don't evict each other's strategy every frame.
+ */
+static enum upload_strategy get_upload_strategy(struct frame_interface *interface, GstCaps *caps, GstBuffer *buffer) {
+    struct upload_strategy_entry *cached;
+    enum upload_strategy strategy;
+
+    pthread_mutex_lock(&interface->pool_lock);
+
+    if (caps != NULL) {
+        list_for_each_entry(struct upload_strategy_entry, candidate, &interface->strategies, entry) {
+            if (candidate->caps == caps || gst_caps_is_equal(candidate->caps, caps)) {
+                // Move it to the back, so it's evicted last.
+                list_del(&candidate->entry);
+                list_addtail(&candidate->entry, &interface->strategies);
+
+                strategy = candidate->strategy;
+                pthread_mutex_unlock(&interface->pool_lock);
+                return strategy;
+            }
+        }
+    }
+
+    if (is_dmabuf_buffer(buffer)) {
+        strategy = kDmabufImport_UploadStrategy;
+    } else {
+        strategy = kPooledBoCopy_UploadStrategy;
+    }
+
+    LOG_DEBUG(
+        "Using %s for uploading video frames.\n",
+        strategy == kDmabufImport_UploadStrategy ? "direct dmabuf import" : "copies into pooled dmabufs"
+    );
+
+    if (caps != NULL) {
+        if (interface->n_strategies >= MAX_N_UPLOAD_STRATEGY_ENTRIES) {
+            // Reuse the least recently used entry.
+            cached = list_first_entry(&interface->strategies, struct upload_strategy_entry, entry);
+            list_del(&cached->entry);
+            gst_caps_unref(cached->caps);
+        } else {
+            cached = malloc(sizeof *cached);
+            if (cached != NULL) {
+                interface->n_strategies++;
+            }
+        }
+
+        // If we can't allocate, we just don't cache the strategy.
+        if (cached != NULL) {
+            cached->caps = gst_caps_ref(caps);
+            cached->strategy = strategy;
+            list_addtail(&cached->entry, &interface->strategies);
+        }
+    }
+
+    pthread_mutex_unlock(&interface->pool_lock);
+    return strategy;
+}
+
 struct plane_info {
     int fd;
     uint32_t offset;
@@ -547,8 +1064,15 @@ static bool calculate_plane_size(UNUSED const GstVideoInfo *info, UNUSED int pla
 }
 #endif
 
-static int
-get_plane_infos(GstBuffer *buffer, const GstVideoInfo *info, struct gbm_device *gbm_device, struct plane_info plane_infos[MAX_N_PLANES]) {
+static int get_plane_infos(
+    GstBuffer *buffer,
+    const GstVideoInfo *info,
+    bool has_modifier,
+    uint64_t modifier,
+    struct pooled_bo *bo,
+    struct gbm_device *gbm_device,
+    struct plane_info plane_infos[MAX_N_PLANES]
+) {
     GstVideoMeta *meta;
     GstMemory *memory;
     gboolean gst_ok;
@@ -557,6 +1081,30 @@ get_plane_infos(GstBuffer *buffer, const GstVideoInfo *info, struct gbm_device *
     int n_planes;
 
     n_planes = GST_VIDEO_INFO_N_PLANES(info);
+    meta = gst_buffer_get_video_meta(buffer);
+
+    // If the buffer was copied into a pooled BO, all planes are in that BO,
+    // at the same offsets as in the buffer.
+    if (bo != NULL) {
+        for (int i = 0; i < n_planes; i++) {
+            int fd = gbm_bo_get_fd(bo->bo);
+            if (fd < 0) {
+                LOG_ERROR("Couldn't get filedescriptor of video frame GBM BO.\n");
+                for (int j = i - 1; j >= 0; j--) {
+                    close(plane_infos[j].fd);
+                }
+                return EIO;
+            }
+
+            plane_infos[i].fd = fd;
+            plane_infos[i].offset = meta ? meta->offset[i] : GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+            plane_infos[i].pitch = meta ? meta->stride[i] : GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+            plane_infos[i].has_modifier = false;
+            plane_infos[i].modifier = DRM_FORMAT_MOD_LINEAR;
+        }
+
+        return 0;
+    }
 
     // There's so many ways to get the plane sizes.
     // 1. Preferably we should use the video meta.
@@ -565,7 +1113,6 @@ get_plane_infos(GstBuffer *buffer, const GstVideoInfo *info, struct gbm_device *
     // 4. If that doesn't work, we can't determine the plane sizes.
     //    In that case, we'll error if we have more than one plane.
     has_plane_sizes = false;
-    meta = gst_buffer_get_video_meta(buffer);
     if (meta != NULL) {
         has_plane_sizes = get_plane_sizes_from_meta(meta, plane_sizes);
     }
@@ -665,16 +1212,15 @@ get_plane_infos(GstBuffer *buffer, const GstVideoInfo *info, struct gbm_device *
         plane_infos[i].offset = offset_in_memory;
         plane_infos[i].pitch = stride;
 
-        /// TODO: Detect modifiers here
-        /// Modifiers will be supported in future gstreamer, see:
-        /// https://gstreamer.freedesktop.org/documentation/additional/design/dmabuf.html?gi-language=c
-        plane_infos[i].has_modifier = false;
-        plane_infos[i].modifier = DRM_FORMAT_MOD_LINEAR;
+        // All planes of a dmabuf share the same modifier.
+        // If we don't have an explicit modifier, the driver will use the implicit one (if any).
+        plane_infos[i].has_modifier = has_modifier;
+        plane_infos[i].modifier = has_modifier ? modifier : DRM_FORMAT_MOD_LINEAR;
         continue;
 
 fail_close_fds:
-        for (int j = i - 1; j > 0; j--) {
-            close(plane_infos[i].fd);
+        for (int j = i - 1; j >= 0; j--) {
+            close(plane_infos[j].fd);
         }
         return ok;
     }
@@ -755,6 +1301,145 @@ ATTR_CONST GstVideoFormat gst_video_format_from_drm_format(uint32_t drm_format)
     }
 }
 
+#if THIS_GSTREAMER_VER >= GSTREAMER_VER(1, 24, 0)
+/**
+ * @brief Parse memory:DMABuf caps with an explicit drm-format. (format=DMA_DRM)
+ *
+ * The video info of DMA_DRM caps doesn't have a real video format, so @param info_out is
+ * filled with a video info for the linear equivalent of the DRM format instead. That's good enough
+ * for us, since the actual plane layout is given by the video meta of the buffers anyway.
+ */
+static bool get_dma_drm_info_from_caps(const GstCaps *caps, GstVideoInfo *info_out, uint32_t *drm_format_out, uint64_t *modifier_out) {
+    GstVideoInfoDmaDrm drm_info;
+    GstVideoFormat format;
+    gboolean gst_ok;
+
+    if (!gst_video_is_dma_drm_caps(caps)) {
+        return false;
+    }
+
+    gst_ok = gst_video_info_dma_drm_from_caps(&drm_info, caps);
+    if (gst_ok == FALSE) {
+        LOG_ERROR("Could not parse DMA_DRM video caps.\n");
+        return false;
+    }
+
+    if (info_out != NULL) {
+        format = gst_video_format_from_drm_format(drm_info.drm_fourcc);
+        if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+            LOG_ERROR("DRM format %" DRM_FOURCC_FORMAT " has no gstreamer equivalent.\n", DRM_FOURCC_ARGS(drm_info.drm_fourcc));
+            return false;
+        }
+
+        gst_ok = gst_video_info_set_interlaced_format(
+            info_out,
+            format,
+            GST_VIDEO_INFO_INTERLACE_MODE(&drm_info.vinfo),
+            GST_VIDEO_INFO_WIDTH(&drm_info.vinfo),
+            GST_VIDEO_INFO_HEIGHT(&drm_info.vinfo)
+        );
+        if (gst_ok == FALSE) {
+            LOG_ERROR("Could not construct video info for DMA_DRM video caps.\n");
+            return false;
+        }
+
+        // gst_video_info_set_interlaced_format resets everything else, so restore it.
+        GST_VIDEO_INFO_COLORIMETRY(info_out) = GST_VIDEO_INFO_COLORIMETRY(&drm_info.vinfo);
+        GST_VIDEO_INFO_CHROMA_SITE(info_out) = GST_VIDEO_INFO_CHROMA_SITE(&drm_info.vinfo);
+        GST_VIDEO_INFO_PAR_N(info_out) = GST_VIDEO_INFO_PAR_N(&drm_info.vinfo);
+        GST_VIDEO_INFO_PAR_D(info_out) = GST_VIDEO_INFO_PAR_D(&drm_info.vinfo);
+        GST_VIDEO_INFO_FPS_N(info_out) = GST_VIDEO_INFO_FPS_N(&drm_info.vinfo);
+        GST_VIDEO_INFO_FPS_D(info_out) = GST_VIDEO_INFO_FPS_D(&drm_info.vinfo);
+    }
+
+    if (drm_format_out != NULL) {
+        *drm_format_out = drm_info.drm_fourcc;
+    }
+    if (modifier_out != NULL) {
+        *modifier_out = drm_info.drm_modifier;
+    }
+    return true;
+}
+#else
+static bool get_dma_drm_info_from_caps(
+    UNUSED const GstCaps *caps,
+    UNUSED GstVideoInfo *info_out,
+    UNUSED uint32_t *drm_format_out,
+    UNUSED uint64_t *modifier_out
+) {
+    return false;
+}
+#endif
+
+bool frame_video_info_from_caps(const GstCaps *caps, GstVideoInfo *info_out) {
+    if (get_dma_drm_info_from_caps(caps, info_out, NULL, NULL)) {
+        return true;
+    }
+
+    return gst_video_info_from_caps(info_out, caps);
+}
+
+GstCaps *frame_interface_get_caps(struct frame_interface *interface) {
+    GstCaps *caps;
+
+    caps = gst_caps_new_empty();
+    if (caps == NULL) {
+        return NULL;
+    }
+
+#if THIS_GSTREAMER_VER >= GSTREAMER_VER(1, 24, 0)
+    // With gstreamer 1.24 and newer, we can negotiate explicit DRM format modifiers.
+    // That way decoders can give us their native tiled buffers (for example SAND128 on the Pi)
+    // instead of detiling them into linear buffers first.
+    // These caps come first, so they're preferred.
+    GValue drm_formats = G_VALUE_INIT;
+    g_value_init(&drm_formats, GST_TYPE_LIST);
+
+    for_each_format_in_frame_interface(i, format, interface) {
+        if (format->modifier == DRM_FORMAT_MOD_INVALID) {
+            continue;
+        }
+
+        // frame_new needs a gstreamer video format to determine the plane count.
+        if (gst_video_format_from_drm_format(format->format) == GST_VIDEO_FORMAT_UNKNOWN) {
+            continue;
+        }
+
+        gchar *drm_format_str = gst_video_dma_drm_fourcc_to_string(format->format, format->modifier);
+        if (drm_format_str == NULL) {
+            continue;
+        }
+
+        GValue value = G_VALUE_INIT;
+        g_value_init(&value, G_TYPE_STRING);
+        g_value_take_string(&value, drm_format_str);
+        gst_value_list_append_and_take_value(&drm_formats, &value);
+    }
+
+    if (gst_value_list_get_size(&drm_formats) > 0) {
+        GstCaps *dma_drm_caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "DMA_DRM", NULL);
+        gst_caps_set_features(dma_drm_caps, 0, gst_caps_features_new(GST_CAPS_FEATURE_MEMORY_DMABUF, NULL));
+        gst_structure_take_value(gst_caps_get_structure(dma_drm_caps, 0), "drm-format", &drm_formats);
+        gst_caps_append(caps, dma_drm_caps);
+    } else {
+        g_value_unset(&drm_formats);
+    }
+#endif
+
+    // we only accept video formats that we can actually upload to EGL
+    for_each_format_in_frame_interface(i, format, interface) {
+        GstVideoFormat gst_format = gst_video_format_from_drm_format(format->format);
+        if (gst_format == GST_VIDEO_FORMAT_UNKNOWN) {
+            continue;
+        }
+
+        gst_caps_append(caps, gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, gst_video_format_to_string(gst_format), NULL));
+    }
+
+    // Merges duplicate structures for formats that are supported with multiple modifiers.
+    return gst_caps_simplify(caps);
+}
+
 static EGLint egl_color_space_from_gst_info(const GstVideoInfo *info) {
     if (gst_video_colorimetry_matches(&GST_VIDEO_INFO_COLORIMETRY(info), GST_VIDEO_COLORIMETRY_BT601)) {
         return EGL_ITU_REC601_EXT;
@@ -809,20 +1494,22 @@ struct video_frame *frame_new(struct frame_interface *interface, GstSample *samp
         attributes[attr_index++] = (_key);                \
         attributes[attr_index++] = (_value);              \
     } while (false)
+    enum upload_strategy strategy;
     struct video_frame *frame;
     struct plane_info planes[MAX_N_PLANES];
+    struct pooled_bo *bo;
     GstVideoInfo _info;
-    EGLBoolean egl_ok;
     GstBuffer *buffer;
     EGLImageKHR egl_image;
     gboolean gst_ok;
     uint32_t drm_format;
+    uint64_t modifier;
     GstCaps *caps;
     GLuint texture;
     GLenum gl_error;
-    EGLint egl_error;
     EGLint attributes[2 * 7 + MAX_N_PLANES * 2 * 5 + 1];
     EGLint egl_color_space, egl_sample_range_hint, egl_horizontal_chroma_siting, egl_vertical_chroma_siting;
+    bool is_temporary_context, has_modifier;
     int ok, width, height, n_planes, attr_index;
 
     buffer = gst_sample_get_buffer(sample);
@@ -831,22 +1518,21 @@ struct video_frame *frame_new(struct frame_interface *interface, GstSample *samp
         return NULL;
     }
 
+    caps = gst_sample_get_caps(sample);
+
     // If we don't have an explicit info given, we determine it from the sample caps.
     if (info == NULL) {
-        caps = gst_sample_get_caps(sample);
         if (caps == NULL) {
             return NULL;
         }
 
         info = &_info;
 
-        gst_ok = gst_video_info_from_caps(&_info, caps);
+        gst_ok = frame_video_info_from_caps(caps, &_info);
         if (gst_ok == FALSE) {
             LOG_ERROR("Could not get video info from video sample caps.\n");
             return NULL;
         }
-    } else {
-        caps = NULL;
     }
 
     // Determine some basic frame info.
@@ -854,16 +1540,25 @@ struct video_frame *frame_new(struct frame_interface *interface, GstSample *samp
     height = GST_VIDEO_INFO_HEIGHT(info);
     n_planes = GST_VIDEO_INFO_N_PLANES(info);
 
-    // query the drm format for this sample
-    drm_format = drm_format_from_gst_info(info);
-    if (drm_format == DRM_FORMAT_INVALID) {
-        LOG_ERROR("Video format has no EGL equivalent.\n");
-        return NULL;
+    // query the drm format and modifier for this sample.
+    // If we negotiated memory:DMABuf caps with an explicit drm-format, those tell us the modifier.
+    // Otherwise, the buffer is linear or uses some implicit modifier the driver knows about.
+    if (caps != NULL && get_dma_drm_info_from_caps(caps, NULL, &drm_format, &modifier) && modifier != DRM_FORMAT_MOD_INVALID) {
+        has_modifier = true;
+    } else {
+        drm_format = drm_format_from_gst_info(info);
+        if (drm_format == DRM_FORMAT_INVALID) {
+            LOG_ERROR("Video format has no EGL equivalent.\n");
+            return NULL;
+        }
+
+        has_modifier = false;
+        modifier = DRM_FORMAT_MOD_LINEAR;
     }
 
     bool external_only;
     for_each_format_in_frame_interface(i, format, interface) {
-        if (format->format == drm_format && format->modifier == DRM_FORMAT_MOD_LINEAR) {
+        if (format->format == drm_format && format->modifier == modifier) {
             external_only = format->external_only;
             goto format_supported;
         }
@@ -872,7 +1567,7 @@ struct video_frame *frame_new(struct frame_interface *interface, GstSample *samp
     LOG_ERROR(
         "Video format is not supported by EGL: %" DRM_FOURCC_FORMAT " (modifier: %" PRIu64 ").\n",
         DRM_FOURCC_ARGS(drm_format),
-        (uint64_t) DRM_FORMAT_MOD_LINEAR
+        modifier
     );
     return NULL;
 
@@ -893,9 +1588,19 @@ format_supported:
         return NULL;
     }
 
-    ok = get_plane_infos(buffer, info, interface->gbm_device, planes);
+    strategy = get_upload_strategy(interface, caps, buffer);
+    if (strategy == kPooledBoCopy_UploadStrategy) {
+        bo = copy_buffer_into_pooled_bo(interface, buffer);
+        if (bo == NULL) {
+            goto fail_free_frame;
+        }
+    } else {
+        bo = NULL;
+    }
+
+    ok = get_plane_infos(buffer, info, has_modifier, modifier, bo, interface->gbm_device, planes);
     if (ok != 0) {
-        goto fail_free_frame;
+        goto fail_release_bo;
     }
 
     // Start putting together the EGL attributes.
@@ -1029,39 +1734,16 @@ format_supported:
         goto fail_release_planes;
     }
 
-    frame_interface_lock(interface);
-
-    /// TODO: Make a single EGL context current for the whole lifetime of a
-    /// gstreamer thread, instead of making one current and clearing it after
-    /// for the duration of this procedure, to save some cycles.
-    ///
-    /// Make context current in GST_STREAM_STATUS_TYPE_ENTER message, clear it
-    /// in GST_STREAM_STATUS_TYPE_LEAVE message.
-    ///
-    /// See https://gstreamer.freedesktop.org/documentation/additional/design/stream-status.html
-    ///
-    /// Alternatively, don't unconditionally create & make current an EGL
-    /// context in the ENTER message, but create one lazily as soon as we need
-    /// one, but keep track of it an destroy it in the LEAVE message.
-    ///
-    /// The STREAM_STATUS messages need to be handled synchronously of course,
-    /// on the streaming thread, using either:
-    ///   - gst_bus_set_sync_handler
-    ///     https://gstreamer.freedesktop.org/documentation/gstreamer/gstbus.html#gst_bus_set_sync_handler
-    ///   - or GstBus sync-message signal
-    ///     https://gstreamer.freedesktop.org/documentation/gstreamer/gstbus.html#GstBus::sync-message
-    egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, interface->context);
-    if (egl_ok == EGL_FALSE) {
-        egl_error = eglGetError();
-        LOG_ERROR("Could not make EGL context current. eglMakeCurrent: %" PRId32 "\n", egl_error);
-        goto fail_unlock_interface;
+    ok = begin_gl(interface, &is_temporary_context);
+    if (ok != 0) {
+        goto fail_destroy_image;
     }
 
     glGenTextures(1, &texture);
     if (texture == 0) {
         gl_error = glGetError();
         LOG_ERROR("Could not create GL texture. glGenTextures: %" PRIu32 "\n", gl_error);
-        goto fail_clear_context;
+        goto fail_end_gl;
     }
 
     GLenum target;
@@ -1082,17 +1764,13 @@ format_supported:
 
     glBindTexture(target, 0);
 
-    egl_ok = eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    if (egl_ok == EGL_FALSE) {
-        egl_error = eglGetError();
-        LOG_ERROR("Could not clear EGL context. eglMakeCurrent: %" PRId32 "\n", egl_error);
-        goto fail_delete_texture;
-    }
+    end_gl(interface, is_temporary_context);
 
-    frame_interface_unlock(interface);
-
-    frame->sample = gst_sample_ref(sample);
+    // If we copied the frame, we don't need to keep the sample (and the buffer) alive.
+    // That way the decoder can reuse the buffer sooner.
+    frame->sample = bo == NULL ? gst_sample_ref(sample) : NULL;
     frame->interface = frame_interface_ref(interface);
+    frame->bo = bo;
     frame->drm_format = drm_format;
     frame->n_dmabuf_fds = n_planes;
     frame->dmabuf_fds[0] = planes[0].fd;
@@ -1108,51 +1786,70 @@ format_supported:
     return frame;
 
 fail_unbind_texture:
-    glBindTexture(texture, 0);
-
-fail_delete_texture:
+    glBindTexture(target, 0);
     glDeleteTextures(1, &texture);
 
-fail_clear_context:
-    eglMakeCurrent(interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+fail_end_gl:
+    end_gl(interface, is_temporary_context);
 
-fail_unlock_interface:
-    frame_interface_unlock(interface);
+fail_destroy_image:
     interface->eglDestroyImageKHR(interface->display, egl_image);
 
 fail_release_planes:
     for (int i = 0; i < n_planes; i++)
         close(planes[i].fd);
 
+fail_release_bo:
+    if (bo != NULL) {
+        release_pooled_bo(interface, bo, EGL_NO_SYNC_KHR);
+    }
+
 fail_free_frame:
     free(frame);
     return NULL;
 }
 
 void frame_destroy(struct video_frame *frame) {
+    EGLSyncKHR release_fence;
     EGLBoolean egl_ok;
+    bool is_temporary_context;
     int ok;
 
-    frame_interface_lock(frame->interface);
-    egl_ok = eglMakeCurrent(frame->interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, frame->interface->context);
-    ASSERT_EGL_TRUE(egl_ok);
-    (void) egl_ok;
+    // The flutter engine destroys the frame on the raster thread, with its context still current.
+    // The commands sampling the frame were issued on that context, so fence it there before we
+    // switch contexts. The BO is reused only once the fence is signalled.
+    release_fence = EGL_NO_SYNC_KHR;
+    if (frame->bo != NULL && frame->interface->eglCreateSyncKHR != NULL && eglGetCurrentContext() != EGL_NO_CONTEXT) {
+        release_fence = frame->interface->eglCreateSyncKHR(frame->interface->display, EGL_SYNC_FENCE_KHR, NULL);
+        if (release_fence == EGL_NO_SYNC_KHR) {
+            LOG_ERROR("Could not create fence for video frame BO. eglCreateSyncKHR: %" PRId32 "\n", eglGetError());
+        } else {
+            glFlush();
+        }
+    }
+
+    ok = begin_gl(frame->interface, &is_temporary_context);
+    ASSERT_ZERO(ok);
     glDeleteTextures(1, &frame->gl_frame.name);
     assert(GL_NO_ERROR == glGetError());
-    egl_ok = eglMakeCurrent(frame->interface->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    ASSERT_EGL_TRUE(egl_ok);
-    frame_interface_unlock(frame->interface);
+    end_gl(frame->interface, is_temporary_context);
 
     egl_ok = frame->interface->eglDestroyImageKHR(frame->interface->display, frame->image);
     ASSERT_EGL_TRUE(egl_ok);
-    frame_interface_unref(frame->interface);
     for (int i = 0; i < frame->n_dmabuf_fds; i++) {
         ok = close(frame->dmabuf_fds[i]);
         assert(ok == 0);
         (void) ok;
     }
 
-    gst_sample_unref(frame->sample);
+    if (frame->bo != NULL) {
+        release_pooled_bo(frame->interface, frame->bo, release_fence);
+    }
+    frame_interface_unref(frame->interface);
+
+    if (frame->sample != NULL) {
+        gst_sample_unref(frame->sample);
+    }
     free(frame);
 }
 
@@ -466,6 +466,31 @@ static int apply_playback_state(struct gstplayer *player) {
     return 0;
 }
 
+static GstBusSyncReply on_bus_sync_message(GstBus *bus, GstMessage *msg, void *userdata) {
+    GstStreamStatusType type;
+    struct gstplayer *player;
+    GstElement *owner;
+
+    (void) bus;
+    player = userdata;
+
+    if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS) {
+        return GST_BUS_PASS;
+    }
+
+    // Stream status messages are posted synchronously by the streaming thread itself,
+    // so we can use them to setup / teardown thread-local state for that thread.
+    gst_message_parse_stream_status(msg, &type, &owner);
+
+    if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+        frame_interface_on_thread_enter(player->frame_interface);
+    } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+        frame_interface_on_thread_leave(player->frame_interface);
+    }
+
+    return GST_BUS_PASS;
+}
+
 static void on_bus_message(struct gstplayer *player, GstMessage *msg) {
     GstState old, current, pending, requested;
     GError *error;
@@ -689,7 +714,7 @@ static GstPadProbeReturn on_probe_pad(GstPad *pad, GstPadProbeInfo *info, void *
         return GST_PAD_PROBE_OK;
     }
 
-    ok = gst_video_info_from_caps(&player->gst_info, caps);
+    ok = frame_video_info_from_caps(caps, &player->gst_info);
     if (!ok) {
         LOG_ERROR("gstreamer: caps event with invalid video caps\n");
         return GST_PAD_PROBE_OK;
@@ -767,7 +792,6 @@ static GstFlowReturn on_appsink_new_preroll(GstAppSink *appsink, void *userdata)
         return GST_FLOW_ERROR;
     }
 
-    /// TODO: Attempt to upload using gst_gl_upload here
     frame = frame_new(player->frame_interface, sample, player->has_gst_info ? &player->gst_info : NULL);
 
     gst_sample_unref(sample);
@@ -796,7 +820,6 @@ static GstFlowReturn on_appsink_new_sample(GstAppSink *appsink, void *userdata)
 
     player = userdata;
 
-    /// TODO: Attempt to upload using gst_gl_upload here
     sample = gst_app_sink_try_pull_sample(appsink, 0);
     if (sample == NULL) {
         LOG_ERROR("gstreamer returned a NULL sample.\n");
@@ -917,16 +940,7 @@ static int init(struct gstplayer *player, bool force_sw_decoders) {
     gst_app_sink_set_drop(GST_APP_SINK(sink), FALSE);
 
     // configure our caps
-    // we only accept video formats that we can actually upload to EGL
-    GstCaps *caps = gst_caps_new_empty();
-    for_each_format_in_frame_interface(i, format, player->frame_interface) {
-        GstVideoFormat gst_format = gst_video_format_from_drm_format(format->format);
-        if (gst_format == GST_VIDEO_FORMAT_UNKNOWN) {
-            continue;
-        }
-
-        gst_caps_append(caps, gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, gst_video_format_to_string(gst_format), NULL));
-    }
+    GstCaps *caps = frame_interface_get_caps(player->frame_interface);
     gst_app_sink_set_caps(GST_APP_SINK(sink), caps);
     gst_caps_unref(caps);
 
@@ -954,6 +968,8 @@ static int init(struct gstplayer *player, bool force_sw_decoders) {
 
     bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
 
+    gst_bus_set_sync_handler(bus, on_bus_sync_message, player, NULL);
+
     gst_bus_get_pollfd(bus, &fd);
 
     flutterpi_sd_event_add_io(&busfd_event_source, fd.fd, EPOLLIN, on_bus_fd_ready, player);
@@ -0,0 +1,353 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flutter-pi.h"
+#include "pluginregistry.h"
+#include "util/collection.h"
+#include "util/logging.h"
+#include "window.h"
+
+#define SCREEN_CAPTURE_CHANNEL "flutter-pi/screen_capture"
+#define SCREEN_CAPTURE_FRAMES_CHANNEL "flutter-pi/screen_capture/frames"
+
+#define DEFAULT_MAX_FPS 5.0
+
+/**
+ * @brief How long we wait before trying again if there was no frame to capture yet.
+ */
+#define RETRY_DELAY_US 100000
+
+// Captures the frame that's shown on the display, using the writeback connector of the display
+// controller if there is one. (See window_capture_frame)
+//
+// Methods:
+//   capture() -> {width, height, pixels}
+//     pixels is a Uint8List with the frame in RGBA order, 4 bytes per pixel, without padding.
+//
+// The frames event channel sends captured frames in the same format, at most maxFps per second:
+//   listen({maxFps?})
+//   cancel()
+
+static struct plugin {
+    struct flutterpi *flutterpi;
+
+    bool streaming;
+    double max_fps;
+
+    /**
+     * @brief Incremented every time the stream is (re)started or cancelled, so we can
+     * drop captures and scheduled tasks that belong to an older stream.
+     *
+     * Each stream only ever has one capture in flight or scheduled, so a slow
+     * consumer can't make frames queue up.
+     */
+    unsigned stream_generation;
+} plugin;
+
+struct capture_result {
+    /**
+     * @brief The response handle for a capture() call, or NULL if this capture is for the frames stream.
+     */
+    const FlutterPlatformMessageResponseHandle *responsehandle;
+    unsigned stream_generation;
+
+    int error;
+    int width, height;
+    uint8_t *rgba;
+};
+
+static int convert_to_rgba(const struct window_frame_capture *capture, uint8_t *rgba_out) {
+    bool has_alpha;
+
+    if (capture->format == PIXFMT_XRGB8888) {
+        has_alpha = false;
+    } else if (capture->format == PIXFMT_ARGB8888) {
+        has_alpha = true;
+    } else {
+        return EINVAL;
+    }
+
+    for (int y = 0; y < capture->size.y; y++) {
+        const uint8_t *src = (const uint8_t *) capture->pixels + (size_t) y * capture->stride;
+
+        // Both formats are B, G, R, X/A in memory.
+        for (int x = 0; x < capture->size.x; x++, src += 4, rgba_out += 4) {
+            rgba_out[0] = src[2];
+            rgba_out[1] = src[1];
+            rgba_out[2] = src[0];
+            rgba_out[3] = has_alpha ? src[3] : 0xFF;
+        }
+    }
+
+    return 0;
+}
+
+static int start_stream_capture(unsigned generation);
+
+static int on_stream_capture_due(void *userdata) {
+    unsigned generation;
+
+    generation = (unsigned) (uintptr_t) userdata;
+    if (!plugin.streaming || generation != plugin.stream_generation) {
+        return 0;
+    }
+
+    start_stream_capture(generation);
+    return 0;
+}
+
+static void schedule_stream_capture(uint64_t delay_us) {
+    int ok;
+
+    ok = flutterpi_post_platform_task_with_time(
+        on_stream_capture_due,
+        (void *) (uintptr_t) plugin.stream_generation,
+        get_monotonic_time() / 1000 + delay_us
+    );
+    if (ok != 0) {
+        LOG_ERROR("Couldn't schedule the next frame capture. flutterpi_post_platform_task_with_time: %s\n", strerror(ok));
+    }
+}
+
+static int on_capture_result(void *userdata) {
+    struct capture_result *result;
+    int ok;
+
+    result = userdata;
+    ok = 0;
+
+    if (result->responsehandle != NULL) {
+        if (result->error == 0) {
+            ok = platch_respond_success_std(
+                result->responsehandle,
+                &STDMAP3(
+                    STDSTRING("width"),
+                    STDINT32(result->width),
+                    STDSTRING("height"),
+                    STDINT32(result->height),
+                    STDSTRING("pixels"),
+                    ((struct std_value){
+                        .type = kStdUInt8Array,
+                        .size = (size_t) result->width * result->height * 4,
+                        .uint8array = result->rgba,
+                    })
+                )
+            );
+        } else {
+            ok = platch_respond_native_error_std(result->responsehandle, result->error);
+        }
+    } else if (plugin.streaming && result->stream_generation == plugin.stream_generation) {
+        if (result->error == 0) {
+            ok = platch_send_success_event_std(
+                SCREEN_CAPTURE_FRAMES_CHANNEL,
+                &STDMAP3(
+                    STDSTRING("width"),
+                    STDINT32(result->width),
+                    STDSTRING("height"),
+                    STDINT32(result->height),
+                    STDSTRING("pixels"),
+                    ((struct std_value){
+                        .type = kStdUInt8Array,
+                        .size = (size_t) result->width * result->height * 4,
+                        .uint8array = result->rgba,
+                    })
+                )
+            );
+            if (ok != 0) {
+                LOG_ERROR("Couldn't send captured frame. platch_send_success_event_std: %s\n", strerror(ok));
+            }
+
+            schedule_stream_capture((uint64_t) (1000000.0 / plugin.max_fps));
+        } else if (result->error == EAGAIN || result->error == EBUSY) {
+            schedule_stream_capture(RETRY_DELAY_US);
+        } else {
+            LOG_ERROR("Couldn't capture frame for the frames stream: %s\n", strerror(result->error));
+        }
+    } else {
+        // The stream was cancelled or restarted while we were capturing.
+    }
+
+    free(result->rgba);
+    free(result);
+    return ok;
+}
+
+static void on_frame_captured(void *userdata, int error, const struct window_frame_capture *capture) {
+    struct capture_result *result;
+    int ok;
+
+    // We're called on some internal thread here, so just copy the frame
+    // and handle it on the platform thread.
+    result = userdata;
+    result->error = error;
+
+    if (error == 0) {
+        result->width = capture->size.x;
+        result->height = capture->size.y;
+        result->rgba = malloc((size_t) capture->size.x * capture->size.y * 4);
+        if (result->rgba == NULL) {
+            result->error = ENOMEM;
+        } else {
+            result->error = convert_to_rgba(capture, result->rgba);
+        }
+    }
+
+    ok = flutterpi_post_platform_task(on_capture_result, result);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't post captured frame to the platform thread. flutterpi_post_platform_task: %s\n", strerror(ok));
+        free(result->rgba);
+        free(result);
+    }
+}
+
+static int start_capture(const FlutterPlatformMessageResponseHandle *responsehandle, unsigned generation) {
+    struct capture_result *result;
+    int ok;
+
+    result = malloc(sizeof *result);
+    if (result == NULL) {
+        return ENOMEM;
+    }
+
+    result->responsehandle = responsehandle;
+    result->stream_generation = generation;
+    result->error = 0;
+    result->width = 0;
+    result->height = 0;
+    result->rgba = NULL;
+
+    ok = flutterpi_capture_frame(plugin.flutterpi, on_frame_captured, result);
+    if (ok != 0) {
+        free(result);
+        return ok;
+    }
+
+    return 0;
+}
+
+static int start_stream_capture(unsigned generation) {
+    int ok;
+
+    ok = start_capture(NULL, generation);
+    if (ok == EAGAIN || ok == EBUSY) {
+        // No frame yet, or a capture() call is using the capture buffers right now.
+        schedule_stream_capture(RETRY_DELAY_US);
+        return 0;
+    } else if (ok != 0) {
+        LOG_ERROR("Couldn't capture frame for the frames stream: %s\n", strerror(ok));
+        return ok;
+    }
+
+    return 0;
+}
+
+static int on_capture(FlutterPlatformMessageResponseHandle *responsehandle) {
+    int ok;
+
+    ok = start_capture(responsehandle, 0);
+    if (ok == EAGAIN) {
+        return platch_respond_error_std(responsehandle, "no-frame", "There's no frame to capture yet.", &STDNULL);
+    } else if (ok == EBUSY) {
+        return platch_respond_error_std(responsehandle, "busy", "Too many frame captures are in progress.", &STDNULL);
+    } else if (ok != 0) {
+        return platch_respond_native_error_std(responsehandle, ok);
+    }
+
+    // We'll respond when the capture is done.
+    return 0;
+}
+
+static int on_receive(char *channel, struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
+    (void) channel;
+
+    if (streq(object->method, "capture")) {
+        return on_capture(responsehandle);
+    }
+
+    return platch_respond_not_implemented(responsehandle);
+}
+
+static int on_listen(struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
+    struct std_value *arg, *max_fps;
+    int ok;
+
+    arg = &object->std_arg;
+
+    plugin.max_fps = DEFAULT_MAX_FPS;
+    if (STDVALUE_IS_MAP(*arg)) {
+        max_fps = stdmap_get_str(arg, "maxFps");
+        if (max_fps != NULL && STDVALUE_IS_NUM(*max_fps) && STDVALUE_AS_NUM(*max_fps) > 0) {
+            plugin.max_fps = STDVALUE_AS_NUM(*max_fps);
+        } else if (max_fps != NULL && !STDVALUE_IS_NULL(*max_fps)) {
+            return platch_respond_illegal_arg_std(responsehandle, "Expected `arg['maxFps']` to be null or a positive number.");
+        }
+    } else if (!STDVALUE_IS_NULL(*arg)) {
+        return platch_respond_illegal_arg_std(responsehandle, "Expected `arg` to be null or a map.");
+    }
+
+    plugin.streaming = true;
+    plugin.stream_generation++;
+
+    ok = start_stream_capture(plugin.stream_generation);
+    if (ok != 0) {
+        plugin.streaming = false;
+        return platch_respond_native_error_std(responsehandle, ok);
+    }
+
+    return platch_respond_success_std(responsehandle, &STDNULL);
+}
+
+static int on_receive_frames(char *channel, struct platch_obj *object, FlutterPlatformMessageResponseHandle *responsehandle) {
+    (void) channel;
+
+    if (streq(object->method, "listen")) {
+        return on_listen(object, responsehandle);
+    } else if (streq(object->method, "cancel")) {
+        plugin.streaming = false;
+        plugin.stream_generation++;
+        return platch_respond_success_std(responsehandle, &STDNULL);
+    }
+
+    return platch_respond_not_implemented(responsehandle);
+}
+
+enum plugin_init_result screen_capture_init(struct flutterpi *flutterpi, void **userdata_out) {
+    int ok;
+
+    plugin.flutterpi = flutterpi;
+    plugin.streaming = false;
+    plugin.max_fps = DEFAULT_MAX_FPS;
+    plugin.stream_generation = 0;
+
+    ok = plugin_registry_set_receiver_locked(SCREEN_CAPTURE_CHANNEL, kStandardMethodCall, on_receive);
+    if (ok != 0) {
+        return PLUGIN_INIT_RESULT_ERROR;
+    }
+
+    ok = plugin_registry_set_receiver_locked(SCREEN_CAPTURE_FRAMES_CHANNEL, kStandardMethodCall, on_receive_frames);
+    if (ok != 0) {
+        goto fail_remove_receiver;
+    }
+
+    *userdata_out = NULL;
+
+    return PLUGIN_INIT_RESULT_INITIALIZED;
+
+fail_remove_receiver:
+    plugin_registry_remove_receiver_v2_locked(flutterpi_get_plugin_registry(flutterpi), SCREEN_CAPTURE_CHANNEL);
+    return PLUGIN_INIT_RESULT_ERROR;
+}
+
+void screen_capture_deinit(struct flutterpi *flutterpi, void *userdata) {
+    (void) userdata;
+
+    plugin.streaming = false;
+    plugin.stream_generation++;
+
+    plugin_registry_remove_receiver_v2_locked(flutterpi_get_plugin_registry(flutterpi), SCREEN_CAPTURE_FRAMES_CHANNEL);
+    plugin_registry_remove_receiver_v2_locked(flutterpi_get_plugin_registry(flutterpi), SCREEN_CAPTURE_CHANNEL);
+}
+
+FLUTTERPI_PLUGIN("screen capture", screen_capture, screen_capture_init, screen_capture_deinit)
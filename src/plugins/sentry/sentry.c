@@ -1,11 +1,22 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sentry.h>
 
+#include "compositor_ng.h"
 #include "flutter-pi.h"
 #include "platformchannel.h"
 #include "pluginregistry.h"
+#include "util/collection.h"
+#include "util/dynarray.h"
 #include "util/logging.h"
 
 #define SENTRY_PLUGIN_METHOD_CHANNEL "sentry_flutter"
@@ -18,9 +29,84 @@
     } while (0)
 
 struct sentry_plugin {
+    struct flutterpi *flutterpi;
     bool sentry_initialized;
+
+    bool has_frames_begin;
+    struct frame_stats frames_begin;
+
+    int64_t plugin_registration_time_ms;
 };
 
+static uint64_t get_realtime_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    return time.tv_nsec + time.tv_sec * 1000000000ull;
+}
+
+/**
+ * @brief Convert a timestamp of the monotonic clock to milliseconds since the unix epoch.
+ */
+static int64_t monotonic_to_epoch_ms(uint64_t monotonic_ns) {
+    int64_t age_ns = (int64_t) (get_monotonic_time() - monotonic_ns);
+
+    return ((int64_t) get_realtime_ns() - age_ns) / 1000000;
+}
+
+/**
+ * @brief Get the time the process was started, in milliseconds since the unix epoch.
+ *
+ * The start time in /proc/self/stat is in clock ticks since boot, so it's as precise as the
+ * kernel tick rate. (Usually 10ms)
+ */
+static int get_process_start_time_ms(double *start_time_ms_out) {
+    struct timespec boottime;
+    unsigned long long start_ticks;
+    char buf[1024], *fields;
+    ssize_t n_read;
+    long ticks_per_s;
+    int fd, ok;
+
+    fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+
+    n_read = read(fd, buf, sizeof(buf) - 1);
+    ok = errno;
+    close(fd);
+
+    if (n_read < 0) {
+        return ok;
+    }
+
+    buf[n_read] = '\0';
+
+    // The process name (field 2) can contain spaces and parentheses, so start after the last ')'.
+    // The start time is field 22, i.e. the 20th field after the process name.
+    fields = strrchr(buf, ')');
+    if (fields == NULL) {
+        return EINVAL;
+    }
+
+    ok = sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &start_ticks);
+    if (ok != 1) {
+        return EINVAL;
+    }
+
+    ticks_per_s = sysconf(_SC_CLK_TCK);
+    if (ticks_per_s <= 0) {
+        return EINVAL;
+    }
+
+    clock_gettime(CLOCK_BOOTTIME, &boottime);
+
+    double age_ms = boottime.tv_sec * 1000.0 + boottime.tv_nsec / 1000000.0 - start_ticks * 1000.0 / ticks_per_s;
+
+    *start_time_ms_out = get_realtime_ns() / 1000000.0 - age_ms;
+    return 0;
+}
+
 UNUSED static int sentry_configure_bundled_crashpad_handler(sentry_options_t *options) {
     char *path = malloc(PATH_MAX);
     if (path == NULL) {
@@ -152,6 +238,10 @@ static void on_init_native_sdk(
     }
 #endif
 
+    // Envelopes that couldn't be sent (for example because there's no network connection) are kept in the
+    // database directory and sent again on the next start, instead of being dropped.
+    sentry_options_set_cache_keep(options, 1);
+
     ok = sentry_init(options);
     if (ok != 0) {
         platch_respond_error_std(responsehandle, "1", "Failed to initialize Sentry.", &STDNULL);
@@ -168,13 +258,171 @@ static void on_capture_envelope(
     const struct raw_std_value *arg,
     const FlutterPlatformMessageResponseHandle *responsehandle
 ) {
-    (void) plugin;
-    (void) arg;
+    const struct raw_std_value *data;
+    sentry_envelope_t *envelope;
 
-    LOG_SENTRY_DEBUG("captureEnvelope()\n");
+    // Newer versions of sentry_flutter send `[envelope, containsUnhandledException]`,
+    // older ones just the envelope.
+    if (raw_std_value_is_list(arg) && raw_std_list_get_size(arg) >= 1) {
+        data = raw_std_list_get_first_element(arg);
+    } else {
+        data = arg;
+    }
 
-    /// TODO: Implement
-    platch_respond_not_implemented(responsehandle);
+    if (!raw_std_value_is_uint8array(data)) {
+        platch_respond_error_std(
+            responsehandle,
+            "4",
+            "Expected `arg` to be a Uint8List or a List with a Uint8List as the first element.",
+            &STDNULL
+        );
+        return;
+    }
+
+    LOG_SENTRY_DEBUG("captureEnvelope(), size: %zu\n", raw_std_value_get_size(data));
+
+    if (!plugin->sentry_initialized) {
+        platch_respond_error_std(responsehandle, "1", "Sentry is not initialized.", &STDNULL);
+        return;
+    }
+
+    envelope = sentry_envelope_deserialize((const char *) raw_std_value_as_uint8array(data), raw_std_value_get_size(data));
+    if (envelope == NULL) {
+        platch_respond_error_std(responsehandle, "4", "Couldn't parse envelope.", &STDNULL);
+        return;
+    }
+
+    // Takes ownership of the envelope. It's sent by the transport's worker thread,
+    // and kept in the offline cache if that fails.
+    sentry_capture_envelope(envelope);
+
+    platch_respond_success_std(responsehandle, &STDNULL);
+}
+
+struct debug_image {
+    char *code_file;
+    char image_addr[19];
+    int64_t image_size;
+    char debug_id[37];
+    char *code_id;
+
+    struct std_value keys[6];
+    struct std_value values[6];
+};
+
+/**
+ * @brief Find the GNU build id of a loaded ELF module by looking through its PT_NOTE segments.
+ */
+static bool find_build_id(struct dl_phdr_info *info, const uint8_t **build_id_out, size_t *size_out) {
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = info->dlpi_phdr + i;
+        if (phdr->p_type != PT_NOTE) {
+            continue;
+        }
+
+        const uint8_t *note = (const uint8_t *) (info->dlpi_addr + phdr->p_vaddr);
+        const uint8_t *end = note + phdr->p_memsz;
+
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *) note;
+            const uint8_t *name = note + sizeof(ElfW(Nhdr));
+            const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+
+            if (desc + nhdr->n_descsz > end) {
+                break;
+            }
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0 && nhdr->n_descsz > 0) {
+                *build_id_out = desc;
+                *size_out = nhdr->n_descsz;
+                return true;
+            }
+
+            note = desc + ((nhdr->n_descsz + 3) & ~3u);
+        }
+    }
+
+    return false;
+}
+
+static int on_phdr(struct dl_phdr_info *info, size_t size, void *userdata) {
+    struct util_dynarray *images;
+    struct debug_image *image;
+    const uint8_t *build_id;
+    ElfW(Addr) start, end;
+    size_t build_id_size;
+    uint8_t guid[16];
+    char exe[PATH_MAX];
+    const char *name;
+    ssize_t n_read;
+
+    (void) size;
+    images = userdata;
+
+    start = UINTPTR_MAX;
+    end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = info->dlpi_phdr + i;
+        if (phdr->p_type == PT_LOAD) {
+            start = MIN2(start, phdr->p_vaddr);
+            end = MAX2(end, phdr->p_vaddr + phdr->p_memsz);
+        }
+    }
+
+    if (start >= end) {
+        return 0;
+    }
+
+    // The main executable has an empty name.
+    name = info->dlpi_name;
+    if (name == NULL || name[0] == '\0') {
+        n_read = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n_read < 0) {
+            return 0;
+        }
+
+        exe[n_read] = '\0';
+        name = exe;
+    }
+
+    image = util_dynarray_grow(images, struct debug_image, 1);
+    if (image == NULL) {
+        return 1;
+    }
+
+    memset(image, 0, sizeof *image);
+    image->code_file = strdup(name);
+    image->image_size = (int64_t) (end - start);
+    snprintf(image->image_addr, sizeof(image->image_addr), "0x%" PRIxPTR, (uintptr_t) (info->dlpi_addr + start));
+
+    if (find_build_id(info, &build_id, &build_id_size)) {
+        image->code_id = malloc(build_id_size * 2 + 1);
+        if (image->code_id != NULL) {
+            for (size_t i = 0; i < build_id_size; i++) {
+                sprintf(image->code_id + i * 2, "%02x", build_id[i]);
+            }
+        }
+
+        // The debug id is the first 16 bytes of the build id, interpreted as a little-endian GUID.
+        // That's the same thing sentry-native and the symbol server do.
+        memset(guid, 0, sizeof(guid));
+        memcpy(guid, build_id, MIN2(build_id_size, sizeof(guid)));
+
+        // clang-format off
+        snprintf(
+            image->debug_id,
+            sizeof(image->debug_id),
+            "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+            guid[3], guid[2], guid[1], guid[0],
+            guid[5], guid[4],
+            guid[7], guid[6],
+            guid[8], guid[9],
+            guid[10], guid[11], guid[12], guid[13], guid[14], guid[15]
+        );
+        // clang-format on
+    }
+
+    return 0;
 }
 
 static void on_load_image_list(
@@ -182,13 +430,57 @@ static void on_load_image_list(
     const struct raw_std_value *arg,
     const FlutterPlatformMessageResponseHandle *responsehandle
 ) {
+    struct util_dynarray images;
+    struct debug_image *image;
+    struct std_value *list;
+    size_t n_images;
+
     (void) plugin;
     (void) arg;
 
     LOG_SENTRY_DEBUG("loadImageList()\n");
 
-    /// TODO: Implement
-    platch_respond_not_implemented(responsehandle);
+    util_dynarray_init(&images);
+
+    dl_iterate_phdr(on_phdr, &images);
+
+    n_images = util_dynarray_num_elements(&images, struct debug_image);
+
+    list = calloc(n_images ? n_images : 1, sizeof *list);
+    if (list == NULL) {
+        platch_respond_native_error_std(responsehandle, ENOMEM);
+        goto fail_free_images;
+    }
+
+    for (size_t i = 0; i < n_images; i++) {
+        image = util_dynarray_element(&images, struct debug_image, i);
+
+        image->keys[0] = STDSTRING("type");
+        image->values[0] = STDSTRING("elf");
+        image->keys[1] = STDSTRING("code_file");
+        image->values[1] = image->code_file ? STDSTRING(image->code_file) : STDNULL;
+        image->keys[2] = STDSTRING("image_addr");
+        image->values[2] = STDSTRING(image->image_addr);
+        image->keys[3] = STDSTRING("image_size");
+        image->values[3] = STDINT64(image->image_size);
+        image->keys[4] = STDSTRING("debug_id");
+        image->values[4] = image->code_id ? STDSTRING(image->debug_id) : STDNULL;
+        image->keys[5] = STDSTRING("code_id");
+        image->values[5] = image->code_id ? STDSTRING(image->code_id) : STDNULL;
+
+        list[i] = (struct std_value){ .type = kStdMap, .size = 6, .keys = image->keys, .values = image->values };
+    }
+
+    platch_respond_success_std(responsehandle, &(struct std_value){ .type = kStdList, .size = n_images, .list = list });
+
+    free(list);
+
+fail_free_images:
+    util_dynarray_foreach(&images, struct debug_image, image) {
+        free(image->code_file);
+        free(image->code_id);
+    }
+    util_dynarray_fini(&images);
 }
 
 static void on_close_native_sdk(
@@ -216,8 +508,9 @@ static void on_fetch_native_app_start(
     const struct raw_std_value *arg,
     const FlutterPlatformMessageResponseHandle *responsehandle
 ) {
-    (void) plugin;
-    (void) arg;
+    struct frame_stats stats;
+    double app_start_time;
+    int ok;
 
     if (!raw_std_value_is_null(arg)) {
         platch_respond_error_std(responsehandle, "4", "Expected `arg` to be null.", &STDNULL);
@@ -226,15 +519,43 @@ static void on_fetch_native_app_start(
 
     LOG_SENTRY_DEBUG("fetchNativeAppStart()\n");
 
-    // clang-format off
-    platch_respond_success_std(
-        responsehandle,
-        &STDMAP2(
-            STDSTRING("appStartTime"), STDFLOAT64(0.0),
-            STDSTRING("isColdStart"), STDBOOL(true)
-        )
-    );
-    // clang-format on
+    ok = get_process_start_time_ms(&app_start_time);
+    if (ok != 0) {
+        platch_respond_native_error_std(responsehandle, ok);
+        return;
+    }
+
+    flutterpi_get_frame_stats(plugin->flutterpi, &stats);
+
+    if (stats.has_first_frame) {
+        // clang-format off
+        platch_respond_success_std(
+            responsehandle,
+            &STDMAP4(
+                STDSTRING("appStartTime"), STDFLOAT64(app_start_time),
+                STDSTRING("isColdStart"), STDBOOL(true),
+                STDSTRING("pluginRegistrationTime"), STDINT64(plugin->plugin_registration_time_ms),
+                STDSTRING("nativeSpanTimes"), STDMAP1(
+                    STDSTRING("process start to first frame"), STDMAP2(
+                        STDSTRING("startTimestampMsSinceEpoch"), STDINT64((int64_t) app_start_time),
+                        STDSTRING("stopTimestampMsSinceEpoch"), STDINT64(monotonic_to_epoch_ms(stats.first_frame_ns))
+                    )
+                )
+            )
+        );
+        // clang-format on
+    } else {
+        // clang-format off
+        platch_respond_success_std(
+            responsehandle,
+            &STDMAP3(
+                STDSTRING("appStartTime"), STDFLOAT64(app_start_time),
+                STDSTRING("isColdStart"), STDBOOL(true),
+                STDSTRING("pluginRegistrationTime"), STDINT64(plugin->plugin_registration_time_ms)
+            )
+        );
+        // clang-format on
+    }
 }
 
 static void on_begin_native_frames(
@@ -242,9 +563,6 @@ static void on_begin_native_frames(
     const struct raw_std_value *arg,
     const FlutterPlatformMessageResponseHandle *responsehandle
 ) {
-    (void) plugin;
-    (void) arg;
-
     if (!raw_std_value_is_null(arg)) {
         platch_respond_error_std(responsehandle, "4", "Expected `arg` to be null.", &STDNULL);
         return;
@@ -252,8 +570,10 @@ static void on_begin_native_frames(
 
     LOG_SENTRY_DEBUG("beginNativeFrames()\n");
 
-    /// TODO: Implement
-    platch_respond_not_implemented(responsehandle);
+    flutterpi_get_frame_stats(plugin->flutterpi, &plugin->frames_begin);
+    plugin->has_frames_begin = true;
+
+    platch_respond_success_std(responsehandle, &STDNULL);
 }
 
 static void on_end_native_frames(
@@ -261,8 +581,7 @@ static void on_end_native_frames(
     const struct raw_std_value *arg,
     const FlutterPlatformMessageResponseHandle *responsehandle
 ) {
-    (void) plugin;
-    (void) arg;
+    struct frame_stats stats;
 
     if (!raw_std_value_is_map(arg)) {
         platch_respond_error_std(responsehandle, "4", "Expected `arg` to be a Map.", &STDNULL);
@@ -277,13 +596,23 @@ static void on_end_native_frames(
 
     LOG_SENTRY_DEBUG("endNativeFrames(), id: %.*s\n", (int) raw_std_string_get_length(id), raw_std_string_get_nonzero_terminated(id));
 
+    if (!plugin->has_frames_begin) {
+        platch_respond_success_std(responsehandle, &STDNULL);
+        return;
+    }
+
+    flutterpi_get_frame_stats(plugin->flutterpi, &stats);
+    plugin->has_frames_begin = false;
+
+    // We only know how long frames took to rasterize, so that's what slow and frozen frames are based on.
+
     // clang-format off
     platch_respond_success_std(
         responsehandle,
         &STDMAP3(
-            STDSTRING("totalFrames"), STDINT64(0),
-            STDSTRING("slowFrames"), STDINT64(0),
-            STDSTRING("frozenFrames"), STDINT64(0)
+            STDSTRING("totalFrames"), STDINT64(stats.total_frames - plugin->frames_begin.total_frames),
+            STDSTRING("slowFrames"), STDINT64(stats.slow_raster_frames - plugin->frames_begin.slow_raster_frames),
+            STDSTRING("frozenFrames"), STDINT64(stats.frozen_raster_frames - plugin->frames_begin.frozen_raster_frames)
         )
     );
     // clang-format on
@@ -755,7 +1084,7 @@ static void on_method_call(void *userdata, const FlutterPlatformMessage *message
     }
 }
 
-enum plugin_init_result sentry_plugin_deinit(struct flutterpi *flutterpi, void **userdata_out) {
+enum plugin_init_result sentry_plugin_init(struct flutterpi *flutterpi, void **userdata_out) {
     struct sentry_plugin *plugin;
     int ok;
 
@@ -764,6 +1093,11 @@ enum plugin_init_result sentry_plugin_deinit(struct flutterpi *flutterpi, void *
         return PLUGIN_INIT_RESULT_ERROR;
     }
 
+    plugin->flutterpi = flutterpi;
+    plugin->sentry_initialized = false;
+    plugin->has_frames_begin = false;
+    plugin->plugin_registration_time_ms = get_realtime_ns() / 1000000;
+
     ok = plugin_registry_set_receiver_v2_locked(
         flutterpi_get_plugin_registry(flutterpi),
         SENTRY_PLUGIN_METHOD_CHANNEL,
@@ -780,7 +1114,7 @@ enum plugin_init_result sentry_plugin_deinit(struct flutterpi *flutterpi, void *
     return PLUGIN_INIT_RESULT_INITIALIZED;
 }
 
-void sentry_plugin_init(struct flutterpi *flutterpi, void *userdata) {
+void sentry_plugin_deinit(struct flutterpi *flutterpi, void *userdata) {
     struct sentry_plugin *plugin;
 
     ASSERT_NOT_NULL(userdata);
@@ -794,4 +1128,4 @@ void sentry_plugin_init(struct flutterpi *flutterpi, void *userdata) {
     free(plugin);
 }
 
-FLUTTERPI_PLUGIN("sentry", sentry_plugin_init, sentry_plugin_deinit, NULL);
+FLUTTERPI_PLUGIN("sentry", sentry, sentry_plugin_init, sentry_plugin_deinit)
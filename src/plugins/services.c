@@ -2,20 +2,61 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 
 #include "cursor.h"
 #include "flutter-pi.h"
 #include "pluginregistry.h"
 #include "util/asserts.h"
+#include "util/list.h"
 #include "util/logging.h"
 
+struct custom_cursor {
+    struct list_head entry;
+    char *name;
+    struct pointer_icon *icon;
+};
+
 struct plugin {
     struct flutterpi *flutterpi;
     char label[256];
     uint32_t primary_color;  // ARGB8888 (blue is the lowest byte)
     char isolate_id[32];
+
+    /**
+     * @brief The orientation we were started with. Used when flutter resets the preferred orientations.
+     */
+    enum device_orientation default_orientation;
+
+    /**
+     * @brief The custom cursors created using createCustomCursor, list of struct custom_cursor.
+     */
+    struct list_head custom_cursors;
+
+    /**
+     * @brief The custom cursor that's currently shown, or NULL if it's a system cursor.
+     *
+     * We need to switch away from a custom cursor before we can destroy it.
+     */
+    struct custom_cursor *active_custom_cursor;
 };
 
+static bool orientation_from_string(const char *str, enum device_orientation *orientation_out) {
+    if (streq(str, "DeviceOrientation.portraitUp")) {
+        *orientation_out = kPortraitUp;
+    } else if (streq(str, "DeviceOrientation.landscapeLeft")) {
+        *orientation_out = kLandscapeLeft;
+    } else if (streq(str, "DeviceOrientation.portraitDown")) {
+        *orientation_out = kPortraitDown;
+    } else if (streq(str, "DeviceOrientation.landscapeRight")) {
+        *orientation_out = kLandscapeRight;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 static void on_receive_navigation(ASSERTED void *userdata, const FlutterPlatformMessage *message) {
     ASSUME(userdata);
     ASSUME(message);
@@ -89,78 +130,58 @@ static void on_receive_platform(void *userdata, const FlutterPlatformMessage *me
          *  }
          */
 
-        /// TODO: Implement
-
-        /*
-        value = &object->json_arg;
+        bool preferred_orientations[kLandscapeRight + 1] = { 0 };
+        enum device_orientation current, orientation;
+        bool has_preferred;
 
-        if ((value->type != kJsonArray) || (value->size == 0)) {
-            return platch_respond_illegal_arg_json(
-                responsehandle,
-                "Expected `arg` to be an array with minimum size 1."
-            );
+        if (arg->type != kJsonArray) {
+            platch_free_obj(&object);
+            platch_respond_illegal_arg_json(message->response_handle, "Expected `arg` to be an array.");
+            return;
         }
 
-        bool preferred_orientations[kLandscapeRight+1] = {0};
+        current = flutterpi_get_orientation(plugin->flutterpi);
 
-        for (int i = 0; i < value->size; i++) {
-
-            if (value->array[i].type != kJsonString) {
-                return platch_respond_illegal_arg_json(
-                    responsehandle,
-                    "Expected `arg` to to only contain strings."
+        has_preferred = false;
+        for (size_t i = 0; i < arg->size; i++) {
+            if (arg->array[i].type != kJsonString || !orientation_from_string(arg->array[i].string_value, &orientation)) {
+                platch_free_obj(&object);
+                platch_respond_illegal_arg_json(
+                    message->response_handle,
+                    "Expected `arg` to only contain stringifications of the `DeviceOrientation` enum."
                 );
+                return;
             }
 
-            enum device_orientation o = ORIENTATION_FROM_STRING(value->array[i].string_value);
-
-            if (o == -1) {
-                return platch_respond_illegal_arg_json(
-                    responsehandle,
-                    "Expected `arg` to only contain stringifications of the "
-                    "`DeviceOrientation` enum."
-                );
-            }
+            preferred_orientations[orientation] = true;
+            has_preferred = true;
+        }
 
-            // if the list contains the current orientation, we just return and don't change the current orientation at all.
-            if (o == flutterpi.view.orientation) {
-                return platch_respond_success_json(responsehandle, NULL);
+        if (!has_preferred) {
+            // An empty list means the app doesn't care anymore, so we go back to the
+            // orientation we were started with.
+            orientation = plugin->default_orientation;
+        } else if (preferred_orientations[current]) {
+            // if the list contains the current orientation, we don't change the orientation at all.
+            orientation = current;
+        } else {
+            // otherwise we select the first orientation in the order of the enum that's preferred by flutter.
+            orientation = kPortraitUp;
+            while (!preferred_orientations[orientation]) {
+                orientation = ORIENTATION_ROTATE_CW(orientation);
             }
-
-            preferred_orientations[o] = true;
         }
 
-        // if we have to change the orientation, we go through the orientation enum in the defined order and
-        // select the first one that is preferred by flutter.
-        for (int i = kPortraitUp; i <= kLandscapeRight; i++) {
-            if (preferred_orientations[i]) {
-                FlutterEngineResult result;
-
-                flutterpi_fill_view_properties(true, i, false, 0);
-
-                compositor_apply_cursor_state(false, flutterpi.view.rotation, flutterpi.display.pixel_ratio);
-
-                // send updated window metrics to flutter
-                result = flutterpi.flutter.libflutter_engine.FlutterEngineSendWindowMetricsEvent(flutterpi.flutter.engine, &(const FlutterWindowMetricsEvent) {
-                    .struct_size = sizeof(FlutterWindowMetricsEvent),
-                    .width = flutterpi.view.width,
-                    .height = flutterpi.view.height,
-                    .pixel_ratio = flutterpi.display.pixel_ratio
-                });
-                if (result != kSuccess) {
-                    fprintf(stderr, "[services] Could not send updated window metrics to flutter. FlutterEngineSendWindowMetricsEvent: %s\n", FLUTTER_RESULT_TO_STRING(result));
-                    return platch_respond_error_json(responsehandle, "engine-error", "Could not send updated window metrics to flutter", NULL);
-                }
+        platch_free_obj(&object);
 
-                return platch_respond_success_json(responsehandle, NULL);
-            }
+        ok = flutterpi_set_orientation(plugin->flutterpi, orientation);
+        if (ok != 0) {
+            platch_respond_native_error_json(message->response_handle, ok);
+            return;
         }
 
-        return platch_respond_illegal_arg_json(
-            responsehandle,
-            "Expected `arg` to contain at least one element."
-        );
-        */
+        platch_respond_success_json(message->response_handle, NULL);
+        return;
     } else if (streq(object.method, "SystemChrome.setApplicationSwitcherDescription")) {
         /*
          *  SystemChrome.setApplicationSwitcherDescription(Map description)
@@ -239,6 +260,221 @@ static void on_receive_platform_views(ASSERTED void *userdata, const FlutterPlat
     platch_respond_not_implemented(message->response_handle);
 }
 
+static struct custom_cursor *find_custom_cursor(struct plugin *plugin, const struct raw_std_value *name) {
+    list_for_each_entry(struct custom_cursor, cursor, &plugin->custom_cursors, entry) {
+        if (raw_std_string_equals(name, cursor->name)) {
+            return cursor;
+        }
+    }
+
+    return NULL;
+}
+
+static void destroy_custom_cursor(struct plugin *plugin, struct custom_cursor *cursor) {
+    if (plugin->active_custom_cursor == cursor) {
+        // The window might still be showing this icon.
+        flutterpi_set_pointer_kind(plugin->flutterpi, POINTER_KIND_BASIC);
+        plugin->active_custom_cursor = NULL;
+    }
+
+    list_del(&cursor->entry);
+    pointer_icon_destroy(cursor->icon);
+    free(cursor->name);
+    free(cursor);
+}
+
+static bool get_number_arg(const struct raw_std_value *arg, const char *key, double *value_out) {
+    const struct raw_std_value *value;
+
+    value = raw_std_map_find_str(arg, key);
+    if (value == NULL) {
+        return false;
+    } else if (raw_std_value_is_int(value)) {
+        *value_out = raw_std_value_as_int(value);
+        return true;
+    } else if (raw_std_value_is_float64(value)) {
+        *value_out = raw_std_value_as_float64(value);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/**
+ * @brief Create a custom cursor from an image.
+ *
+ * The argument is a map with the cursor `name`, the image `width` and `height`, the hotspot position
+ * `hotX` and `hotY` and the RGBA pixels of the image (with premultiplied alpha, like ImageByteFormat.rawRgba)
+ * as a Uint8List `buffer`. An existing cursor with the same name is replaced.
+ *
+ * Cursors bigger than what the cursor plane supports are still accepted here, since that depends on the
+ * display. Setting one will show the default cursor instead.
+ */
+static void on_create_custom_cursor(
+    struct plugin *plugin,
+    const struct raw_std_value *arg,
+    const FlutterPlatformMessageResponseHandle *handle
+) {
+    const struct raw_std_value *name, *buffer;
+    struct custom_cursor *cursor;
+    struct pointer_icon *icon;
+    double width, height, hot_x, hot_y;
+    uint32_t *pixels;
+    const uint8_t *rgba;
+    int w, h;
+
+    if (!raw_std_value_is_map(arg)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg` to be a Map.");
+        return;
+    }
+
+    name = raw_std_map_find_str(arg, "name");
+    if (name == NULL || !raw_std_value_is_string(name)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['name']` to be a string.");
+        return;
+    }
+
+    if (!get_number_arg(arg, "width", &width) || !get_number_arg(arg, "height", &height)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['width']` and `arg['height']` to be numbers.");
+        return;
+    }
+
+    if (!get_number_arg(arg, "hotX", &hot_x) || !get_number_arg(arg, "hotY", &hot_y)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['hotX']` and `arg['hotY']` to be numbers.");
+        return;
+    }
+
+    w = (int) width;
+    h = (int) height;
+    if (w <= 0 || h <= 0 || w > 1024 || h > 1024) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['width']` and `arg['height']` to be between 1 and 1024.");
+        return;
+    }
+
+    // The hotspot is the pixel that's pointing at something, so it needs to be inside the image.
+    if (!(hot_x >= 0 && hot_x <= w - 1 && hot_y >= 0 && hot_y <= h - 1)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['hotX']` and `arg['hotY']` to be inside the cursor image.");
+        return;
+    }
+
+    buffer = raw_std_map_find_str(arg, "buffer");
+    if (buffer == NULL || !raw_std_value_is_uint8array(buffer) || raw_std_value_get_size(buffer) != (size_t) w * h * 4) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['buffer']` to be a Uint8List containing width * height RGBA pixels.");
+        return;
+    }
+
+    pixels = malloc(w * h * sizeof *pixels);
+    if (pixels == NULL) {
+        platch_respond_native_error_std(handle, ENOMEM);
+        return;
+    }
+
+    // Convert from RGBA byte order to ARGB8888, which is what KMS wants.
+    rgba = raw_std_value_as_uint8array(buffer);
+    for (int i = 0; i < w * h; i++) {
+        const uint8_t *p = rgba + i * 4;
+        pixels[i] = ((uint32_t) p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2];
+    }
+
+    icon = pointer_icon_new(VEC2I(w, h), VEC2I((int) round(hot_x), (int) round(hot_y)), 1.0, pixels);
+
+    free(pixels);
+
+    if (icon == NULL) {
+        platch_respond_native_error_std(handle, ENOMEM);
+        return;
+    }
+
+    cursor = find_custom_cursor(plugin, name);
+    if (cursor != NULL) {
+        destroy_custom_cursor(plugin, cursor);
+    }
+
+    cursor = malloc(sizeof *cursor);
+    if (cursor == NULL) {
+        pointer_icon_destroy(icon);
+        platch_respond_native_error_std(handle, ENOMEM);
+        return;
+    }
+
+    cursor->name = raw_std_string_dup(name);
+    if (cursor->name == NULL) {
+        free(cursor);
+        pointer_icon_destroy(icon);
+        platch_respond_native_error_std(handle, ENOMEM);
+        return;
+    }
+
+    cursor->icon = icon;
+    list_addtail(&cursor->entry, &plugin->custom_cursors);
+
+    platch_respond_success_std(handle, &STDSTRING(cursor->name));
+}
+
+static void on_set_custom_cursor(
+    struct plugin *plugin,
+    const struct raw_std_value *arg,
+    const FlutterPlatformMessageResponseHandle *handle
+) {
+    const struct raw_std_value *name;
+    struct custom_cursor *cursor;
+    int ok;
+
+    if (!raw_std_value_is_map(arg)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg` to be a Map.");
+        return;
+    }
+
+    name = raw_std_map_find_str(arg, "name");
+    if (name == NULL || !raw_std_value_is_string(name)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['name']` to be a string.");
+        return;
+    }
+
+    cursor = find_custom_cursor(plugin, name);
+    if (cursor == NULL) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['name']` to be the name of a cursor created with createCustomCursor.");
+        return;
+    }
+
+    ok = flutterpi_set_pointer_icon(plugin->flutterpi, cursor->icon);
+    if (ok != 0) {
+        platch_respond_native_error_std(handle, ok);
+        return;
+    }
+
+    plugin->active_custom_cursor = cursor;
+
+    platch_respond_success_std(handle, &STDNULL);
+}
+
+static void on_delete_custom_cursor(
+    struct plugin *plugin,
+    const struct raw_std_value *arg,
+    const FlutterPlatformMessageResponseHandle *handle
+) {
+    const struct raw_std_value *name;
+    struct custom_cursor *cursor;
+
+    if (!raw_std_value_is_map(arg)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg` to be a Map.");
+        return;
+    }
+
+    name = raw_std_map_find_str(arg, "name");
+    if (name == NULL || !raw_std_value_is_string(name)) {
+        platch_respond_illegal_arg_std(handle, "Expected `arg['name']` to be a string.");
+        return;
+    }
+
+    cursor = find_custom_cursor(plugin, name);
+    if (cursor != NULL) {
+        destroy_custom_cursor(plugin, cursor);
+    }
+
+    platch_respond_success_std(handle, &STDNULL);
+}
+
 static void on_receive_mouse_cursor(ASSERTED void *userdata, const FlutterPlatformMessage *message) {
     const struct raw_std_value *method_call;
     const struct raw_std_value *arg;
@@ -374,8 +610,15 @@ static void on_receive_mouse_cursor(ASSERTED void *userdata, const FlutterPlatfo
         }
 
         flutterpi_set_pointer_kind(plugin->flutterpi, kind);
+        plugin->active_custom_cursor = NULL;
 
         platch_respond_success_std(message->response_handle, &STDNULL);
+    } else if (raw_std_method_call_is_method(method_call, "createCustomCursor")) {
+        on_create_custom_cursor(plugin, arg, message->response_handle);
+    } else if (raw_std_method_call_is_method(method_call, "setCustomCursor")) {
+        on_set_custom_cursor(plugin, arg, message->response_handle);
+    } else if (raw_std_method_call_is_method(method_call, "deleteCustomCursor")) {
+        on_delete_custom_cursor(plugin, arg, message->response_handle);
     } else {
         platch_respond_not_implemented(message->response_handle);
     }
@@ -396,6 +639,9 @@ enum plugin_init_result services_init(struct flutterpi *flutterpi, void **userda
     }
 
     plugin->flutterpi = flutterpi;
+    plugin->default_orientation = flutterpi_get_orientation(flutterpi);
+    list_inithead(&plugin->custom_cursors);
+    plugin->active_custom_cursor = NULL;
 
     ok = plugin_registry_set_receiver_v2_locked(registry, FLUTTER_NAVIGATION_CHANNEL, on_receive_navigation, plugin);
     if (ok != 0) {
@@ -481,6 +727,11 @@ void services_deinit(struct flutterpi *flutterpi, void *userdata) {
     plugin_registry_remove_receiver_v2_locked(registry, FLUTTER_ACCESSIBILITY_CHANNEL);
     plugin_registry_remove_receiver_v2_locked(registry, FLUTTER_PLATFORM_VIEWS_CHANNEL);
     plugin_registry_remove_receiver_v2_locked(registry, FLUTTER_MOUSECURSOR_CHANNEL);
+
+    list_for_each_entry_safe(struct custom_cursor, cursor, &plugin->custom_cursors, entry) {
+        destroy_custom_cursor(plugin, cursor);
+    }
+
     free(plugin);
 }
 
@@ -13,13 +13,19 @@
 
 #include "surface.h"
 
+#include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <gbm.h>
 
 #include "compositor_ng.h"
+#include "fbdev.h"
 #include "surface_private.h"
 #include "tracer.h"
 #include "util/collection.h"
+#include "util/logging.h"
 
 void surface_deinit(struct surface *s);
 
@@ -45,6 +51,7 @@ int surface_init(struct surface *s, struct tracer *tracer) {
     s->revision = 1;
     s->present_kms = NULL;
     s->present_fbdev = NULL;
+    s->snapshot = NULL;
     s->deinit = surface_deinit;
     return 0;
 }
@@ -116,3 +123,90 @@ int surface_present_fbdev(struct surface *s, const struct fl_layer_props *props,
 
     return ok;
 }
+
+int surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out) {
+    int ok;
+
+    ASSERT_NOT_NULL(s);
+    ASSERT_NOT_NULL(snapshot_out);
+
+    if (s->snapshot == NULL) {
+        return EOPNOTSUPP;
+    }
+
+    TRACER_BEGIN(s->tracer, "surface_snapshot");
+    ok = s->snapshot(s, snapshot_out);
+    TRACER_END(s->tracer, "surface_snapshot");
+
+    return ok;
+}
+
+int surface_snapshot_present_fbdev(
+    const struct surface_snapshot *snapshot,
+    const struct fl_layer_props *props,
+    struct fbdev_commit_builder *builder
+) {
+    uint32_t stride;
+    void *map, *map_data;
+    int ok;
+
+    ASSERT_NOT_NULL(snapshot);
+    ASSERT_NOT_NULL(props);
+    ASSERT_NOT_NULL(builder);
+
+    if (snapshot->bo == NULL) {
+        return 0;
+    }
+
+    /// TODO: Implement non axis-aligned fl_layer_props
+    ASSERT_MSG(props->is_aa_rect, "only axis aligned view geometry is supported right now");
+
+    map_data = NULL;
+    map = gbm_bo_map(
+        snapshot->bo,
+        0,
+        0,
+        gbm_bo_get_width(snapshot->bo),
+        gbm_bo_get_height(snapshot->bo),
+        GBM_BO_TRANSFER_READ,
+        &stride,
+        &map_data
+    );
+    if (map == NULL) {
+        ok = errno ? errno : EIO;
+        LOG_ERROR("Couldn't map GBM buffer for presenting it on a fbdev. gbm_bo_map: %s\n", strerror(ok));
+        return ok;
+    }
+
+    ok = fbdev_commit_builder_push_layer(
+        builder,
+        &(const struct fbdev_layer){
+            .map = map,
+            .stride = stride,
+            .format = snapshot->format,
+            .src_w = gbm_bo_get_width(snapshot->bo),
+            .src_h = gbm_bo_get_height(snapshot->bo),
+            .dst_x = (int) props->aa_rect.offset.x,
+            .dst_y = (int) props->aa_rect.offset.y,
+            .dst_w = (int) props->aa_rect.size.x,
+            .dst_h = (int) props->aa_rect.size.y,
+            .opacity = props->opacity,
+        }
+    );
+
+    gbm_bo_unmap(snapshot->bo, map_data);
+
+    return ok;
+}
+
+void surface_snapshot_release(struct surface_snapshot *snapshot) {
+    ASSERT_NOT_NULL(snapshot);
+
+    if (snapshot->release != NULL) {
+        snapshot->release(snapshot->release_userdata);
+    }
+
+    snapshot->bo = NULL;
+    snapshot->release = NULL;
+    snapshot->release_userdata = NULL;
+}
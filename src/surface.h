@@ -10,6 +10,7 @@
 #ifndef _FLUTTERPI_SRC_SURFACE_H
 #define _FLUTTERPI_SRC_SURFACE_H
 
+#include "pixel_format.h"
 #include "util/collection.h"
 #include "util/lock_ops.h"
 #include "util/refcounting.h"
@@ -19,6 +20,7 @@ struct compositor;
 struct fl_layer_props;
 struct kms_req_builder;
 struct fbdev_commit_builder;
+struct gbm_bo;
 
 #define CAST_SURFACE_UNCHECKED(ptr) ((struct surface *) (ptr))
 #ifdef DEBUG
@@ -44,4 +46,40 @@ int surface_present_kms(struct surface *s, const struct fl_layer_props *props, s
 
 int surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder);
 
+/**
+ * @brief The buffer a surface is currently presenting, kept locked so it can be read back later,
+ * even if the surface has presented a newer frame in the meantime.
+ */
+struct surface_snapshot {
+    /**
+     * @brief The buffer, or NULL if the surface doesn't show anything.
+     */
+    struct gbm_bo *bo;
+    enum pixfmt format;
+
+    void (*release)(void *userdata);
+    void *release_userdata;
+};
+
+/**
+ * @brief Take a snapshot of the frame the surface is currently presenting.
+ *
+ * @returns Zero on success, EOPNOTSUPP if this kind of surface can't be snapshotted,
+ *          EAGAIN if the surface didn't present anything yet.
+ */
+int surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out);
+
+/**
+ * @brief Like @ref surface_present_fbdev, but presents the snapshotted frame.
+ *
+ * Can be called on any thread.
+ */
+int surface_snapshot_present_fbdev(
+    const struct surface_snapshot *snapshot,
+    const struct fl_layer_props *props,
+    struct fbdev_commit_builder *builder
+);
+
+void surface_snapshot_release(struct surface_snapshot *snapshot);
+
 #endif  // _FLUTTERPI_SRC_SURFACE_H
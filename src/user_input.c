@@ -7,6 +7,7 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -24,6 +25,33 @@
 #define LIBINPUT_VER(major, minor, patch) ((((major) & 0xFF) << 16) | (((minor) & 0xFF) << 8) | ((patch) & 0xFF))
 #define THIS_LIBINPUT_VER LIBINPUT_VER(LIBINPUT_VERSION_MAJOR, LIBINPUT_VERSION_MINOR, LIBINPUT_VERSION_PATCH)
 
+/**
+ * @brief State of a single multitouch slot.
+ *
+ * libinput sends the down / motion / up events of all slots that changed, followed by
+ * a frame event. We collect the changes here and only send them to flutter when
+ * the frame event arrives, so flutter always sees a consistent multitouch state.
+ */
+struct touch_slot {
+    /**
+     * @brief The last position sent to flutter, in view coordinates.
+     */
+    struct vec2f position;
+
+    /**
+     * @brief True if flutter thinks this slot is touching the screen right now.
+     */
+    bool is_down;
+
+    /**
+     * @brief Changes since the last frame that weren't sent to flutter yet.
+     */
+    struct vec2f pending_position;
+    bool pending_down;
+    bool pending_motion;
+    bool pending_up;
+};
+
 struct input_device_data {
     struct keyboard_state *keyboard_state;
     int64_t buttons;
@@ -44,13 +72,41 @@ struct input_device_data {
     bool tip;
 
     /**
-     * @brief The current touch positions for each multitouch slot.
-     *  
+     * @brief Only applies to tablets. The pressed buttons of the tablet tool (including the contact of the tip),
+     * as flutter stylus button flags.
+     */
+    int64_t stylus_buttons;
+
+    /**
+     * @brief Only applies to tablets. The last position of the tablet tool, in view coordinates.
+     */
+    struct vec2f stylus_position;
+
+    /**
+     * @brief Only applies to tablets. Timestamp of the hover event that wasn't sent to flutter yet.
+     *
+     * Tablets report their position at a high rate (200Hz or more). While the tool is hovering,
+     * only the latest position of a batch of libinput events is sent. While it's touching the tablet,
+     * every sample is sent so strokes are as smooth as possible.
+     */
+    uint64_t pending_stylus_hover_timestamp;
+
+    /**
+     * @brief The state of each multitouch slot.
      */
-    struct vec2f *positions;
+    struct touch_slot *slots;
+    int n_slots;
 
     int64_t touch_device_id_offset;
     int64_t stylus_device_id;
+
+    /**
+     * @brief The flutter device id used for pan/zoom events of this trackpad.
+     *
+     * Applies to devices with LIBINPUT_DEVICE_CAP_GESTURE and to devices that
+     * support finger (two-finger or edge) scrolling.
+     */
+    int64_t trackpad_device_id;
 };
 
 struct user_input {
@@ -94,6 +150,52 @@ struct user_input {
      * @brief Number of pointer events currently contained in @ref collected_flutter_pointer_events.
      */
     size_t n_collected_flutter_pointer_events;
+
+    /**
+     * @brief timerfd that expires when the held down key should repeat next.
+     *
+     * libinput doesn't emit key repeat events, so we need to do that ourselves.
+     */
+    int repeat_timer_fd;
+
+    /**
+     * @brief The keyboard and key that's currently repeating, or NULL if no key is repeating.
+     */
+    struct libinput_device *repeat_device;
+    uint16_t repeat_evdev_keycode;
+
+    /**
+     * @brief Timestamp of the initial key press, and the number of repeats emitted since then.
+     * Used to calculate the (ideal) timestamps of the repeat events.
+     */
+    uint64_t repeat_press_timestamp_us;
+    uint64_t repeat_count;
+
+    /**
+     * @brief The trackpad whose pinch, swipe or two-finger scroll gesture is in progress, or NULL.
+     *
+     * The gesture is sent to flutter as pan/zoom events, with the pan, scale and rotation
+     * accumulated since the gesture began.
+     */
+    struct libinput_device *panzoom_device;
+    int64_t panzoom_flutter_device_id;
+    struct vec2f panzoom_pan;
+    double panzoom_scale;
+    double panzoom_rotation;
+
+    /**
+     * @brief Whether the pan/zoom state changed since the last update sent to flutter.
+     *
+     * libinput can report gesture updates a lot more often than flutter renders frames,
+     * so we only send one update per batch of libinput events.
+     */
+    bool has_pending_panzoom_update;
+    uint64_t panzoom_timestamp;
+
+    /**
+     * @brief The tablet that has a coalesced hover event that wasn't sent to flutter yet, or NULL.
+     */
+    struct input_device_data *pending_stylus_hover_device;
 };
 
 static inline FlutterPointerEvent make_touch_event(FlutterPointerPhase phase, size_t timestamp, struct vec2f pos, int32_t device_id) {
@@ -119,7 +221,7 @@ static inline FlutterPointerEvent make_touch_event(FlutterPointerPhase phase, si
     return event;
 }
 
-UNUSED static inline FlutterPointerEvent make_touch_cancel_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
+static inline FlutterPointerEvent make_touch_cancel_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
     return make_touch_event(kCancel, timestamp, pos, device_id);
 }
 
@@ -202,7 +304,15 @@ static inline FlutterPointerEvent make_mouse_hover_event(size_t timestamp, struc
     return make_mouse_event(kHover, timestamp, pos, device_id, kFlutterPointerSignalKindNone, VEC2F(0, 0), buttons);
 }
 
-static inline FlutterPointerEvent make_stylus_event(FlutterPointerPhase phase, size_t timestamp, struct vec2f pos, int32_t device_id) {
+static inline FlutterPointerEvent make_panzoom_event(
+    FlutterPointerPhase phase,
+    size_t timestamp,
+    struct vec2f pos,
+    int32_t device_id,
+    struct vec2f pan,
+    double scale,
+    double rotation
+) {
     FlutterPointerEvent event;
     memset(&event, 0, sizeof(event));
 
@@ -215,8 +325,39 @@ static inline FlutterPointerEvent make_stylus_event(FlutterPointerPhase phase, s
     event.signal_kind = kFlutterPointerSignalKindNone;
     event.scroll_delta_x = 0.0;
     event.scroll_delta_y = 0.0;
-    event.device_kind = kFlutterPointerDeviceKindStylus;
+    event.device_kind = kFlutterPointerDeviceKindTrackpad;
     event.buttons = 0;
+    event.pan_x = pan.x;
+    event.pan_y = pan.y;
+    event.scale = scale;
+    event.rotation = rotation;
+
+    return event;
+}
+
+// Same as the button constants of the flutter framework for styluses.
+// The embedder passes the buttons of stylus events through unchanged.
+#define STYLUS_BUTTON_CONTACT (1 << 0)
+#define STYLUS_BUTTON_PRIMARY (1 << 1)
+#define STYLUS_BUTTON_SECONDARY (1 << 2)
+#define STYLUS_BUTTON_TERTIARY (1 << 3)
+
+static inline FlutterPointerEvent
+make_stylus_event(FlutterPointerPhase phase, size_t timestamp, struct vec2f pos, int32_t device_id, int64_t buttons) {
+    FlutterPointerEvent event;
+    memset(&event, 0, sizeof(event));
+
+    event.struct_size = sizeof(event);
+    event.phase = phase;
+    event.timestamp = timestamp;
+    event.x = pos.x;
+    event.y = pos.y;
+    event.device = device_id;
+    event.signal_kind = kFlutterPointerSignalKindNone;
+    event.scroll_delta_x = 0.0;
+    event.scroll_delta_y = 0.0;
+    event.device_kind = kFlutterPointerDeviceKindStylus;
+    event.buttons = buttons;
     event.pan_x = 0.0;
     event.pan_y = 0.0;
     event.scale = 0.0;
@@ -225,32 +366,32 @@ static inline FlutterPointerEvent make_stylus_event(FlutterPointerPhase phase, s
     return event;
 }
 
-UNUSED static inline FlutterPointerEvent make_stylus_cancel_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kCancel, timestamp, pos, device_id);
+static inline FlutterPointerEvent make_stylus_cancel_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
+    return make_stylus_event(kCancel, timestamp, pos, device_id, 0);
 }
 
-static inline FlutterPointerEvent make_stylus_up_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kUp, timestamp, pos, device_id);
+static inline FlutterPointerEvent make_stylus_up_event(size_t timestamp, struct vec2f pos, int32_t device_id, int64_t buttons) {
+    return make_stylus_event(kUp, timestamp, pos, device_id, buttons);
 }
 
-static inline FlutterPointerEvent make_stylus_down_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kDown, timestamp, pos, device_id);
+static inline FlutterPointerEvent make_stylus_down_event(size_t timestamp, struct vec2f pos, int32_t device_id, int64_t buttons) {
+    return make_stylus_event(kDown, timestamp, pos, device_id, buttons);
 }
 
-static inline FlutterPointerEvent make_stylus_move_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kMove, timestamp, pos, device_id);
+static inline FlutterPointerEvent make_stylus_move_event(size_t timestamp, struct vec2f pos, int32_t device_id, int64_t buttons) {
+    return make_stylus_event(kMove, timestamp, pos, device_id, buttons);
 }
 
-static inline FlutterPointerEvent make_stylus_hover_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kHover, timestamp, pos, device_id);
+static inline FlutterPointerEvent make_stylus_hover_event(size_t timestamp, struct vec2f pos, int32_t device_id, int64_t buttons) {
+    return make_stylus_event(kHover, timestamp, pos, device_id, buttons);
 }
 
 static inline FlutterPointerEvent make_stylus_add_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kAdd, timestamp, pos, device_id);
+    return make_stylus_event(kAdd, timestamp, pos, device_id, 0);
 }
 
 static inline FlutterPointerEvent make_stylus_remove_event(size_t timestamp, struct vec2f pos, int32_t device_id) {
-    return make_stylus_event(kRemove, timestamp, pos, device_id);
+    return make_stylus_event(kRemove, timestamp, pos, device_id, 0);
 }
 
 // libinput interface
@@ -326,6 +467,12 @@ struct user_input *user_input_new(
     kbdcfg = NULL;
 #endif
 
+    input->repeat_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (input->repeat_timer_fd < 0) {
+        LOG_ERROR("Could not create key repeat timer. timerfd_create: %s\n", strerror(errno));
+        goto fail_destroy_kbdcfg;
+    }
+
     input->libinput = libinput;
     input->kbdcfg = kbdcfg;
     input->next_unused_flutter_device_id = 0;
@@ -339,8 +486,28 @@ struct user_input *user_input_new(
 
     input->n_collected_flutter_pointer_events = 0;
 
+    input->repeat_device = NULL;
+    input->repeat_evdev_keycode = 0;
+    input->repeat_press_timestamp_us = 0;
+    input->repeat_count = 0;
+
+    input->panzoom_device = NULL;
+    input->panzoom_flutter_device_id = -1;
+    input->panzoom_pan = VEC2F(0, 0);
+    input->panzoom_scale = 1.0;
+    input->panzoom_rotation = 0.0;
+    input->has_pending_panzoom_update = false;
+    input->panzoom_timestamp = 0;
+
+    input->pending_stylus_hover_device = NULL;
+
     return input;
 
+fail_destroy_kbdcfg:
+    if (kbdcfg != NULL) {
+        keyboard_config_destroy(kbdcfg);
+    }
+
 fail_unref_libinput:
     libinput_unref(libinput);
     goto fail_free_input;
@@ -357,6 +524,8 @@ fail_return_null:
 
 static int on_device_removed(struct user_input *input, struct libinput_event *event, uint64_t timestamp, bool emit_flutter_events);
 
+static void stop_key_repeat(struct user_input *input);
+
 void user_input_destroy(struct user_input *input) {
     enum libinput_event_type event_type;
     struct libinput_event *event;
@@ -387,6 +556,9 @@ void user_input_destroy(struct user_input *input) {
         libinput_event_destroy(event);
     }
 
+    stop_key_repeat(input);
+    close(input->repeat_timer_fd);
+
     if (input->kbdcfg != NULL) {
         keyboard_config_destroy(input->kbdcfg);
     }
@@ -394,6 +566,22 @@ void user_input_destroy(struct user_input *input) {
     free(input);
 }
 
+void user_input_replace_keyboard_config(struct user_input *input, struct keyboard_config *config) {
+    ASSERT_NOT_NULL(input);
+    ASSERT_NOT_NULL(config);
+
+    // The repeat delay and rate might've changed.
+    stop_key_repeat(input);
+
+    if (input->kbdcfg != NULL) {
+        keyboard_config_replace(input->kbdcfg, config);
+    } else {
+        // Keyboards that are already connected don't have a keyboard state,
+        // but the ones connected from now on will.
+        input->kbdcfg = config;
+    }
+}
+
 void user_input_set_transform(
     struct user_input *input,
     const struct mat3f *display_to_view_transform,
@@ -418,9 +606,27 @@ int user_input_get_fd(struct user_input *input) {
     return libinput_get_fd(input->libinput);
 }
 
+int user_input_get_repeat_timer_fd(struct user_input *input) {
+    ASSERT_NOT_NULL(input);
+    return input->repeat_timer_fd;
+}
+
+static int process_libinput_events(struct user_input *input, uint64_t timestamp);
+
+static void flush_pointer_events(struct user_input *input);
+
 void user_input_suspend(struct user_input *input) {
     ASSERT_NOT_NULL(input);
+
+    // We won't get the key release event while we're suspended.
+    stop_key_repeat(input);
     libinput_suspend(input->libinput);
+
+    // libinput_suspend removes all devices. Handle the removal right away,
+    // so touches that are still active get cancelled now and not when we're resumed.
+    libinput_dispatch(input->libinput);
+    process_libinput_events(input, get_monotonic_time() / 1000);
+    flush_pointer_events(input);
 }
 
 int user_input_resume(struct user_input *input) {
@@ -532,7 +738,7 @@ static void maybe_disable_mouse_cursor(struct user_input *input, uint64_t timest
 static int on_device_added(struct user_input *input, struct libinput_event *event, uint64_t timestamp) {
     struct input_device_data *data;
     struct libinput_device *device;
-    struct vec2f *positions;
+    struct touch_slot *slots;
     int64_t device_id;
 
     assert(input != NULL);
@@ -552,7 +758,12 @@ static int on_device_added(struct user_input *input, struct libinput_event *even
     data->timestamp = timestamp;
     data->has_emitted_pointer_events = false;
     data->tip = false;
-    data->positions = NULL;
+    data->stylus_buttons = 0;
+    data->stylus_position = VEC2F(0, 0);
+    data->pending_stylus_hover_timestamp = 0;
+    data->slots = NULL;
+    data->n_slots = 0;
+    data->trackpad_device_id = -1;
 
     libinput_device_set_user_data(device, data);
 
@@ -585,12 +796,13 @@ static int on_device_added(struct user_input *input, struct libinput_event *even
             emit_pointer_event(input, make_touch_add_event(timestamp, VEC2F(0, 0), device_id));
         }
 
-        positions = malloc(n_slots * sizeof(struct vec2f));
-        if (positions == NULL) {
+        slots = calloc(n_slots, sizeof *slots);
+        if (slots == NULL) {
             goto fail_free_data;
         }
 
-        data->positions = positions;
+        data->slots = slots;
+        data->n_slots = n_slots;
     }
 
     if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_KEYBOARD)) {
@@ -603,6 +815,13 @@ static int on_device_added(struct user_input *input, struct libinput_event *even
         }
     }
 
+    if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_GESTURE) ||
+        (libinput_device_config_scroll_get_methods(device) & (LIBINPUT_CONFIG_SCROLL_2FG | LIBINPUT_CONFIG_SCROLL_EDGE))) {
+        // Gestures and finger scrolling are both sent as pan/zoom events.
+        // flutter adds the device itself when the first pan/zoom event arrives.
+        data->trackpad_device_id = input->next_unused_flutter_device_id++;
+    }
+
     if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TABLET_TOOL)) {
         device_id = input->next_unused_flutter_device_id++;
 
@@ -618,6 +837,103 @@ fail_free_data:
     return EINVAL;
 }
 
+static struct vec2f get_cursor_view_position(struct user_input *input) {
+    // since the stored coords are in display, not view coordinates,
+    // we need to transform them again
+    return transform_point(input->display_to_view_transform, VEC2F(input->cursor_x, input->cursor_y));
+}
+
+static void flush_panzoom_update(struct user_input *input) {
+    if (!input->has_pending_panzoom_update) {
+        return;
+    }
+
+    emit_pointer_event(
+        input,
+        make_panzoom_event(
+            kPanZoomUpdate,
+            input->panzoom_timestamp,
+            get_cursor_view_position(input),
+            input->panzoom_flutter_device_id,
+            input->panzoom_pan,
+            input->panzoom_scale,
+            input->panzoom_rotation
+        )
+    );
+
+    input->has_pending_panzoom_update = false;
+}
+
+static void end_panzoom(struct user_input *input, uint64_t timestamp) {
+    if (input->panzoom_device == NULL) {
+        return;
+    }
+
+    flush_panzoom_update(input);
+
+    emit_pointer_event(
+        input,
+        make_panzoom_event(
+            kPanZoomEnd,
+            timestamp,
+            get_cursor_view_position(input),
+            input->panzoom_flutter_device_id,
+            input->panzoom_pan,
+            input->panzoom_scale,
+            input->panzoom_rotation
+        )
+    );
+
+    input->panzoom_device = NULL;
+}
+
+static void begin_panzoom(struct user_input *input, struct libinput_device *device, uint64_t timestamp) {
+    struct input_device_data *data;
+
+    data = libinput_device_get_user_data(device);
+
+    // Some device we didn't expect to send pan/zooms does.
+    if (data->trackpad_device_id < 0) {
+        data->trackpad_device_id = input->next_unused_flutter_device_id++;
+    }
+
+    // There can only be one gesture at a time.
+    end_panzoom(input, timestamp);
+
+    input->panzoom_device = device;
+    input->panzoom_flutter_device_id = data->trackpad_device_id;
+    input->panzoom_pan = VEC2F(0, 0);
+    input->panzoom_scale = 1.0;
+    input->panzoom_rotation = 0.0;
+    input->has_pending_panzoom_update = false;
+    input->panzoom_timestamp = timestamp;
+
+    emit_pointer_event(
+        input,
+        make_panzoom_event(kPanZoomStart, timestamp, get_cursor_view_position(input), data->trackpad_device_id, VEC2F(0, 0), 1.0, 0.0)
+    );
+}
+
+static void cancel_touch(struct user_input *input, struct input_device_data *data, int slot, uint64_t timestamp) {
+    struct touch_slot *state = data->slots + slot;
+
+    // Touches that flutter doesn't know about yet can just be dropped.
+    if (state->is_down) {
+        emit_pointer_event(input, make_touch_cancel_event(timestamp, state->position, data->touch_device_id_offset + slot));
+    }
+
+    state->is_down = false;
+    state->pending_down = false;
+    state->pending_motion = false;
+    state->pending_up = false;
+}
+
+static void cancel_all_touches(struct user_input *input, struct input_device_data *data, uint64_t timestamp) {
+    for (int i = 0; i < data->n_slots; i++) {
+        cancel_touch(input, data, i, timestamp);
+    }
+}
+
 static int on_device_removed(struct user_input *input, struct libinput_event *event, uint64_t timestamp, bool emit_flutter_events) {
     struct input_device_data *data;
     struct libinput_device *device;
@@ -643,6 +959,18 @@ static int on_device_removed(struct user_input *input, struct libinput_event *ev
         return 0;
     }
 
+    if (input->repeat_device == device) {
+        stop_key_repeat(input);
+    }
+
+    if (input->panzoom_device == device) {
+        if (emit_flutter_events) {
+            end_panzoom(input, timestamp);
+        } else {
+            input->panzoom_device = NULL;
+        }
+    }
+
     if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_POINTER)) {
         if (data->has_emitted_pointer_events) {
             input->n_cursor_devices--;
@@ -653,8 +981,10 @@ static int on_device_removed(struct user_input *input, struct libinput_event *ev
     }
 
     if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TOUCH)) {
-        // add all touch slots as individual touch devices to flutter
+        // remove all touch slots from flutter, cancelling the ones that are still touching the screen.
         if (emit_flutter_events) {
+            cancel_all_touches(input, data, timestamp);
+
             for (int i = 0; i < libinput_device_touch_get_touch_count(device); i++) {
                 emit_pointer_event(input, make_touch_remove_event(timestamp, VEC2F(0, 0), data->touch_device_id_offset + i));
             }
@@ -669,12 +999,20 @@ static int on_device_removed(struct user_input *input, struct libinput_event *ev
     }
 
     if (libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_TABLET_TOOL)) {
+        if (input->pending_stylus_hover_device == data) {
+            input->pending_stylus_hover_device = NULL;
+        }
+
+        if (emit_flutter_events && data->tip) {
+            emit_pointer_event(input, make_stylus_cancel_event(timestamp, data->stylus_position, data->stylus_device_id));
+        }
+
         emit_pointer_event(input, make_stylus_remove_event(timestamp, VEC2F(0, 0), data->stylus_device_id));
     }
 
     if (data != NULL) {
-        if (data->positions != NULL) {
-            free(data->positions);
+        if (data->slots != NULL) {
+            free(data->slots);
         }
         free(data);
     }
@@ -684,39 +1022,22 @@ static int on_device_removed(struct user_input *input, struct libinput_event *ev
     return 0;
 }
 
-static int on_key_event(struct user_input *input, struct libinput_event *event) {
-    struct libinput_event_keyboard *key_event;
-    struct input_device_data *data;
-    struct libinput_device *device;
-    enum libinput_key_state key_state;
+static int emit_key_event(
+    struct user_input *input,
+    struct input_device_data *data,
+    uint64_t timestamp_us,
+    uint16_t evdev_keycode,
+    int32_t evdev_value
+) {
     xkb_keysym_t keysym;
     uint32_t codepoint, plain_codepoint;
-    uint16_t evdev_keycode;
     int ok;
 
-    assert(input != NULL);
-    assert(event != NULL);
-
-    key_event = libinput_event_get_keyboard_event(event);
-    device = libinput_event_get_device(event);
-    data = libinput_device_get_user_data(device);
-
-    evdev_keycode = (uint16_t) libinput_event_keyboard_get_key(key_event);
-    key_state = libinput_event_keyboard_get_key_state(key_event);
-
-    LOG_DEBUG("on_key_event\n");
-
-    // If we don't have a keyboard state (for example if we couldn't load /etc/default/keyboard)
-    // we just return here.
-    if (data->keyboard_state == NULL) {
-        return 0;
-    }
-
     // Let the keyboard advance its statemachine.
     // keysym/codepoint are 0 when none were emitted.
     keysym = 0;
     codepoint = 0;
-    ok = keyboard_state_process_key_event(data->keyboard_state, evdev_keycode, (int32_t) key_state, &keysym, &codepoint);
+    ok = keyboard_state_process_key_event(data->keyboard_state, evdev_keycode, evdev_value, &keysym, &codepoint);
     if (ok != 0) {
         return ok;
     }
@@ -732,7 +1053,8 @@ static int on_key_event(struct user_input *input, struct libinput_event *event)
         keysym
     );
 
-    if (input->interface.on_switch_vt != NULL && keysym >= XKB_KEY_XF86Switch_VT_1 && keysym <= XKB_KEY_XF86Switch_VT_12) {
+    if (input->interface.on_switch_vt != NULL && evdev_value == KEY_PRESS && keysym >= XKB_KEY_XF86Switch_VT_1 &&
+        keysym <= XKB_KEY_XF86Switch_VT_12) {
         // "switch VT" keybind
         input->interface.on_switch_vt(input->userdata, keysym - XKB_KEY_XF86Switch_VT_1 + 1);
     }
@@ -770,7 +1092,7 @@ static int on_key_event(struct user_input *input, struct libinput_event *event)
     if (input->interface.on_key_event) {
         input->interface.on_key_event(
             input->userdata,
-            libinput_event_keyboard_get_time_usec(key_event),
+            timestamp_us,
             evdev_keycode + 8u,
             keysym,
             plain_codepoint,
@@ -782,8 +1104,8 @@ static int on_key_event(struct user_input *input, struct libinput_event *event)
                                .__pad = 0,
                                .meta = keyboard_state_is_meta_active(data->keyboard_state) },
             (char *) utf8_character,
-            key_state == LIBINPUT_KEY_STATE_PRESSED,
-            false
+            evdev_value != KEY_RELEASE,
+            evdev_value == KEY_REPEAT
         );
     } else {
         // call the GTK keyevent callback.
@@ -796,7 +1118,7 @@ static int on_key_event(struct user_input *input, struct libinput_event *event)
             keyboard_state_is_shift_active(data->keyboard_state) | (keyboard_state_is_capslock_active(data->keyboard_state) << 1) |
                 (keyboard_state_is_ctrl_active(data->keyboard_state) << 2) | (keyboard_state_is_alt_active(data->keyboard_state) << 3) |
                 (keyboard_state_is_numlock_active(data->keyboard_state) << 4) | (keyboard_state_is_meta_active(data->keyboard_state) << 28),
-            key_state
+            evdev_value != KEY_RELEASE
         );
 
         if (utf8_character[0]) {
@@ -812,6 +1134,100 @@ static int on_key_event(struct user_input *input, struct libinput_event *event)
     return 0;
 }
 
+
+static void stop_key_repeat(struct user_input *input) {
+    if (input->repeat_device == NULL) {
+        return;
+    }
+
+    timerfd_settime(input->repeat_timer_fd, 0, &(struct itimerspec){ 0 }, NULL);
+
+    libinput_device_unref(input->repeat_device);
+    input->repeat_device = NULL;
+}
+
+static void start_key_repeat(struct user_input *input, struct libinput_device *device, uint16_t evdev_keycode, uint64_t timestamp_us) {
+    struct itimerspec spec;
+    uint64_t interval_ns;
+    int ok;
+
+    // Pressing another key stops the previous key from repeating, just like on X11 / wayland.
+    stop_key_repeat(input);
+
+    interval_ns = 1000000000ull / input->kbdcfg->repeat_rate;
+
+    spec.it_value.tv_sec = input->kbdcfg->repeat_delay_ms / 1000;
+    spec.it_value.tv_nsec = (input->kbdcfg->repeat_delay_ms % 1000) * 1000000ull;
+    spec.it_interval.tv_sec = interval_ns / 1000000000ull;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000ull;
+
+    // A zero it_value would disarm the timer.
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+
+    ok = timerfd_settime(input->repeat_timer_fd, 0, &spec, NULL);
+    if (ok < 0) {
+        LOG_ERROR("Could not arm key repeat timer. timerfd_settime: %s\n", strerror(errno));
+        return;
+    }
+
+    input->repeat_device = libinput_device_ref(device);
+    input->repeat_evdev_keycode = evdev_keycode;
+    input->repeat_press_timestamp_us = timestamp_us;
+    input->repeat_count = 0;
+}
+
+static int on_key_event(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_keyboard *key_event;
+    struct input_device_data *data;
+    struct libinput_device *device;
+    enum libinput_key_state key_state;
+    struct xkb_keymap *keymap;
+    uint64_t timestamp_us;
+    uint16_t evdev_keycode;
+    int ok;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    key_event = libinput_event_get_keyboard_event(event);
+    device = libinput_event_get_device(event);
+    data = libinput_device_get_user_data(device);
+
+    evdev_keycode = (uint16_t) libinput_event_keyboard_get_key(key_event);
+    key_state = libinput_event_keyboard_get_key_state(key_event);
+    timestamp_us = libinput_event_keyboard_get_time_usec(key_event);
+
+    LOG_DEBUG("on_key_event\n");
+
+    // If we don't have a keyboard state (for example if we couldn't load /etc/default/keyboard)
+    // we just return here.
+    if (data->keyboard_state == NULL) {
+        return 0;
+    }
+
+    // Switch to the new keymap before looking at the key, if it was replaced since the last key event.
+    keyboard_state_sync_config(data->keyboard_state);
+
+    if (key_state == LIBINPUT_KEY_STATE_PRESSED) {
+        // Modifier keys (and some others) don't repeat according to the keymap.
+        keymap = xkb_state_get_keymap(data->keyboard_state->state);
+        if (input->kbdcfg->repeat_rate > 0 && xkb_keymap_key_repeats(keymap, evdev_keycode + 8)) {
+            start_key_repeat(input, device, evdev_keycode, timestamp_us);
+        }
+    } else if (input->repeat_device == device && input->repeat_evdev_keycode == evdev_keycode) {
+        stop_key_repeat(input);
+    }
+
+    ok = emit_key_event(input, data, timestamp_us, evdev_keycode, key_state == LIBINPUT_KEY_STATE_PRESSED ? KEY_PRESS : KEY_RELEASE);
+    if (ok != 0) {
+        return ok;
+    }
+
+    return 0;
+}
+
 static int on_mouse_motion_event(struct user_input *input, struct libinput_event *event) {
     struct libinput_event_pointer *pointer_event;
     struct input_device_data *data;
@@ -1018,24 +1434,125 @@ static int on_mouse_button_event(struct user_input *input, struct libinput_event
     return 0;
 }
 
-static int on_mouse_axis_event(struct user_input *input, struct libinput_event *event) {
-    struct libinput_event_pointer *pointer_event;
-    struct input_device_data *data;
-    struct libinput_device *device;
-    struct vec2f pos_view;
-    uint64_t timestamp;
+static void emit_scroll_event(struct user_input *input, struct input_device_data *data, uint64_t timestamp, struct vec2f scroll_delta) {
+    emit_pointer_event(
+        input,
+        make_mouse_event(
+            data->buttons & kFlutterPointerButtonMousePrimary ? kMove : kHover,
+            timestamp,
+            get_cursor_view_position(input),
+            input->cursor_flutter_device_id,
+            kFlutterPointerSignalKindScroll,
+            scroll_delta,
+            data->buttons
+        )
+    );
+}
+
+#if THIS_LIBINPUT_VER >= LIBINPUT_VER(1, 19, 0)
+static struct vec2f get_scroll_value(struct libinput_event_pointer *pointer_event, bool v120) {
+    struct vec2f value = VEC2F(0, 0);
+
+    if (libinput_event_pointer_has_axis(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL)) {
+        value.x = v120 ? libinput_event_pointer_get_scroll_value_v120(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL) :
+                         libinput_event_pointer_get_scroll_value(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL);
+    }
+
+    if (libinput_event_pointer_has_axis(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL)) {
+        value.y = v120 ? libinput_event_pointer_get_scroll_value_v120(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL) :
+                         libinput_event_pointer_get_scroll_value(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+    }
+
+    return value;
+}
+
+static int on_scroll_wheel_event(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_pointer *pointer_event;
+    struct input_device_data *data;
+    struct vec2f v120;
+    uint64_t timestamp;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    pointer_event = libinput_event_get_pointer_event(event);
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    timestamp = libinput_event_pointer_get_time_usec(pointer_event);
+
+    // One wheel detent is 120. High resolution wheels send fractions of that,
+    // so we don't need to wait for a whole detent to scroll.
+    v120 = get_scroll_value(pointer_event, true);
+
+    emit_scroll_event(input, data, timestamp, VEC2F(v120.x / 120.0 * 53.0, v120.y / 120.0 * 53.0));
+
+    return 0;
+}
+
+static int on_scroll_finger_event(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_pointer *pointer_event;
+    struct libinput_device *device;
+    struct vec2f value;
+    uint64_t timestamp;
 
     assert(input != NULL);
     assert(event != NULL);
 
     pointer_event = libinput_event_get_pointer_event(event);
     device = libinput_event_get_device(event);
-    data = libinput_device_get_user_data(device);
     timestamp = libinput_event_pointer_get_time_usec(pointer_event);
 
-    // since the stored coords are in display, not view coordinates,
-    // we need to transform them again
-    pos_view = transform_point(input->display_to_view_transform, VEC2F(input->cursor_x, input->cursor_y));
+    value = get_scroll_value(pointer_event, false);
+
+    // libinput sends a scroll event with a value of 0 when the fingers are lifted.
+    if (value.x == 0.0 && value.y == 0.0) {
+        if (input->panzoom_device == device) {
+            end_panzoom(input, timestamp);
+        }
+        return 0;
+    }
+
+    if (input->panzoom_device != device) {
+        begin_panzoom(input, device, timestamp);
+    }
+
+    // The fingers move in the opposite direction of the scroll.
+    input->panzoom_pan.x -= value.x;
+    input->panzoom_pan.y -= value.y;
+    input->has_pending_panzoom_update = true;
+    input->panzoom_timestamp = timestamp;
+
+    return 0;
+}
+
+static int on_scroll_continuous_event(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_pointer *pointer_event;
+    struct input_device_data *data;
+    uint64_t timestamp;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    pointer_event = libinput_event_get_pointer_event(event);
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    timestamp = libinput_event_pointer_get_time_usec(pointer_event);
+
+    // For example button scrolling on a trackpoint. The values are pixel-like already.
+    emit_scroll_event(input, data, timestamp, get_scroll_value(pointer_event, false));
+
+    return 0;
+}
+#else
+static int on_mouse_axis_event(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_pointer *pointer_event;
+    struct input_device_data *data;
+    uint64_t timestamp;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    pointer_event = libinput_event_get_pointer_event(event);
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    timestamp = libinput_event_pointer_get_time_usec(pointer_event);
 
     double scroll_x = libinput_event_pointer_has_axis(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL) ?
                           libinput_event_pointer_get_axis_value(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL) :
@@ -1045,70 +1562,131 @@ static int on_mouse_axis_event(struct user_input *input, struct libinput_event *
                           libinput_event_pointer_get_axis_value(pointer_event, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL) :
                           0.0;
 
-    emit_pointer_event(
-        input,
-        make_mouse_event(
-            data->buttons & kFlutterPointerButtonMousePrimary ? kMove : kHover,
-            timestamp,
-            pos_view,
-            input->cursor_flutter_device_id,
-            kFlutterPointerSignalKindScroll,
-            VEC2F(scroll_x / 15.0 * 53.0, scroll_y / 15.0 * 53.0),
-            data->buttons
-        )
-    );
+    emit_scroll_event(input, data, timestamp, VEC2F(scroll_x / 15.0 * 53.0, scroll_y / 15.0 * 53.0));
 
     return 0;
 }
+#endif
 
-static int on_touch_down(struct user_input *input, struct libinput_event *event) {
-    struct libinput_event_touch *touch_event;
-    struct input_device_data *data;
-    struct vec2f pos_view;
-    uint64_t timestamp;
-    int64_t device_id;
-    int slot;
+static int on_gesture_begin(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_gesture *gesture_event;
 
     assert(input != NULL);
     assert(event != NULL);
 
-    data = libinput_device_get_user_data(libinput_event_get_device(event));
-    touch_event = libinput_event_get_touch_event(event);
-    timestamp = libinput_event_touch_get_time_usec(touch_event);
+    gesture_event = libinput_event_get_gesture_event(event);
+
+    begin_panzoom(input, libinput_event_get_device(event), libinput_event_gesture_get_time_usec(gesture_event));
+
+    return 0;
+}
+
+static int on_gesture_update(struct user_input *input, struct libinput_event *event, bool is_pinch) {
+    struct libinput_event_gesture *gesture_event;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    gesture_event = libinput_event_get_gesture_event(event);
+
+    // The gesture was interrupted by another gesture of a different device.
+    if (input->panzoom_device != libinput_event_get_device(event)) {
+        return 0;
+    }
+
+    // dx / dy are the movement of the logical center of the fingers, in the same coordinate space
+    // as relative pointer motion, which is view coordinates.
+    input->panzoom_pan.x += libinput_event_gesture_get_dx(gesture_event);
+    input->panzoom_pan.y += libinput_event_gesture_get_dy(gesture_event);
+
+    if (is_pinch) {
+        // libinput reports the absolute scale since the beginning of the gesture,
+        // but the rotation as a delta in degrees.
+        input->panzoom_scale = libinput_event_gesture_get_scale(gesture_event);
+        input->panzoom_rotation += libinput_event_gesture_get_angle_delta(gesture_event) * M_PI / 180.0;
+    }
+
+    input->has_pending_panzoom_update = true;
+    input->panzoom_timestamp = libinput_event_gesture_get_time_usec(gesture_event);
+
+    return 0;
+}
+
+static int on_gesture_end(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_gesture *gesture_event;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    gesture_event = libinput_event_get_gesture_event(event);
+
+    // Cancelled gestures (e.g. a finger was added) are ended the same way.
+    if (input->panzoom_device == libinput_event_get_device(event)) {
+        end_panzoom(input, libinput_event_gesture_get_time_usec(gesture_event));
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the multitouch slot for this event, or -1 if it's out of range.
+ */
+static int get_touch_slot(struct input_device_data *data, struct libinput_event_touch *touch_event) {
+    int slot;
 
-    // get the multitouch slot for this event
     // can return -1 when the device is a single touch device
     slot = libinput_event_touch_get_slot(touch_event);
     if (slot == -1) {
         slot = 0;
     }
 
-    device_id = data->touch_device_id_offset + slot;
+    if (slot < 0 || slot >= data->n_slots) {
+        LOG_ERROR("Touch event has out of range multitouch slot %d.\n", slot);
+        return -1;
+    }
+
+    return slot;
+}
 
+static struct vec2f get_touch_position(struct user_input *input, struct libinput_event_touch *touch_event) {
     // transform the display coordinates to view (flutter) coordinates
-    pos_view = transform_point(
+    return transform_point(
         input->display_to_view_transform,
         VEC2F(
             libinput_event_touch_get_x_transformed(touch_event, input->display_width),
             libinput_event_touch_get_y_transformed(touch_event, input->display_height)
         )
     );
+}
 
-    // emit the flutter pointer event
-    emit_pointer_event(input, make_touch_down_event(timestamp, pos_view, device_id));
+static void flush_touch_slot(struct user_input *input, struct input_device_data *data, int slot, uint64_t timestamp) {
+    struct touch_slot *state = data->slots + slot;
+    int64_t device_id = data->touch_device_id_offset + slot;
+
+    if (state->pending_down) {
+        state->position = state->pending_position;
+        state->is_down = true;
+        emit_pointer_event(input, make_touch_down_event(timestamp, state->position, device_id));
+    } else if (state->pending_motion && state->is_down) {
+        state->position = state->pending_position;
+        emit_pointer_event(input, make_touch_move_event(timestamp, state->position, device_id));
+    }
 
-    // alter our device state
-    data->positions[slot] = pos_view;
-    data->timestamp = timestamp;
+    if (state->pending_up && state->is_down) {
+        state->is_down = false;
+        emit_pointer_event(input, make_touch_up_event(timestamp, state->position, device_id));
+    }
 
-    return 0;
+    state->pending_down = false;
+    state->pending_motion = false;
+    state->pending_up = false;
 }
 
-static int on_touch_up(struct user_input *input, struct libinput_event *event) {
+static int on_touch_down(struct user_input *input, struct libinput_event *event) {
     struct libinput_event_touch *touch_event;
     struct input_device_data *data;
+    struct touch_slot *state;
     uint64_t timestamp;
-    int64_t device_id;
     int slot;
 
     assert(input != NULL);
@@ -1118,26 +1696,30 @@ static int on_touch_up(struct user_input *input, struct libinput_event *event) {
     touch_event = libinput_event_get_touch_event(event);
     timestamp = libinput_event_touch_get_time_usec(touch_event);
 
-    // get the multitouch slot for this event
-    // can return -1 when the device is a single touch device
-    slot = libinput_event_touch_get_slot(touch_event);
-    if (slot == -1) {
-        slot = 0;
+    slot = get_touch_slot(data, touch_event);
+    if (slot < 0) {
+        return 0;
     }
 
-    device_id = data->touch_device_id_offset + slot;
+    state = data->slots + slot;
 
-    emit_pointer_event(input, make_touch_up_event(timestamp, data->positions[slot], device_id));
+    // The slot was released and re-used for a new touch in the same frame.
+    // Send the release first, so the two touches aren't merged into one.
+    if (state->pending_up) {
+        flush_touch_slot(input, data, slot, timestamp);
+    }
+
+    state->pending_position = get_touch_position(input, touch_event);
+    state->pending_down = true;
+    data->timestamp = timestamp;
 
     return 0;
 }
 
-static int on_touch_motion(struct user_input *input, struct libinput_event *event) {
+static int on_touch_up(struct user_input *input, struct libinput_event *event) {
     struct libinput_event_touch *touch_event;
     struct input_device_data *data;
-    struct vec2f pos_view;
     uint64_t timestamp;
-    int64_t device_id;
     int slot;
 
     assert(input != NULL);
@@ -1147,62 +1729,140 @@ static int on_touch_motion(struct user_input *input, struct libinput_event *even
     touch_event = libinput_event_get_touch_event(event);
     timestamp = libinput_event_touch_get_time_usec(touch_event);
 
-    // get the multitouch slot for this event
-    // can return -1 when the device is a single touch device
-    slot = libinput_event_touch_get_slot(touch_event);
-    if (slot == -1) {
-        slot = 0;
+    slot = get_touch_slot(data, touch_event);
+    if (slot < 0) {
+        return 0;
     }
 
-    device_id = data->touch_device_id_offset + slot;
+    // If the touch went down in this frame too, the down event is still sent before the up event.
+    data->slots[slot].pending_up = true;
+    data->timestamp = timestamp;
 
-    // transform the display coordinates to view (flutter) coordinates
-    pos_view = transform_point(
-        FLUTTER_TRANSFORM_AS_MAT3F(input->display_to_view_transform),
-        VEC2F(
-            libinput_event_touch_get_x_transformed(touch_event, input->display_width),
-            libinput_event_touch_get_y_transformed(touch_event, input->display_height)
-        )
-    );
+    return 0;
+}
 
-    // emit the flutter pointer event
-    emit_pointer_event(input, make_touch_move_event(timestamp, pos_view, device_id));
+static int on_touch_motion(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_touch *touch_event;
+    struct input_device_data *data;
+    struct touch_slot *state;
+    uint64_t timestamp;
+    int slot;
+
+    assert(input != NULL);
+    assert(event != NULL);
+
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    touch_event = libinput_event_get_touch_event(event);
+    timestamp = libinput_event_touch_get_time_usec(touch_event);
+
+    slot = get_touch_slot(data, touch_event);
+    if (slot < 0) {
+        return 0;
+    }
 
-    // alter our device state
-    data->positions[slot] = pos_view;
+    // Multiple motion events for the same slot in one frame are merged into one.
+    state = data->slots + slot;
+    state->pending_position = get_touch_position(input, touch_event);
+    state->pending_motion = true;
     data->timestamp = timestamp;
 
     return 0;
 }
 
 static int on_touch_cancel(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_touch *touch_event;
+    struct input_device_data *data;
+    uint64_t timestamp;
+    int slot;
+
     assert(input != NULL);
     assert(event != NULL);
 
-    (void) input;
-    (void) event;
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    touch_event = libinput_event_get_touch_event(event);
+    timestamp = libinput_event_touch_get_time_usec(touch_event);
+
+    // libinput cancels touches for example because of palm detection.
+    // Flutter needs to know, otherwise the gesture arena will wait for the up event forever.
+    slot = get_touch_slot(data, touch_event);
+    if (slot < 0) {
+        return 0;
+    }
+
+    cancel_touch(input, data, slot, timestamp);
+    data->timestamp = timestamp;
 
-    /// TODO: Implement touch cancel
     return 0;
 }
 
 static int on_touch_frame(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_touch *touch_event;
+    struct input_device_data *data;
+    uint64_t timestamp;
+
     assert(input != NULL);
     assert(event != NULL);
 
-    (void) input;
-    (void) event;
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    touch_event = libinput_event_get_touch_event(event);
+    timestamp = libinput_event_touch_get_time_usec(touch_event);
+
+    // Send all the changes of this frame at once, with the same timestamp.
+    for (int i = 0; i < data->n_slots; i++) {
+        flush_touch_slot(input, data, i, timestamp);
+    }
+
+    data->timestamp = timestamp;
 
-    /// TODO: Implement touch frame
     return 0;
 }
 
+static void flush_stylus_hover(struct user_input *input) {
+    struct input_device_data *data;
+
+    data = input->pending_stylus_hover_device;
+    if (data == NULL) {
+        return;
+    }
+
+    emit_pointer_event(
+        input,
+        make_stylus_hover_event(data->pending_stylus_hover_timestamp, data->stylus_position, data->stylus_device_id, data->stylus_buttons)
+    );
+
+    input->pending_stylus_hover_device = NULL;
+}
+
+static struct vec2f get_tablet_tool_position(struct user_input *input, struct libinput_event_tablet_tool *tablet_event) {
+    struct vec2f pos;
+
+    pos.x = libinput_event_tablet_tool_get_x_transformed(tablet_event, input->display_width - 1);
+    pos.y = libinput_event_tablet_tool_get_y_transformed(tablet_event, input->display_height - 1);
+
+    return transform_point(input->display_to_view_transform, pos);
+}
+
+/**
+ * @brief Send the current position of the tablet tool to flutter. A move event is
+ * sent right away if the tool is touching the tablet, hover events are coalesced.
+ */
+static void emit_stylus_motion(struct user_input *input, struct input_device_data *data, uint64_t timestamp) {
+    if (data->tip) {
+        emit_pointer_event(input, make_stylus_move_event(timestamp, data->stylus_position, data->stylus_device_id, data->stylus_buttons));
+    } else {
+        if (input->pending_stylus_hover_device != data) {
+            flush_stylus_hover(input);
+        }
+
+        data->pending_stylus_hover_timestamp = timestamp;
+        input->pending_stylus_hover_device = data;
+    }
+}
+
 static int on_tablet_tool_axis(struct user_input *input, struct libinput_event *event) {
     struct libinput_event_tablet_tool *tablet_event;
     struct input_device_data *data;
-    struct vec2f pos;
     uint64_t timestamp;
-    int64_t device_id;
 
     ASSERT_NOT_NULL(input);
     ASSERT_NOT_NULL(event);
@@ -1213,18 +1873,15 @@ static int on_tablet_tool_axis(struct user_input *input, struct libinput_event *
     tablet_event = libinput_event_get_tablet_tool_event(event);
     timestamp = libinput_event_tablet_tool_get_time_usec(tablet_event);
 
-    device_id = data->stylus_device_id;
+    // Pressure, distance, tilt and rotation changes are ignored here, since
+    // FlutterPointerEvent has no fields for them.
+    if (!libinput_event_tablet_tool_x_has_changed(tablet_event) && !libinput_event_tablet_tool_y_has_changed(tablet_event)) {
+        return 0;
+    }
 
-    pos.x = libinput_event_tablet_tool_get_x_transformed(tablet_event, input->display_width - 1);
-    pos.y = libinput_event_tablet_tool_get_y_transformed(tablet_event, input->display_height - 1);
+    data->stylus_position = get_tablet_tool_position(input, tablet_event);
 
-    pos = transform_point(input->display_to_view_transform, pos);
-
-    if (data->tip) {
-        emit_pointer_event(input, make_stylus_move_event(timestamp, pos, device_id));
-    } else {
-        emit_pointer_event(input, make_stylus_hover_event(timestamp, pos, device_id));
-    }
+    emit_stylus_motion(input, data, timestamp);
 
     return 0;
 }
@@ -1232,9 +1889,7 @@ static int on_tablet_tool_axis(struct user_input *input, struct libinput_event *
 static int on_tablet_tool_proximity(struct user_input *input, struct libinput_event *event) {
     struct libinput_event_tablet_tool *tablet_event;
     struct input_device_data *data;
-    struct vec2f pos;
     uint64_t timestamp;
-    int64_t device_id;
 
     ASSERT_NOT_NULL(input);
     ASSERT_NOT_NULL(event);
@@ -1245,17 +1900,26 @@ static int on_tablet_tool_proximity(struct user_input *input, struct libinput_ev
     tablet_event = libinput_event_get_tablet_tool_event(event);
     timestamp = libinput_event_tablet_tool_get_time_usec(tablet_event);
 
-    device_id = data->stylus_device_id;
+    data->stylus_position = get_tablet_tool_position(input, tablet_event);
 
-    pos.x = libinput_event_tablet_tool_get_x_transformed(tablet_event, input->display_width - 1);
-    pos.y = libinput_event_tablet_tool_get_y_transformed(tablet_event, input->display_height - 1);
+    if (libinput_event_tablet_tool_get_proximity_state(tablet_event) == LIBINPUT_TABLET_TOOL_PROXIMITY_STATE_OUT) {
+        // libinput should send a tip up before the tool leaves proximity,
+        // but make sure flutter doesn't see a stuck pointer in any case.
+        if (data->tip) {
+            data->tip = false;
+            emit_pointer_event(input, make_stylus_up_event(timestamp, data->stylus_position, data->stylus_device_id, 0));
+        }
 
-    pos = transform_point(input->display_to_view_transform, pos);
+        data->stylus_buttons = 0;
+    }
 
     if (!data->tip) {
-        emit_pointer_event(input, make_stylus_hover_event(timestamp, pos, device_id));
+        emit_stylus_motion(input, data, timestamp);
     }
 
+    // Don't coalesce the tool entering or leaving proximity with later hover events.
+    flush_stylus_hover(input);
+
     return 0;
 }
 
@@ -1264,7 +1928,6 @@ static int on_tablet_tool_tip(struct user_input *input, struct libinput_event *e
     struct input_device_data *data;
     uint64_t timestamp;
     int64_t device_id;
-    struct vec2f pos;
 
     ASSERT_NOT_NULL(input);
     ASSERT_NOT_NULL(event);
@@ -1277,28 +1940,57 @@ static int on_tablet_tool_tip(struct user_input *input, struct libinput_event *e
 
     device_id = data->stylus_device_id;
 
-    pos.x = libinput_event_tablet_tool_get_x_transformed(tablet_event, input->display_width - 1);
-    pos.y = libinput_event_tablet_tool_get_y_transformed(tablet_event, input->display_height - 1);
+    // The last hover position should arrive at flutter before the down event.
+    flush_stylus_hover(input);
 
-    pos = transform_point(input->display_to_view_transform, pos);
+    data->stylus_position = get_tablet_tool_position(input, tablet_event);
 
     if (libinput_event_tablet_tool_get_tip_state(tablet_event) == LIBINPUT_TABLET_TOOL_TIP_DOWN) {
         data->tip = true;
-        emit_pointer_event(input, make_stylus_down_event(timestamp, pos, device_id));
+        data->stylus_buttons |= STYLUS_BUTTON_CONTACT;
+        emit_pointer_event(input, make_stylus_down_event(timestamp, data->stylus_position, device_id, data->stylus_buttons));
     } else {
         data->tip = false;
-        emit_pointer_event(input, make_stylus_up_event(timestamp, pos, device_id));
+        data->stylus_buttons &= ~STYLUS_BUTTON_CONTACT;
+        emit_pointer_event(input, make_stylus_up_event(timestamp, data->stylus_position, device_id, data->stylus_buttons));
     }
 
     return 0;
 }
 
 static int on_tablet_tool_button(struct user_input *input, struct libinput_event *event) {
+    struct libinput_event_tablet_tool *tablet_event;
+    struct input_device_data *data;
+    uint64_t timestamp;
+    int64_t button;
+
     ASSERT_NOT_NULL(input);
     ASSERT_NOT_NULL(event);
 
-    (void) input;
-    (void) event;
+    data = libinput_device_get_user_data(libinput_event_get_device(event));
+    ASSERT_NOT_NULL(data);
+
+    tablet_event = libinput_event_get_tablet_tool_event(event);
+    timestamp = libinput_event_tablet_tool_get_time_usec(tablet_event);
+
+    switch (libinput_event_tablet_tool_get_button(tablet_event)) {
+        case BTN_STYLUS: button = STYLUS_BUTTON_PRIMARY; break;
+        case BTN_STYLUS2: button = STYLUS_BUTTON_SECONDARY; break;
+#ifdef BTN_STYLUS3
+        case BTN_STYLUS3: button = STYLUS_BUTTON_TERTIARY; break;
+#endif
+        default: return 0;
+    }
+
+    if (libinput_event_tablet_tool_get_button_state(tablet_event) == LIBINPUT_BUTTON_STATE_PRESSED) {
+        data->stylus_buttons |= button;
+    } else {
+        data->stylus_buttons &= ~button;
+    }
+
+    // flutter only notices button changes with the next pointer event, so send one right away.
+    emit_stylus_motion(input, data, timestamp);
+    flush_stylus_hover(input);
 
     return 0;
 }
@@ -1393,12 +2085,56 @@ static int process_libinput_events(struct user_input *input, uint64_t timestamp)
                     goto fail_destroy_event;
                 }
                 break;
+#if THIS_LIBINPUT_VER >= LIBINPUT_VER(1, 19, 0)
+            // LIBINPUT_EVENT_POINTER_AXIS is deprecated and sent in addition to these,
+            // so we just ignore it.
+            case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+                ok = on_scroll_wheel_event(input, event);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
+            case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+                ok = on_scroll_finger_event(input, event);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
+            case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+                ok = on_scroll_continuous_event(input, event);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
+#else
             case LIBINPUT_EVENT_POINTER_AXIS:
                 ok = on_mouse_axis_event(input, event);
                 if (ok != 0) {
                     goto fail_destroy_event;
                 }
                 break;
+#endif
+            case LIBINPUT_EVENT_GESTURE_SWIPE_BEGIN:
+            case LIBINPUT_EVENT_GESTURE_PINCH_BEGIN:
+                ok = on_gesture_begin(input, event);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
+            case LIBINPUT_EVENT_GESTURE_SWIPE_UPDATE:
+            case LIBINPUT_EVENT_GESTURE_PINCH_UPDATE:
+                ok = on_gesture_update(input, event, event_type == LIBINPUT_EVENT_GESTURE_PINCH_UPDATE);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
+            case LIBINPUT_EVENT_GESTURE_SWIPE_END:
+            case LIBINPUT_EVENT_GESTURE_PINCH_END:
+                ok = on_gesture_end(input, event);
+                if (ok != 0) {
+                    goto fail_destroy_event;
+                }
+                break;
             case LIBINPUT_EVENT_TOUCH_DOWN:
                 ok = on_touch_down(input, event);
                 if (ok != 0) {
@@ -1485,6 +2221,10 @@ static int process_libinput_events(struct user_input *input, uint64_t timestamp)
         libinput_event_destroy(event);
     }
 
+    // Send at most one pan/zoom update and one stylus hover event per batch of events.
+    flush_panzoom_update(input);
+    flush_stylus_hover(input);
+
     return 0;
 
 fail_destroy_event:
@@ -1546,3 +2286,42 @@ int user_input_on_fd_ready(struct user_input *input) {
 
     return 0;
 }
+
+int user_input_on_repeat_timer_fd_ready(struct user_input *input) {
+    struct input_device_data *data;
+    uint64_t expirations, timestamp_us, interval_us;
+    ssize_t ok;
+
+    assert(input != NULL);
+
+    ok = read(input->repeat_timer_fd, &expirations, sizeof(expirations));
+    if (ok < 0) {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+
+        LOG_ERROR("Could not read key repeat timer. read: %s\n", strerror(errno));
+        return errno;
+    }
+
+    // The key could've been released in the meantime.
+    if (input->repeat_device == NULL) {
+        return 0;
+    }
+
+    data = libinput_device_get_user_data(input->repeat_device);
+    if (data == NULL || data->keyboard_state == NULL) {
+        stop_key_repeat(input);
+        return 0;
+    }
+
+    // If we couldn't keep up, we just skip the missed repeats instead of sending
+    // a burst of them, but still count them so the timestamps stay correct.
+    input->repeat_count += expirations;
+
+    interval_us = 1000000ull / input->kbdcfg->repeat_rate;
+    timestamp_us = input->repeat_press_timestamp_us + input->kbdcfg->repeat_delay_ms * 1000ull;
+    timestamp_us += (input->repeat_count - 1) * interval_us;
+
+    return emit_key_event(input, data, timestamp_us, input->repeat_evdev_keycode, KEY_REPEAT);
+}
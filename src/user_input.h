@@ -70,6 +70,7 @@ struct user_input_interface {
 };
 
 struct user_input;
+struct keyboard_config;
 
 /**
  * @brief Create a new user input instance. Will try to load the default keyboard config from /etc/default/keyboard
@@ -119,6 +120,26 @@ int user_input_get_fd(struct user_input *input);
  */
 int user_input_on_fd_ready(struct user_input *input);
 
+/**
+ * @brief Returns a timerfd that becomes ready when a held down key should repeat. It should be listened to with EPOLLIN.
+ * When it becomes ready, @ref user_input_on_repeat_timer_fd_ready should be called.
+ */
+int user_input_get_repeat_timer_fd(struct user_input *input);
+
+/**
+ * @brief Should be called when the fd returned by @ref user_input_get_repeat_timer_fd becomes ready.
+ * Emits the key repeat event using the user_input_interface callbacks.
+ */
+int user_input_on_repeat_timer_fd_ready(struct user_input *input);
+
+/**
+ * @brief Switch to a new keyboard configuration (keymap, compose table, key repeat info), for example after
+ * /etc/default/keyboard was changed. Takes ownership of @param config.
+ *
+ * Keyboards switch to the new keymap with their next key event, and a key that's repeating right now stops repeating.
+ */
+void user_input_replace_keyboard_config(struct user_input *input, struct keyboard_config *config);
+
 void user_input_suspend(struct user_input *input);
 
 int user_input_resume(struct user_input *input);
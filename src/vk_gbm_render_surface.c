@@ -18,6 +18,7 @@
 
 #include <vulkan.h>
 
+#include "fbdev.h"
 #include "render_surface.h"
 #include "render_surface_private.h"
 #include "surface.h"
@@ -36,6 +37,14 @@ struct fb {
     VkDeviceMemory memory;
     VkImage image;
     FlutterVulkanImage fl_image;
+
+    /**
+     * @brief Signalled once the rendering flutter submitted into this fb is finished.
+     *
+     * Submitted in @ref vk_gbm_render_surface_queue_present, only valid if @ref has_render_fence is true.
+     */
+    VkFence render_fence;
+    bool has_render_fence;
 };
 
 struct locked_fb {
@@ -97,6 +106,12 @@ struct vk_gbm_render_surface {
      */
     enum pixfmt pixel_format;
 
+    /**
+     * @brief True if we already warned that presenting on a fbdev is slow because the framebuffers are not linear.
+     *
+     */
+    bool warned_about_modifier;
+
 #ifdef DEBUG
     /**
      * @brief The number of framebuffers that are currently locked.
@@ -173,6 +188,7 @@ ATTR_PURE struct vk_gbm_render_surface *__checked_cast_vk_gbm_render_surface(voi
 void vk_gbm_render_surface_deinit(struct surface *s);
 static int vk_gbm_render_surface_present_kms(struct surface *s, const struct fl_layer_props *props, struct kms_req_builder *builder);
 static int vk_gbm_render_surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder);
+static int vk_gbm_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out);
 static int vk_gbm_render_surface_fill(struct render_surface *surface, FlutterBackingStore *fl_store);
 static int vk_gbm_render_surface_queue_present(struct render_surface *surface, const FlutterBackingStore *fl_store);
 
@@ -399,9 +415,25 @@ fb_init(struct fb *fb, struct gbm_device *gbm_device, struct vk_renderer *render
         goto fail_free_device_memory;
     }
 
+    ok = vkCreateFence(
+        device,
+        &(VkFenceCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = 0,
+            .pNext = NULL,
+        },
+        NULL,
+        &fb->render_fence
+    );
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't create vulkan fence. vkCreateFence");
+        goto fail_free_device_memory;
+    }
+
     fb->bo = bo;
     fb->memory = img_device_memory;
     fb->image = vkimg;
+    fb->has_render_fence = false;
 
     COMPILE_ASSERT(sizeof(FlutterVulkanImage) == 24);
     fb->fl_image = (FlutterVulkanImage){
@@ -430,6 +462,11 @@ fail_destroy_bo:
 static void fb_deinit(struct fb *fb, VkDevice device) {
     ASSERT_NOT_NULL(fb);
 
+    if (fb->has_render_fence) {
+        vkWaitForFences(device, 1, &fb->render_fence, VK_TRUE, UINT64_MAX);
+    }
+    vkDestroyFence(device, fb->render_fence, NULL);
+
     vkFreeMemory(device, fb->memory, NULL);
     gbm_bo_destroy(fb->bo);
     vkDestroyImage(device, fb->image, NULL);
@@ -477,6 +514,7 @@ fail_deinit_previous_fbs:
 
     surface->surface.present_kms = vk_gbm_render_surface_present_kms;
     surface->surface.present_fbdev = vk_gbm_render_surface_present_fbdev;
+    surface->surface.snapshot = vk_gbm_render_surface_snapshot;
     surface->surface.deinit = vk_gbm_render_surface_deinit;
     surface->render_surface.fill = vk_gbm_render_surface_fill;
     surface->render_surface.queue_present = vk_gbm_render_surface_queue_present;
@@ -488,6 +526,7 @@ fail_deinit_previous_fbs:
     surface->renderer = vk_renderer_ref(renderer);
     surface->front_fb = NULL;
     surface->pixel_format = pixel_format;
+    surface->warned_about_modifier = false;
 #ifdef DEBUG
     surface->n_locked_fbs = 0;
 #endif
@@ -579,6 +618,7 @@ static void on_release_layer(void *userdata) {
 
 static int vk_gbm_render_surface_present_kms(struct surface *s, const struct fl_layer_props *props, struct kms_req_builder *builder) {
     struct vk_gbm_render_surface *vk_surface;
+    struct kms_fb_layer layer;
     struct gbm_bo_meta *meta;
     struct drmdev *drmdev;
     struct gbm_bo *bo;
@@ -668,35 +708,48 @@ static int vk_gbm_render_surface_present_kms(struct surface *s, const struct fl_
 
     vkDeviceWaitIdle(vk_renderer_get_device(vk_surface->renderer));
 
+    layer = (struct kms_fb_layer){
+        .drm_fb_id = fb_id,
+        .format = pixel_format,
+        .has_modifier = true,
+        .modifier = gbm_bo_get_modifier(bo),
+
+        .dst_x = (int32_t) props->aa_rect.offset.x,
+        .dst_y = (int32_t) props->aa_rect.offset.y,
+        .dst_w = (uint32_t) props->aa_rect.size.x,
+        .dst_h = (uint32_t) props->aa_rect.size.y,
+
+        .src_x = 0,
+        .src_y = 0,
+        .src_w = DOUBLE_TO_FP1616_ROUNDED(vk_surface->render_surface.size.x),
+        .src_h = DOUBLE_TO_FP1616_ROUNDED(vk_surface->render_surface.size.y),
+
+        .has_rotation = false,
+        .rotation = PLANE_TRANSFORM_ROTATE_0,
+
+        .has_in_fence_fd = false,
+        .in_fence_fd = 0,
+
+        .has_alpha = props->opacity < 1.0,
+        .alpha = drm_blend_alpha_from_opacity(props->opacity),
+
+        // flutter renders with premultiplied alpha.
+        .has_blend_mode = true,
+        .blend_mode = kPremultiplied_DrmBlendMode,
+    };
+
     TRACER_BEGIN(vk_surface->surface.tracer, "kms_req_builder_push_fb_layer");
-    ok = kms_req_builder_push_fb_layer(
-        builder,
-        &(const struct kms_fb_layer){
-            .drm_fb_id = fb_id,
-            .format = pixel_format,
-            .has_modifier = true,
-            .modifier = gbm_bo_get_modifier(bo),
-
-            .dst_x = (int32_t) props->aa_rect.offset.x,
-            .dst_y = (int32_t) props->aa_rect.offset.y,
-            .dst_w = (uint32_t) props->aa_rect.size.x,
-            .dst_h = (uint32_t) props->aa_rect.size.y,
-
-            .src_x = 0,
-            .src_y = 0,
-            .src_w = DOUBLE_TO_FP1616_ROUNDED(vk_surface->render_surface.size.x),
-            .src_h = DOUBLE_TO_FP1616_ROUNDED(vk_surface->render_surface.size.y),
-
-            .has_rotation = false,
-            .rotation = PLANE_TRANSFORM_ROTATE_0,
-
-            .has_in_fence_fd = false,
-            .in_fence_fd = 0,
-        },
-        on_release_layer,
-        NULL,
-        locked_fb_ref(vk_surface->front_fb)
-    );
+    ok = kms_req_builder_push_fb_layer(builder, &layer, on_release_layer, NULL, locked_fb_ref(vk_surface->front_fb));
+    if (ok == EOPNOTSUPP && layer.has_alpha) {
+        locked_fb_unref(vk_surface->front_fb);
+
+        // No free plane supports plane alpha. Better to show the layer opaque than not at all.
+        LOG_DEBUG("Couldn't find a plane with alpha support for the layer, presenting it opaque.\n");
+        layer.has_alpha = false;
+        layer.alpha = DRM_BLEND_ALPHA_OPAQUE;
+
+        ok = kms_req_builder_push_fb_layer(builder, &layer, on_release_layer, NULL, locked_fb_ref(vk_surface->front_fb));
+    }
     TRACER_END(vk_surface->surface.tracer, "kms_req_builder_push_fb_layer");
     if (ok != 0) {
         goto fail_unref_locked_fb;
@@ -719,18 +772,117 @@ fail_unlock:
 
 static int
 vk_gbm_render_surface_present_fbdev(struct surface *s, const struct fl_layer_props *props, struct fbdev_commit_builder *builder) {
-    struct vk_gbm_render_surface *render_surface;
+    struct vk_gbm_render_surface *vk_surface;
+    struct gbm_bo *bo;
+    struct fb *fb;
+    uint32_t stride;
+    VkResult vk_ok;
+    void *map, *map_data;
+    int ok;
 
-    /// TODO: Implement by mmapping the current front bo, copy it into the fbdev
-    /// TODO: Print a warning here if we're not using explicit linear tiling and transition to linear layout with vulkan instead of gbm_bo_map in that case
+    vk_surface = CAST_THIS(s);
 
-    render_surface = CAST_THIS(s);
-    (void) render_surface;
-    (void) props;
-    (void) builder;
+    /// TODO: Implement non axis-aligned fl_layer_props
+    ASSERT_MSG(props->is_aa_rect, "only axis aligned view geometry is supported right now");
+
+    surface_lock(s);
+
+    ASSERT_NOT_NULL_MSG(
+        vk_surface->front_fb,
+        "There's no framebuffer available for scanout right now. Make sure you called render_surface_queue_present() before presenting."
+    );
 
-    UNIMPLEMENTED();
+    fb = vk_surface->front_fb->fb;
+    bo = fb->bo;
 
+    /// TODO: Transition to linear layout with vulkan instead of gbm_bo_map in that case
+    if (!vk_surface->warned_about_modifier && gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_LINEAR) {
+        LOG_ERROR("Vulkan surface is not using a linear modifier. Presenting it on a fbdev will be slow.\n");
+        vk_surface->warned_about_modifier = true;
+    }
+
+    // Make sure rendering into the buffer is finished before we read it.
+    TRACER_BEGIN(vk_surface->surface.tracer, "vkWaitForFences");
+    if (fb->has_render_fence) {
+        vk_ok = vkWaitForFences(vk_renderer_get_device(vk_surface->renderer), 1, &fb->render_fence, VK_TRUE, UINT64_MAX);
+    } else {
+        vk_ok = vkDeviceWaitIdle(vk_renderer_get_device(vk_surface->renderer));
+    }
+    TRACER_END(vk_surface->surface.tracer, "vkWaitForFences");
+    if (vk_ok != VK_SUCCESS) {
+        LOG_VK_ERROR(vk_ok, "Couldn't wait for vulkan rendering to finish");
+        ok = EIO;
+        goto fail_unlock;
+    }
+
+    TRACER_BEGIN(vk_surface->surface.tracer, "gbm_bo_map");
+    map_data = NULL;
+    map = gbm_bo_map(bo, 0, 0, gbm_bo_get_width(bo), gbm_bo_get_height(bo), GBM_BO_TRANSFER_READ, &stride, &map_data);
+    TRACER_END(vk_surface->surface.tracer, "gbm_bo_map");
+    if (map == NULL) {
+        ok = errno ? errno : EIO;
+        LOG_ERROR("Couldn't map GBM buffer for presenting it on a fbdev. gbm_bo_map: %s\n", strerror(ok));
+        goto fail_unlock;
+    }
+
+    TRACER_BEGIN(vk_surface->surface.tracer, "fbdev_commit_builder_push_layer");
+    ok = fbdev_commit_builder_push_layer(
+        builder,
+        &(const struct fbdev_layer){
+            .map = map,
+            .stride = stride,
+            .format = vk_surface->pixel_format,
+            .src_w = gbm_bo_get_width(bo),
+            .src_h = gbm_bo_get_height(bo),
+            .dst_x = (int) props->aa_rect.offset.x,
+            .dst_y = (int) props->aa_rect.offset.y,
+            .dst_w = (int) props->aa_rect.size.x,
+            .dst_h = (int) props->aa_rect.size.y,
+            .opacity = props->opacity,
+        }
+    );
+    TRACER_END(vk_surface->surface.tracer, "fbdev_commit_builder_push_layer");
+
+    gbm_bo_unmap(bo, map_data);
+
+    if (ok != 0) {
+        goto fail_unlock;
+    }
+
+    surface_unlock(s);
+    return 0;
+
+fail_unlock:
+    surface_unlock(s);
+    return ok;
+}
+
+static void on_release_snapshot(void *userdata) {
+    ASSERT_NOT_NULL(userdata);
+    locked_fb_unref(userdata);
+}
+
+static int vk_gbm_render_surface_snapshot(struct surface *s, struct surface_snapshot *snapshot_out) {
+    struct vk_gbm_render_surface *vk_surface;
+
+    vk_surface = CAST_THIS(s);
+
+    surface_lock(s);
+
+    if (vk_surface->front_fb == NULL) {
+        surface_unlock(s);
+        return EAGAIN;
+    }
+
+    // Keeping the front fb locked makes sure flutter won't render into it until the snapshot is released.
+    // Like present_kms, we don't wait for rendering to finish here. We'd need to synchronize with the
+    // rasterizer thread for vkDeviceWaitIdle, and the frame was queued for presenting a while ago anyway.
+    snapshot_out->bo = vk_surface->front_fb->fb->bo;
+    snapshot_out->format = vk_surface->pixel_format;
+    snapshot_out->release = on_release_snapshot;
+    snapshot_out->release_userdata = locked_fb_ref(vk_surface->front_fb);
+
+    surface_unlock(s);
     return 0;
 }
 
@@ -785,6 +937,35 @@ fail_unlock:
     return ok;
 }
 
+/**
+ * @brief Submit a fence on the queue flutter renders with, which signals once everything
+ * flutter submitted so far (including the rendering into @param fb) is finished.
+ */
+static int fb_submit_render_fence(struct fb *fb, struct vk_renderer *renderer) {
+    VkDevice device;
+    VkResult ok;
+
+    device = vk_renderer_get_device(renderer);
+
+    if (fb->has_render_fence) {
+        // This is normally signalled long ago, flutter rendered a whole frame into this fb since then.
+        vkWaitForFences(device, 1, &fb->render_fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(device, 1, &fb->render_fence);
+        fb->has_render_fence = false;
+    }
+
+    // A fence signal operation covers all work submitted to the queue before it,
+    // so an empty submission is enough.
+    ok = vkQueueSubmit(vk_renderer_get_queue(renderer), 0, NULL, fb->render_fence);
+    if (ok != VK_SUCCESS) {
+        LOG_VK_ERROR(ok, "Couldn't submit vulkan fence. vkQueueSubmit");
+        return EIO;
+    }
+
+    fb->has_render_fence = true;
+    return 0;
+}
+
 static int vk_gbm_render_surface_queue_present(struct render_surface *s, const FlutterBackingStore *fl_store) {
     struct vk_gbm_render_surface *vk_surface;
     struct locked_fb *fb;
@@ -811,6 +992,10 @@ static int vk_gbm_render_surface_queue_present(struct render_surface *s, const F
         return EINVAL;
     }
 
+    // Called on the raster thread after flutter submitted the frame, so we're allowed to use the queue here.
+    // If this fails, present_fbdev falls back to waiting for the whole device.
+    fb_submit_render_fence(fb->fb, vk_surface->renderer);
+
     // Replace the front fb with the new one
     // (will unref the old one if not NULL internally)
     locked_fb_swap_ptrs(&vk_surface->front_fb, fb);
@@ -601,3 +601,17 @@ ATTR_PURE int vk_renderer_find_mem_type(struct vk_renderer *renderer, VkMemoryPr
 
     return -1;
 }
+
+bool vk_renderer_supports_color_attachment_format(struct vk_renderer *renderer, VkFormat format) {
+    VkFormatProperties props;
+
+    ASSERT_NOT_NULL(renderer);
+
+    if (format == VK_FORMAT_UNDEFINED) {
+        return false;
+    }
+
+    vkGetPhysicalDeviceFormatProperties(renderer->physical_device, format, &props);
+
+    return (props.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) != 0;
+}
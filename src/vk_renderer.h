@@ -129,4 +129,13 @@ ATTR_PURE const char **vk_renderer_get_enabled_device_extensions(struct vk_rende
  */
 ATTR_PURE int vk_renderer_find_mem_type(struct vk_renderer *renderer, VkMemoryPropertyFlags flags, uint32_t req_bits);
 
+/**
+ * @brief Check whether images with @param format can be rendered into, i.e. used as a color attachment.
+ *
+ * @param renderer renderer instance
+ * @param format The vulkan format. VK_FORMAT_UNDEFINED is never supported.
+ * @return true if the format can be used as a color attachment.
+ */
+bool vk_renderer_supports_color_attachment_format(struct vk_renderer *renderer, VkFormat format);
+
 #endif  // _FLUTTERPI_SRC_VK_RENDERER_H
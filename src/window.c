@@ -11,7 +11,11 @@
 #include "window.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
@@ -19,6 +23,8 @@
 
 #include "compositor_ng.h"
 #include "cursor.h"
+#include "display_color.h"
+#include "fbdev.h"
 #include "flutter-pi.h"
 #include "frame_scheduler.h"
 #include "modesetting.h"
@@ -26,6 +32,7 @@
 #include "surface.h"
 #include "tracer.h"
 #include "util/collection.h"
+#include "util/list.h"
 #include "util/logging.h"
 #include "util/refcounting.h"
 
@@ -41,6 +48,24 @@
     #include "vk_renderer.h"
 #endif
 
+/**
+ * @brief How many writeback captures can be in flight at the same time.
+ */
+#define N_CAPTURE_BUFFERS 2
+
+/**
+ * @brief How long we wait for flutter to present a frame a pending writeback capture can be attached to,
+ * before we assume the app is idle and present the last frame again.
+ */
+#define CAPTURE_IDLE_TIMEOUT_US 50000
+
+/**
+ * @brief How long the writeback connector stays routed to our CRTC after the last capture.
+ *
+ * Routing and detaching it are both modesets, so we don't want to do that for every capture.
+ */
+#define CAPTURE_DETACH_DELAY_NS 10000000000ull
+
 struct window {
     pthread_mutex_t lock;
     refcount_t n_refs;
@@ -138,6 +163,21 @@ struct window {
      */
     struct mat3f view_to_display_transform;
 
+    /**
+     * @brief An orientation that was set using @ref window_set_orientation, but is not applied yet.
+     *
+     * Flutter is told about the new view size right away, but frames that are already in the pipeline
+     * were laid out using the old one. So @ref rotation, @ref view_size and the view transforms above
+     * only switch over once flutter presents the first frame with the new view size.
+     * (See @ref window_latch_orientation)
+     */
+    bool has_pending_orientation;
+    enum device_orientation pending_orientation;
+    drm_plane_transform_t pending_rotation;
+    struct vec2f pending_view_size;
+    struct mat3f pending_display_to_view_transform;
+    struct mat3f pending_view_to_display_transform;
+
     /**
      * @brief True if we should use a specific pixel format.
      *
@@ -165,14 +205,135 @@ struct window {
         struct drm_connector *connector;
         struct drm_encoder *encoder;
         struct drm_crtc *crtc;
-        drmModeModeInfo *mode;
+        drmModeModeInfo mode;
+
+        /**
+         * @brief The videomode given on the commandline, or NULL.
+         *
+         * Used to select a new mode when the display is re-plugged.
+         */
+        char *desired_videomode;
 
         bool should_apply_mode;
 
+        /**
+         * @brief The CRTC we used before a hotplug moved the display to a different one, or NULL.
+         *
+         * It's turned off with the next modeset, so it doesn't keep scanning out the last frame.
+         */
+        struct drm_crtc *crtc_to_disable;
+
+        /**
+         * @brief True if there's no connected display right now.
+         *
+         * Like when suspended, nothing is presented until a display is connected again.
+         */
+        bool disconnected;
+
+        /**
+         * @brief True if we don't have DRM master right now (because our session is inactive),
+         * and shouldn't try to present anything.
+         *
+         * The composition pushed while suspended will be presented when we're resumed.
+         */
+        bool suspended;
+
         const struct pointer_icon *pointer_icon;
         struct cursor_buffer *cursor;
+
+        /**
+         * @brief The arrow icon we show when the cursor is enabled without an icon, or when an icon
+         * doesn't fit into the cursor plane.
+         *
+         * Loaded once when the window is created, so we never need to read the cursor theme
+         * with the window locked.
+         */
+        const struct pointer_icon *default_pointer_icon;
+
+        /**
+         * @brief The color adjustments applied using the gamma LUT and CTM of the CRTC.
+         */
+        struct display_color_settings display_color;
+
+        /**
+         * @brief True if the display color settings changed (or some other DRM master might
+         * have changed the color pipeline) and they need to be applied with the next frame.
+         */
+        bool should_apply_display_color;
+
+        /**
+         * @brief Factor the brightness of the display color settings is multiplied with, while the display is dimmed.
+         */
+        double dim_factor;
+
+        /**
+         * @brief True if the display was turned off (see @ref window_set_display_power).
+         *
+         * Like while suspended, the frame scheduler is paused and nothing is presented.
+         */
+        bool display_off;
+
+        /**
+         * @brief True if the display should be switched into HDR mode, using @ref hdr_metadata.
+         */
+        bool has_hdr_metadata;
+        struct display_hdr_metadata hdr_metadata;
+
+        /**
+         * @brief Buffers the writeback connector writes captured frames into. Allocated on first use.
+         */
+        struct capture_buffer *capture_buffers[N_CAPTURE_BUFFERS];
+
+        /**
+         * @brief Writeback captures that should be done with the next frame.
+         */
+        struct list_head pending_captures;
+
+        /**
+         * @brief The writeback connector we capture frames with, or NULL if we haven't looked for one yet.
+         *
+         * It's routed to our CRTC with the first frame that has a capture pending, and detached
+         * again once no frame was captured for @ref CAPTURE_DETACH_DELAY_NS.
+         */
+        struct drm_connector *writeback_connector;
+        enum pixfmt writeback_format;
+        uint64_t last_capture_ns;
+
+        /**
+         * @brief True if a platform task is scheduled that presents the last frame again
+         * for the pending captures, in case flutter doesn't present a new one.
+         */
+        bool has_capture_timeout;
     } kms;
 
+    /**
+     * @brief fbdev-specific fields if this is a fbdev window.
+     *
+     * Dummy windows also use an (offscreen) fbdev to composite the flutter layers on the CPU.
+     */
+    struct {
+        struct fbdev *fbdev;
+        struct gbm_device *gbm_device;
+    } fbdev;
+
+    /**
+     * @brief dummy-window-specific fields if this is a dummy window.
+     *
+     */
+    struct {
+        /**
+         * @brief The directory every frame should be written to, or NULL.
+         */
+        char *output_directory;
+
+        /**
+         * @brief frames.txt inside @ref output_directory, or NULL.
+         */
+        FILE *frames_file;
+
+        uint64_t n_frames;
+    } dummy;
+
     /**
      * @brief The type of rendering that should be used. (gl, vk)
      *
@@ -235,11 +396,18 @@ struct window {
         struct window *window,
         bool has_enabled,
         bool enabled,
-        bool has_kind,
-        enum pointer_kind kind,
+        bool has_icon,
+        const struct pointer_icon *icon,
         bool has_pos,
         struct vec2i pos
     );
+    void (*suspend_locked)(struct window *window);
+    int (*resume_locked)(struct window *window);
+    void (*update_orientation_locked)(struct window *window);
+    int (*on_hotplug_locked)(struct window *window, bool *geometry_changed_out);
+    int (*set_display_color_locked)(struct window *window, const struct display_color_settings *settings);
+    int (*capture_frame_locked)(struct window *window, window_capture_cb_t callback, void *userdata);
+    int (*set_display_power_locked)(struct window *window, enum display_power_state state, double dim_brightness);
     void (*deinit)(struct window *window);
 };
 
@@ -398,6 +566,7 @@ static int window_init(
     window->rotation = rotation;
     window->orientation = orientation;
     window->original_orientation = original_orientation;
+    window->has_pending_orientation = false;
     window->has_forced_pixel_format = has_forced_pixel_format;
     window->forced_pixel_format = forced_pixel_format;
     window->composition = NULL;
@@ -414,6 +583,13 @@ static int window_init(
     window->get_egl_surface = NULL;
 #endif
     window->set_cursor_locked = NULL;
+    window->suspend_locked = NULL;
+    window->resume_locked = NULL;
+    window->update_orientation_locked = NULL;
+    window->on_hotplug_locked = NULL;
+    window->set_display_color_locked = NULL;
+    window->capture_frame_locked = NULL;
+    window->set_display_power_locked = NULL;
     window->deinit = window_deinit;
     return 0;
 }
@@ -445,6 +621,34 @@ int window_push_composition(struct window *window, struct fl_layer_composition *
 }
 
 struct view_geometry window_get_view_geometry(struct window *window) {
+    struct view_geometry geometry;
+
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+    if (window->has_pending_orientation) {
+        geometry = (struct view_geometry){
+            .view_size = window->pending_view_size,
+            .display_size = window->display_size,
+            .display_to_view_transform = window->pending_display_to_view_transform,
+            .view_to_display_transform = window->pending_view_to_display_transform,
+            .device_pixel_ratio = window->pixel_ratio,
+        };
+    } else {
+        geometry = (struct view_geometry){
+            .view_size = window->view_size,
+            .display_size = window->display_size,
+            .display_to_view_transform = window->display_to_view_transform,
+            .view_to_display_transform = window->view_to_display_transform,
+            .device_pixel_ratio = window->pixel_ratio,
+        };
+    }
+    window_unlock(window);
+
+    return geometry;
+}
+
+struct view_geometry window_get_frame_view_geometry(struct window *window) {
     ASSERT_NOT_NULL(window);
 
     window_lock(window);
@@ -460,6 +664,175 @@ struct view_geometry window_get_view_geometry(struct window *window) {
     return geometry;
 }
 
+enum device_orientation window_get_orientation(struct window *window) {
+    enum device_orientation orientation;
+
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+    orientation = window->has_pending_orientation ? window->pending_orientation : window->orientation;
+    window_unlock(window);
+
+    return orientation;
+}
+
+static void window_apply_pending_orientation_locked(struct window *window) {
+    assert(window->has_pending_orientation);
+
+    window->rotation = window->pending_rotation;
+    window->orientation = window->pending_orientation;
+    window->view_size = window->pending_view_size;
+    window->display_to_view_transform = window->pending_display_to_view_transform;
+    window->view_to_display_transform = window->pending_view_to_display_transform;
+    window->has_pending_orientation = false;
+
+    if (window->update_orientation_locked != NULL) {
+        window->update_orientation_locked(window);
+    }
+}
+
+int window_set_orientation(struct window *window, enum device_orientation orientation) {
+    drm_plane_transform_t rotation;
+    enum device_orientation o;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT(ORIENTATION_IS_VALID(orientation));
+
+    window_lock(window);
+
+    o = window->has_pending_orientation ? window->pending_orientation : window->orientation;
+    if (orientation == o) {
+        window_unlock(window);
+        return 0;
+    }
+
+    rotation = PLANE_TRANSFORM_ROTATE_0;
+    o = orientation;
+    while (o != window->original_orientation) {
+        rotation = PLANE_TRANSFORM_ROTATE_CW(rotation);
+        o = ORIENTATION_ROTATE_CCW(o);
+    }
+
+    // flutter renders into a buffer of the display size and rotates the view using the root surface
+    // transform, so the render surface can stay as it is. Only the transforms and the view size change.
+    // This is the same path the startup rotation (--rotation / --orientation) takes. KMS plane rotation
+    // isn't used for either: many drivers (vc4 for example) only support 0 and 180 degrees there,
+    // or 90 and 270 only for some modifiers, so we'd need the root surface transform as a fallback anyway.
+    fill_view_matrices(
+        rotation,
+        (int) window->display_size.x,
+        (int) window->display_size.y,
+        &window->pending_display_to_view_transform,
+        &window->pending_view_to_display_transform
+    );
+
+    if (rotation.rotate_90 || rotation.rotate_270) {
+        window->pending_view_size = VEC2F(window->display_size.y, window->display_size.x);
+    } else {
+        window->pending_view_size = window->display_size;
+    }
+    window->pending_rotation = rotation;
+    window->pending_orientation = orientation;
+    window->has_pending_orientation = true;
+
+    if (vec2f_equals(window->pending_view_size, window->view_size)) {
+        // Either we're going back to the applied orientation, or rotating by 180 degrees.
+        // Frames laid out for the old and the new orientation have the same size then,
+        // so we can't wait for the first frame with the new size. Just apply it right away.
+        window_apply_pending_orientation_locked(window);
+    }
+
+    window_unlock(window);
+
+    return 0;
+}
+
+bool window_latch_orientation(struct window *window, struct vec2i frame_size) {
+    struct vec2i expected_size;
+    bool latched;
+
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+
+    latched = false;
+    if (window->has_pending_orientation) {
+        // flutter rasterizes the frame using the root surface transform we currently apply,
+        // so a frame laid out with the new view size arrives with the new view size rotated by the old rotation.
+        // Frames still laid out with the old view size arrive with the display size.
+        if (window->rotation.rotate_90 || window->rotation.rotate_270) {
+            expected_size = vec2f_round_to_integer(VEC2F(window->pending_view_size.y, window->pending_view_size.x));
+        } else {
+            expected_size = vec2f_round_to_integer(window->pending_view_size);
+        }
+
+        if (frame_size.x == expected_size.x && frame_size.y == expected_size.y) {
+            window_apply_pending_orientation_locked(window);
+            latched = true;
+        }
+    }
+
+    window_unlock(window);
+
+    return latched;
+}
+
+int window_on_hotplug(struct window *window, bool *geometry_changed_out) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(geometry_changed_out);
+
+    window_lock(window);
+
+    ok = 0;
+    *geometry_changed_out = false;
+    if (window->on_hotplug_locked != NULL) {
+        ok = window->on_hotplug_locked(window, geometry_changed_out);
+    }
+
+    window_unlock(window);
+
+    return ok;
+}
+
+int window_set_display_color(struct window *window, const struct display_color_settings *settings) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(settings);
+
+    window_lock(window);
+
+    if (window->set_display_color_locked != NULL) {
+        ok = window->set_display_color_locked(window, settings);
+    } else {
+        ok = EOPNOTSUPP;
+    }
+
+    window_unlock(window);
+
+    return ok;
+}
+
+int window_set_display_power(struct window *window, enum display_power_state state, double dim_brightness) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+
+    if (window->set_display_power_locked != NULL) {
+        ok = window->set_display_power_locked(window, state, dim_brightness);
+    } else {
+        ok = EOPNOTSUPP;
+    }
+
+    window_unlock(window);
+
+    return ok;
+}
+
 double window_get_refresh_rate(struct window *window) {
     ASSERT_NOT_NULL(window);
 
@@ -516,379 +889,1029 @@ int window_set_cursor(
     bool has_pos, struct vec2i pos
     // clang-format on
 ) {
+    const struct pointer_icon *icon;
     int ok;
 
     ASSERT_NOT_NULL(window);
 
+    // This might load the icon from the cursor theme, so do it before locking the window.
+    // The pixel ratio never changes after the window is created.
+    icon = has_kind ? pointer_icon_for_details(kind, window->pixel_ratio) : NULL;
+
     window_lock(window);
 
-    ok = window->set_cursor_locked(window, has_enabled, enabled, has_kind, kind, has_pos, pos);
+    ok = window->set_cursor_locked(window, has_enabled, enabled, has_kind, icon, has_pos, pos);
 
     window_unlock(window);
 
     return ok;
 }
 
-struct cursor_buffer {
+int window_set_cursor_icon(struct window *window, const struct pointer_icon *icon) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(icon);
+
+    window_lock(window);
+
+    ok = window->set_cursor_locked(window, false, false, true, icon, false, VEC2I(0, 0));
+
+    window_unlock(window);
+
+    return ok;
+}
+
+void window_suspend(struct window *window) {
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+
+    if (window->suspend_locked != NULL) {
+        window->suspend_locked(window);
+    }
+
+    window_unlock(window);
+}
+
+int window_resume(struct window *window) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+
+    window_lock(window);
+
+    ok = 0;
+    if (window->resume_locked != NULL) {
+        ok = window->resume_locked(window);
+    }
+
+    window_unlock(window);
+
+    return ok;
+}
+
+/**
+ * @brief How long we wait for the display controller to finish a writeback before giving up.
+ */
+#define CAPTURE_FENCE_TIMEOUT_MS 1000
+
+/**
+ * @brief How long the capture worker keeps its offscreen buffer after the last job.
+ */
+#define CAPTURE_BUFFER_IDLE_TIMEOUT_S 2
+
+/**
+ * @brief A buffer the writeback connector writes a captured frame into.
+ */
+struct capture_buffer {
     refcount_t n_refs;
 
-    const struct pointer_icon *icon;
-    enum pixfmt format;
-    int width, height;
-    drm_plane_transform_t rotation;
+    /**
+     * @brief Set while a capture is using this buffer.
+     */
+    atomic_flag in_use;
 
     struct drmdev *drmdev;
-    int drm_fb_id;
     struct gbm_bo *bo;
-
-    struct vec2i hotspot;
+    uint32_t drm_fb_id;
+    enum pixfmt format;
+    struct vec2i size;
 };
 
-static struct vec2i get_rotated_hotspot(const struct pointer_icon *icon, drm_plane_transform_t rotation) {
-    struct vec2i size;
-    struct vec2i hotspot;
+struct capture_job {
+    struct list_head entry;
 
-    assert(PLANE_TRANSFORM_IS_ONLY_ROTATION(rotation));
-    size = pointer_icon_get_size(icon);
-    hotspot = pointer_icon_get_hotspot(icon);
+    window_capture_cb_t callback;
+    void *userdata;
 
-    if (rotation.rotate_0) {
-        return hotspot;
-    } else if (rotation.rotate_90) {
-        return VEC2I(size.y - hotspot.y - 1, hotspot.x);
-    } else if (rotation.rotate_180) {
-        return VEC2I(size.x - hotspot.x - 1, size.y - hotspot.y - 1);
-    } else {
-        ASSUME(rotation.rotate_270);
-        return VEC2I(hotspot.y, size.x - hotspot.x - 1);
-    }
-}
+    /**
+     * @brief For writeback captures, the buffer the frame is written into and the writeback out fence.
+     */
+    uint32_t writeback_connector_id;
+    struct capture_buffer *buffer;
+    int fence_fd;
 
-static struct cursor_buffer *cursor_buffer_new(struct drmdev *drmdev, const struct pointer_icon *icon, drm_plane_transform_t rotation) {
-    struct cursor_buffer *b;
+    /**
+     * @brief For CPU captures, the composition that should be flattened and the size of the display.
+     *
+     * The composition is only used for the layer geometry. The pixels come from @ref snapshots,
+     * which are taken when the job is created, so the surfaces rendering newer frames in the meantime
+     * doesn't matter.
+     */
+    struct fl_layer_composition *composition;
+    struct surface_snapshot *snapshots;
+    struct vec2i size;
+};
+
+static struct capture_buffer *capture_buffer_new(struct drmdev *drmdev, struct vec2i size, enum pixfmt format) {
+    struct capture_buffer *b;
     struct gbm_bo *bo;
     uint32_t fb_id;
-    struct vec2i size, rotated_size;
-    int ok;
 
     ASSERT_NOT_NULL(drmdev);
-    assert(PLANE_TRANSFORM_IS_ONLY_ROTATION(rotation));
-
-    size = pointer_icon_get_size(icon);
-    rotated_size = size;
 
     b = malloc(sizeof *b);
     if (b == NULL) {
         return NULL;
     }
 
-    if (rotation.rotate_90 || rotation.rotate_270) {
-        rotated_size = vec2i_swap_xy(size);
-    }
-
     bo = gbm_bo_create(
         drmdev_get_gbm_device(drmdev),
-        rotated_size.x,
-        rotated_size.y,
-        get_pixfmt_info(PIXFMT_ARGB8888)->gbm_format,
-        GBM_BO_USE_LINEAR | GBM_BO_USE_SCANOUT | GBM_BO_USE_WRITE | GBM_BO_USE_CURSOR
+        size.x,
+        size.y,
+        get_pixfmt_info(format)->gbm_format,
+        GBM_BO_USE_LINEAR | GBM_BO_USE_SCANOUT
     );
     if (bo == NULL) {
-        LOG_ERROR("Could not create GBM buffer for uploading mouse cursor icon. gbm_bo_create: %s\n", strerror(errno));
+        LOG_ERROR("Could not create GBM buffer for capturing frames. gbm_bo_create: %s\n", strerror(errno));
         goto fail_free_b;
     }
 
-    if (gbm_bo_get_stride(bo) != rotated_size.x * 4) {
-        LOG_ERROR("GBM BO has unsupported framebuffer stride %u, expected was: %d\n", gbm_bo_get_stride(bo), size.x * 4);
+    fb_id = drmdev_add_fb(
+        drmdev,
+        size.x,
+        size.y,
+        format,
+        gbm_bo_get_handle(bo).u32,
+        gbm_bo_get_stride(bo),
+        gbm_bo_get_offset(bo, 0),
+        gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_INVALID,
+        gbm_bo_get_modifier(bo)
+    );
+    if (fb_id == 0) {
         goto fail_destroy_bo;
     }
 
-    uint32_t *pixel_data = pointer_icon_dup_pixels(icon);
-    if (pixel_data == NULL) {
-        goto fail_destroy_bo;
-    }
+    b->n_refs = REFCOUNT_INIT_1;
+    b->in_use = (atomic_flag) ATOMIC_FLAG_INIT;
+    b->drmdev = drmdev_ref(drmdev);
+    b->bo = bo;
+    b->drm_fb_id = fb_id;
+    b->format = format;
+    b->size = size;
+    return b;
 
-    if (rotation.rotate_0) {
-        ok = gbm_bo_write(bo, pixel_data, gbm_bo_get_stride(bo) * size.y);
-        if (ok != 0) {
-            LOG_ERROR("Couldn't write cursor icon to GBM BO. gbm_bo_write: %s\n", strerror(errno));
-            goto fail_free_duped_pixel_data;
-        }
-    } else {
-        ASSUME(rotation.rotate_90 || rotation.rotate_180 || rotation.rotate_270);
-
-        uint32_t *rotated = malloc(size.x * size.y * 4);
-        if (rotated == NULL) {
-            goto fail_free_duped_pixel_data;
-        }
-
-        for (int y = 0; y < size.y; y++) {
-            for (int x = 0; x < size.x; x++) {
-                int buffer_x, buffer_y;
-                if (rotation.rotate_90) {
-                    buffer_x = size.y - y - 1;
-                    buffer_y = x;
-                } else if (rotation.rotate_180) {
-                    buffer_x = size.y - y - 1;
-                    buffer_y = size.x - x - 1;
-                } else {
-                    ASSUME(rotation.rotate_270);
-                    buffer_x = y;
-                    buffer_y = size.x - x - 1;
-                }
-
-                int buffer_offset = rotated_size.x * buffer_y + buffer_x;
-                int cursor_offset = size.x * y + x;
-
-                rotated[buffer_offset] = pixel_data[cursor_offset];
-            }
-        }
-
-        ok = gbm_bo_write(bo, rotated, gbm_bo_get_stride(bo) * rotated_size.y);
-
-        free(rotated);
-
-        if (ok != 0) {
-            LOG_ERROR("Couldn't write rotated cursor icon to GBM BO. gbm_bo_write: %s\n", strerror(errno));
-            goto fail_free_duped_pixel_data;
-        }
-    }
-
-    free(pixel_data);
-
-    fb_id = drmdev_add_fb(
-        drmdev,
-        rotated_size.x,
-        rotated_size.y,
-        PIXFMT_ARGB8888,
-        gbm_bo_get_handle(bo).u32,
-        gbm_bo_get_stride(bo),
-        gbm_bo_get_offset(bo, 0),
-        gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_INVALID,
-        gbm_bo_get_modifier(bo)
-    );
-    if (fb_id == 0) {
-        goto fail_destroy_bo;
-    }
-
-    b->n_refs = REFCOUNT_INIT_1;
-    b->icon = icon;
-    b->format = PIXFMT_ARGB8888;
-    b->width = rotated_size.x;
-    b->height = rotated_size.y;
-    b->rotation = rotation;
-    b->drmdev = drmdev_ref(drmdev);
-    b->drm_fb_id = fb_id;
-    b->bo = bo;
-    b->hotspot = get_rotated_hotspot(icon, rotation);
-    return b;
-
-fail_free_duped_pixel_data:
-    free(pixel_data);
-
-fail_destroy_bo:
-    gbm_bo_destroy(bo);
+fail_destroy_bo:
+    gbm_bo_destroy(bo);
 
 fail_free_b:
     free(b);
     return NULL;
 }
 
-static void cursor_buffer_destroy(struct cursor_buffer *buffer) {
+static void capture_buffer_destroy(struct capture_buffer *buffer) {
     drmdev_rm_fb(buffer->drmdev, buffer->drm_fb_id);
     gbm_bo_destroy(buffer->bo);
     drmdev_unref(buffer->drmdev);
     free(buffer);
 }
 
-static void cursor_buffer_destroy_with_locked_drmdev(struct cursor_buffer *buffer) {
-    drmdev_rm_fb_locked(buffer->drmdev, buffer->drm_fb_id);
-    gbm_bo_destroy(buffer->bo);
-    drmdev_unref(buffer->drmdev);
-    free(buffer);
-}
-
-DEFINE_STATIC_REF_OPS(cursor_buffer, n_refs)
-
-static void cursor_buffer_unref_with_locked_drmdev(void *userdata) {
-    struct cursor_buffer *cursor;
-
-    ASSERT_NOT_NULL(userdata);
-    cursor = userdata;
+DEFINE_STATIC_REF_OPS(capture_buffer, n_refs)
 
-    if (refcount_dec(&cursor->n_refs) == false) {
-        cursor_buffer_destroy_with_locked_drmdev(cursor);
+static void capture_job_destroy(struct capture_job *job) {
+    if (job->buffer != NULL) {
+        atomic_flag_clear(&job->buffer->in_use);
+        capture_buffer_unref(job->buffer);
+    }
+    if (job->fence_fd >= 0) {
+        close(job->fence_fd);
     }
+    if (job->snapshots != NULL) {
+        for (size_t i = 0; i < fl_layer_composition_get_n_layers(job->composition); i++) {
+            surface_snapshot_release(job->snapshots + i);
+        }
+        free(job->snapshots);
+    }
+    if (job->composition != NULL) {
+        fl_layer_composition_unref(job->composition);
+    }
+    free(job);
 }
 
-static int select_mode(
-    struct drmdev *drmdev,
-    struct drm_connector **connector_out,
-    struct drm_encoder **encoder_out,
-    struct drm_crtc **crtc_out,
-    drmModeModeInfo **mode_out,
-    const char *desired_videomode
-) {
-    struct drm_connector *connector;
-    struct drm_encoder *encoder;
-    struct drm_crtc *crtc;
-    drmModeModeInfo *mode, *mode_iter;
+static int capture_writeback_frame(struct capture_job *job) {
+    struct pollfd fence_pollfd;
+    uint32_t stride;
+    void *map, *map_data;
     int ok;
 
-    // find any connected connector
-    for_each_connector_in_drmdev(drmdev, connector) {
-        if (connector->variable_state.connection_state == kConnected_DrmConnectionState) {
-            break;
-        }
+    if (job->fence_fd < 0) {
+        // The commit that should've done the writeback failed.
+        return EIO;
     }
 
-    if (connector == NULL) {
-        LOG_ERROR("Could not find a connected connector!\n");
-        return EINVAL;
+    fence_pollfd.fd = job->fence_fd;
+    fence_pollfd.events = POLLIN;
+    do {
+        ok = poll(&fence_pollfd, 1, CAPTURE_FENCE_TIMEOUT_MS);
+    } while (ok < 0 && errno == EINTR);
+
+    if (ok < 0) {
+        ok = errno;
+        LOG_ERROR("Couldn't wait for writeback to finish. poll: %s\n", strerror(ok));
+        return ok;
+    } else if (ok == 0) {
+        LOG_ERROR("Timed out waiting for writeback to finish.\n");
+        return ETIMEDOUT;
     }
 
-    mode = NULL;
-    if (desired_videomode != NULL) {
-        for_each_mode_in_connector(connector, mode_iter) {
-            char *modeline = NULL, *modeline_nohz = NULL;
+    map_data = NULL;
+    map = gbm_bo_map(job->buffer->bo, 0, 0, job->buffer->size.x, job->buffer->size.y, GBM_BO_TRANSFER_READ, &stride, &map_data);
+    if (map == NULL) {
+        ok = errno ? errno : EIO;
+        LOG_ERROR("Couldn't map writeback buffer. gbm_bo_map: %s\n", strerror(ok));
+        return ok;
+    }
 
-            ok = asprintf(&modeline, "%" PRIu16 "x%" PRIu16 "@%" PRIu32, mode_iter->hdisplay, mode_iter->vdisplay, mode_iter->vrefresh);
-            if (ok < 0) {
-                return ENOMEM;
-            }
+    job->callback(
+        job->userdata,
+        0,
+        &(const struct window_frame_capture){
+            .pixels = map,
+            .stride = stride,
+            .size = job->buffer->size,
+            .format = job->buffer->format,
+        }
+    );
 
-            ok = asprintf(&modeline_nohz, "%" PRIu16 "x%" PRIu16, mode_iter->hdisplay, mode_iter->vdisplay);
-            if (ok < 0) {
-                return ENOMEM;
-            }
+    gbm_bo_unmap(job->buffer->bo, map_data);
+    return 0;
+}
 
-            if (streq(modeline, desired_videomode)) {
-                // Probably a bit superfluos, but the refresh rate can still vary in the decimal places.
-                if (mode == NULL || (mode_get_vrefresh(mode_iter) > mode_get_vrefresh(mode))) {
-                    mode = mode_iter;
-                }
-            } else if (streq(modeline_nohz, desired_videomode)) {
-                if (mode == NULL || (mode_get_vrefresh(mode_iter) > mode_get_vrefresh(mode))) {
-                    mode = mode_iter;
-                }
-            }
+/**
+ * @brief Finishes capture jobs, so we don't block the caller (the rendering thread, or a drmdev
+ * callback that's called with the drmdev locked) while waiting for the frame.
+ *
+ * There's one worker for the whole process. It's started with the first capture and then keeps
+ * running, since captures usually come in at the frame rate (for example when sharing the screen).
+ */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool started;
+    struct list_head jobs;
 
-            free(modeline);
-            free(modeline_nohz);
+    /**
+     * @brief The offscreen buffer CPU captures are flattened into. Only used by the worker thread.
+     *
+     * Kept between captures, and freed once there was no job for @ref CAPTURE_BUFFER_IDLE_TIMEOUT_S.
+     */
+    struct fbdev *fbdev;
+} capture_worker = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .started = false,
+    .fbdev = NULL,
+};
+
+static int capture_composition_frame(struct capture_job *job) {
+    struct fbdev_commit_builder *builder;
+    struct vec2i size;
+    const void *frame;
+    int ok, stride;
+
+    if (capture_worker.fbdev != NULL) {
+        size = fbdev_get_size(capture_worker.fbdev);
+        if (size.x != job->size.x || size.y != job->size.y) {
+            fbdev_unref(capture_worker.fbdev);
+            capture_worker.fbdev = NULL;
         }
+    }
 
-        if (mode == NULL) {
-            LOG_ERROR("Didn't find a videomode matching \"%s\"! Falling back to display preferred mode.\n", desired_videomode);
+    if (capture_worker.fbdev == NULL) {
+        capture_worker.fbdev = fbdev_new_offscreen(job->size);
+        if (capture_worker.fbdev == NULL) {
+            return ENOMEM;
         }
     }
 
-    // Find the preferred mode (GPU drivers _should_ always supply a preferred mode, but of course, they don't)
-    // Alternatively, find the mode with the highest width*height. If there are multiple modes with the same w*h,
-    // prefer higher refresh rates. After that, prefer progressive scanout modes.
-    if (mode == NULL) {
-        for_each_mode_in_connector(connector, mode_iter) {
-            if (mode_iter->type & DRM_MODE_TYPE_PREFERRED) {
-                mode = mode_iter;
-                break;
-            } else if (mode == NULL) {
-                mode = mode_iter;
-            } else {
-                int area = mode_iter->hdisplay * mode_iter->vdisplay;
-                int old_area = mode->hdisplay * mode->vdisplay;
+    // Flatten the layers on the CPU, the same way a fbdev or dummy window does.
+    // Mapping the layers' buffers is what reads back the pixels from the GPU, on this thread.
+    builder = fbdev_create_commit_builder(capture_worker.fbdev);
+    if (builder == NULL) {
+        return ENOMEM;
+    }
 
-                if ((area > old_area) || ((area == old_area) && (mode_iter->vrefresh > mode->vrefresh)) ||
-                    ((area == old_area) && (mode_iter->vrefresh == mode->vrefresh) && ((mode->flags & DRM_MODE_FLAG_INTERLACE) == 0))) {
-                    mode = mode_iter;
-                }
-            }
-        }
+    for (size_t i = 0; i < fl_layer_composition_get_n_layers(job->composition); i++) {
+        struct fl_layer *layer = fl_layer_composition_peek_layer(job->composition, i);
 
-        if (mode == NULL) {
-            LOG_ERROR("Could not find a preferred output mode!\n");
-            return EINVAL;
+        ok = surface_snapshot_present_fbdev(job->snapshots + i, &layer->props, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't flatten flutter layer for capturing. surface_snapshot_present_fbdev: %s\n", strerror(ok));
+            goto fail_destroy_builder;
         }
     }
 
-    ASSERT_NOT_NULL(mode);
+    ok = fbdev_commit_builder_commit(builder);
+    if (ok != 0) {
+        goto fail_destroy_builder;
+    }
 
-    // Find the encoder that's linked to the connector right now
-    for_each_encoder_in_drmdev(drmdev, encoder) {
-        if (encoder->encoder->encoder_id == connector->committed_state.encoder_id) {
-            break;
+    // The offscreen fbdev always uses XRGB8888.
+    frame = fbdev_commit_builder_peek_frame(builder, &stride);
+
+    job->callback(
+        job->userdata,
+        0,
+        &(const struct window_frame_capture){
+            .pixels = frame,
+            .stride = stride,
+            .size = job->size,
+            .format = PIXFMT_XRGB8888,
         }
-    }
+    );
 
-    // Otherwise use use any encoder that the connector supports linking to
-    if (encoder == NULL) {
-        for (int i = 0; i < connector->n_encoders; i++, encoder = NULL) {
-            for_each_encoder_in_drmdev(drmdev, encoder) {
-                if (encoder->encoder->encoder_id == connector->encoders[i]) {
-                    break;
-                }
+    fbdev_commit_builder_destroy(builder);
+    return 0;
+
+fail_destroy_builder:
+    fbdev_commit_builder_destroy(builder);
+    return ok;
+}
+
+static void *capture_worker_entry(void *arg) {
+    struct capture_job *job;
+    struct timespec deadline;
+    int ok;
+
+    (void) arg;
+
+    pthread_mutex_lock(&capture_worker.mutex);
+    while (true) {
+        while (list_is_empty(&capture_worker.jobs)) {
+            if (capture_worker.fbdev == NULL) {
+                pthread_cond_wait(&capture_worker.cond, &capture_worker.mutex);
+                continue;
             }
 
-            if (encoder->encoder->possible_crtcs) {
-                // only use this encoder if there's a crtc we can use with it
-                break;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += CAPTURE_BUFFER_IDLE_TIMEOUT_S;
+
+            ok = pthread_cond_timedwait(&capture_worker.cond, &capture_worker.mutex, &deadline);
+            if (ok == ETIMEDOUT && list_is_empty(&capture_worker.jobs)) {
+                fbdev_unref(capture_worker.fbdev);
+                capture_worker.fbdev = NULL;
             }
         }
-    }
 
-    if (encoder == NULL) {
-        LOG_ERROR("Could not find a suitable DRM encoder.\n");
-        return EINVAL;
-    }
+        job = list_first_entry(&capture_worker.jobs, struct capture_job, entry);
+        list_del(&job->entry);
 
-    // Find the CRTC that's currently linked to this encoder
-    for_each_crtc_in_drmdev(drmdev, crtc) {
-        if (crtc->id == encoder->encoder->crtc_id) {
-            break;
+        pthread_mutex_unlock(&capture_worker.mutex);
+
+        if (job->composition != NULL) {
+            ok = capture_composition_frame(job);
+        } else {
+            ok = capture_writeback_frame(job);
         }
-    }
 
-    // Otherwise use any CRTC that this encoder supports linking to
-    if (crtc == NULL) {
-        for_each_crtc_in_drmdev(drmdev, crtc) {
-            if (encoder->encoder->possible_crtcs & crtc->bitmask) {
-                // find a CRTC that is possible to use with this encoder
-                break;
-            }
+        if (ok != 0) {
+            job->callback(job->userdata, ok, NULL);
         }
-    }
 
-    if (crtc == NULL) {
-        LOG_ERROR("Could not find a suitable DRM CRTC.\n");
-        return EINVAL;
+        capture_job_destroy(job);
+
+        pthread_mutex_lock(&capture_worker.mutex);
     }
 
-    *connector_out = connector;
-    *encoder_out = encoder;
-    *crtc_out = crtc;
-    *mode_out = mode;
-    return 0;
+    UNREACHABLE();
 }
 
-static int kms_window_push_composition(struct window *window, struct fl_layer_composition *composition);
-static struct render_surface *kms_window_get_render_surface(struct window *window, struct vec2i size);
+/**
+ * @brief Start the capture worker, if it's not running yet.
+ *
+ * Must be called before any capture job is created, so @ref capture_job_start can't fail.
+ */
+static int capture_worker_start(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ok;
 
-#ifdef HAVE_EGL_GLES2
-static bool kms_window_has_egl_surface(struct window *window);
-static EGLSurface kms_window_get_egl_surface(struct window *window);
-#endif
+    pthread_mutex_lock(&capture_worker.mutex);
 
-static void kms_window_deinit(struct window *window);
-static int kms_window_set_cursor_locked(
-    // clang-format off
-    struct window *window,
-    bool has_enabled, bool enabled,
-    bool has_kind, enum pointer_kind kind,
-    bool has_pos, struct vec2i pos
-    // clang-format on
-);
+    if (capture_worker.started) {
+        pthread_mutex_unlock(&capture_worker.mutex);
+        return 0;
+    }
 
-MUST_CHECK struct window *kms_window_new(
-    // clang-format off
-    struct tracer *tracer,
+    list_inithead(&capture_worker.jobs);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    ok = pthread_create(&thread, &attr, capture_worker_entry, NULL);
+
+    pthread_attr_destroy(&attr);
+
+    if (ok != 0) {
+        LOG_ERROR("Couldn't create frame capture thread. pthread_create: %s\n", strerror(ok));
+        pthread_mutex_unlock(&capture_worker.mutex);
+        return ok;
+    }
+
+    pthread_setname_np(thread, "frame-capture");
+
+    capture_worker.started = true;
+
+    pthread_mutex_unlock(&capture_worker.mutex);
+    return 0;
+}
+
+/**
+ * @brief Let the capture worker finish @param job.
+ *
+ * Never calls the job callback directly, so it's safe to call with the drmdev or window locked.
+ */
+static void capture_job_start(struct capture_job *job) {
+    pthread_mutex_lock(&capture_worker.mutex);
+
+    assert(capture_worker.started);
+
+    list_addtail(&job->entry, &capture_worker.jobs);
+    pthread_cond_signal(&capture_worker.cond);
+
+    pthread_mutex_unlock(&capture_worker.mutex);
+}
+
+static struct capture_job *capture_job_new(window_capture_cb_t callback, void *userdata) {
+    struct capture_job *job;
+
+    job = malloc(sizeof *job);
+    if (job == NULL) {
+        return NULL;
+    }
+
+    job->callback = callback;
+    job->userdata = userdata;
+    job->writeback_connector_id = DRM_ID_NONE;
+    job->buffer = NULL;
+    job->fence_fd = -1;
+    job->composition = NULL;
+    job->snapshots = NULL;
+    job->size = VEC2I(0, 0);
+    return job;
+}
+
+static void on_writeback_fence(void *userdata, int out_fence_fd) {
+    struct capture_job *job;
+
+    job = userdata;
+
+    // We're called with the drmdev locked here, so let the capture worker finish the job.
+    job->fence_fd = out_fence_fd;
+    capture_job_start(job);
+}
+
+static void kms_window_fail_pending_captures_locked(struct window *window, int error) {
+    list_for_each_entry_safe(struct capture_job, job, &window->kms.pending_captures, entry) {
+        list_del(&job->entry);
+        job->callback(job->userdata, error, NULL);
+        capture_job_destroy(job);
+    }
+}
+
+/**
+ * @brief Capture the last frame by compositing its layers on the CPU.
+ */
+static int window_capture_composition_locked(struct window *window, window_capture_cb_t callback, void *userdata) {
+    struct capture_job *job;
+    size_t n_layers;
+    int ok;
+
+    if (window->composition == NULL) {
+        return EAGAIN;
+    }
+
+    job = capture_job_new(callback, userdata);
+    if (job == NULL) {
+        return ENOMEM;
+    }
+
+    job->composition = fl_layer_composition_ref(window->composition);
+    job->size = vec2f_round_to_integer(window->display_size);
+
+    n_layers = fl_layer_composition_get_n_layers(job->composition);
+
+    job->snapshots = calloc(n_layers, sizeof *job->snapshots);
+    if (job->snapshots == NULL && n_layers > 0) {
+        ok = ENOMEM;
+        goto fail_destroy_job;
+    }
+
+    // Snapshot the frames the layers are showing right now, while we hold the window lock.
+    // Otherwise the capture thread could see a newer frame for some of the layers.
+    for (size_t i = 0; i < n_layers; i++) {
+        struct fl_layer *layer = fl_layer_composition_peek_layer(job->composition, i);
+
+        ok = surface_snapshot(layer->surface, job->snapshots + i);
+        if (ok == EOPNOTSUPP || ok == EAGAIN) {
+            // For example, a video platform view. We can't read those back on the CPU,
+            // so the capture just won't show them. The snapshot stays empty.
+            LOG_DEBUG("Flutter layer %zu can't be captured. It will be left out.\n", i);
+        } else if (ok != 0) {
+            goto fail_destroy_job;
+        }
+    }
+
+    capture_job_start(job);
+    return 0;
+
+fail_destroy_job:
+    capture_job_destroy(job);
+    return ok;
+}
+
+int window_capture_frame(struct window *window, window_capture_cb_t callback, void *userdata) {
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(callback);
+
+    ok = capture_worker_start();
+    if (ok != 0) {
+        return ok;
+    }
+
+    window_lock(window);
+
+    ok = EOPNOTSUPP;
+    if (window->capture_frame_locked != NULL) {
+        ok = window->capture_frame_locked(window, callback, userdata);
+    }
+
+    // Fall back to compositing the frame on the CPU if we can't use the display controller.
+    if (ok == EOPNOTSUPP) {
+        ok = window_capture_composition_locked(window, callback, userdata);
+    }
+
+    window_unlock(window);
+
+    return ok;
+}
+
+struct cursor_buffer {
+    refcount_t n_refs;
+
+    const struct pointer_icon *icon;
+    enum pixfmt format;
+    int width, height;
+    drm_plane_transform_t rotation;
+
+    struct drmdev *drmdev;
+    int drm_fb_id;
+    struct gbm_bo *bo;
+
+    struct vec2i hotspot;
+};
+
+static struct vec2i get_rotated_hotspot(const struct pointer_icon *icon, drm_plane_transform_t rotation) {
+    struct vec2i size;
+    struct vec2i hotspot;
+
+    assert(PLANE_TRANSFORM_IS_ONLY_ROTATION(rotation));
+    size = pointer_icon_get_size(icon);
+    hotspot = pointer_icon_get_hotspot(icon);
+
+    if (rotation.rotate_0) {
+        return hotspot;
+    } else if (rotation.rotate_90) {
+        return VEC2I(size.y - hotspot.y - 1, hotspot.x);
+    } else if (rotation.rotate_180) {
+        return VEC2I(size.x - hotspot.x - 1, size.y - hotspot.y - 1);
+    } else {
+        ASSUME(rotation.rotate_270);
+        return VEC2I(hotspot.y, size.x - hotspot.x - 1);
+    }
+}
+
+static struct cursor_buffer *cursor_buffer_new(struct drmdev *drmdev, const struct pointer_icon *icon, drm_plane_transform_t rotation) {
+    struct cursor_buffer *b;
+    struct gbm_bo *bo;
+    uint32_t fb_id;
+    struct vec2i size, rotated_size;
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+    assert(PLANE_TRANSFORM_IS_ONLY_ROTATION(rotation));
+
+    size = pointer_icon_get_size(icon);
+    rotated_size = size;
+
+    b = malloc(sizeof *b);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    if (rotation.rotate_90 || rotation.rotate_270) {
+        rotated_size = vec2i_swap_xy(size);
+    }
+
+    bo = gbm_bo_create(
+        drmdev_get_gbm_device(drmdev),
+        rotated_size.x,
+        rotated_size.y,
+        get_pixfmt_info(PIXFMT_ARGB8888)->gbm_format,
+        GBM_BO_USE_LINEAR | GBM_BO_USE_SCANOUT | GBM_BO_USE_WRITE | GBM_BO_USE_CURSOR
+    );
+    if (bo == NULL) {
+        LOG_ERROR("Could not create GBM buffer for uploading mouse cursor icon. gbm_bo_create: %s\n", strerror(errno));
+        goto fail_free_b;
+    }
+
+    if (gbm_bo_get_stride(bo) != rotated_size.x * 4) {
+        LOG_ERROR("GBM BO has unsupported framebuffer stride %u, expected was: %d\n", gbm_bo_get_stride(bo), size.x * 4);
+        goto fail_destroy_bo;
+    }
+
+    uint32_t *pixel_data = pointer_icon_dup_pixels(icon);
+    if (pixel_data == NULL) {
+        goto fail_destroy_bo;
+    }
+
+    if (rotation.rotate_0) {
+        ok = gbm_bo_write(bo, pixel_data, gbm_bo_get_stride(bo) * size.y);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't write cursor icon to GBM BO. gbm_bo_write: %s\n", strerror(errno));
+            goto fail_free_duped_pixel_data;
+        }
+    } else {
+        ASSUME(rotation.rotate_90 || rotation.rotate_180 || rotation.rotate_270);
+
+        uint32_t *rotated = malloc(size.x * size.y * 4);
+        if (rotated == NULL) {
+            goto fail_free_duped_pixel_data;
+        }
+
+        for (int y = 0; y < size.y; y++) {
+            for (int x = 0; x < size.x; x++) {
+                int buffer_x, buffer_y;
+                if (rotation.rotate_90) {
+                    buffer_x = size.y - y - 1;
+                    buffer_y = x;
+                } else if (rotation.rotate_180) {
+                    buffer_x = size.y - y - 1;
+                    buffer_y = size.x - x - 1;
+                } else {
+                    ASSUME(rotation.rotate_270);
+                    buffer_x = y;
+                    buffer_y = size.x - x - 1;
+                }
+
+                int buffer_offset = rotated_size.x * buffer_y + buffer_x;
+                int cursor_offset = size.x * y + x;
+
+                rotated[buffer_offset] = pixel_data[cursor_offset];
+            }
+        }
+
+        ok = gbm_bo_write(bo, rotated, gbm_bo_get_stride(bo) * rotated_size.y);
+
+        free(rotated);
+
+        if (ok != 0) {
+            LOG_ERROR("Couldn't write rotated cursor icon to GBM BO. gbm_bo_write: %s\n", strerror(errno));
+            goto fail_free_duped_pixel_data;
+        }
+    }
+
+    free(pixel_data);
+
+    fb_id = drmdev_add_fb(
+        drmdev,
+        rotated_size.x,
+        rotated_size.y,
+        PIXFMT_ARGB8888,
+        gbm_bo_get_handle(bo).u32,
+        gbm_bo_get_stride(bo),
+        gbm_bo_get_offset(bo, 0),
+        gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_INVALID,
+        gbm_bo_get_modifier(bo)
+    );
+    if (fb_id == 0) {
+        goto fail_destroy_bo;
+    }
+
+    b->n_refs = REFCOUNT_INIT_1;
+    b->icon = icon;
+    b->format = PIXFMT_ARGB8888;
+    b->width = rotated_size.x;
+    b->height = rotated_size.y;
+    b->rotation = rotation;
+    b->drmdev = drmdev_ref(drmdev);
+    b->drm_fb_id = fb_id;
+    b->bo = bo;
+    b->hotspot = get_rotated_hotspot(icon, rotation);
+    return b;
+
+fail_free_duped_pixel_data:
+    free(pixel_data);
+
+fail_destroy_bo:
+    gbm_bo_destroy(bo);
+
+fail_free_b:
+    free(b);
+    return NULL;
+}
+
+static void cursor_buffer_destroy(struct cursor_buffer *buffer) {
+    drmdev_rm_fb(buffer->drmdev, buffer->drm_fb_id);
+    gbm_bo_destroy(buffer->bo);
+    drmdev_unref(buffer->drmdev);
+    free(buffer);
+}
+
+static void cursor_buffer_destroy_with_locked_drmdev(struct cursor_buffer *buffer) {
+    drmdev_rm_fb_locked(buffer->drmdev, buffer->drm_fb_id);
+    gbm_bo_destroy(buffer->bo);
+    drmdev_unref(buffer->drmdev);
+    free(buffer);
+}
+
+DEFINE_STATIC_REF_OPS(cursor_buffer, n_refs)
+
+static void cursor_buffer_unref_with_locked_drmdev(void *userdata) {
+    struct cursor_buffer *cursor;
+
+    ASSERT_NOT_NULL(userdata);
+    cursor = userdata;
+
+    if (refcount_dec(&cursor->n_refs) == false) {
+        cursor_buffer_destroy_with_locked_drmdev(cursor);
+    }
+}
+
+static int select_mode(
+    struct drmdev *drmdev,
+    struct drm_connector **connector_out,
+    struct drm_encoder **encoder_out,
+    struct drm_crtc **crtc_out,
+    drmModeModeInfo **mode_out,
+    const char *desired_videomode
+) {
+    struct drm_connector *connector;
+    struct drm_encoder *encoder;
+    struct drm_crtc *crtc;
+    drmModeModeInfo *mode, *mode_iter;
+    int ok;
+
+    // find any connected connector
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (drm_connector_is_display_connected(connector)) {
+            break;
+        }
+    }
+
+    if (connector == NULL) {
+        LOG_ERROR("Could not find a connected connector!\n");
+        return EINVAL;
+    }
+
+    mode = NULL;
+    if (desired_videomode != NULL) {
+        for_each_mode_in_connector(connector, mode_iter) {
+            char *modeline = NULL, *modeline_nohz = NULL;
+
+            ok = asprintf(&modeline, "%" PRIu16 "x%" PRIu16 "@%" PRIu32, mode_iter->hdisplay, mode_iter->vdisplay, mode_iter->vrefresh);
+            if (ok < 0) {
+                return ENOMEM;
+            }
+
+            ok = asprintf(&modeline_nohz, "%" PRIu16 "x%" PRIu16, mode_iter->hdisplay, mode_iter->vdisplay);
+            if (ok < 0) {
+                return ENOMEM;
+            }
+
+            if (streq(modeline, desired_videomode)) {
+                // Probably a bit superfluos, but the refresh rate can still vary in the decimal places.
+                if (mode == NULL || (mode_get_vrefresh(mode_iter) > mode_get_vrefresh(mode))) {
+                    mode = mode_iter;
+                }
+            } else if (streq(modeline_nohz, desired_videomode)) {
+                if (mode == NULL || (mode_get_vrefresh(mode_iter) > mode_get_vrefresh(mode))) {
+                    mode = mode_iter;
+                }
+            }
+
+            free(modeline);
+            free(modeline_nohz);
+        }
+
+        if (mode == NULL) {
+            LOG_ERROR("Didn't find a videomode matching \"%s\"! Falling back to display preferred mode.\n", desired_videomode);
+        }
+    }
+
+    // Find the preferred mode (GPU drivers _should_ always supply a preferred mode, but of course, they don't)
+    // Alternatively, find the mode with the highest width*height. If there are multiple modes with the same w*h,
+    // prefer higher refresh rates. After that, prefer progressive scanout modes.
+    if (mode == NULL) {
+        for_each_mode_in_connector(connector, mode_iter) {
+            if (mode_iter->type & DRM_MODE_TYPE_PREFERRED) {
+                mode = mode_iter;
+                break;
+            } else if (mode == NULL) {
+                mode = mode_iter;
+            } else {
+                int area = mode_iter->hdisplay * mode_iter->vdisplay;
+                int old_area = mode->hdisplay * mode->vdisplay;
+
+                if ((area > old_area) || ((area == old_area) && (mode_iter->vrefresh > mode->vrefresh)) ||
+                    ((area == old_area) && (mode_iter->vrefresh == mode->vrefresh) && ((mode->flags & DRM_MODE_FLAG_INTERLACE) == 0))) {
+                    mode = mode_iter;
+                }
+            }
+        }
+
+        if (mode == NULL) {
+            LOG_ERROR("Could not find a preferred output mode!\n");
+            return EINVAL;
+        }
+    }
+
+    ASSERT_NOT_NULL(mode);
+
+    // Find the encoder that's linked to the connector right now
+    for_each_encoder_in_drmdev(drmdev, encoder) {
+        if (encoder->encoder->encoder_id == connector->committed_state.encoder_id) {
+            break;
+        }
+    }
+
+    // Otherwise use use any encoder that the connector supports linking to
+    if (encoder == NULL) {
+        for (int i = 0; i < connector->n_encoders; i++, encoder = NULL) {
+            for_each_encoder_in_drmdev(drmdev, encoder) {
+                if (encoder->encoder->encoder_id == connector->encoders[i]) {
+                    break;
+                }
+            }
+
+            if (encoder->encoder->possible_crtcs) {
+                // only use this encoder if there's a crtc we can use with it
+                break;
+            }
+        }
+    }
+
+    if (encoder == NULL) {
+        LOG_ERROR("Could not find a suitable DRM encoder.\n");
+        return EINVAL;
+    }
+
+    // Find the CRTC that's currently linked to this encoder
+    for_each_crtc_in_drmdev(drmdev, crtc) {
+        if (crtc->id == encoder->encoder->crtc_id) {
+            break;
+        }
+    }
+
+    // Otherwise use any CRTC that this encoder supports linking to
+    if (crtc == NULL) {
+        for_each_crtc_in_drmdev(drmdev, crtc) {
+            if (encoder->encoder->possible_crtcs & crtc->bitmask) {
+                // find a CRTC that is possible to use with this encoder
+                break;
+            }
+        }
+    }
+
+    if (crtc == NULL) {
+        LOG_ERROR("Could not find a suitable DRM CRTC.\n");
+        return EINVAL;
+    }
+
+    *connector_out = connector;
+    *encoder_out = encoder;
+    *crtc_out = crtc;
+    *mode_out = mode;
+    return 0;
+}
+
+static int kms_window_push_composition(struct window *window, struct fl_layer_composition *composition);
+static struct render_surface *kms_window_get_render_surface(struct window *window, struct vec2i size);
+
+#ifdef HAVE_EGL_GLES2
+static bool kms_window_has_egl_surface(struct window *window);
+static EGLSurface kms_window_get_egl_surface(struct window *window);
+#endif
+
+static void kms_window_deinit(struct window *window);
+static int kms_window_set_cursor_locked(
+    // clang-format off
+    struct window *window,
+    bool has_enabled, bool enabled,
+    bool has_icon, const struct pointer_icon *icon,
+    bool has_pos, struct vec2i pos
+    // clang-format on
+);
+static void kms_window_suspend_locked(struct window *window);
+static int kms_window_resume_locked(struct window *window);
+static void kms_window_update_orientation_locked(struct window *window);
+static int kms_window_on_hotplug_locked(struct window *window, bool *geometry_changed_out);
+static int kms_window_set_display_color_locked(struct window *window, const struct display_color_settings *settings);
+static int kms_window_capture_frame_locked(struct window *window, window_capture_cb_t callback, void *userdata);
+static int kms_window_set_display_power_locked(struct window *window, enum display_power_state state, double dim_brightness);
+
+/**
+ * @brief True if @param format can be scanned out on a primary plane of the window's CRTC
+ * and the renderer can render into it.
+ */
+static bool kms_window_supports_pixel_format(struct window *window, enum pixfmt format) {
+    struct drm_plane *plane;
+    bool has_plane;
+
+    has_plane = false;
+    for_each_plane_in_drmdev(window->kms.drmdev, plane) {
+        if (!(plane->possible_crtcs & window->kms.crtc->bitmask) || plane->type != kPrimary_DrmPlaneType) {
+            continue;
+        }
+
+        // The primary plane is the bottom-most one, so it's fine if it only supports the opaque variant.
+        if (plane->supported_formats[format] || plane->supported_formats[pixfmt_opaque(format)]) {
+            has_plane = true;
+            break;
+        }
+    }
+
+    if (!has_plane) {
+        LOG_DEBUG("No primary plane supports the pixel format %s.\n", get_pixfmt_info(format)->name);
+        return false;
+    }
+
+    if (window->renderer_type == kOpenGL_RendererType) {
+#ifdef HAVE_EGL_GLES2
+        if (gl_renderer_has_forced_pixel_format(window->gl_renderer)) {
+            // The EGL contexts were already created with a config for this pixel format.
+            return gl_renderer_get_forced_pixel_format(window->gl_renderer) == format;
+        }
+
+        if (gl_renderer_choose_config_direct(window->gl_renderer, format) == EGL_NO_CONFIG_KHR) {
+            LOG_DEBUG("No EGL config supports the pixel format %s.\n", get_pixfmt_info(format)->name);
+            return false;
+        }
+
+        return true;
+#else
+        UNREACHABLE();
+#endif
+    } else {
+#ifdef HAVE_VULKAN
+        if (!vk_renderer_supports_color_attachment_format(window->vk_renderer, get_pixfmt_info(format)->vk_format)) {
+            LOG_DEBUG("There's no vulkan format for the pixel format %s that can be rendered into.\n", get_pixfmt_info(format)->name);
+            return false;
+        }
+
+        return true;
+#else
+        UNREACHABLE();
+#endif
+    }
+}
+
+/**
+ * @brief Make sure the display controller and the renderer agree on the pixel format we'll use.
+ *
+ * If no pixel format was forced and @param prefer_deep_color is true, selects a 10-bit format
+ * if possible. Otherwise the render surfaces choose the (8-bit) default format.
+ *
+ * @returns Zero if successful, EINVAL if the forced pixel format can't be used.
+ */
+static int kms_window_select_pixel_format(struct window *window, bool prefer_deep_color) {
+    static const enum pixfmt deep_color_formats[] = { PIXFMT_ARGB2101010, PIXFMT_XRGB2101010 };
+
+    if (window->has_forced_pixel_format) {
+        if (!kms_window_supports_pixel_format(window, window->forced_pixel_format)) {
+            LOG_ERROR(
+                "The pixel format %s is not supported by both the display controller and the renderer.\n",
+                get_pixfmt_info(window->forced_pixel_format)->name
+            );
+            return EINVAL;
+        }
+
+        return 0;
+    }
+
+    if (!prefer_deep_color) {
+        return 0;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(deep_color_formats); i++) {
+        if (kms_window_supports_pixel_format(window, deep_color_formats[i])) {
+            LOG_DEBUG("Using pixel format %s for deep color output.\n", get_pixfmt_info(deep_color_formats[i])->name);
+            window->has_forced_pixel_format = true;
+            window->forced_pixel_format = deep_color_formats[i];
+            return 0;
+        }
+    }
+
+    LOG_ERROR("No 10-bit pixel format is supported by both the display controller and the renderer. Using 8 bits per channel.\n");
+    return 0;
+}
+
+MUST_CHECK struct window *kms_window_new(
+    // clang-format off
+    struct tracer *tracer,
     struct frame_scheduler *scheduler,
     enum renderer_type renderer_type,
     struct gl_renderer *gl_renderer,
@@ -897,544 +1920,1913 @@ MUST_CHECK struct window *kms_window_new(
     bool has_orientation, enum device_orientation orientation,
     bool has_explicit_dimensions, int width_mm, int height_mm,
     bool has_forced_pixel_format, enum pixfmt forced_pixel_format,
+    const struct display_hdr_metadata *hdr_metadata,
     struct drmdev *drmdev,
     const char *desired_videomode
     // clang-format on
 ) {
-    struct window *window;
-    struct drm_connector *selected_connector;
-    struct drm_encoder *selected_encoder;
-    struct drm_crtc *selected_crtc;
-    drmModeModeInfo *selected_mode;
-    bool has_dimensions;
+    struct window *window;
+    struct drm_connector *selected_connector;
+    struct drm_encoder *selected_encoder;
+    struct drm_crtc *selected_crtc;
+    drmModeModeInfo *selected_mode;
+    bool has_dimensions;
+    int ok;
+
+    ASSERT_NOT_NULL(drmdev);
+
+#if !defined(HAVE_VULKAN)
+    ASSUME(renderer_type != kVulkan_RendererType);
+#endif
+
+#if !defined(HAVE_EGL_GLES2)
+    ASSUME(renderer_type != kOpenGL_RendererType);
+#endif
+
+    // if opengl --> gl_renderer != NULL && vk_renderer == NULL
+    assert(renderer_type != kOpenGL_RendererType || (gl_renderer != NULL && vk_renderer == NULL));
+
+    // if vulkan --> vk_renderer != NULL && gl_renderer == NULL
+    assert(renderer_type != kVulkan_RendererType || (vk_renderer != NULL && gl_renderer == NULL));
+
+    window = malloc(sizeof *window);
+    if (window == NULL) {
+        return NULL;
+    }
+
+    ok = select_mode(drmdev, &selected_connector, &selected_encoder, &selected_crtc, &selected_mode, desired_videomode);
+    if (ok != 0) {
+        goto fail_free_window;
+    }
+
+    if (has_explicit_dimensions) {
+        has_dimensions = true;
+    } else if (selected_connector->variable_state.width_mm % 10 || selected_connector->variable_state.height_mm % 10) {
+        // as a heuristic, assume the physical dimensions are valid if they're not both multiples of 10.
+        // dimensions like 160x90mm, 150x100mm are often bogus.
+        has_dimensions = true;
+        width_mm = selected_connector->variable_state.width_mm;
+        height_mm = selected_connector->variable_state.height_mm;
+    } else if (selected_connector->type == DRM_MODE_CONNECTOR_DSI
+        && selected_connector->variable_state.width_mm == 0
+        && selected_connector->variable_state.height_mm == 0) {
+        // assume this is the official Raspberry Pi DSI display.
+        has_dimensions = true;
+        width_mm = 155;
+        height_mm = 86;
+    } else {
+        has_dimensions = false;
+    }
+
+    ok = window_init(
+        // clang-format off
+        window,
+        tracer,
+        scheduler,
+        has_rotation, rotation,
+        has_orientation, orientation,
+        selected_mode->hdisplay, selected_mode->vdisplay,
+        has_dimensions, width_mm, height_mm,
+        mode_get_vrefresh(selected_mode),
+        has_forced_pixel_format, forced_pixel_format
+        // clang-format on
+    );
+    if (ok != 0) {
+        free(window);
+        return NULL;
+    }
+
+    LOG_DEBUG_UNPREFIXED(
+        "display mode:\n"
+        "  resolution: %" PRIu16 " x %" PRIu16
+        "\n"
+        "  refresh rate: %fHz\n"
+        "  physical size: %dmm x %dmm\n"
+        "  flutter device pixel ratio: %f\n"
+        "  pixel format: %s\n",
+        selected_mode->hdisplay,
+        selected_mode->vdisplay,
+        mode_get_vrefresh(selected_mode),
+        width_mm,
+        height_mm,
+        window->pixel_ratio,
+        has_forced_pixel_format ? get_pixfmt_info(forced_pixel_format)->name : "(any)"
+    );
+
+    window->kms.drmdev = drmdev_ref(drmdev);
+    window->kms.connector = selected_connector;
+    window->kms.encoder = selected_encoder;
+    window->kms.crtc = selected_crtc;
+    window->kms.mode = *selected_mode;
+    window->kms.desired_videomode = desired_videomode != NULL ? strdup(desired_videomode) : NULL;
+    window->kms.should_apply_mode = true;
+    window->kms.crtc_to_disable = NULL;
+    window->kms.disconnected = false;
+    window->kms.suspended = false;
+    window->kms.cursor = NULL;
+    window->kms.pointer_icon = NULL;
+    window->kms.default_pointer_icon = pointer_icon_for_details(POINTER_KIND_BASIC, window->pixel_ratio);
+    display_color_settings_init(&window->kms.display_color);
+    window->kms.should_apply_display_color = false;
+    window->kms.dim_factor = 1.0;
+    window->kms.display_off = false;
+    window->kms.has_hdr_metadata = hdr_metadata != NULL;
+    if (hdr_metadata != NULL) {
+        window->kms.hdr_metadata = *hdr_metadata;
+    }
+    for (int i = 0; i < N_CAPTURE_BUFFERS; i++) {
+        window->kms.capture_buffers[i] = NULL;
+    }
+    list_inithead(&window->kms.pending_captures);
+    window->kms.writeback_connector = NULL;
+    window->kms.writeback_format = PIXFMT_XRGB8888;
+    window->kms.last_capture_ns = 0;
+    window->kms.has_capture_timeout = false;
+    window->renderer_type = renderer_type;
+    if (gl_renderer != NULL) {
+#ifdef HAVE_EGL_GLES2
+        window->gl_renderer = gl_renderer_ref(gl_renderer);
+#else
+        UNREACHABLE();
+#endif
+    }
+    if (vk_renderer != NULL) {
+#ifdef HAVE_VULKAN
+        window->vk_renderer = vk_renderer_ref(vk_renderer);
+#else
+        UNREACHABLE();
+#endif
+    } else {
+        window->vk_renderer = NULL;
+    }
+
+    // HDR content needs more than 8 bits per channel, otherwise it bands even worse than SDR.
+    ok = kms_window_select_pixel_format(window, hdr_metadata != NULL);
+    if (ok != 0) {
+        goto fail_deinit_window;
+    }
+
+    window->push_composition = kms_window_push_composition;
+    window->get_render_surface = kms_window_get_render_surface;
+#ifdef HAVE_EGL_GLES2
+    window->has_egl_surface = kms_window_has_egl_surface;
+    window->get_egl_surface = kms_window_get_egl_surface;
+#endif
+    window->deinit = kms_window_deinit;
+    window->set_cursor_locked = kms_window_set_cursor_locked;
+    window->suspend_locked = kms_window_suspend_locked;
+    window->resume_locked = kms_window_resume_locked;
+    window->update_orientation_locked = kms_window_update_orientation_locked;
+    window->on_hotplug_locked = kms_window_on_hotplug_locked;
+    window->set_display_color_locked = kms_window_set_display_color_locked;
+    window->capture_frame_locked = kms_window_capture_frame_locked;
+    window->set_display_power_locked = kms_window_set_display_power_locked;
+    return window;
+
+fail_deinit_window:
+    kms_window_deinit(window);
+    free(window);
+    return NULL;
+
+fail_free_window:
+    free(window);
+    return NULL;
+}
+
+void kms_window_deinit(struct window *window) {
+    /// TODO: Do we really need to do this?
+    /*
+    struct kms_req_builder *builder;
+    struct kms_req *req;
+    int ok;
+
+    builder = drmdev_create_request_builder(window->kms.drmdev, window->kms.crtc->id);
+    ASSERT_NOT_NULL(builder);
+
+    ok = kms_req_builder_unset_mode(builder);
+    ASSERT_EQUALS(ok, 0);
+
+    req = kms_req_builder_build(builder);
+    ASSERT_NOT_NULL(req);
+
+    kms_req_builder_unref(builder);
+
+    ok = kms_req_commit_blocking(req, NULL);
+    ASSERT_EQUALS(ok, 0);
+    (void) ok;
+
+    kms_req_unref(req);
+    */
+
+    kms_window_fail_pending_captures_locked(window, ECANCELED);
+    for (int i = 0; i < N_CAPTURE_BUFFERS; i++) {
+        if (window->kms.capture_buffers[i] != NULL) {
+            capture_buffer_unref(window->kms.capture_buffers[i]);
+        }
+    }
+    if (window->kms.cursor != NULL) {
+        cursor_buffer_unref(window->kms.cursor);
+    }
+    if (window->kms.desired_videomode != NULL) {
+        free(window->kms.desired_videomode);
+    }
+    if (window->render_surface != NULL) {
+        surface_unref(CAST_SURFACE(window->render_surface));
+    }
+    if (window->gl_renderer != NULL) {
+#ifdef HAVE_EGL_GLES2
+        gl_renderer_unref(window->gl_renderer);
+#else
+        UNREACHABLE();
+#endif
+    }
+    if (window->vk_renderer != NULL) {
+#ifdef HAVE_VULKAN
+        vk_renderer_unref(window->vk_renderer);
+#else
+        UNREACHABLE();
+#endif
+    }
+    drmdev_unref(window->kms.drmdev);
+    window_deinit(window);
+}
+
+struct frame {
+    struct window *window;
+    struct tracer *tracer;
+    struct kms_req *req;
+    bool unset_should_apply_mode_on_commit;
+
+    /**
+     * @brief The CRTC this frame turns off, or NULL.
+     */
+    struct drm_crtc *disables_crtc;
+
+    /**
+     * @brief True if this frame applies changed display color settings. If it never makes it
+     * to the screen, the next frame needs to apply them instead.
+     */
+    bool applies_display_color;
+};
+
+static void frame_destroy(struct frame *frame) {
+    window_unref(frame->window);
+    tracer_unref(frame->tracer);
+    kms_req_unref(frame->req);
+    free(frame);
+}
+
+static void frame_on_not_presented(struct frame *frame) {
+    // The frame scheduler calls the present and cancel callbacks from frame_scheduler_present_frame,
+    // so the window is still locked by kms_window_push_composition_locked here.
+    if (frame->applies_display_color) {
+        frame->window->kms.should_apply_display_color = true;
+    }
+}
+
+UNUSED static void on_scanout(struct drmdev *drmdev, uint64_t vblank_ns, void *userdata) {
+    ASSERT_NOT_NULL(drmdev);
+    (void) drmdev;
+    (void) vblank_ns;
+    (void) userdata;
+
+    /// TODO: What should we do here?
+}
+
+static void on_present_frame(void *userdata) {
+    struct frame *frame;
+    int ok;
+
+    ASSERT_NOT_NULL(userdata);
+
+    frame = userdata;
+
+    TRACER_BEGIN(frame->tracer, "kms_req_commit_nonblocking");
+    ok = kms_req_commit_blocking(frame->req, NULL);
+    TRACER_END(frame->tracer, "kms_req_commit_nonblocking");
+
+    if (ok != 0) {
+        LOG_ERROR("Could not commit frame request.\n");
+        frame_on_not_presented(frame);
+    } else if (frame->disables_crtc != NULL && frame->window->kms.crtc_to_disable == frame->disables_crtc) {
+        // The window is still locked here, see frame_on_not_presented.
+        frame->window->kms.crtc_to_disable = NULL;
+    }
+
+    frame_destroy(frame);
+}
+
+static void on_cancel_frame(void *userdata) {
+    struct frame *frame;
+    ASSERT_NOT_NULL(userdata);
+
+    frame = userdata;
+
+    frame_on_not_presented(frame);
+    frame_destroy(frame);
+}
+
+static int kms_window_apply_display_color_locked(struct window *window, struct kms_req_builder *builder) {
+    struct display_color_settings dimmed;
+    const struct display_color_settings *settings;
+    struct drm_color_lut *lut;
+    struct drm_color_ctm ctm;
+    struct drm_crtc *crtc;
+    bool identity, include_ctm_in_lut;
+    int ok;
+
+    // Dimming is done on top of the user's display color settings.
+    dimmed = window->kms.display_color;
+    dimmed.brightness *= window->kms.dim_factor;
+
+    settings = &dimmed;
+    crtc = window->kms.crtc;
+    identity = display_color_settings_is_identity(settings);
+
+    if (identity) {
+        ok = kms_req_builder_set_ctm(builder, NULL);
+    } else {
+        // Without a gamma LUT, the CTM is the only place left to apply the brightness (and the dimming).
+        display_color_fill_ctm(settings, crtc->gamma_lut_size < 2, &ctm);
+        ok = kms_req_builder_set_ctm(builder, &ctm);
+    }
+    if (ok != 0 && ok != EOPNOTSUPP) {
+        return ok;
+    }
+
+    // If there's no CTM, we can at least do the per-channel part of it in the gamma LUT.
+    include_ctm_in_lut = ok == EOPNOTSUPP;
+
+    if (identity || crtc->gamma_lut_size < 2) {
+        ok = kms_req_builder_set_gamma_lut(builder, 0, NULL);
+    } else {
+        lut = malloc(crtc->gamma_lut_size * sizeof *lut);
+        if (lut == NULL) {
+            return ENOMEM;
+        }
+
+        display_color_fill_gamma_lut(settings, include_ctm_in_lut, crtc->gamma_lut_size, lut);
+
+        ok = kms_req_builder_set_gamma_lut(builder, crtc->gamma_lut_size, lut);
+
+        free(lut);
+    }
+    if (ok != 0 && ok != EOPNOTSUPP) {
+        return ok;
+    }
+
+    return 0;
+}
+
+static int kms_window_apply_output_format_locked(struct window *window, struct kms_req_builder *builder) {
+    struct drm_hdr_output_metadata blob;
+    enum pixfmt format;
+    uint32_t bpc;
+    int ok;
+
+    format = window->has_forced_pixel_format ? window->forced_pixel_format : PIXFMT_ARGB8888;
+
+    // Most drivers only send 8 bits per channel to the display by default, which would
+    // throw away the extra precision of deep color framebuffers.
+    bpc = get_pixfmt_info(format)->bit_depth / 3;
+    if (bpc > 8) {
+        ok = kms_req_builder_set_max_bpc(builder, bpc);
+        if (ok == EOPNOTSUPP) {
+            LOG_DEBUG("The connector doesn't support setting the maximum bits per channel.\n");
+        } else if (ok != 0) {
+            return ok;
+        }
+    }
+
+    // Always set the colorspace and HDR metadata if supported, so we don't keep
+    // the HDR mode some other DRM master left behind.
+    ok = kms_req_builder_set_colorspace(builder, window->kms.has_hdr_metadata ? kBT2020RGB_DrmColorspace : kDefault_DrmColorspace);
+    if (ok == EOPNOTSUPP && window->kms.has_hdr_metadata) {
+        LOG_ERROR("The connector doesn't support the BT.2020 colorspace. Colors will be off in HDR mode.\n");
+    } else if (ok != 0 && ok != EOPNOTSUPP) {
+        return ok;
+    }
+
+    if (window->kms.has_hdr_metadata) {
+        display_hdr_metadata_fill_blob(&window->kms.hdr_metadata, &blob);
+        ok = kms_req_builder_set_hdr_output_metadata(builder, &blob);
+    } else {
+        ok = kms_req_builder_set_hdr_output_metadata(builder, NULL);
+    }
+    if (ok == EOPNOTSUPP && window->kms.has_hdr_metadata) {
+        LOG_ERROR("The connector doesn't support HDR output metadata. The display will stay in SDR mode.\n");
+    } else if (ok != 0 && ok != EOPNOTSUPP) {
+        return ok;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Route the writeback connector to our CRTC if a capture is pending, or detach it again
+ * if no frame was captured for a while.
+ *
+ * Both need a modeset, so the connector stays routed between captures.
+ */
+static int kms_window_route_writeback_locked(struct window *window, struct kms_req_builder *builder) {
+    struct drm_connector *connector;
+
+    connector = window->kms.writeback_connector;
+    if (connector == NULL) {
+        return 0;
+    }
+
+    if (!list_is_empty(&window->kms.pending_captures)) {
+        // This doesn't need a modeset if the connector is already routed to us.
+        return kms_req_builder_route_writeback_connector(builder, connector->id, true);
+    }
+
+    if (connector->committed_state.crtc_id == window->kms.crtc->id &&
+        get_monotonic_time() - window->kms.last_capture_ns >= CAPTURE_DETACH_DELAY_NS) {
+        return kms_req_builder_route_writeback_connector(builder, connector->id, false);
+    }
+
+    return 0;
+}
+
+static int kms_window_push_composition_locked(struct window *window, struct fl_layer_composition *composition) {
+    struct kms_req_builder *builder;
+    struct kms_req *req;
+    struct frame *frame;
+    bool applies_display_color;
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(composition);
+
+    applies_display_color = false;
+
+    // If flutter won't request frames (because the vsync callback is broken),
+    // we'll wait here for the previous frame to be presented / rendered.
+    // Otherwise the surface_swap_buffers at the bottom might allocate an
+    // additional buffer and we'll potentially use more buffers than we're
+    // trying to use.
+    // if (!window->use_frame_requests) {
+    //     TRACER_BEGIN(window->tracer, "window_request_frame_and_wait_for_begin");
+    //     ok = window_request_frame_and_wait_for_begin(window);
+    //     TRACER_END(window->tracer, "window_request_frame_and_wait_for_begin");
+    //     if (ok != 0) {
+    //         LOG_ERROR("Could not wait for frame begin.\n");
+    //         return ok;
+    //     }
+    // }
+
+    /// TODO: If we don't have new revisions, we don't need to scanout anything.
+    fl_layer_composition_swap_ptrs(&window->composition, composition);
+
+    if (window->kms.suspended || window->kms.disconnected || window->kms.display_off) {
+        // We're not allowed to (or can't) present anything right now.
+        // We'll present window->composition when we're resumed / a display is connected / it's turned on again.
+        return 0;
+    }
+
+    builder = drmdev_create_request_builder(window->kms.drmdev, window->kms.crtc->id);
+    if (builder == NULL) {
+        ok = ENOMEM;
+        goto fail_unref_builder;
+    }
+
+    // We only set the mode once, at the first atomic request.
+    if (window->kms.should_apply_mode) {
+        ok = kms_req_builder_set_connector(builder, window->kms.connector->id);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't select connector.\n");
+            goto fail_unref_builder;
+        }
+
+        ok = kms_req_builder_set_mode(builder, &window->kms.mode);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't apply output mode.\n");
+            goto fail_unref_builder;
+        }
+
+        if (window->kms.crtc_to_disable != NULL) {
+            ok = kms_req_builder_disable_crtc(builder, window->kms.crtc_to_disable->id);
+            if (ok != 0) {
+                LOG_ERROR("Couldn't turn off the previous CRTC.\n");
+                goto fail_unref_builder;
+            }
+        }
+
+        ok = kms_window_apply_output_format_locked(window, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't apply output format.\n");
+            goto fail_unref_builder;
+        }
+    }
+
+    applies_display_color = window->kms.should_apply_display_color;
+    if (applies_display_color) {
+        ok = kms_window_apply_display_color_locked(window, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't apply display color settings.\n");
+            goto fail_unref_builder;
+        }
+
+        // Set again if the frame doesn't make it to the screen.
+        window->kms.should_apply_display_color = false;
+    }
+
+    ok = kms_window_route_writeback_locked(window, builder);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't route writeback connector for capturing frames.\n");
+        goto fail_unref_builder;
+    }
+
+    // Only one writeback can be attached per commit, further captures are done with the following frames.
+    if (!list_is_empty(&window->kms.pending_captures)) {
+        struct capture_job *job = list_first_entry(&window->kms.pending_captures, struct capture_job, entry);
+
+        ok = kms_req_builder_set_writeback(builder, job->writeback_connector_id, job->buffer->drm_fb_id, on_writeback_fence, job);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't attach writeback connector for capturing the frame. kms_req_builder_set_writeback: %s\n", strerror(ok));
+            goto fail_unref_builder;
+        }
+
+        // The builder owns the job now and calls on_writeback_fence once the request was committed (or destroyed).
+        list_del(&job->entry);
+    }
+
+    for (size_t i = 0; i < fl_layer_composition_get_n_layers(composition); i++) {
+        struct fl_layer *layer = fl_layer_composition_peek_layer(composition, i);
+
+        ok = surface_present_kms(layer->surface, &layer->props, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't present flutter layer on screen. surface_present_kms: %s\n", strerror(ok));
+            goto fail_unref_builder;
+        }
+    }
+
+    // add cursor infos
+    if (window->kms.cursor != NULL) {
+        ok = kms_req_builder_push_fb_layer(
+            builder,
+            &(const struct kms_fb_layer){
+                .drm_fb_id = window->kms.cursor->drm_fb_id,
+                .format = window->kms.cursor->format,
+                .has_modifier = true,
+                .modifier = DRM_FORMAT_MOD_LINEAR,
+                .src_x = 0,
+                .src_y = 0,
+                .src_w = ((uint16_t) window->kms.cursor->width) << 16,
+                .src_h = ((uint16_t) window->kms.cursor->height) << 16,
+                .dst_x = window->cursor_pos.x - window->kms.cursor->hotspot.x,
+                .dst_y = window->cursor_pos.y - window->kms.cursor->hotspot.y,
+                .dst_w = window->kms.cursor->width,
+                .dst_h = window->kms.cursor->height,
+                .has_rotation = false,
+                .rotation = PLANE_TRANSFORM_NONE,
+                .has_in_fence_fd = false,
+                .in_fence_fd = 0,
+                .prefer_cursor = true,
+            },
+            cursor_buffer_unref_with_locked_drmdev,
+            NULL,
+            window->kms.cursor
+        );
+        if (ok != 0) {
+            LOG_ERROR("Couldn't present cursor.\n");
+        } else {
+            cursor_buffer_ref(window->kms.cursor);
+        }
+    }
+
+    req = kms_req_builder_build(builder);
+    if (req == NULL) {
+        goto fail_unref_builder;
+    }
+
+    kms_req_builder_unref(builder);
+    builder = NULL;
+
+    frame = malloc(sizeof *frame);
+    if (frame == NULL) {
+        goto fail_unref_req;
+    }
+
+    frame->window = window_ref(window);
+    frame->req = req;
+    frame->tracer = tracer_ref(window->tracer);
+    frame->unset_should_apply_mode_on_commit = window->kms.should_apply_mode;
+    frame->disables_crtc = window->kms.should_apply_mode ? window->kms.crtc_to_disable : NULL;
+    frame->applies_display_color = applies_display_color;
+
+    frame_scheduler_present_frame(window->frame_scheduler, on_present_frame, frame, on_cancel_frame);
+
+    // if (window->present_mode == kDoubleBufferedVsync_PresentMode) {
+    //     TRACER_BEGIN(window->tracer, "kms_req_builder_commit");
+    //     ok = kms_req_commit(req, /* blocking: */ false);
+    //     TRACER_END(window->tracer, "kms_req_builder_commit");
+    //
+    //     if (ok != 0) {
+    //         LOG_ERROR("Could not commit frame request.\n");
+    //         goto fail_unref_window2;
+    //     }
+    //
+    //     if (window->set_set_mode) {
+    //         window->set_mode = false;
+    //         window->set_set_mode = false;
+    //     }
+    // } else {
+    //     ASSERT_EQUALS(window->present_mode, kTripleBufferedVsync_PresentMode);
+    //
+    //     if (window->present_immediately) {
+    //         TRACER_BEGIN(window->tracer, "kms_req_builder_commit");
+    //         ok = kms_req_commit(req, /* blocking: */ false);
+    //         TRACER_END(window->tracer, "kms_req_builder_commit");
+    //
+    //         if (ok != 0) {
+    //             LOG_ERROR("Could not commit frame request.\n");
+    //             goto fail_unref_window2;
+    //         }
+    //
+    //         if (window->set_set_mode) {
+    //             window->set_mode = false;
+    //             window->set_set_mode = false;
+    //         }
+    //
+    //         window->present_immediately = false;
+    //     } else {
+    //         if (window->next_frame != NULL) {
+    //             /// FIXME: Call the release callbacks when the kms_req is destroyed, not when it's unrefed.
+    //             /// Not sure this here will lead to the release callbacks being called multiple times.
+    //             kms_req_call_release_callbacks(window->next_frame);
+    //             kms_req_unref(window->next_frame);
+    //         }
+    //
+    //         window->next_frame = kms_req_ref(req);
+    //         window->set_set_mode = window->set_mode;
+    //     }
+    // }
+
+    // KMS Req is committed now and drmdev keeps a ref
+    // on it internally, so we don't need to keep this one.
+    // kms_req_unref(req);
+
+    // window_on_rendering_complete(window);
+
+    return 0;
+
+fail_unref_req:
+    kms_req_unref(req);
+    goto fail_restore_display_color;
+
+fail_unref_builder:
+    kms_req_builder_unref(builder);
+
+fail_restore_display_color:
+    if (applies_display_color) {
+        window->kms.should_apply_display_color = true;
+    }
+    return ok;
+}
+
+static int kms_window_push_composition(struct window *window, struct fl_layer_composition *composition) {
+    int ok;
+
+    window_lock(window);
+
+    ok = kms_window_push_composition_locked(window, composition);
+
+    window_unlock(window);
+
+    return ok;
+}
+
+static bool count_modifiers_for_pixel_format(
+    UNUSED struct drm_plane *plane,
+    UNUSED int index,
+    enum pixfmt pixel_format,
+    UNUSED uint64_t modifier,
+    void *userdata
+) {
+    struct {
+        enum pixfmt format;
+        uint64_t *modifiers;
+        size_t n_modifiers;
+        int index;
+    } *context = userdata;
+
+    if (pixel_format == context->format) {
+        context->n_modifiers++;
+    }
+
+    return true;
+}
+
+static bool extract_modifiers_for_pixel_format(
+    UNUSED struct drm_plane *plane,
+    UNUSED int index,
+    enum pixfmt pixel_format,
+    uint64_t modifier,
+    void *userdata
+) {
+    struct {
+        enum pixfmt format;
+        uint64_t *modifiers;
+        size_t n_modifiers;
+        int index;
+    } *context = userdata;
+
+    if (pixel_format == context->format) {
+        context->modifiers[context->index++] = modifier;
+    }
+
+    return true;
+}
+
+#ifdef HAVE_EGL_GLES2
+/**
+ * @brief Narrow down the modifiers a render surface can use when flutter renders on another GPU
+ * than the one scanning out.
+ *
+ * The render GPU allocates the buffers, so only modifiers that both the display controller and the
+ * render GPU understand are useful. Buffers are shared as a single dmabuf, so multi-planar layouts
+ * (for example with a separate compression plane) are filtered out too.
+ * If nothing is left (or the display controller doesn't list any modifiers), fall back to a linear
+ * layout, which every device can use.
+ *
+ * @param render_device The GBM device of the render GPU.
+ * @param pixel_format The pixel format of the render surface.
+ * @param modifiers The modifiers supported by the scanout plane, or NULL. Will be filtered in place.
+ * @param n_modifiers_inout The number of modifiers in @param modifiers. Will be set to the number of modifiers left.
+ * @return uint64_t* The allowed modifiers, or NULL if out of memory. This might be a different pointer than @param modifiers.
+ */
+static uint64_t *negotiate_prime_modifiers(
+    struct gbm_device *render_device,
+    enum pixfmt pixel_format,
+    uint64_t *modifiers,
+    size_t *n_modifiers_inout
+) {
+    size_t n_modifiers = 0;
+
+    if (modifiers != NULL) {
+        for (size_t i = 0; i < *n_modifiers_inout; i++) {
+            int n_planes =
+                gbm_device_get_format_modifier_plane_count(render_device, get_pixfmt_info(pixel_format)->gbm_format, modifiers[i]);
+            if (n_planes == 1) {
+                modifiers[n_modifiers++] = modifiers[i];
+            }
+        }
+    }
+
+    if (n_modifiers == 0) {
+        free(modifiers);
+
+        modifiers = malloc(sizeof *modifiers);
+        if (modifiers == NULL) {
+            return NULL;
+        }
+
+        modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+        n_modifiers = 1;
+    }
+
+    *n_modifiers_inout = n_modifiers;
+    return modifiers;
+}
+#endif
+
+static struct render_surface *kms_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size) {
+    struct render_surface *render_surface;
+
+    ASSERT_NOT_NULL(window);
+
+    if (window->render_surface != NULL) {
+        return window->render_surface;
+    }
+
+    if (!has_size) {
+        // Flutter wants a render surface, but hasn't told us the backing store dimensions yet.
+        // Just make a good guess about the dimensions.
+        LOG_DEBUG("Flutter requested render surface before supplying surface dimensions.\n");
+        size = VEC2I(window->kms.mode.hdisplay, window->kms.mode.vdisplay);
+    }
+
+    enum pixfmt pixel_format;
+    if (window->has_forced_pixel_format) {
+        pixel_format = window->forced_pixel_format;
+    } else {
+        // Actually, more devices support ARGB8888 might sometimes not be supported by devices,
+        // for example for primary planes. But we can just cast ARGB8888 to XRGB8888 if we need to,
+        // and ARGB8888 is still a good default choice because casting XRGB to ARGB might not work,
+        // and sometimes we need alpha for overlay planes.
+        // Also vulkan doesn't work with XRGB yet so we definitely need to use ARGB to vulkan too.
+        pixel_format = PIXFMT_ARGB8888;
+    }
+
+    // Possibly populate this with the supported modifiers for this pixel format.
+    // If no plane lists modifiers for this pixel format, this will be left at NULL,
+    // and egl_gbm_render_surface_new... will create the GBM surface using usage flags
+    // (GBM_USE_SCANOUT | GBM_USE_RENDER) instead.
+    uint64_t *allowed_modifiers = NULL;
+    size_t n_allowed_modifiers = 0;
+
+    // For now just set the supported modifiers for the first plane that supports this pixel format
+    // as the allowed modifiers.
+    /// TODO: Find a way to rank pixel formats, maybe by number of planes that support them for scanout.
+    {
+        struct drm_plane *plane;
+        for_each_plane_in_drmdev(window->kms.drmdev, plane) {
+            if (!(plane->possible_crtcs & window->kms.crtc->bitmask)) {
+                // Only query planes that are possible to connect to the CRTC we're using.
+                continue;
+            }
+
+            if (plane->type != kPrimary_DrmPlaneType && plane->type != kOverlay_DrmPlaneType) {
+                // We explicitly only look for primary and overlay planes.
+                continue;
+            }
+
+            if (!plane->supports_modifiers) {
+                // The plane does not have an IN_FORMATS property and does not support
+                // explicit modifiers.
+                //
+                // Calling drm_plane_for_each_modified_format below will segfault.
+                continue;
+            }
+
+            struct {
+                enum pixfmt format;
+                uint64_t *modifiers;
+                size_t n_modifiers;
+                int index;
+            } context = {
+                .format = pixel_format,
+                .modifiers = NULL,
+                .n_modifiers = 0,
+                .index = 0,
+            };
+
+            // First, count the allowed modifiers for this pixel format.
+            drm_plane_for_each_modified_format(plane, count_modifiers_for_pixel_format, &context);
+
+            n_allowed_modifiers = context.n_modifiers;
+            allowed_modifiers = calloc(n_allowed_modifiers, sizeof(*context.modifiers));
+            context.modifiers = allowed_modifiers;
+
+            // Next, fill context.modifiers with the allowed modifiers.
+            drm_plane_for_each_modified_format(plane, extract_modifiers_for_pixel_format, &context);
+            break;
+        }
+    }
+
+    if (window->renderer_type == kOpenGL_RendererType) {
+        // opengl
+#ifdef HAVE_EGL_GLES2
+    // EGL_NO_CONFIG_KHR is defined by EGL_KHR_no_config_context.
+    #ifndef EGL_KHR_no_config_context
+        #error "EGL header definitions for extension EGL_KHR_no_config_context are required."
+    #endif
+
+        // If the renderer uses another GPU than the one we're scanning out on (PRIME render offload),
+        // the buffers are shared as dmabufs, so both devices need to agree on the modifier.
+        if (gl_renderer_get_gbm_device(window->gl_renderer) != drmdev_get_gbm_device(window->kms.drmdev)) {
+            allowed_modifiers = negotiate_prime_modifiers(
+                gl_renderer_get_gbm_device(window->gl_renderer),
+                pixel_format,
+                allowed_modifiers,
+                &n_allowed_modifiers
+            );
+            if (allowed_modifiers == NULL) {
+                return NULL;
+            }
+        }
+
+        struct egl_gbm_render_surface *egl_surface = egl_gbm_render_surface_new_with_egl_config(
+            window->tracer,
+            size,
+            gl_renderer_get_gbm_device(window->gl_renderer),
+            window->gl_renderer,
+            pixel_format,
+            EGL_NO_CONFIG_KHR,
+            allowed_modifiers,
+            n_allowed_modifiers
+        );
+        if (egl_surface == NULL) {
+            LOG_ERROR("Couldn't create EGL GBM rendering surface.\n");
+            render_surface = NULL;
+        } else {
+            render_surface = CAST_RENDER_SURFACE(egl_surface);
+        }
+
+#else
+        UNREACHABLE();
+#endif
+    } else {
+        ASSUME(window->renderer_type == kVulkan_RendererType);
+
+        // vulkan
+#ifdef HAVE_VULKAN
+        struct vk_gbm_render_surface *vk_surface =
+            vk_gbm_render_surface_new(window->tracer, size, drmdev_get_gbm_device(window->kms.drmdev), window->vk_renderer, pixel_format);
+        if (vk_surface == NULL) {
+            LOG_ERROR("Couldn't create Vulkan GBM rendering surface.\n");
+            render_surface = NULL;
+        } else {
+            render_surface = CAST_RENDER_SURFACE(vk_surface);
+        }
+#else
+        UNREACHABLE();
+#endif
+    }
+
+    if (allowed_modifiers != NULL) {
+        free(allowed_modifiers);
+    }
+
+    window->render_surface = render_surface;
+    return render_surface;
+}
+
+static struct render_surface *kms_window_get_render_surface(struct window *window, struct vec2i size) {
+    struct render_surface *render_surface;
+
+    ASSERT_NOT_NULL(window);
+
+    // The render surface can be replaced on hotplug.
+    window_lock(window);
+    render_surface = kms_window_get_render_surface_internal(window, true, size);
+    window_unlock(window);
+
+    return render_surface;
+}
+
+#ifdef HAVE_EGL_GLES2
+static bool kms_window_has_egl_surface(struct window *window) {
+    if (window->renderer_type == kOpenGL_RendererType) {
+        return window->render_surface != NULL;
+    } else {
+        return false;
+    }
+}
+
+static EGLSurface kms_window_get_egl_surface(struct window *window) {
+    if (window->renderer_type == kOpenGL_RendererType) {
+        window_lock(window);
+        struct render_surface *render_surface = kms_window_get_render_surface_internal(window, false, VEC2I(0, 0));
+        EGLSurface egl_surface = egl_gbm_render_surface_get_egl_surface(CAST_EGL_GBM_RENDER_SURFACE(render_surface));
+        window_unlock(window);
+
+        return egl_surface;
+    } else {
+        return EGL_NO_SURFACE;
+    }
+}
+#endif
+
+static bool kms_window_cursor_fits(struct window *window, const struct pointer_icon *icon) {
+    struct vec2i size, max_size;
+
+    size = pointer_icon_get_size(icon);
+    if (window->rotation.rotate_90 || window->rotation.rotate_270) {
+        size = vec2i_swap_xy(size);
+    }
+
+    max_size = drmdev_get_max_cursor_size(window->kms.drmdev);
+
+    return size.x <= max_size.x && size.y <= max_size.y;
+}
+
+static int kms_window_set_cursor_locked(
+    // clang-format off
+    struct window *window,
+    bool has_enabled, bool enabled,
+    bool has_icon, const struct pointer_icon *icon,
+    bool has_pos, struct vec2i pos
+    // clang-format on
+) {
+    struct cursor_buffer *cursor;
+
+    enabled = has_enabled ? enabled : window->cursor_enabled;
+    icon = has_icon ? icon : window->kms.pointer_icon;
+    pos = has_pos ? pos : window->cursor_pos;
+    cursor = window->kms.cursor;
+
+    if (enabled && icon == NULL) {
+        // default to the arrow icon.
+        icon = window->kms.default_pointer_icon;
+        ASSERT_NOT_NULL(icon);
+    }
+
+    if (enabled && !kms_window_cursor_fits(window, icon)) {
+        LOG_ERROR(
+            "Cursor icon is %d x %d pixels, but the cursor plane only supports up to %d x %d. Showing the default cursor instead.\n",
+            pointer_icon_get_size(icon).x,
+            pointer_icon_get_size(icon).y,
+            drmdev_get_max_cursor_size(window->kms.drmdev).x,
+            drmdev_get_max_cursor_size(window->kms.drmdev).y
+        );
+
+        icon = window->kms.default_pointer_icon;
+        if (!kms_window_cursor_fits(window, icon)) {
+            return EINVAL;
+        }
+    }
+
+    if (window->kms.pointer_icon != icon) {
+        window->kms.pointer_icon = icon;
+    }
+
+    if (enabled) {
+        if (cursor == NULL || icon != cursor->icon) {
+            cursor = cursor_buffer_new(window->kms.drmdev, window->kms.pointer_icon, window->rotation);
+            if (cursor == NULL) {
+                return EIO;
+            }
+
+            cursor_buffer_swap_ptrs(&window->kms.cursor, cursor);
+
+            // cursor is created with refcount 1. cursor_buffer_swap_ptrs
+            // increases refcount by one. deref here so we don't leak a
+            // reference.
+            cursor_buffer_unrefp(&cursor);
+
+            // apply the new cursor icon & position by scanning out a new frame.
+            window->cursor_pos = pos;
+            if (window->composition != NULL) {
+                kms_window_push_composition_locked(window, window->composition);
+            }
+        } else if (has_pos) {
+            // apply the new cursor position using drmModeMoveCursor
+            window->cursor_pos = pos;
+            if (window->kms.suspended) {
+                // the position will be applied with the next frame we present.
+                window->cursor_enabled = enabled;
+                return 0;
+            }
+
+            drmdev_move_cursor(window->kms.drmdev, window->kms.crtc->id, vec2i_sub(pos, window->kms.cursor->hotspot));
+        }
+    } else {
+        if (window->kms.cursor != NULL) {
+            cursor_buffer_unrefp(&window->kms.cursor);
+        }
+    }
+
+    window->cursor_enabled = enabled;
+    return 0;
+}
+
+static void kms_window_suspend_locked(struct window *window) {
+    ASSERT_NOT_NULL(window);
+
+    if (window->kms.suspended) {
+        return;
+    }
+
+    // Pause the frame scheduler so pending frames are cancelled and flutter
+    // doesn't render frames no one will see. We keep window->composition
+    // (and with it, the render surfaces and their DRM framebuffers) around
+    // so we can present it again without waiting for flutter when we're resumed.
+    frame_scheduler_pause(window->frame_scheduler);
+    window->kms.suspended = true;
+}
+
+static int kms_window_resume_locked(struct window *window) {
     int ok;
 
-    ASSERT_NOT_NULL(drmdev);
+    ASSERT_NOT_NULL(window);
 
-#if !defined(HAVE_VULKAN)
-    ASSUME(renderer_type != kVulkan_RendererType);
-#endif
+    if (!window->kms.suspended) {
+        return 0;
+    }
 
-#if !defined(HAVE_EGL_GLES2)
-    ASSUME(renderer_type != kOpenGL_RendererType);
-#endif
+    if (window->kms.connector->variable_state.connection_state == kDisconnected_DrmConnectionState) {
+        LOG_ERROR("The display connector was disconnected while the session was inactive.\n");
+    }
 
-    // if opengl --> gl_renderer != NULL && vk_renderer == NULL
-    assert(renderer_type != kOpenGL_RendererType || (gl_renderer != NULL && vk_renderer == NULL));
+    window->kms.suspended = false;
 
-    // if vulkan --> vk_renderer != NULL && gl_renderer == NULL
-    assert(renderer_type != kVulkan_RendererType || (vk_renderer != NULL && gl_renderer == NULL));
+    // Some other DRM master was driving the display in the meantime,
+    // so we need to do a full modeset again.
+    window->kms.should_apply_mode = true;
 
-    window = malloc(sizeof *window);
-    if (window == NULL) {
-        return NULL;
+    // It might've changed the color pipeline as well.
+    if (!display_color_settings_is_identity(&window->kms.display_color) || window->kms.dim_factor != 1.0) {
+        window->kms.should_apply_display_color = true;
     }
 
-    ok = select_mode(drmdev, &selected_connector, &selected_encoder, &selected_crtc, &selected_mode, desired_videomode);
+    if (window->kms.disconnected) {
+        // We'll continue presenting when a display is connected again.
+        return 0;
+    }
+
+    if (window->kms.display_off) {
+        // Some other DRM master might've turned the display on again in the meantime.
+        ok = drmdev_set_crtc_active(window->kms.drmdev, window->kms.crtc->id, window->kms.connector->id, false);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't turn the display off again after resuming.\n");
+        }
+
+        // We'll continue presenting when the display is turned on again.
+        return 0;
+    }
+
+    frame_scheduler_resume(window->frame_scheduler);
+
+    // Re-present the last composition, so we're not showing a black screen
+    // until flutter renders the next frame.
+    if (window->composition != NULL) {
+        ok = kms_window_push_composition_locked(window, window->composition);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't restore the last frame after resuming. kms_window_push_composition_locked: %s\n", strerror(ok));
+            return ok;
+        }
+    }
+
+    return 0;
+}
+
+static void kms_window_update_orientation_locked(struct window *window) {
+    struct cursor_buffer *cursor;
+
+    ASSERT_NOT_NULL(window);
+
+    if (window->kms.cursor == NULL || window->kms.cursor->rotation.u64 == window->rotation.u64) {
+        return;
+    }
+
+    // The cursor image is rotated on the CPU, so we need a new cursor buffer.
+    // We don't present it right away, it'll be presented together with the next
+    // flutter frame, which is the first one to use the new orientation.
+    cursor = cursor_buffer_new(window->kms.drmdev, window->kms.cursor->icon, window->rotation);
+    if (cursor == NULL) {
+        LOG_ERROR("Couldn't create a rotated cursor buffer.\n");
+        return;
+    }
+
+    cursor_buffer_swap_ptrs(&window->kms.cursor, cursor);
+    cursor_buffer_unrefp(&cursor);
+}
+
+static bool drmdev_has_connected_connector(struct drmdev *drmdev) {
+    struct drm_connector *connector;
+
+    for_each_connector_in_drmdev(drmdev, connector) {
+        if (drm_connector_is_display_connected(connector)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int kms_window_on_hotplug_locked(struct window *window, bool *geometry_changed_out) {
+    struct drm_connector *connector;
+    struct drm_encoder *encoder;
+    struct drm_crtc *crtc;
+    drmModeModeInfo *mode;
+    bool was_disconnected, size_changed;
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(geometry_changed_out);
+
+    *geometry_changed_out = false;
+
+    ok = drmdev_reprobe_connectors(window->kms.drmdev);
     if (ok != 0) {
-        goto fail_free_window;
+        return ok;
     }
 
-    if (has_explicit_dimensions) {
-        has_dimensions = true;
-    } else if (selected_connector->variable_state.width_mm % 10 || selected_connector->variable_state.height_mm % 10) {
-        // as a heuristic, assume the physical dimensions are valid if they're not both multiples of 10.
-        // dimensions like 160x90mm, 150x100mm are often bogus.
-        has_dimensions = true;
-        width_mm = selected_connector->variable_state.width_mm;
-        height_mm = selected_connector->variable_state.height_mm;
-    } else if (selected_connector->type == DRM_MODE_CONNECTOR_DSI
-        && selected_connector->variable_state.width_mm == 0
-        && selected_connector->variable_state.height_mm == 0) {
-        // assume this is the official Raspberry Pi DSI display.
-        has_dimensions = true;
-        width_mm = 155;
-        height_mm = 86;
-    } else {
-        has_dimensions = false;
+    if (!drmdev_has_connected_connector(window->kms.drmdev)) {
+        if (!window->kms.disconnected) {
+            LOG_DEBUG("Display was disconnected. Not presenting anything until a display is connected again.\n");
+
+            window->kms.disconnected = true;
+            if (!window->kms.suspended && !window->kms.display_off) {
+                frame_scheduler_pause(window->frame_scheduler);
+            }
+        }
+        return 0;
     }
 
-    ok = window_init(
-        // clang-format off
-        window,
-        tracer,
-        scheduler,
-        has_rotation, rotation,
-        has_orientation, orientation,
-        selected_mode->hdisplay, selected_mode->vdisplay,
-        has_dimensions, width_mm, height_mm,
-        mode_get_vrefresh(selected_mode),
-        has_forced_pixel_format, forced_pixel_format
-        // clang-format on
-    );
+    ok = select_mode(window->kms.drmdev, &connector, &encoder, &crtc, &mode, window->kms.desired_videomode);
     if (ok != 0) {
-        free(window);
-        return NULL;
+        return ok;
     }
 
-    LOG_DEBUG_UNPREFIXED(
-        "display mode:\n"
-        "  resolution: %" PRIu16 " x %" PRIu16
-        "\n"
-        "  refresh rate: %fHz\n"
-        "  physical size: %dmm x %dmm\n"
-        "  flutter device pixel ratio: %f\n"
-        "  pixel format: %s\n",
-        selected_mode->hdisplay,
-        selected_mode->vdisplay,
-        mode_get_vrefresh(selected_mode),
-        width_mm,
-        height_mm,
-        window->pixel_ratio,
-        has_forced_pixel_format ? get_pixfmt_info(forced_pixel_format)->name : "(any)"
+    was_disconnected = window->kms.disconnected;
+
+    if (!was_disconnected && connector == window->kms.connector && crtc == window->kms.crtc &&
+        memcmp(mode, &window->kms.mode, sizeof *mode) == 0) {
+        // Nothing changed for us. (For example, some other connector was plugged in.)
+        return 0;
+    }
+
+    size_changed = mode->hdisplay != window->kms.mode.hdisplay || mode->vdisplay != window->kms.mode.vdisplay;
+
+    LOG_DEBUG(
+        "Display hotplug, using videomode %" PRIu16 "x%" PRIu16 "@%f on connector %" PRIu32 ".\n",
+        mode->hdisplay,
+        mode->vdisplay,
+        mode_get_vrefresh(mode),
+        connector->id
     );
 
-    window->kms.drmdev = drmdev_ref(drmdev);
-    window->kms.connector = selected_connector;
-    window->kms.encoder = selected_encoder;
-    window->kms.crtc = selected_crtc;
-    window->kms.mode = selected_mode;
+    if (crtc != window->kms.crtc) {
+        // The writeback connector might not be able to use the new CRTC.
+        kms_window_fail_pending_captures_locked(window, EAGAIN);
+        window->kms.writeback_connector = NULL;
+
+        // Turn off the old CRTC in the same modeset that lights up the new one.
+        // If an earlier move wasn't presented yet, the CRTC from before that one is still on.
+        if (window->kms.crtc_to_disable == crtc) {
+            window->kms.crtc_to_disable = NULL;
+        } else if (window->kms.crtc_to_disable == NULL) {
+            window->kms.crtc_to_disable = window->kms.crtc;
+        }
+    }
+
+    window->kms.connector = connector;
+    window->kms.encoder = encoder;
+    window->kms.crtc = crtc;
+    window->kms.mode = *mode;
     window->kms.should_apply_mode = true;
-    window->kms.cursor = NULL;
-    window->kms.pointer_icon = NULL;
-    window->renderer_type = renderer_type;
-    if (gl_renderer != NULL) {
-#ifdef HAVE_EGL_GLES2
-        window->gl_renderer = gl_renderer_ref(gl_renderer);
-#else
-        UNREACHABLE();
-#endif
+    window->kms.disconnected = false;
+    window->refresh_rate = mode_get_vrefresh(mode);
+
+    // We might be using a different CRTC now.
+    if (!display_color_settings_is_identity(&window->kms.display_color) || window->kms.dim_factor != 1.0) {
+        window->kms.should_apply_display_color = true;
     }
-    if (vk_renderer != NULL) {
-#ifdef HAVE_VULKAN
-        window->vk_renderer = vk_renderer_ref(vk_renderer);
-#else
-        UNREACHABLE();
-#endif
-    } else {
-        window->vk_renderer = NULL;
+
+    if (size_changed) {
+        // Flutter will get new metrics anyway, so don't wait for a frame with the pending view size.
+        if (window->has_pending_orientation) {
+            window_apply_pending_orientation_locked(window);
+        }
+
+        window->display_size = VEC2F(mode->hdisplay, mode->vdisplay);
+        if (window->rotation.rotate_90 || window->rotation.rotate_270) {
+            window->view_size = VEC2F(mode->vdisplay, mode->hdisplay);
+        } else {
+            window->view_size = window->display_size;
+        }
+
+        fill_view_matrices(
+            window->rotation,
+            mode->hdisplay,
+            mode->vdisplay,
+            &window->display_to_view_transform,
+            &window->view_to_display_transform
+        );
+
+        // flutter renders into a surface of the display size, so we need a new one.
+        // The next time flutter makes its EGL surface current / creates a backing store,
+        // we'll create it with the new size.
+        //
+        // The engine never holds on to the EGL surface itself, the make_current callback asks us for it
+        // every frame, so swapping it between frames is fine. Backing stores and compositions flutter
+        // might still be using keep their own reference on the old surface, so it's only destroyed
+        // once the raster thread is done with it.
+        if (window->render_surface != NULL) {
+            surface_unref(CAST_SURFACE(window->render_surface));
+            window->render_surface = NULL;
+        }
+
+        // The last frame has the wrong size, don't present it again.
+        if (window->composition != NULL) {
+            fl_layer_composition_unref(window->composition);
+            window->composition = NULL;
+        }
+
+        *geometry_changed_out = true;
+    }
+
+    if (window->kms.suspended) {
+        // The new mode will be applied when we're resumed.
+        return 0;
+    }
+
+    if (window->kms.display_off) {
+        // The new mode will be applied when the display is turned on again.
+        return 0;
+    }
+
+    if (was_disconnected) {
+        frame_scheduler_resume(window->frame_scheduler);
+    }
+
+    // Do the modeset right away, so the display doesn't stay black until flutter renders the next frame.
+    if (window->composition != NULL) {
+        ok = kms_window_push_composition_locked(window, window->composition);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't present the last frame after a display hotplug. kms_window_push_composition_locked: %s\n", strerror(ok));
+            return ok;
+        }
+    }
+
+    return 0;
+}
+
+static int kms_window_set_display_color_locked(struct window *window, const struct display_color_settings *settings) {
+    struct drm_crtc *crtc;
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(settings);
+
+    crtc = window->kms.crtc;
+    if (crtc->gamma_lut_size < 2 && !DRM_ID_IS_VALID(crtc->ids.ctm)) {
+        LOG_ERROR("The display controller doesn't support gamma or color correction.\n");
+        return EOPNOTSUPP;
+    }
+
+    window->kms.display_color = *settings;
+    window->kms.should_apply_display_color = true;
+
+    if (window->kms.suspended || window->kms.disconnected) {
+        // The settings will be applied when we're resumed / a display is connected.
+        return 0;
+    }
+
+    // flutter only renders a new frame if something changed in the app,
+    // so present the last frame again with the new color settings.
+    if (window->composition != NULL) {
+        ok = kms_window_push_composition_locked(window, window->composition);
+        if (ok != 0) {
+            LOG_ERROR(
+                "Couldn't present the last frame with the new display color settings. kms_window_push_composition_locked: %s\n",
+                strerror(ok)
+            );
+            return ok;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find a writeback connector that can be routed to our CRTC, and a pixel format it supports.
+ */
+static struct drm_connector *kms_window_find_writeback_connector_locked(struct window *window, enum pixfmt *format_out) {
+    struct drm_connector *connector;
+    struct drm_encoder *encoder;
+
+    for_each_connector_in_drmdev(window->kms.drmdev, connector) {
+        if (connector->type != kWRITEBACK_DrmConnectorType) {
+            continue;
+        }
+
+        if (connector->writeback_formats[PIXFMT_XRGB8888]) {
+            *format_out = PIXFMT_XRGB8888;
+        } else if (connector->writeback_formats[PIXFMT_ARGB8888]) {
+            *format_out = PIXFMT_ARGB8888;
+        } else {
+            continue;
+        }
+
+        for (int i = 0; i < connector->n_encoders; i++) {
+            for_each_encoder_in_drmdev(window->kms.drmdev, encoder) {
+                if (encoder->encoder->encoder_id == connector->encoders[i] &&
+                    encoder->encoder->possible_crtcs & window->kms.crtc->bitmask) {
+                    return connector;
+                }
+            }
+        }
     }
-    window->push_composition = kms_window_push_composition;
-    window->get_render_surface = kms_window_get_render_surface;
-#ifdef HAVE_EGL_GLES2
-    window->has_egl_surface = kms_window_has_egl_surface;
-    window->get_egl_surface = kms_window_get_egl_surface;
-#endif
-    window->deinit = kms_window_deinit;
-    window->set_cursor_locked = kms_window_set_cursor_locked;
-    return window;
 
-fail_free_window:
-    free(window);
     return NULL;
 }
 
-void kms_window_deinit(struct window *window) {
-    /// TODO: Do we really need to do this?
-    /*
-    struct kms_req_builder *builder;
-    struct kms_req *req;
+static struct capture_buffer *kms_window_acquire_capture_buffer_locked(struct window *window, struct vec2i size, enum pixfmt format) {
+    struct capture_buffer *buffer;
+
+    for (int i = 0; i < N_CAPTURE_BUFFERS; i++) {
+        buffer = window->kms.capture_buffers[i];
+
+        // Replace buffers that don't match the current mode anymore, if they're not in use.
+        if (buffer != NULL && (buffer->size.x != size.x || buffer->size.y != size.y || buffer->format != format)) {
+            if (atomic_flag_test_and_set(&buffer->in_use)) {
+                continue;
+            }
+
+            capture_buffer_unref(buffer);
+            window->kms.capture_buffers[i] = buffer = NULL;
+        }
+
+        if (buffer == NULL) {
+            buffer = capture_buffer_new(window->kms.drmdev, size, format);
+            if (buffer == NULL) {
+                return NULL;
+            }
+
+            window->kms.capture_buffers[i] = buffer;
+            atomic_flag_test_and_set(&buffer->in_use);
+            return capture_buffer_ref(buffer);
+        }
+
+        if (!atomic_flag_test_and_set(&buffer->in_use)) {
+            return capture_buffer_ref(buffer);
+        }
+    }
+
+    errno = EBUSY;
+    return NULL;
+}
+
+static int on_capture_timeout(void *userdata);
+
+static void kms_window_schedule_capture_timeout_locked(struct window *window) {
     int ok;
 
-    builder = drmdev_create_request_builder(window->kms.drmdev, window->kms.crtc->id);
-    ASSERT_NOT_NULL(builder);
+    if (window->kms.has_capture_timeout) {
+        return;
+    }
+
+    ok = flutterpi_post_platform_task_with_time(
+        on_capture_timeout,
+        window_ref(window),
+        get_monotonic_time() / 1000 + CAPTURE_IDLE_TIMEOUT_US
+    );
+    if (ok != 0) {
+        LOG_ERROR("Couldn't schedule presenting the last frame for capturing.\n");
+        window_unref(window);
+        kms_window_fail_pending_captures_locked(window, ok);
+        return;
+    }
 
-    ok = kms_req_builder_unset_mode(builder);
-    ASSERT_EQUALS(ok, 0);
+    window->kms.has_capture_timeout = true;
+}
 
-    req = kms_req_builder_build(builder);
-    ASSERT_NOT_NULL(req);
+static int on_capture_timeout(void *userdata) {
+    struct window *window;
+    int ok;
 
-    kms_req_builder_unref(builder);
+    ASSERT_NOT_NULL(userdata);
+    window = userdata;
 
-    ok = kms_req_commit_blocking(req, NULL);
-    ASSERT_EQUALS(ok, 0);
-    (void) ok;
+    window_lock(window);
 
-    kms_req_unref(req);
-    */
+    window->kms.has_capture_timeout = false;
 
-    if (window->kms.cursor != NULL) {
-        cursor_buffer_unref(window->kms.cursor);
-    }
-    if (window->render_surface != NULL) {
-        surface_unref(CAST_SURFACE(window->render_surface));
-    }
-    if (window->gl_renderer != NULL) {
-#ifdef HAVE_EGL_GLES2
-        gl_renderer_unref(window->gl_renderer);
-#else
-        UNREACHABLE();
-#endif
+    if (list_is_empty(&window->kms.pending_captures)) {
+        // flutter presented a frame in the meantime and the captures were done with that.
+        goto out_unlock;
     }
-    if (window->vk_renderer != NULL) {
-#ifdef HAVE_VULKAN
-        vk_renderer_unref(window->vk_renderer);
-#else
-        UNREACHABLE();
-#endif
+
+    if (window->kms.suspended || window->kms.disconnected || window->kms.display_off || window->composition == NULL) {
+        kms_window_fail_pending_captures_locked(window, EBUSY);
+        goto out_unlock;
     }
-    drmdev_unref(window->kms.drmdev);
-    window_deinit(window);
-}
 
-struct frame {
-    struct tracer *tracer;
-    struct kms_req *req;
-    bool unset_should_apply_mode_on_commit;
-};
+    // flutter didn't present anything, so the app is idle. Present the last frame again.
+    ok = kms_window_push_composition_locked(window, window->composition);
+    if (ok != 0) {
+        LOG_ERROR("Couldn't present the frame for capturing. kms_window_push_composition_locked: %s\n", strerror(ok));
 
-UNUSED static void on_scanout(struct drmdev *drmdev, uint64_t vblank_ns, void *userdata) {
-    ASSERT_NOT_NULL(drmdev);
-    (void) drmdev;
-    (void) vblank_ns;
-    (void) userdata;
+        // Captures that made it into the request are failed by it.
+        kms_window_fail_pending_captures_locked(window, ok);
+        goto out_unlock;
+    }
 
-    /// TODO: What should we do here?
+    // Only one capture can be done per frame.
+    if (!list_is_empty(&window->kms.pending_captures)) {
+        kms_window_schedule_capture_timeout_locked(window);
+    }
+
+out_unlock:
+    window_unlock(window);
+    window_unref(window);
+    return 0;
 }
 
-static void on_present_frame(void *userdata) {
-    struct frame *frame;
+static int kms_window_capture_frame_locked(struct window *window, window_capture_cb_t callback, void *userdata) {
+    struct capture_job *job;
     int ok;
 
-    ASSERT_NOT_NULL(userdata);
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(callback);
 
-    frame = userdata;
+    if (window->kms.suspended || window->kms.disconnected || window->kms.display_off) {
+        return EBUSY;
+    }
 
-    TRACER_BEGIN(frame->tracer, "kms_req_commit_nonblocking");
-    ok = kms_req_commit_blocking(frame->req, NULL);
-    TRACER_END(frame->tracer, "kms_req_commit_nonblocking");
+    if (window->composition == NULL) {
+        return EAGAIN;
+    }
 
-    if (ok != 0) {
-        LOG_ERROR("Could not commit frame request.\n");
+    if (window->kms.writeback_connector == NULL) {
+        window->kms.writeback_connector = kms_window_find_writeback_connector_locked(window, &window->kms.writeback_format);
+        if (window->kms.writeback_connector == NULL) {
+            // Let window_capture_frame composite the frame on the CPU instead.
+            return EOPNOTSUPP;
+        }
     }
 
-    tracer_unref(frame->tracer);
-    kms_req_unref(frame->req);
-    free(frame);
-}
+    job = capture_job_new(callback, userdata);
+    if (job == NULL) {
+        return ENOMEM;
+    }
 
-static void on_cancel_frame(void *userdata) {
-    struct frame *frame;
-    ASSERT_NOT_NULL(userdata);
+    errno = 0;
+    job->buffer = kms_window_acquire_capture_buffer_locked(
+        window,
+        VEC2I(window->kms.mode.hdisplay, window->kms.mode.vdisplay),
+        window->kms.writeback_format
+    );
+    if (job->buffer == NULL) {
+        ok = errno ? errno : ENOMEM;
+        goto fail_destroy_job;
+    }
 
-    frame = userdata;
+    job->writeback_connector_id = window->kms.writeback_connector->id;
 
-    tracer_unref(frame->tracer);
-    kms_req_unref(frame->req);
-    free(frame);
+    list_addtail(&job->entry, &window->kms.pending_captures);
+    window->kms.last_capture_ns = get_monotonic_time();
+
+    // The capture is done with the next frame flutter presents. If flutter doesn't present one
+    // soon, because the app is idle, we'll present the last frame again.
+    kms_window_schedule_capture_timeout_locked(window);
+
+    return 0;
+
+fail_destroy_job:
+    capture_job_destroy(job);
+    return ok;
 }
 
-static int kms_window_push_composition_locked(struct window *window, struct fl_layer_composition *composition) {
-    struct kms_req_builder *builder;
-    struct kms_req *req;
-    struct frame *frame;
+static int kms_window_set_display_power_locked(struct window *window, enum display_power_state state, double dim_brightness) {
+    struct drm_crtc *crtc;
+    double dim_factor;
+    bool can_present;
     int ok;
 
     ASSERT_NOT_NULL(window);
-    ASSERT_NOT_NULL(composition);
 
-    // If flutter won't request frames (because the vsync callback is broken),
-    // we'll wait here for the previous frame to be presented / rendered.
-    // Otherwise the surface_swap_buffers at the bottom might allocate an
-    // additional buffer and we'll potentially use more buffers than we're
-    // trying to use.
-    // if (!window->use_frame_requests) {
-    //     TRACER_BEGIN(window->tracer, "window_request_frame_and_wait_for_begin");
-    //     ok = window_request_frame_and_wait_for_begin(window);
-    //     TRACER_END(window->tracer, "window_request_frame_and_wait_for_begin");
-    //     if (ok != 0) {
-    //         LOG_ERROR("Could not wait for frame begin.\n");
-    //         return ok;
-    //     }
-    // }
+    crtc = window->kms.crtc;
+    can_present = !window->kms.suspended && !window->kms.disconnected;
 
-    /// TODO: If we don't have new revisions, we don't need to scanout anything.
-    fl_layer_composition_swap_ptrs(&window->composition, composition);
+    dim_factor = state == DISPLAY_POWER_DIMMED ? CLAMP(dim_brightness, 0.0, 1.0) : 1.0;
+    if (dim_factor != window->kms.dim_factor) {
+        // Dimming is done in the gamma LUT, or by scaling the CTM if there's no gamma LUT.
+        if (crtc->gamma_lut_size < 2 && !DRM_ID_IS_VALID(crtc->ids.ctm)) {
+            return EOPNOTSUPP;
+        }
 
-    builder = drmdev_create_request_builder(window->kms.drmdev, window->kms.crtc->id);
-    if (builder == NULL) {
-        ok = ENOMEM;
-        goto fail_unref_builder;
+        window->kms.dim_factor = dim_factor;
+        window->kms.should_apply_display_color = true;
     }
 
-    // We only set the mode once, at the first atomic request.
-    if (window->kms.should_apply_mode) {
-        ok = kms_req_builder_set_connector(builder, window->kms.connector->id);
-        if (ok != 0) {
-            LOG_ERROR("Couldn't select connector.\n");
-            goto fail_unref_builder;
+    if (state == DISPLAY_POWER_OFF) {
+        if (window->kms.display_off) {
+            return 0;
         }
 
-        ok = kms_req_builder_set_mode(builder, window->kms.mode);
-        if (ok != 0) {
-            LOG_ERROR("Couldn't apply output mode.\n");
-            goto fail_unref_builder;
+        if (can_present) {
+            frame_scheduler_pause(window->frame_scheduler);
+
+            ok = drmdev_set_crtc_active(window->kms.drmdev, crtc->id, window->kms.connector->id, false);
+            if (ok != 0) {
+                frame_scheduler_resume(window->frame_scheduler);
+                return ok;
+            }
         }
+
+        window->kms.display_off = true;
+        return 0;
     }
 
-    for (size_t i = 0; i < fl_layer_composition_get_n_layers(composition); i++) {
-        struct fl_layer *layer = fl_layer_composition_peek_layer(composition, i);
+    if (window->kms.display_off) {
+        window->kms.display_off = false;
 
-        ok = surface_present_kms(layer->surface, &layer->props, builder);
+        if (!can_present) {
+            // We'll turn it on again with the next modeset, when we're resumed / a display is connected.
+            return 0;
+        }
+
+        ok = drmdev_set_crtc_active(window->kms.drmdev, crtc->id, window->kms.connector->id, true);
         if (ok != 0) {
-            LOG_ERROR("Couldn't present flutter layer on screen. surface_present_kms: %s\n", strerror(ok));
-            goto fail_unref_builder;
+            // Try a full modeset with the next frame instead, that'll activate the CRTC as well.
+            LOG_ERROR("Couldn't turn the display on again. Trying a full modeset.\n");
+            window->kms.should_apply_mode = true;
         }
+
+        frame_scheduler_resume(window->frame_scheduler);
+    } else if (!window->kms.should_apply_display_color || !can_present) {
+        // Nothing to present.
+        return 0;
     }
 
-    // add cursor infos
-    if (window->kms.cursor != NULL) {
-        ok = kms_req_builder_push_fb_layer(
-            builder,
-            &(const struct kms_fb_layer){
-                .drm_fb_id = window->kms.cursor->drm_fb_id,
-                .format = window->kms.cursor->format,
-                .has_modifier = true,
-                .modifier = DRM_FORMAT_MOD_LINEAR,
-                .src_x = 0,
-                .src_y = 0,
-                .src_w = ((uint16_t) window->kms.cursor->width) << 16,
-                .src_h = ((uint16_t) window->kms.cursor->height) << 16,
-                .dst_x = window->cursor_pos.x - window->kms.cursor->hotspot.x,
-                .dst_y = window->cursor_pos.y - window->kms.cursor->hotspot.y,
-                .dst_w = window->kms.cursor->width,
-                .dst_h = window->kms.cursor->height,
-                .has_rotation = false,
-                .rotation = PLANE_TRANSFORM_NONE,
-                .has_in_fence_fd = false,
-                .in_fence_fd = 0,
-                .prefer_cursor = true,
-            },
-            cursor_buffer_unref_with_locked_drmdev,
-            NULL,
-            window->kms.cursor
-        );
+    // Present the last frame right away (with the new brightness), flutter
+    // will only render a new one when something changes in the app.
+    if (window->composition != NULL) {
+        ok = kms_window_push_composition_locked(window, window->composition);
         if (ok != 0) {
-            LOG_ERROR("Couldn't present cursor.\n");
-        } else {
-            cursor_buffer_ref(window->kms.cursor);
+            LOG_ERROR("Couldn't present the last frame. kms_window_push_composition_locked: %s\n", strerror(ok));
+            return ok;
+        }
+    }
+
+    return 0;
+}
+
+static int dummy_window_push_composition(struct window *window, struct fl_layer_composition *composition);
+static struct render_surface *dummy_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size);
+static struct render_surface *dummy_window_get_render_surface(struct window *window, struct vec2i size);
+
+#ifdef HAVE_EGL_GLES2
+static bool dummy_window_has_egl_surface(struct window *window);
+static EGLSurface dummy_window_get_egl_surface(struct window *window);
+#endif
+
+static void dummy_window_deinit(struct window *window);
+static int dummy_window_set_cursor_locked(
+    // clang-format off
+    struct window *window,
+    bool has_enabled, bool enabled,
+    bool has_icon, const struct pointer_icon *icon,
+    bool has_pos, struct vec2i pos
+    // clang-format on
+);
+
+MUST_CHECK struct window *dummy_window_new(
+    // clang-format off
+    struct tracer *tracer,
+    struct frame_scheduler *scheduler,
+    enum renderer_type renderer_type,
+    struct gl_renderer *gl_renderer,
+    struct vk_renderer *vk_renderer,
+    struct vec2i size,
+    bool has_explicit_dimensions, int width_mm, int height_mm,
+    double refresh_rate,
+    const char *output_directory
+    // clang-format on
+) {
+    struct window *window;
+    int ok;
+
+    window = malloc(sizeof *window);
+    if (window == NULL) {
+        return NULL;
+    }
+
+    // The frames are only flattened (into this offscreen fbdev) if they're written out somewhere.
+    window->fbdev.fbdev = NULL;
+    window->fbdev.gbm_device = NULL;
+
+    window->dummy.output_directory = NULL;
+    window->dummy.frames_file = NULL;
+    if (output_directory != NULL) {
+        char *frames_path;
+
+        window->fbdev.fbdev = fbdev_new_offscreen(size);
+        if (window->fbdev.fbdev == NULL) {
+            LOG_ERROR("Couldn't create offscreen framebuffer for the dummy window.\n");
+            goto fail_free_window;
+        }
+
+        window->dummy.output_directory = strdup(output_directory);
+        if (window->dummy.output_directory == NULL) {
+            goto fail_unref_fbdev;
+        }
+
+        ok = asprintf(&frames_path, "%s/frames.txt", output_directory);
+        if (ok < 0) {
+            goto fail_free_output_directory;
+        }
+
+        window->dummy.frames_file = fopen(frames_path, "w");
+        if (window->dummy.frames_file == NULL) {
+            LOG_ERROR("Couldn't open \"%s\" for writing. fopen: %s\n", frames_path, strerror(errno));
+            free(frames_path);
+            goto fail_free_output_directory;
         }
+
+        free(frames_path);
+    }
+    window->dummy.n_frames = 0;
+
+    ok = window_init(
+        // clang-format off
+        window,
+        tracer,
+        scheduler,
+        false, PLANE_TRANSFORM_NONE,
+        false, kLandscapeLeft,
+        size.x, size.y,
+        has_explicit_dimensions, width_mm, height_mm,
+        refresh_rate,
+        false, PIXFMT_RGB565
+        // clang-format on
+    );
+    if (ok != 0) {
+        goto fail_close_frames_file;
+    }
+
+    window->renderer_type = renderer_type;
+    if (gl_renderer != NULL) {
+#ifdef HAVE_EGL_GLES2
+        window->gl_renderer = gl_renderer_ref(gl_renderer);
+#else
+        UNREACHABLE();
+#endif
+    }
+    if (vk_renderer != NULL) {
+#ifdef HAVE_VULKAN
+        window->vk_renderer = vk_renderer_ref(vk_renderer);
+#else
+        UNREACHABLE();
+#endif
+    } else {
+        window->vk_renderer = NULL;
     }
+    window->push_composition = dummy_window_push_composition;
+    window->get_render_surface = dummy_window_get_render_surface;
+#ifdef HAVE_EGL_GLES2
+    window->has_egl_surface = dummy_window_has_egl_surface;
+    window->get_egl_surface = dummy_window_get_egl_surface;
+#endif
+    window->deinit = dummy_window_deinit;
+    window->set_cursor_locked = dummy_window_set_cursor_locked;
+    return window;
 
-    req = kms_req_builder_build(builder);
-    if (req == NULL) {
-        goto fail_unref_builder;
+fail_close_frames_file:
+    if (window->dummy.frames_file != NULL) {
+        fclose(window->dummy.frames_file);
     }
 
-    kms_req_builder_unref(builder);
-    builder = NULL;
+fail_free_output_directory:
+    free(window->dummy.output_directory);
 
-    frame = malloc(sizeof *frame);
-    if (frame == NULL) {
-        goto fail_unref_req;
+fail_unref_fbdev:
+    if (window->fbdev.fbdev != NULL) {
+        fbdev_unref(window->fbdev.fbdev);
     }
 
-    frame->req = req;
-    frame->tracer = tracer_ref(window->tracer);
-    frame->unset_should_apply_mode_on_commit = window->kms.should_apply_mode;
-
-    frame_scheduler_present_frame(window->frame_scheduler, on_present_frame, frame, on_cancel_frame);
-
-    // if (window->present_mode == kDoubleBufferedVsync_PresentMode) {
-    //     TRACER_BEGIN(window->tracer, "kms_req_builder_commit");
-    //     ok = kms_req_commit(req, /* blocking: */ false);
-    //     TRACER_END(window->tracer, "kms_req_builder_commit");
-    //
-    //     if (ok != 0) {
-    //         LOG_ERROR("Could not commit frame request.\n");
-    //         goto fail_unref_window2;
-    //     }
-    //
-    //     if (window->set_set_mode) {
-    //         window->set_mode = false;
-    //         window->set_set_mode = false;
-    //     }
-    // } else {
-    //     ASSERT_EQUALS(window->present_mode, kTripleBufferedVsync_PresentMode);
-    //
-    //     if (window->present_immediately) {
-    //         TRACER_BEGIN(window->tracer, "kms_req_builder_commit");
-    //         ok = kms_req_commit(req, /* blocking: */ false);
-    //         TRACER_END(window->tracer, "kms_req_builder_commit");
-    //
-    //         if (ok != 0) {
-    //             LOG_ERROR("Could not commit frame request.\n");
-    //             goto fail_unref_window2;
-    //         }
-    //
-    //         if (window->set_set_mode) {
-    //             window->set_mode = false;
-    //             window->set_set_mode = false;
-    //         }
-    //
-    //         window->present_immediately = false;
-    //     } else {
-    //         if (window->next_frame != NULL) {
-    //             /// FIXME: Call the release callbacks when the kms_req is destroyed, not when it's unrefed.
-    //             /// Not sure this here will lead to the release callbacks being called multiple times.
-    //             kms_req_call_release_callbacks(window->next_frame);
-    //             kms_req_unref(window->next_frame);
-    //         }
-    //
-    //         window->next_frame = kms_req_ref(req);
-    //         window->set_set_mode = window->set_mode;
-    //     }
-    // }
+fail_free_window:
+    free(window);
+    return NULL;
+}
 
-    // KMS Req is committed now and drmdev keeps a ref
-    // on it internally, so we don't need to keep this one.
-    // kms_req_unref(req);
+/**
+ * @brief Calculate the 64-bit FNV-1a hash of the color channels of an XRGB8888 frame.
+ *
+ * The X channel is ignored, so the hash only depends on what's visible.
+ */
+static uint64_t hash_xrgb8888_frame(const uint8_t *frame, int stride, struct vec2i size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
 
-    // window_on_rendering_complete(window);
+    for (int y = 0; y < size.y; y++) {
+        const uint32_t *row = (const uint32_t *) (frame + (size_t) y * stride);
 
-    return 0;
+        for (int x = 0; x < size.x; x++) {
+            uint32_t pixel = row[x];
 
-fail_unref_req:
-    kms_req_unref(req);
-    return ok;
+            hash = (hash ^ ((pixel >> 16) & 0xFF)) * 0x100000001b3ull;
+            hash = (hash ^ ((pixel >> 8) & 0xFF)) * 0x100000001b3ull;
+            hash = (hash ^ (pixel & 0xFF)) * 0x100000001b3ull;
+        }
+    }
 
-fail_unref_builder:
-    kms_req_builder_unref(builder);
-    return ok;
+    return hash;
 }
 
-static int kms_window_push_composition(struct window *window, struct fl_layer_composition *composition) {
+static int write_xrgb8888_frame_as_ppm(const char *path, const uint8_t *frame, int stride, struct vec2i size) {
+    uint8_t *rgb_row;
+    FILE *file;
     int ok;
 
-    window_lock(window);
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        ok = errno;
+        LOG_ERROR("Couldn't open \"%s\" for writing. fopen: %s\n", path, strerror(ok));
+        return ok;
+    }
 
-    ok = kms_window_push_composition_locked(window, composition);
+    rgb_row = malloc(size.x * 3);
+    if (rgb_row == NULL) {
+        ok = ENOMEM;
+        goto fail_close_file;
+    }
 
-    window_unlock(window);
+    fprintf(file, "P6\n%d %d\n255\n", size.x, size.y);
 
-    return ok;
-}
+    for (int y = 0; y < size.y; y++) {
+        const uint32_t *row = (const uint32_t *) (frame + (size_t) y * stride);
 
-static bool count_modifiers_for_pixel_format(
-    UNUSED struct drm_plane *plane,
-    UNUSED int index,
-    enum pixfmt pixel_format,
-    UNUSED uint64_t modifier,
-    void *userdata
-) {
-    struct {
-        enum pixfmt format;
-        uint64_t *modifiers;
-        size_t n_modifiers;
-        int index;
-    } *context = userdata;
+        for (int x = 0; x < size.x; x++) {
+            rgb_row[x * 3 + 0] = (row[x] >> 16) & 0xFF;
+            rgb_row[x * 3 + 1] = (row[x] >> 8) & 0xFF;
+            rgb_row[x * 3 + 2] = row[x] & 0xFF;
+        }
 
-    if (pixel_format == context->format) {
-        context->n_modifiers++;
+        if (fwrite(rgb_row, 3, size.x, file) != (size_t) size.x) {
+            ok = EIO;
+            LOG_ERROR("Couldn't write frame to \"%s\".\n", path);
+            goto fail_free_rgb_row;
+        }
     }
 
-    return true;
-}
-
-static bool extract_modifiers_for_pixel_format(
-    UNUSED struct drm_plane *plane,
-    UNUSED int index,
-    enum pixfmt pixel_format,
-    uint64_t modifier,
-    void *userdata
-) {
-    struct {
-        enum pixfmt format;
-        uint64_t *modifiers;
-        size_t n_modifiers;
-        int index;
-    } *context = userdata;
+    free(rgb_row);
+    fclose(file);
+    return 0;
 
-    if (pixel_format == context->format) {
-        context->modifiers[context->index++] = modifier;
-    }
+fail_free_rgb_row:
+    free(rgb_row);
 
-    return true;
+fail_close_file:
+    fclose(file);
+    return ok;
 }
 
-static struct render_surface *kms_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size) {
-    struct render_surface *render_surface;
+static int dummy_window_push_composition(struct window *window, struct fl_layer_composition *composition) {
+    struct fbdev_commit_builder *builder;
+    const uint8_t *frame;
+    struct vec2i size;
+    uint64_t frame_number, hash;
+    char *path;
+    int ok, stride;
 
     ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(composition);
 
-    if (window->render_surface != NULL) {
-        return window->render_surface;
+    window_lock(window);
+
+    fl_layer_composition_swap_ptrs(&window->composition, composition);
+
+    if (window->dummy.output_directory == NULL) {
+        // Nobody's looking at the frames, so don't waste time flattening them.
+        window_unlock(window);
+        return 0;
     }
 
-    if (!has_size) {
-        // Flutter wants a render surface, but hasn't told us the backing store dimensions yet.
-        // Just make a good guess about the dimensions.
-        LOG_DEBUG("Flutter requested render surface before supplying surface dimensions.\n");
-        size = VEC2I(window->kms.mode->hdisplay, window->kms.mode->vdisplay);
+    // Flatten the composition into a single image, the same way a fbdev window would.
+    builder = fbdev_create_commit_builder(window->fbdev.fbdev);
+    if (builder == NULL) {
+        ok = ENOMEM;
+        goto fail_unlock;
     }
 
-    enum pixfmt pixel_format;
-    if (window->has_forced_pixel_format) {
-        pixel_format = window->forced_pixel_format;
-    } else {
-        // Actually, more devices support ARGB8888 might sometimes not be supported by devices,
-        // for example for primary planes. But we can just cast ARGB8888 to XRGB8888 if we need to,
-        // and ARGB8888 is still a good default choice because casting XRGB to ARGB might not work,
-        // and sometimes we need alpha for overlay planes.
-        // Also vulkan doesn't work with XRGB yet so we definitely need to use ARGB to vulkan too.
-        pixel_format = PIXFMT_ARGB8888;
+    for (size_t i = 0; i < fl_layer_composition_get_n_layers(composition); i++) {
+        struct fl_layer *layer = fl_layer_composition_peek_layer(composition, i);
+
+        ok = surface_present_fbdev(layer->surface, &layer->props, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't flatten flutter layer. surface_present_fbdev: %s\n", strerror(ok));
+            goto fail_destroy_builder;
+        }
     }
 
-    // Possibly populate this with the supported modifiers for this pixel format.
-    // If no plane lists modifiers for this pixel format, this will be left at NULL,
-    // and egl_gbm_render_surface_new... will create the GBM surface using usage flags
-    // (GBM_USE_SCANOUT | GBM_USE_RENDER) instead.
-    uint64_t *allowed_modifiers = NULL;
-    size_t n_allowed_modifiers = 0;
+    TRACER_BEGIN(window->tracer, "fbdev_commit_builder_commit");
+    ok = fbdev_commit_builder_commit(builder);
+    TRACER_END(window->tracer, "fbdev_commit_builder_commit");
+    if (ok != 0) {
+        goto fail_destroy_builder;
+    }
 
-    // For now just set the supported modifiers for the first plane that supports this pixel format
-    // as the allowed modifiers.
-    /// TODO: Find a way to rank pixel formats, maybe by number of planes that support them for scanout.
-    {
-        struct drm_plane *plane;
-        for_each_plane_in_drmdev(window->kms.drmdev, plane) {
-            if (!(plane->possible_crtcs & window->kms.crtc->bitmask)) {
-                // Only query planes that are possible to connect to the CRTC we're using.
-                continue;
-            }
+    // The offscreen fbdev always uses XRGB8888.
+    size = fbdev_get_size(window->fbdev.fbdev);
+    frame = fbdev_commit_builder_peek_frame(builder, &stride);
+    hash = hash_xrgb8888_frame(frame, stride, size);
 
-            if (plane->type != kPrimary_DrmPlaneType && plane->type != kOverlay_DrmPlaneType) {
-                // We explicitly only look for primary and overlay planes.
-                continue;
-            }
+    frame_number = window->dummy.n_frames++;
 
-            if (!plane->supports_modifiers) {
-                // The plane does not have an IN_FORMATS property and does not support
-                // explicit modifiers.
-                //
-                // Calling drm_plane_for_each_modified_format below will segfault.
-                continue;
-            }
+    ok = asprintf(&path, "%s/frame_%06" PRIu64 ".ppm", window->dummy.output_directory, frame_number);
+    if (ok < 0) {
+        ok = ENOMEM;
+        goto fail_destroy_builder;
+    }
 
-            struct {
-                enum pixfmt format;
-                uint64_t *modifiers;
-                size_t n_modifiers;
-                int index;
-            } context = {
-                .format = pixel_format,
-                .modifiers = NULL,
-                .n_modifiers = 0,
-                .index = 0,
-            };
+    // Failing to write a frame is not fatal.
+    write_xrgb8888_frame_as_ppm(path, frame, stride, size);
+    free(path);
 
-            // First, count the allowed modifiers for this pixel format.
-            drm_plane_for_each_modified_format(plane, count_modifiers_for_pixel_format, &context);
+    fprintf(window->dummy.frames_file, "%" PRIu64 " %" PRIu64 " %016" PRIx64 "\n", frame_number, get_monotonic_time(), hash);
+    fflush(window->dummy.frames_file);
 
-            n_allowed_modifiers = context.n_modifiers;
-            allowed_modifiers = calloc(n_allowed_modifiers, sizeof(*context.modifiers));
-            context.modifiers = allowed_modifiers;
+    LOG_DEBUG("dummy window frame %" PRIu64 ": hash %016" PRIx64 "\n", frame_number, hash);
 
-            // Next, fill context.modifiers with the allowed modifiers.
-            drm_plane_for_each_modified_format(plane, extract_modifiers_for_pixel_format, &context);
-            break;
-        }
+    fbdev_commit_builder_destroy(builder);
+    window_unlock(window);
+    return 0;
+
+fail_destroy_builder:
+    fbdev_commit_builder_destroy(builder);
+
+fail_unlock:
+    window_unlock(window);
+    return ok;
+}
+
+static struct render_surface *dummy_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size) {
+    struct render_surface *render_surface;
+
+    ASSERT_NOT_NULL(window);
+
+    if (!has_size) {
+        size = vec2f_round_to_integer(window->view_size);
+    }
+
+    if (window->render_surface != NULL) {
+        return window->render_surface;
     }
 
     if (window->renderer_type == kOpenGL_RendererType) {
@@ -1450,10 +3842,10 @@ static struct render_surface *kms_window_get_render_surface_internal(struct wind
             size,
             gl_renderer_get_gbm_device(window->gl_renderer),
             window->gl_renderer,
-            pixel_format,
+            window->has_forced_pixel_format ? window->forced_pixel_format : PIXFMT_ARGB8888,
             EGL_NO_CONFIG_KHR,
-            allowed_modifiers,
-            n_allowed_modifiers
+            NULL,
+            0
         );
         if (egl_surface == NULL) {
             LOG_ERROR("Couldn't create EGL GBM rendering surface.\n");
@@ -1461,43 +3853,34 @@ static struct render_surface *kms_window_get_render_surface_internal(struct wind
         } else {
             render_surface = CAST_RENDER_SURFACE(egl_surface);
         }
-
-#else
-        UNREACHABLE();
-#endif
-    } else {
-        ASSUME(window->renderer_type == kVulkan_RendererType);
-
-        // vulkan
-#ifdef HAVE_VULKAN
-        struct vk_gbm_render_surface *vk_surface =
-            vk_gbm_render_surface_new(window->tracer, size, drmdev_get_gbm_device(window->kms.drmdev), window->vk_renderer, pixel_format);
-        if (vk_surface == NULL) {
-            LOG_ERROR("Couldn't create Vulkan GBM rendering surface.\n");
-            render_surface = NULL;
-        } else {
-            render_surface = CAST_RENDER_SURFACE(vk_surface);
-        }
+
 #else
         UNREACHABLE();
 #endif
-    }
+    } else {
+        ASSUME(window->renderer_type == kVulkan_RendererType);
 
-    if (allowed_modifiers != NULL) {
-        free(allowed_modifiers);
+        // vulkan
+#ifdef HAVE_VULKAN
+        UNIMPLEMENTED();
+#else
+        UNREACHABLE();
+#endif
     }
 
     window->render_surface = render_surface;
     return render_surface;
 }
 
-static struct render_surface *kms_window_get_render_surface(struct window *window, struct vec2i size) {
+static struct render_surface *dummy_window_get_render_surface(struct window *window, struct vec2i size) {
     ASSERT_NOT_NULL(window);
-    return kms_window_get_render_surface_internal(window, true, size);
+    return dummy_window_get_render_surface_internal(window, true, size);
 }
 
 #ifdef HAVE_EGL_GLES2
-static bool kms_window_has_egl_surface(struct window *window) {
+static bool dummy_window_has_egl_surface(struct window *window) {
+    ASSERT_NOT_NULL(window);
+
     if (window->renderer_type == kOpenGL_RendererType) {
         return window->render_surface != NULL;
     } else {
@@ -1505,9 +3888,11 @@ static bool kms_window_has_egl_surface(struct window *window) {
     }
 }
 
-static EGLSurface kms_window_get_egl_surface(struct window *window) {
+static EGLSurface dummy_window_get_egl_surface(struct window *window) {
+    ASSERT_NOT_NULL(window);
+
     if (window->renderer_type == kOpenGL_RendererType) {
-        struct render_surface *render_surface = kms_window_get_render_surface_internal(window, false, VEC2I(0, 0));
+        struct render_surface *render_surface = dummy_window_get_render_surface_internal(window, false, VEC2I(0, 0));
         return egl_gbm_render_surface_get_egl_surface(CAST_EGL_GBM_RENDER_SURFACE(render_surface));
     } else {
         return EGL_NO_SURFACE;
@@ -1515,125 +3900,162 @@ static EGLSurface kms_window_get_egl_surface(struct window *window) {
 }
 #endif
 
-static int kms_window_set_cursor_locked(
-    // clang-format off
-    struct window *window,
-    bool has_enabled, bool enabled,
-    bool has_kind, enum pointer_kind kind,
-    bool has_pos, struct vec2i pos
-    // clang-format on
-) {
-    const struct pointer_icon *icon;
-    struct cursor_buffer *cursor;
+static void dummy_window_deinit(struct window *window) {
+    ASSERT_NOT_NULL(window);
 
-    if (has_kind) {
-        if (window->kms.pointer_icon == NULL || pointer_icon_get_kind(window->kms.pointer_icon) != kind) {
-            window->kms.pointer_icon = pointer_icon_for_details(kind, window->pixel_ratio);
-            ASSERT_NOT_NULL(window->kms.pointer_icon);
-        }
+    if (window->render_surface != NULL) {
+        surface_unref(CAST_SURFACE(window->render_surface));
     }
 
-    enabled = has_enabled ? enabled : window->cursor_enabled;
-    icon = has_kind ? pointer_icon_for_details(kind, window->pixel_ratio) : window->kms.pointer_icon;
-    pos = has_pos ? pos : window->cursor_pos;
-    cursor = window->kms.cursor;
-
-    if (enabled && icon == NULL) {
-        // default to the arrow icon.
-        icon = pointer_icon_for_details(POINTER_KIND_BASIC, window->pixel_ratio);
-        ASSERT_NOT_NULL(icon);
+    if (window->gl_renderer != NULL) {
+#ifdef HAVE_EGL_GLES2
+        gl_renderer_unref(window->gl_renderer);
+#else
+        UNREACHABLE();
+#endif
     }
 
-    if (window->kms.pointer_icon != icon) {
-        window->kms.pointer_icon = icon;
+    if (window->vk_renderer != NULL) {
+#ifdef HAVE_VULKAN
+        vk_renderer_unref(window->vk_renderer);
+#else
+        UNREACHABLE();
+#endif
     }
 
-    if (enabled) {
-        if (cursor == NULL || icon != cursor->icon) {
-            cursor = cursor_buffer_new(window->kms.drmdev, window->kms.pointer_icon, window->rotation);
-            if (cursor == NULL) {
-                return EIO;
-            }
+    if (window->dummy.frames_file != NULL) {
+        fclose(window->dummy.frames_file);
+    }
+    free(window->dummy.output_directory);
+    if (window->fbdev.fbdev != NULL) {
+        fbdev_unref(window->fbdev.fbdev);
+    }
 
-            cursor_buffer_swap_ptrs(&window->kms.cursor, cursor);
+    window_deinit(window);
+}
 
-            // cursor is created with refcount 1. cursor_buffer_swap_ptrs
-            // increases refcount by one. deref here so we don't leak a
-            // reference.
-            cursor_buffer_unrefp(&cursor);
+static int dummy_window_set_cursor_locked(
+    // clang-format off
+    struct window *window,
+    bool has_enabled, bool enabled,
+    bool has_icon, const struct pointer_icon *icon,
+    bool has_pos, struct vec2i pos
+    // clang-format on
+) {
+    ASSERT_NOT_NULL(window);
 
-            // apply the new cursor icon & position by scanning out a new frame.
-            window->cursor_pos = pos;
-            if (window->composition != NULL) {
-                kms_window_push_composition_locked(window, window->composition);
-            }
-        } else if (has_pos) {
-            // apply the new cursor position using drmModeMoveCursor
-            window->cursor_pos = pos;
-            drmdev_move_cursor(window->kms.drmdev, window->kms.crtc->id, vec2i_sub(pos, window->kms.cursor->hotspot));
-        }
-    } else {
-        if (window->kms.cursor != NULL) {
-            cursor_buffer_unrefp(&window->kms.cursor);
-        }
-    }
+    (void) window;
+    (void) has_enabled;
+    (void) enabled;
+    (void) has_icon;
+    (void) icon;
+    (void) has_pos;
+    (void) pos;
 
-    window->cursor_enabled = enabled;
     return 0;
 }
 
-static int dummy_window_push_composition(struct window *window, struct fl_layer_composition *composition);
-static struct render_surface *dummy_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size);
-static struct render_surface *dummy_window_get_render_surface(struct window *window, struct vec2i size);
+static int fbdev_window_push_composition(struct window *window, struct fl_layer_composition *composition);
+static struct render_surface *fbdev_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size);
+static struct render_surface *fbdev_window_get_render_surface(struct window *window, struct vec2i size);
 
 #ifdef HAVE_EGL_GLES2
-static bool dummy_window_has_egl_surface(struct window *window);
-static EGLSurface dummy_window_get_egl_surface(struct window *window);
+static bool fbdev_window_has_egl_surface(struct window *window);
+static EGLSurface fbdev_window_get_egl_surface(struct window *window);
 #endif
 
-static void dummy_window_deinit(struct window *window);
-static int dummy_window_set_cursor_locked(
-    // clang-format off
-    struct window *window,
-    bool has_enabled, bool enabled,
-    bool has_kind, enum pointer_kind kind,
-    bool has_pos, struct vec2i pos
-    // clang-format on
-);
+static void fbdev_window_deinit(struct window *window);
 
-MUST_CHECK struct window *dummy_window_new(
+MUST_CHECK struct window *fbdev_window_new(
     // clang-format off
     struct tracer *tracer,
     struct frame_scheduler *scheduler,
     enum renderer_type renderer_type,
     struct gl_renderer *gl_renderer,
     struct vk_renderer *vk_renderer,
-    struct vec2i size,
+    struct fbdev *fbdev,
+    struct gbm_device *gbm_device,
+    bool has_rotation, drm_plane_transform_t rotation,
+    bool has_orientation, enum device_orientation orientation,
     bool has_explicit_dimensions, int width_mm, int height_mm,
-    double refresh_rate
+    bool has_forced_pixel_format, enum pixfmt forced_pixel_format
     // clang-format on
 ) {
     struct window *window;
+    struct vec2i size;
+    bool has_dimensions;
+    int ok;
+
+    ASSERT_NOT_NULL(fbdev);
+
+    if (has_forced_pixel_format && pixfmt_is_float(forced_pixel_format)) {
+        LOG_ERROR("Floating point pixel formats are not supported for fbdev displays.\n");
+        return NULL;
+    }
+
+#if !defined(HAVE_VULKAN)
+    ASSUME(renderer_type != kVulkan_RendererType);
+#endif
+
+#if !defined(HAVE_EGL_GLES2)
+    ASSUME(renderer_type != kOpenGL_RendererType);
+#endif
+
+    // if opengl --> gl_renderer != NULL && vk_renderer == NULL
+    assert(renderer_type != kOpenGL_RendererType || (gl_renderer != NULL && vk_renderer == NULL));
+
+    // if vulkan --> vk_renderer != NULL && gl_renderer == NULL && gbm_device != NULL
+    assert(renderer_type != kVulkan_RendererType || (vk_renderer != NULL && gl_renderer == NULL && gbm_device != NULL));
 
     window = malloc(sizeof *window);
     if (window == NULL) {
         return NULL;
     }
 
-    window_init(
+    size = fbdev_get_size(fbdev);
+
+    if (has_explicit_dimensions) {
+        has_dimensions = true;
+    } else {
+        has_dimensions = fbdev_get_physical_size(fbdev, &width_mm, &height_mm);
+    }
+
+    ok = window_init(
         // clang-format off
         window,
         tracer,
         scheduler,
-        false, PLANE_TRANSFORM_NONE,
-        false, kLandscapeLeft,
+        has_rotation, rotation,
+        has_orientation, orientation,
         size.x, size.y,
-        has_explicit_dimensions, width_mm, height_mm,
-        refresh_rate,
-        false, PIXFMT_RGB565
+        has_dimensions, width_mm, height_mm,
+        fbdev_get_refresh_rate(fbdev),
+        has_forced_pixel_format, forced_pixel_format
         // clang-format on
     );
+    if (ok != 0) {
+        free(window);
+        return NULL;
+    }
+
+    LOG_DEBUG_UNPREFIXED(
+        "display mode:\n"
+        "  resolution: %d x %d\n"
+        "  refresh rate: %fHz\n"
+        "  physical size: %dmm x %dmm\n"
+        "  flutter device pixel ratio: %f\n"
+        "  pixel format: %s\n",
+        size.x,
+        size.y,
+        window->refresh_rate,
+        width_mm,
+        height_mm,
+        window->pixel_ratio,
+        has_forced_pixel_format ? get_pixfmt_info(forced_pixel_format)->name : "(any)"
+    );
 
+    window->fbdev.fbdev = fbdev_ref(fbdev);
+    window->fbdev.gbm_device = gbm_device;
     window->renderer_type = renderer_type;
     if (gl_renderer != NULL) {
 #ifdef HAVE_EGL_GLES2
@@ -1651,39 +4073,87 @@ MUST_CHECK struct window *dummy_window_new(
     } else {
         window->vk_renderer = NULL;
     }
-    window->push_composition = dummy_window_push_composition;
-    window->get_render_surface = dummy_window_get_render_surface;
+    window->push_composition = fbdev_window_push_composition;
+    window->get_render_surface = fbdev_window_get_render_surface;
 #ifdef HAVE_EGL_GLES2
-    window->has_egl_surface = dummy_window_has_egl_surface;
-    window->get_egl_surface = dummy_window_get_egl_surface;
+    window->has_egl_surface = fbdev_window_has_egl_surface;
+    window->get_egl_surface = fbdev_window_get_egl_surface;
 #endif
-    window->deinit = dummy_window_deinit;
+    window->deinit = fbdev_window_deinit;
+    // There's no hardware cursor on fbdev, so we can just do nothing here like the dummy window.
     window->set_cursor_locked = dummy_window_set_cursor_locked;
     return window;
 }
 
-static int dummy_window_push_composition(struct window *window, struct fl_layer_composition *composition) {
+static int fbdev_window_push_composition(struct window *window, struct fl_layer_composition *composition) {
+    struct fbdev_commit_builder *builder;
+    int ok;
+
+    ASSERT_NOT_NULL(window);
+    ASSERT_NOT_NULL(composition);
+
     window_lock(window);
 
-    /// TODO: Maybe allow to export the layer composition as an image, for testing purposes.
-    (void) composition;
+    fl_layer_composition_swap_ptrs(&window->composition, composition);
 
-    window_unlock(window);
+    builder = fbdev_create_commit_builder(window->fbdev.fbdev);
+    if (builder == NULL) {
+        ok = ENOMEM;
+        goto fail_unlock;
+    }
+
+    for (size_t i = 0; i < fl_layer_composition_get_n_layers(composition); i++) {
+        struct fl_layer *layer = fl_layer_composition_peek_layer(composition, i);
+
+        ok = surface_present_fbdev(layer->surface, &layer->props, builder);
+        if (ok != 0) {
+            LOG_ERROR("Couldn't present flutter layer on screen. surface_present_fbdev: %s\n", strerror(ok));
+            goto fail_destroy_builder;
+        }
+    }
+
+    TRACER_BEGIN(window->tracer, "fbdev_commit_builder_commit");
+    ok = fbdev_commit_builder_commit(builder);
+    TRACER_END(window->tracer, "fbdev_commit_builder_commit");
+    if (ok != 0) {
+        LOG_ERROR("Couldn't present frame on fbdev.\n");
+        goto fail_destroy_builder;
+    }
 
+    fbdev_commit_builder_destroy(builder);
+    window_unlock(window);
     return 0;
+
+fail_destroy_builder:
+    fbdev_commit_builder_destroy(builder);
+
+fail_unlock:
+    window_unlock(window);
+    return ok;
 }
 
-static struct render_surface *dummy_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size) {
+static struct render_surface *fbdev_window_get_render_surface_internal(struct window *window, bool has_size, UNUSED struct vec2i size) {
     struct render_surface *render_surface;
+    enum pixfmt pixel_format;
 
     ASSERT_NOT_NULL(window);
 
+    if (window->render_surface != NULL) {
+        return window->render_surface;
+    }
+
     if (!has_size) {
         size = vec2f_round_to_integer(window->view_size);
     }
 
-    if (window->render_surface != NULL) {
-        return window->render_surface;
+    if (window->has_forced_pixel_format) {
+        pixel_format = window->forced_pixel_format;
+    } else if (window->renderer_type == kOpenGL_RendererType && fbdev_get_pixel_format(window->fbdev.fbdev, &pixel_format)) {
+        // Rendering in the pixel format of the fbdev means we don't need to convert the pixels
+        // when presenting, and can just copy them into the framebuffer memory.
+    } else {
+        // vulkan doesn't work with anything else than ARGB8888 yet.
+        pixel_format = PIXFMT_ARGB8888;
     }
 
     if (window->renderer_type == kOpenGL_RendererType) {
@@ -1694,15 +4164,19 @@ static struct render_surface *dummy_window_get_render_surface_internal(struct wi
         #error "EGL header definitions for extension EGL_KHR_no_config_context are required."
     #endif
 
+        // We read back the buffers using the CPU when presenting, so make sure they're linear.
+        // Otherwise gbm_bo_map would need to detile them on every frame.
+        static const uint64_t linear_modifier = DRM_FORMAT_MOD_LINEAR;
+
         struct egl_gbm_render_surface *egl_surface = egl_gbm_render_surface_new_with_egl_config(
             window->tracer,
             size,
             gl_renderer_get_gbm_device(window->gl_renderer),
             window->gl_renderer,
-            window->has_forced_pixel_format ? window->forced_pixel_format : PIXFMT_ARGB8888,
+            pixel_format,
             EGL_NO_CONFIG_KHR,
-            NULL,
-            0
+            &linear_modifier,
+            1
         );
         if (egl_surface == NULL) {
             LOG_ERROR("Couldn't create EGL GBM rendering surface.\n");
@@ -1719,7 +4193,14 @@ static struct render_surface *dummy_window_get_render_surface_internal(struct wi
 
         // vulkan
 #ifdef HAVE_VULKAN
-        UNIMPLEMENTED();
+        struct vk_gbm_render_surface *vk_surface =
+            vk_gbm_render_surface_new(window->tracer, size, window->fbdev.gbm_device, window->vk_renderer, pixel_format);
+        if (vk_surface == NULL) {
+            LOG_ERROR("Couldn't create Vulkan GBM rendering surface.\n");
+            render_surface = NULL;
+        } else {
+            render_surface = CAST_RENDER_SURFACE(vk_surface);
+        }
 #else
         UNREACHABLE();
 #endif
@@ -1729,13 +4210,13 @@ static struct render_surface *dummy_window_get_render_surface_internal(struct wi
     return render_surface;
 }
 
-static struct render_surface *dummy_window_get_render_surface(struct window *window, struct vec2i size) {
+static struct render_surface *fbdev_window_get_render_surface(struct window *window, struct vec2i size) {
     ASSERT_NOT_NULL(window);
-    return dummy_window_get_render_surface_internal(window, true, size);
+    return fbdev_window_get_render_surface_internal(window, true, size);
 }
 
 #ifdef HAVE_EGL_GLES2
-static bool dummy_window_has_egl_surface(struct window *window) {
+static bool fbdev_window_has_egl_surface(struct window *window) {
     ASSERT_NOT_NULL(window);
 
     if (window->renderer_type == kOpenGL_RendererType) {
@@ -1745,11 +4226,11 @@ static bool dummy_window_has_egl_surface(struct window *window) {
     }
 }
 
-static EGLSurface dummy_window_get_egl_surface(struct window *window) {
+static EGLSurface fbdev_window_get_egl_surface(struct window *window) {
     ASSERT_NOT_NULL(window);
 
     if (window->renderer_type == kOpenGL_RendererType) {
-        struct render_surface *render_surface = dummy_window_get_render_surface_internal(window, false, VEC2I(0, 0));
+        struct render_surface *render_surface = fbdev_window_get_render_surface_internal(window, false, VEC2I(0, 0));
         return egl_gbm_render_surface_get_egl_surface(CAST_EGL_GBM_RENDER_SURFACE(render_surface));
     } else {
         return EGL_NO_SURFACE;
@@ -1757,7 +4238,7 @@ static EGLSurface dummy_window_get_egl_surface(struct window *window) {
 }
 #endif
 
-static void dummy_window_deinit(struct window *window) {
+static void fbdev_window_deinit(struct window *window) {
     ASSERT_NOT_NULL(window);
 
     if (window->render_surface != NULL) {
@@ -1780,26 +4261,6 @@ static void dummy_window_deinit(struct window *window) {
 #endif
     }
 
+    fbdev_unref(window->fbdev.fbdev);
     window_deinit(window);
 }
-
-static int dummy_window_set_cursor_locked(
-    // clang-format off
-    struct window *window,
-    bool has_enabled, bool enabled,
-    bool has_kind, enum pointer_kind kind,
-    bool has_pos, struct vec2i pos
-    // clang-format on
-) {
-    ASSERT_NOT_NULL(window);
-
-    (void) window;
-    (void) has_enabled;
-    (void) enabled;
-    (void) has_kind;
-    (void) kind;
-    (void) has_pos;
-    (void) pos;
-
-    return 0;
-}
@@ -22,6 +22,10 @@ struct window;
 struct tracer;
 struct frame_scheduler;
 struct fl_layer_composition;
+struct fbdev;
+struct gbm_device;
+struct display_color_settings;
+struct display_hdr_metadata;
 
 struct view_geometry {
     struct vec2f view_size, display_size;
@@ -49,6 +53,8 @@ DECLARE_REF_OPS(window)
  * @param height_mm
  * @param has_forced_pixel_format
  * @param forced_pixel_format
+ * @param hdr_metadata If not NULL, the display is switched into HDR mode with this metadata,
+ *                     and a 10-bit pixel format is used if possible.
  * @param drmdev
  * @param desired_videomode
  * @return struct window* The new KMS window.
@@ -64,6 +70,7 @@ struct window *kms_window_new(
     bool has_orientation, enum device_orientation orientation,
     bool has_explicit_dimensions, int width_mm, int height_mm,
     bool has_forced_pixel_format, enum pixfmt forced_pixel_format,
+    const struct display_hdr_metadata *hdr_metadata,
     struct drmdev *drmdev,
     const char *desired_videomode
     // clang-format on
@@ -82,6 +89,11 @@ struct window *kms_window_new(
  * @param width_mm The width of the window in millimeters.
  * @param height_mm The height of the window in millimeters.
  * @param refresh_rate The refresh rate of the window.
+ * @param output_directory If not NULL, every presented frame is written to this directory
+ *                         as a PPM image (frame_000000.ppm, frame_000001.ppm, ...), and the
+ *                         frame number, presentation time and hash of every frame is
+ *                         appended to frames.txt in this directory and logged as a debug message.
+ *                         If NULL, frames aren't flattened at all.
  * @return A pointer to the newly created window.
  */
 MUST_CHECK struct window *dummy_window_new(
@@ -94,7 +106,48 @@ MUST_CHECK struct window *dummy_window_new(
     bool has_explicit_dimensions,
     int width_mm,
     int height_mm,
-    double refresh_rate
+    double refresh_rate,
+    const char *output_directory
+);
+
+/**
+ * @brief Creates a new window that outputs to a linux framebuffer device.
+ *
+ * Flutter renders into linear GBM buffers, which are composited on the CPU
+ * and copied into the framebuffer memory when a frame is presented.
+ *
+ * @param tracer The tracer object.
+ * @param scheduler The frame scheduler object.
+ * @param renderer_type The type of renderer.
+ * @param gl_renderer The GL renderer object.
+ * @param vk_renderer The Vulkan renderer object.
+ * @param fbdev The framebuffer device to output to.
+ * @param gbm_device The GBM device used to allocate buffers for rendering with vulkan.
+ * @param has_rotation Whether a rotation was specified.
+ * @param rotation The rotation of the display.
+ * @param has_orientation Whether an orientation was specified.
+ * @param orientation The orientation of the display.
+ * @param has_explicit_dimensions Whether the physical dimensions were specified explicitly.
+ * @param width_mm The width of the display in millimeters.
+ * @param height_mm The height of the display in millimeters.
+ * @param has_forced_pixel_format Whether a specific pixel format should be used for rendering.
+ * @param forced_pixel_format The pixel format that should be used for rendering.
+ * @return A pointer to the newly created window.
+ */
+MUST_CHECK struct window *fbdev_window_new(
+    // clang-format off
+    struct tracer *tracer,
+    struct frame_scheduler *scheduler,
+    enum renderer_type renderer_type,
+    struct gl_renderer *gl_renderer,
+    struct vk_renderer *vk_renderer,
+    struct fbdev *fbdev,
+    struct gbm_device *gbm_device,
+    bool has_rotation, drm_plane_transform_t rotation,
+    bool has_orientation, enum device_orientation orientation,
+    bool has_explicit_dimensions, int width_mm, int height_mm,
+    bool has_forced_pixel_format, enum pixfmt forced_pixel_format
+    // clang-format on
 );
 
 /**
@@ -114,6 +167,17 @@ int window_push_composition(struct window *window, struct fl_layer_composition *
  */
 struct view_geometry window_get_view_geometry(struct window *window);
 
+/**
+ * @brief Get the view geometry flutter frames are currently rasterized and presented with.
+ *
+ * Differs from @ref window_get_view_geometry while an orientation change is pending,
+ * see @ref window_set_orientation. Use this for the root surface transform.
+ *
+ * @param window The window instance.
+ * @return struct view_geometry
+ */
+struct view_geometry window_get_frame_view_geometry(struct window *window);
+
 /**
  * @brief Returns the vertical refresh rate of the chosen mode & display.
  *
@@ -122,6 +186,42 @@ struct view_geometry window_get_view_geometry(struct window *window);
  */
 ATTR_PURE double window_get_refresh_rate(struct window *window);
 
+/**
+ * @brief Get the current device orientation of the window.
+ *
+ * @param window The window instance.
+ * @return enum device_orientation The current orientation.
+ */
+enum device_orientation window_get_orientation(struct window *window);
+
+/**
+ * @brief Change the device orientation of the window at runtime.
+ *
+ * Updates the view size and the view transforms returned by @ref window_get_view_geometry, so the caller
+ * should send updated window metrics to flutter afterwards.
+ *
+ * If the view size changes, the rotation and the geometry returned by @ref window_get_frame_view_geometry
+ * stay the same until the first frame laid out with the new view size arrives. (See @ref window_latch_orientation)
+ *
+ * @param window The window instance.
+ * @param orientation The new device orientation.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int window_set_orientation(struct window *window, enum device_orientation orientation);
+
+/**
+ * @brief Apply a pending orientation if flutter rasterized a frame of size @p frame_size
+ * using the new view size.
+ *
+ * Such a frame was still rasterized using the old root surface transform, so it must not be
+ * presented. The caller should drop it and make flutter render a new one.
+ *
+ * @param window The window instance.
+ * @param frame_size The size of the backing store flutter rendered the frame into.
+ * @return true if the pending orientation was applied and the frame should be dropped.
+ */
+bool window_latch_orientation(struct window *window, struct vec2i frame_size);
+
 /**
  * @brief Returns the timestamp of the next vblank signal in @param next_vblank_ns_out.
  *
@@ -156,4 +256,128 @@ int window_set_cursor(
     // clang-format on
 );
 
+/**
+ * @brief Show a specific pointer icon as the mouse cursor, for example a custom cursor of the app.
+ *
+ * The icon must stay alive until a different icon or pointer kind is set.
+ *
+ * @param window The window instance.
+ * @param icon The icon that should be shown.
+ * @return int Zero on success, errno-code otherwise.
+ */
+int window_set_cursor_icon(struct window *window, const struct pointer_icon *icon);
+
+/**
+ * @brief Stop presenting frames on this window, for example because our session was deactivated.
+ *
+ * Compositions pushed while suspended are not presented, but the last one is kept around.
+ *
+ * @param window The window instance.
+ */
+void window_suspend(struct window *window);
+
+/**
+ * @brief Resume presenting frames on this window and re-present the last composition.
+ *
+ * @param window The window instance.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int window_resume(struct window *window);
+
+/**
+ * @brief Called when the kernel reported a display hotplug event.
+ *
+ * For KMS windows, this re-probes the connectors and selects a new mode. If the display was disconnected,
+ * nothing is presented until it's connected again. If the mode changed, it is applied with a full modeset.
+ * If the size of the display changed, the render surface is re-created with the new size.
+ *
+ * @param window The window instance.
+ * @param geometry_changed_out Set to true if the view geometry changed and flutter needs new window metrics.
+ * @return int Zero if successful, errno-code otherwise.
+ */
+int window_on_hotplug(struct window *window, bool *geometry_changed_out);
+
+/**
+ * @brief Set the brightness, contrast, color temperature and calibration of the display.
+ *
+ * For KMS windows, this is done using the gamma LUT and color transformation matrix
+ * of the CRTC, so it doesn't cost any GPU time. The new settings are applied atomically
+ * with the next frame. The last frame is presented again, so they're visible right away.
+ *
+ * @param window The window instance.
+ * @param settings The new display color settings.
+ * @return int Zero if successful, EOPNOTSUPP if the window or display controller doesn't support it,
+ *             errno-code otherwise.
+ */
+int window_set_display_color(struct window *window, const struct display_color_settings *settings);
+
+/**
+ * @brief Dim the display, turn it off (blank it) or on again.
+ *
+ * For KMS windows, dimming uses the gamma LUT / CTM of the CRTC (on top of the display color settings)
+ * and turning the display off sets the CRTC inactive (or the connector DPMS property with legacy modesetting).
+ * While the display is off, the frame scheduler is paused so flutter doesn't render any frames.
+ * When it's turned on again, the last frame is presented right away.
+ *
+ * @param window The window instance.
+ * @param state The new power state.
+ * @param dim_brightness Brightness factor (0 to 1) for @ref DISPLAY_POWER_DIMMED, ignored otherwise.
+ * @return int Zero if successful, EOPNOTSUPP if the window or display controller doesn't support
+ *             the requested state, errno-code otherwise.
+ */
+int window_set_display_power(struct window *window, enum display_power_state state, double dim_brightness);
+
+/**
+ * @brief A frame captured using @ref window_capture_frame.
+ */
+struct window_frame_capture {
+    /**
+     * @brief Pointer to the first pixel. Only valid until the capture callback returns.
+     */
+    const void *pixels;
+
+    /**
+     * @brief Number of bytes per row.
+     */
+    int stride;
+
+    /**
+     * @brief Size of the frame in pixels. That's the display size, so it's not rotated
+     * according to the view orientation.
+     */
+    struct vec2i size;
+
+    /**
+     * @brief The pixel format. Either @ref PIXFMT_XRGB8888 or @ref PIXFMT_ARGB8888.
+     */
+    enum pixfmt format;
+};
+
+/**
+ * @brief Called when a frame capture started with @ref window_capture_frame is done.
+ *
+ * Called on an internal capture thread, not on the thread that started the capture.
+ *
+ * @param userdata The userdata given to @ref window_capture_frame.
+ * @param error Zero if the capture succeeded, errno-code otherwise.
+ * @param capture The captured frame, or NULL if @param error is non-zero.
+ */
+typedef void (*window_capture_cb_t)(void *userdata, int error, const struct window_frame_capture *capture);
+
+/**
+ * @brief Capture the frame that's shown on the display, including all platform views.
+ *
+ * For KMS windows with a writeback connector, the composited frame is written back by the display
+ * controller together with the next frame flutter presents, so this doesn't cost any GPU time. If the
+ * app is idle and doesn't present a frame, the last frame is presented again. Otherwise, the layers
+ * of the last frame are composited on the CPU. Neither blocks the rendering thread.
+ *
+ * @param window The window instance.
+ * @param callback Called exactly once when the capture is done, if this returns zero.
+ * @param userdata Userdata for @param callback.
+ * @return int Zero if the capture was started, EAGAIN if there's no frame to capture right now,
+ *             EBUSY if too many captures are in flight, errno-code otherwise.
+ */
+int window_capture_frame(struct window *window, window_capture_cb_t callback, void *userdata);
+
 #endif  // _FLUTTERPI_SRC_WINDOW_H
@@ -1,3 +1,9 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <display_color.h>
 #include <flutter-pi.h>
 #include <unity.h>
 
@@ -48,6 +54,8 @@ void expect_parsed_cmdline_args_matches(int argc, char **argv, bool expected_res
     TEST_ASSERT_EQUAL_BOOL(expected.dummy_display, actual.dummy_display);
     TEST_ASSERT_EQUAL_INT(expected.dummy_display_size.x, actual.dummy_display_size.x);
     TEST_ASSERT_EQUAL_INT(expected.dummy_display_size.y, actual.dummy_display_size.y);
+    TEST_ASSERT_EQUAL_STRING(expected.dummy_display_output_dir, actual.dummy_display_output_dir);
+    TEST_ASSERT_EQUAL_STRING(expected.render_device_path, actual.render_device_path);
 }
 
 static struct flutterpi_cmdline_args get_default_args() {
@@ -71,6 +79,8 @@ static struct flutterpi_cmdline_args get_default_args() {
         .desired_videomode = NULL,
         .dummy_display = false,
         .dummy_display_size = { .x = 0, .y = 0 },
+        .dummy_display_output_dir = NULL,
+        .render_device_path = NULL,
     };
 }
 
@@ -227,6 +237,190 @@ void test_parse_desired_videomode_arg() {
     expect_parsed_cmdline_args_matches(4, (char *[]){ "flutter-pi", "--videomode", "1920x1080@60", BUNDLE_PATH }, true, expected);
 }
 
+void test_parse_dummy_display_output_arg() {
+    struct flutterpi_cmdline_args expected = get_default_args();
+
+    expected.dummy_display = true;
+    expected.dummy_display_output_dir = "/tmp/frames";
+    expect_parsed_cmdline_args_matches(
+        5,
+        (char *[]){ "flutter-pi", "--dummy-display", "--dummy-display-output", "/tmp/frames", BUNDLE_PATH },
+        true,
+        expected
+    );
+}
+
+void test_parse_render_device_arg() {
+    struct flutterpi_cmdline_args expected = get_default_args();
+
+    expected.render_device_path = "/dev/dri/renderD128";
+    expect_parsed_cmdline_args_matches(
+        4,
+        (char *[]){ "flutter-pi", "--render-device", "/dev/dri/renderD128", BUNDLE_PATH },
+        true,
+        expected
+    );
+}
+
+static int load_calibration_from_string(const char *contents, struct display_color_calibration *calibration_out) {
+    char path[] = "/tmp/flutterpi_test_calibration_XXXXXX";
+    FILE *file;
+    int fd, ok;
+
+    fd = mkstemp(path);
+    TEST_ASSERT_NOT_EQUAL_INT(-1, fd);
+
+    file = fdopen(fd, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(contents, file);
+    fclose(file);
+
+    ok = display_color_calibration_load(path, calibration_out);
+
+    unlink(path);
+    return ok;
+}
+
+void test_load_display_color_calibration() {
+    struct display_color_calibration calibration;
+    int ok;
+
+    ok = load_calibration_from_string(
+        "# comment\n"
+        "\n"
+        "gamma = 2.2\n"
+        "gain = 1.0 0.5 0.25  # trailing comment\n"
+        "offset=0.1 0.2 0.3\n"
+        "matrix = 1 0 0  0 0.5 0  0.25 0 1\n",
+        &calibration
+    );
+    TEST_ASSERT_EQUAL_INT(0, ok);
+
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_DOUBLE(2.2, calibration.gamma[i]);
+    }
+    TEST_ASSERT_EQUAL_DOUBLE(1.0, calibration.gain[0]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.5, calibration.gain[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.25, calibration.gain[2]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.1, calibration.offset[0]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.2, calibration.offset[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.3, calibration.offset[2]);
+    TEST_ASSERT_EQUAL_DOUBLE_ARRAY(((double[9]){ 1, 0, 0, 0, 0.5, 0, 0.25, 0, 1 }), calibration.matrix, 9);
+
+    // keys that aren't given keep their identity values
+    ok = load_calibration_from_string("gain = 0.5\n", &calibration);
+    TEST_ASSERT_EQUAL_INT(0, ok);
+    TEST_ASSERT_EQUAL_DOUBLE(1.0, calibration.gamma[0]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.5, calibration.gain[2]);
+    TEST_ASSERT_EQUAL_DOUBLE(0.0, calibration.offset[1]);
+    TEST_ASSERT_EQUAL_DOUBLE_ARRAY(((double[9]){ 1, 0, 0, 0, 1, 0, 0, 0, 1 }), calibration.matrix, 9);
+
+    TEST_ASSERT_EQUAL_INT(EINVAL, load_calibration_from_string("brightness = 0.5\n", &calibration));
+    TEST_ASSERT_EQUAL_INT(EINVAL, load_calibration_from_string("gamma\n", &calibration));
+    TEST_ASSERT_EQUAL_INT(EINVAL, load_calibration_from_string("gamma = 1 2\n", &calibration));
+    TEST_ASSERT_EQUAL_INT(EINVAL, load_calibration_from_string("gamma = 0\n", &calibration));
+    TEST_ASSERT_EQUAL_INT(EINVAL, load_calibration_from_string("matrix = 1 0 0 0 1 0 0 0\n", &calibration));
+    TEST_ASSERT_EQUAL_INT(ENOENT, display_color_calibration_load("/nonexistent/calibration.conf", &calibration));
+}
+
+void test_fill_display_color_ctm() {
+    struct display_color_settings settings;
+    struct drm_color_ctm ctm;
+
+    display_color_settings_init(&settings);
+    display_color_fill_ctm(&settings, true, &ctm);
+    for (int i = 0; i < 9; i++) {
+        TEST_ASSERT_EQUAL_HEX64(i % 4 == 0 ? UINT64_C(1) << 32 : 0, ctm.matrix[i]);
+    }
+
+    // S31.32 is sign-magnitude, not two's complement.
+    settings.calibration.matrix[1] = -0.5;
+    settings.calibration.matrix[2] = 0.25;
+    display_color_fill_ctm(&settings, false, &ctm);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_C(0x8000000080000000), ctm.matrix[1]);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_C(0x0000000040000000), ctm.matrix[2]);
+
+    settings.brightness = 0.5;
+    display_color_fill_ctm(&settings, false, &ctm);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_C(1) << 32, ctm.matrix[0]);
+    display_color_fill_ctm(&settings, true, &ctm);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_C(0x0000000080000000), ctm.matrix[0]);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_C(0x8000000040000000), ctm.matrix[1]);
+}
+
+void test_fill_display_color_gamma_lut() {
+    struct display_color_settings settings;
+    struct drm_color_lut lut[3];
+    static const uint16_t identity[3] = { 0x0000, 0x8000, 0xFFFF };
+
+    display_color_settings_init(&settings);
+    display_color_fill_gamma_lut(&settings, false, 3, lut);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_HEX16(identity[i], lut[i].red);
+        TEST_ASSERT_EQUAL_HEX16(lut[i].red, lut[i].green);
+        TEST_ASSERT_EQUAL_HEX16(lut[i].red, lut[i].blue);
+        TEST_ASSERT_EQUAL_HEX16(0, lut[i].reserved);
+    }
+
+    settings.calibration.gain[0] = 0.5;
+    settings.calibration.gamma[1] = 2.0;
+    settings.calibration.offset[2] = 0.25;
+    display_color_fill_gamma_lut(&settings, false, 3, lut);
+    TEST_ASSERT_EQUAL_HEX16(0x8000, lut[2].red);
+    TEST_ASSERT_EQUAL_HEX16(0x4000, lut[1].green);
+    TEST_ASSERT_EQUAL_HEX16(0x4000, lut[0].blue);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, lut[2].blue);
+
+    // Only the diagonal of the matrix can be folded into the LUT.
+    display_color_settings_init(&settings);
+    settings.calibration.matrix[0] = 0.5;
+    settings.calibration.matrix[1] = 0.5;
+    display_color_fill_gamma_lut(&settings, true, 3, lut);
+    TEST_ASSERT_EQUAL_HEX16(0x8000, lut[2].red);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, lut[2].green);
+    display_color_fill_gamma_lut(&settings, false, 3, lut);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, lut[2].red);
+
+    settings.brightness = 0.5;
+    display_color_fill_gamma_lut(&settings, false, 3, lut);
+    TEST_ASSERT_EQUAL_HEX16(0x8000, lut[2].green);
+}
+
+void test_fill_display_hdr_metadata_blob() {
+    struct drm_hdr_output_metadata blob;
+    struct display_hdr_metadata metadata;
+
+    display_hdr_metadata_init(&metadata, kSMPTEST2084_DrmHdrEotf, 1000.0);
+    display_hdr_metadata_fill_blob(&metadata, &blob);
+
+    TEST_ASSERT_EQUAL_UINT32(0, blob.metadata_type);
+    TEST_ASSERT_EQUAL_UINT8(0, blob.hdmi_metadata_type1.metadata_type);
+    TEST_ASSERT_EQUAL_UINT8(kSMPTEST2084_DrmHdrEotf, blob.hdmi_metadata_type1.eotf);
+
+    // chromaticity coordinates are in units of 0.00002
+    TEST_ASSERT_EQUAL_UINT16(35400, blob.hdmi_metadata_type1.display_primaries[0].x);
+    TEST_ASSERT_EQUAL_UINT16(14600, blob.hdmi_metadata_type1.display_primaries[0].y);
+    TEST_ASSERT_EQUAL_UINT16(8500, blob.hdmi_metadata_type1.display_primaries[1].x);
+    TEST_ASSERT_EQUAL_UINT16(39850, blob.hdmi_metadata_type1.display_primaries[1].y);
+    TEST_ASSERT_EQUAL_UINT16(6550, blob.hdmi_metadata_type1.display_primaries[2].x);
+    TEST_ASSERT_EQUAL_UINT16(2300, blob.hdmi_metadata_type1.display_primaries[2].y);
+    TEST_ASSERT_EQUAL_UINT16(15635, blob.hdmi_metadata_type1.white_point.x);
+    TEST_ASSERT_EQUAL_UINT16(16450, blob.hdmi_metadata_type1.white_point.y);
+
+    // minimum mastering luminance is in units of 0.0001 cd/m², everything else in cd/m²
+    TEST_ASSERT_EQUAL_UINT16(1000, blob.hdmi_metadata_type1.max_display_mastering_luminance);
+    TEST_ASSERT_EQUAL_UINT16(50, blob.hdmi_metadata_type1.min_display_mastering_luminance);
+    TEST_ASSERT_EQUAL_UINT16(1000, blob.hdmi_metadata_type1.max_cll);
+    TEST_ASSERT_EQUAL_UINT16(400, blob.hdmi_metadata_type1.max_fall);
+
+    // out of range values are clamped
+    metadata.max_mastering_luminance = 100000.0;
+    metadata.min_mastering_luminance = -1.0;
+    display_hdr_metadata_fill_blob(&metadata, &blob);
+    TEST_ASSERT_EQUAL_UINT16(65535, blob.hdmi_metadata_type1.max_display_mastering_luminance);
+    TEST_ASSERT_EQUAL_UINT16(0, blob.hdmi_metadata_type1.min_display_mastering_luminance);
+}
+
 int main() {
     UNITY_BEGIN();
 
@@ -239,6 +433,12 @@ int main() {
     RUN_TEST(test_parse_engine_arg);
     RUN_TEST(test_parse_vulkan_arg);
     RUN_TEST(test_parse_desired_videomode_arg);
+    RUN_TEST(test_parse_dummy_display_output_arg);
+    RUN_TEST(test_parse_render_device_arg);
+    RUN_TEST(test_load_display_color_calibration);
+    RUN_TEST(test_fill_display_color_ctm);
+    RUN_TEST(test_fill_display_color_gamma_lut);
+    RUN_TEST(test_fill_display_hdr_metadata_blob);
 
     UNITY_END();
 }